@@ -2,41 +2,104 @@
  * Copyright(c) 2010-2015 Intel Corporation
  */
 
+/*
+ * Forwarding benchmark. Every lcore polls its own queue of all ports and
+ * echoes, forwards or drops what it receives, either through the ethdev API
+ * or, with CleanQ, through the CleanQ queues of the ports directly. The
+ * counters are printed as text, JSON or CSV (see usage()).
+ */
+
 #include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 #include <inttypes.h>
+#include <signal.h>
+#include <getopt.h>
+#include <unistd.h>
+#include <sys/epoll.h>
 #include <rte_eal.h>
 #include <rte_ethdev.h>
 #include <rte_cycles.h>
 #include <rte_lcore.h>
+#include <rte_launch.h>
 #include <rte_mbuf.h>
 #include <rte_ether.h>
 #include <rte_ip.h>
 #include <rte_udp.h>
 #ifdef RTE_LIBCLEANQ
 #include <cleanq.h>
+#include <cleanq_dpdk.h>
+#include <cleanq_poll.h>
 #include <cleanq_pmd_ixgbe.h>
+#include <backends/ethdev.h>
+#endif
+#ifdef RTE_LIBRTE_POWER
+#include <rte_power.h>
 #endif
 
-#define RX_RING_SIZE 1024
-#define TX_RING_SIZE 1024
-
-#define NUM_MBUFS 8191
+#define MAX_BURST 512
 #define MBUF_CACHE_SIZE 250
-#define BURST_SIZE 32
+// longest sleep on the RX interrupts with -a intr
+#define INTR_TIMEOUT_MS 10
 
-// #define ACTIVATE_LOG
 #define DRIVER_LOG_LEVEL RTE_LOG_WARNING
 #define CLEANQ_TX_LOG_LEVEL RTE_LOG_WARNING
 #define CLEANQ_RX_LOG_LEVEL RTE_LOG_WARNING
 #define MAIN_LOG_LEVEL RTE_LOG_INFO
 
 int logtype;
-#ifdef ACTIVATE_LOG
-#define LOG(level, fmt, args...) \
-	rte_log(RTE_LOG_ ## level, logtype, fmt , ##args)
-#else
-#define LOG(level, fmt, args...) do { } while(0)
-#endif
+// every packet is logged with -v
+static int log_packets;
+#define LOG(level, fmt, args...) do { \
+        if (unlikely(log_packets)) \
+            rte_log(RTE_LOG_ ## level, logtype, fmt , ##args); \
+    } while (0)
+
+enum datapath {
+    DATAPATH_ETHDEV,
+    DATAPATH_CLEANQ,
+};
+
+enum fwd_mode {
+    MODE_ECHO,
+    MODE_FWD,
+    MODE_DROP,
+};
+
+enum poll_mode {
+    POLL_FIXED,
+    POLL_ADAPTIVE,
+    POLL_POWER,
+    POLL_INTR,
+};
+
+enum out_format {
+    FORMAT_TEXT,
+    FORMAT_JSON,
+    FORMAT_CSV,
+};
+
+static const char *datapath_names[] = { "ethdev", "cleanq" };
+static const char *mode_names[] = { "echo", "fwd", "drop" };
+static const char *poll_names[] = { "fixed", "adaptive", "power", "intr" };
+static const char *format_names[] = { "text", "json", "csv" };
+
+// settings, see usage()
+static uint16_t burst_size = 32;
+static uint16_t nb_rxd = 1024;
+static uint16_t nb_txd = 1024;
+static uint16_t nb_queues;
+static unsigned nb_mbufs = 8191;
+static enum datapath datapath = DATAPATH_ETHDEV;
+static enum fwd_mode fwd_mode = MODE_ECHO;
+static int swap_ports = 1;
+static enum poll_mode poll_mode = POLL_FIXED;
+static double stats_interval = 1.0;
+static double run_time;
+static enum out_format out_format = FORMAT_TEXT;
+
+static volatile int force_quit;
 
 static const struct rte_eth_conf port_conf_default = {
     .rxmode = {
@@ -44,21 +107,81 @@ static const struct rte_eth_conf port_conf_default = {
     },
 };
 
+/*
+ * Counters of an lcore, only written by it. The stats are the differences
+ * between two snapshots of the sums.
+ */
+struct lcore_stats {
+    uint64_t rx_pkts;
+    uint64_t tx_pkts;
+    // not for us or not sent
+    uint64_t dropped;
+    // the TX queue was full
+    uint64_t tx_full;
+    // polls that returned packets and the cycles they took
+    uint64_t bursts;
+    uint64_t busy_cycles;
+};
+
+#ifdef RTE_LIBCLEANQ
+// the queues of a port used by the CleanQ datapath
+struct port_queues {
+    struct cleanq *nic_rx;
+    struct cleanq *nic_tx;
+    // wraps the ethdev queues if the driver has no CleanQ queues
+    struct ethdev_q *eth_q;
+};
+#endif
+
+#define NO_QUEUE UINT16_MAX
+
+struct lcore_conf {
+    uint16_t queue;
+    struct lcore_stats stats;
+#ifdef RTE_LIBCLEANQ
+    struct port_queues ports[RTE_MAX_ETHPORTS];
+    // the RX interrupt fds of all ports with -a intr
+    int epfd;
+#endif
+} __rte_cache_aligned;
+
+static struct lcore_conf lcore_conf[RTE_MAX_LCORE];
+static struct rte_mempool *mbuf_pools[RTE_MAX_NUMA_NODES];
+static struct ether_addr port_addrs[RTE_MAX_ETHPORTS];
+// where packets received on a port are sent to
+static uint16_t dst_ports[RTE_MAX_ETHPORTS];
+static int port_cleanq_queues[RTE_MAX_ETHPORTS];
+
 /* basicfwd.c: Basic DPDK skeleton forwarding example. */
 
 /*
- * Initializes a given port using global settings and with the RX buffers
- * coming from the mbuf_pool passed as a parameter.
+ * The queues of ixgbe are CleanQ queues, the ones of other drivers are
+ * wrapped with the ethdev backend
+ */
+static int
+port_has_cleanq_queues(const struct rte_eth_dev_info *dev_info)
+{
+#ifdef RTE_LIBCLEANQ
+    return strcmp(dev_info->driver_name, "net_ixgbe") == 0;
+#else
+    RTE_SET_USED(dev_info);
+    return 0;
+#endif
+}
+
+/*
+ * Initializes a given port with one RX and TX queue per lcore, spread with
+ * RSS. The buffers of a queue come from the mempool of the NUMA socket of
+ * its lcore.
  */
 static inline int
-port_init(uint16_t port, struct rte_mempool *mbuf_pool)
+port_init(uint16_t port)
 {
     struct rte_eth_conf port_conf = port_conf_default;
-    const uint16_t rx_rings = 1, tx_rings = 1;
-    uint16_t nb_rxd = RX_RING_SIZE;
-    uint16_t nb_txd = TX_RING_SIZE;
+    uint16_t rxd = nb_rxd;
+    uint16_t txd = nb_txd;
     int retval;
-    uint16_t q;
+    unsigned lcore_id;
     struct rte_eth_dev_info dev_info;
     struct rte_eth_txconf txconf;
 
@@ -66,37 +189,57 @@ port_init(uint16_t port, struct rte_mempool *mbuf_pool)
         return -1;
 
     rte_eth_dev_info_get(port, &dev_info);
-    if (dev_info.tx_offload_capa & DEV_TX_OFFLOAD_MBUF_FAST_FREE)
+    port_cleanq_queues[port] = port_has_cleanq_queues(&dev_info);
+    // not with the ethdev backend, it sends header mbufs with the buffer
+    // attached, which the fast free cannot release
+    if ((datapath == DATAPATH_ETHDEV || port_cleanq_queues[port]) &&
+            (dev_info.tx_offload_capa & DEV_TX_OFFLOAD_MBUF_FAST_FREE))
         port_conf.txmode.offloads |=
             DEV_TX_OFFLOAD_MBUF_FAST_FREE;
 
+    if (poll_mode == POLL_INTR)
+        port_conf.intr_conf.rxq = 1;
+
+    if (nb_queues > 1) {
+        port_conf.rxmode.mq_mode = ETH_MQ_RX_RSS;
+        port_conf.rx_adv_conf.rss_conf.rss_hf =
+            (ETH_RSS_IP | ETH_RSS_UDP) & dev_info.flow_type_rss_offloads;
+        // the driver spreads the packets itself, if at all
+        if (port_conf.rx_adv_conf.rss_conf.rss_hf == 0)
+            port_conf.rxmode.mq_mode = ETH_MQ_RX_NONE;
+    }
+
     /* Configure the Ethernet device. */
-    retval = rte_eth_dev_configure(port, rx_rings, tx_rings, &port_conf);
+    retval = rte_eth_dev_configure(port, nb_queues, nb_queues, &port_conf);
     if (retval != 0)
         return retval;
 
-    retval = rte_eth_dev_adjust_nb_rx_tx_desc(port, &nb_rxd, &nb_txd);
+    retval = rte_eth_dev_adjust_nb_rx_tx_desc(port, &rxd, &txd);
     if (retval != 0)
         return retval;
 
-    /* Allocate and set up 1 RX queue per Ethernet port. */
-    for (q = 0; q < rx_rings; q++) {
-        retval = rte_eth_rx_queue_setup(port, q, nb_rxd,
-                rte_eth_dev_socket_id(port), NULL, mbuf_pool);
+    txconf = dev_info.default_txconf;
+    txconf.offloads = port_conf.txmode.offloads;
+
+    /* Allocate and set up the RX and TX queue of every lcore. */
+    RTE_LCORE_FOREACH(lcore_id) {
+        uint16_t q = lcore_conf[lcore_id].queue;
+        unsigned socket = rte_lcore_to_socket_id(lcore_id);
+
+        if (q == NO_QUEUE)
+            continue;
+
+        retval = rte_eth_rx_queue_setup(port, q, rxd, socket, NULL,
+                mbuf_pools[socket]);
         if (retval < 0)
             return retval;
-    }
 
-    txconf = dev_info.default_txconf;
-    txconf.offloads = port_conf.txmode.offloads;
-    /* Allocate and set up 1 TX queue per Ethernet port. */
-    for (q = 0; q < tx_rings; q++) {
-        retval = rte_eth_tx_queue_setup(port, q, nb_txd,
-                rte_eth_dev_socket_id(port), &txconf);
+        retval = rte_eth_tx_queue_setup(port, q, txd, socket, &txconf);
         if (retval < 0)
             return retval;
 #ifdef RTE_LIBCLEANQ
-        cleanq_pmd_ixgbe_tx_register(port, q, mbuf_pool);
+        if (port_cleanq_queues[port])
+            cleanq_pmd_ixgbe_tx_register(port, q, mbuf_pools[socket]);
 #endif
     }
 
@@ -106,11 +249,11 @@ port_init(uint16_t port, struct rte_mempool *mbuf_pool)
         return retval;
 
     /* Display the port MAC address. */
-    struct ether_addr addr;
-    rte_eth_macaddr_get(port, &addr);
+    rte_eth_macaddr_get(port, &port_addrs[port]);
     char addr_string[ETHER_ADDR_FMT_SIZE];
-    ether_format_addr(addr_string, ETHER_ADDR_FMT_SIZE, &addr);
-    printf("Port %u MAC: %s\n", port, addr_string);
+    ether_format_addr(addr_string, ETHER_ADDR_FMT_SIZE, &port_addrs[port]);
+    fprintf(stderr, "Port %u MAC: %s, %u queues of %u/%u descriptors\n",
+            port, addr_string, nb_queues, rxd, txd);
 
     /* Enable RX in promiscuous mode for the Ethernet device. */
     rte_eth_promiscuous_enable(port);
@@ -119,13 +262,525 @@ port_init(uint16_t port, struct rte_mempool *mbuf_pool)
 }
 
 /*
- * The lcore main. This is the main thread that does the work, reading from
- * an input port and writing to an output port.
+ * Packet handling
+ */
+
+// swaps the addresses and ports of a packet for us, returns 0 otherwise
+static inline int
+echo_pkt(uint16_t port, struct rte_mbuf *buffer)
+{
+    struct ether_hdr *eth_hdr = rte_pktmbuf_mtod(buffer, struct ether_hdr *);
+    struct ether_addr tmp_hw_addr;
+    struct ipv4_hdr *ip_hdr;
+    struct udp_hdr *udp_hdr;
+    uint8_t ip_hdr_len;
+
+    if (unlikely(buffer->data_len < sizeof(struct ether_hdr)) ||
+            !is_same_ether_addr(&port_addrs[port], &eth_hdr->d_addr))
+        return 0;
+
+    if (unlikely(log_packets)) {
+        char s_addr[ETHER_ADDR_FMT_SIZE];
+        char d_addr[ETHER_ADDR_FMT_SIZE];
+
+        ether_format_addr(s_addr, ETHER_ADDR_FMT_SIZE, &eth_hdr->s_addr);
+        ether_format_addr(d_addr, ETHER_ADDR_FMT_SIZE, &eth_hdr->d_addr);
+        LOG(INFO, "Port %u MAC: %s -> %s\n", port, s_addr, d_addr);
+    }
+
+    // Switch hardware addresses
+    ether_addr_copy(&eth_hdr->s_addr, &tmp_hw_addr);
+    ether_addr_copy(&eth_hdr->d_addr, &eth_hdr->s_addr);
+    ether_addr_copy(&tmp_hw_addr, &eth_hdr->d_addr);
+
+    if (eth_hdr->ether_type != rte_cpu_to_be_16(ETHER_TYPE_IPv4) ||
+            buffer->data_len < sizeof(*eth_hdr) + sizeof(*ip_hdr))
+        return 1;
+
+    ip_hdr = (struct ipv4_hdr *) (eth_hdr + 1);
+    ip_hdr_len = (ip_hdr->version_ihl & IPV4_HDR_IHL_MASK) *
+                 IPV4_IHL_MULTIPLIER;
+    LOG(INFO, "IP: %08" PRIx32 " -> %08" PRIx32 " (ID: %" PRIu16 ")\n",
+        rte_be_to_cpu_32(ip_hdr->src_addr), rte_be_to_cpu_32(ip_hdr->dst_addr),
+        rte_be_to_cpu_16(ip_hdr->packet_id));
+
+    // Switch IP addresses
+    const uint32_t tmp_ip_addr = ip_hdr->src_addr;
+    ip_hdr->src_addr = ip_hdr->dst_addr;
+    ip_hdr->dst_addr = tmp_ip_addr;
+
+    // Zero checksum
+    ip_hdr->hdr_checksum = 0;
+
+    if (ip_hdr->next_proto_id == IPPROTO_UDP &&
+            buffer->data_len >= sizeof(*eth_hdr) + ip_hdr_len +
+                                sizeof(*udp_hdr)) {
+        udp_hdr = (struct udp_hdr *) ((uint8_t *) ip_hdr + ip_hdr_len);
+        LOG(INFO, "UDP: %" PRIu16 " -> %" PRIu16 " (length: %" PRIu16 ")\n",
+            rte_be_to_cpu_16(udp_hdr->src_port),
+            rte_be_to_cpu_16(udp_hdr->dst_port),
+            rte_be_to_cpu_16(udp_hdr->dgram_len));
+
+        // Switch ports
+        if (swap_ports) {
+            const uint16_t tmp_udp_port = udp_hdr->src_port;
+            udp_hdr->src_port = udp_hdr->dst_port;
+            udp_hdr->dst_port = tmp_udp_port;
+        }
+
+        // New checksum
+        udp_hdr->dgram_cksum = 0;
+        udp_hdr->dgram_cksum = rte_ipv4_udptcp_cksum(ip_hdr, udp_hdr);
+    }
+
+    // New checksum
+    ip_hdr->hdr_checksum = rte_ipv4_cksum(ip_hdr);
+    return 1;
+}
+
+/*
+ * Keeps the packets of a burst to send at the front of bufs, the others
+ * are moved to drop
+ */
+static inline uint16_t
+process_burst(uint16_t port, struct rte_mbuf **bufs, uint16_t nb_rx,
+              struct rte_mbuf **drop, uint16_t *nb_drop)
+{
+    uint16_t nb_send = 0;
+
+    *nb_drop = 0;
+    switch (fwd_mode) {
+    case MODE_ECHO:
+        for (uint16_t i = 0; i < nb_rx; i++) {
+            if (echo_pkt(port, bufs[i]))
+                bufs[nb_send++] = bufs[i];
+            else
+                drop[(*nb_drop)++] = bufs[i];
+        }
+        return nb_send;
+    case MODE_FWD:
+        return nb_rx;
+    case MODE_DROP:
+    default:
+        for (uint16_t i = 0; i < nb_rx; i++)
+            drop[i] = bufs[i];
+        *nb_drop = nb_rx;
+        return 0;
+    }
+}
+
+/*
+ * ethdev datapath
+ */
+
+static inline uint16_t
+poll_ethdev(struct lcore_conf *conf, uint16_t port, uint16_t burst)
+{
+    struct rte_mbuf *bufs[MAX_BURST];
+    struct rte_mbuf *drop[MAX_BURST];
+    uint16_t nb_rx;
+    uint16_t nb_send;
+    uint16_t nb_drop;
+    uint16_t nb_tx = 0;
+
+    nb_rx = rte_eth_rx_burst(port, conf->queue, bufs, burst);
+    if (nb_rx == 0)
+        return 0;
+
+    nb_send = process_burst(port, bufs, nb_rx, drop, &nb_drop);
+    for (uint16_t i = 0; i < nb_drop; i++)
+        rte_pktmbuf_free(drop[i]);
+
+    if (nb_send > 0) {
+        nb_tx = rte_eth_tx_burst(dst_ports[port], conf->queue, bufs, nb_send);
+        LOG(NOTICE, "%" PRIu16 " packets sent over port %" PRIu16 "\n",
+            nb_tx, dst_ports[port]);
+
+        /* Free any unsent packets. */
+        for (uint16_t i = nb_tx; i < nb_send; i++)
+            rte_pktmbuf_free(bufs[i]);
+    }
+
+    conf->stats.rx_pkts += nb_rx;
+    conf->stats.tx_pkts += nb_tx;
+    conf->stats.dropped += nb_drop + nb_send - nb_tx;
+    conf->stats.tx_full += nb_send - nb_tx;
+    return nb_rx;
+}
+
+/*
+ * CleanQ datapath. The buffers are mbufs, they are converted with the
+ * queue they come from and go to, region ids are per queue. Sent and
+ * dropped buffers are posted to the RX queue again.
+ */
+
+#ifdef RTE_LIBCLEANQ
+static inline void
+post_rx(struct port_queues *pq, struct rte_mbuf *m)
+{
+    struct cleanq_buf b;
+    errval_t err;
+
+    m->data_off = RTE_PKTMBUF_HEADROOM;
+    m->data_len = 0;
+    mbuf_to_cleanq_buf(pq->nic_rx, m, &b);
+    err = cleanq_enqueue(pq->nic_rx, b.rid, b.offset, b.length,
+                         b.valid_data, 0, 0);
+    if (unlikely(err_is_fail(err)))
+        rte_pktmbuf_free(m);
+}
+
+static inline void
+reap_tx(struct port_queues *pq)
+{
+    struct cleanq_buf b;
+    struct rte_mbuf *m;
+
+    for (uint16_t i = 0; i < burst_size; i++) {
+        if (cleanq_dequeue(pq->nic_tx, &b.rid, &b.offset, &b.length,
+                           &b.valid_data, &b.valid_length,
+                           &b.flags) != CLEANQ_ERR_OK)
+            return;
+        cleanq_buf_to_mbuf(pq->nic_tx, b, &m);
+        post_rx(pq, m);
+    }
+}
+
+static inline uint16_t
+poll_cleanq(struct lcore_conf *conf, uint16_t port, uint16_t burst)
+{
+    struct port_queues *pq = &conf->ports[port];
+    struct port_queues *out = &conf->ports[dst_ports[port]];
+    struct rte_mbuf *bufs[MAX_BURST];
+    struct rte_mbuf *drop[MAX_BURST];
+    struct cleanq_buf b;
+    uint16_t nb_rx = 0;
+    uint16_t nb_send;
+    uint16_t nb_drop;
+    uint16_t nb_tx;
+    errval_t err;
+
+    reap_tx(pq);
+
+    for (uint16_t i = 0; i < burst; i++) {
+        err = cleanq_dequeue(pq->nic_rx, &b.rid, &b.offset, &b.length,
+                             &b.valid_data, &b.valid_length, &b.flags);
+        if (err_is_fail(err))
+            break;
+        cleanq_buf_to_mbuf(pq->nic_rx, b, &bufs[nb_rx++]);
+    }
+    if (nb_rx == 0)
+        return 0;
+
+    nb_send = process_burst(port, bufs, nb_rx, drop, &nb_drop);
+    for (uint16_t i = 0; i < nb_drop; i++)
+        post_rx(pq, drop[i]);
+
+    for (nb_tx = 0; nb_tx < nb_send; nb_tx++) {
+        mbuf_to_cleanq_buf(out->nic_tx, bufs[nb_tx], &b);
+        err = cleanq_enqueue(out->nic_tx, b.rid, b.offset, b.length,
+                             b.valid_data, b.valid_length,
+                             nb_tx == nb_send - 1 ? CLEANQ_FLAG_LAST : 0);
+        if (unlikely(err_is_fail(err)))
+            break;
+    }
+    if (unlikely(nb_tx < nb_send)) {
+        // the last one sent has to go out now
+        cleanq_notify(out->nic_tx);
+        for (uint16_t i = nb_tx; i < nb_send; i++)
+            post_rx(pq, bufs[i]);
+    }
+
+    conf->stats.rx_pkts += nb_rx;
+    conf->stats.tx_pkts += nb_tx;
+    conf->stats.dropped += nb_drop + nb_send - nb_tx;
+    conf->stats.tx_full += nb_send - nb_tx;
+    return nb_rx;
+}
+
+/*
+ * Takes the CleanQ queues of the lcore on a port and fills up the RX queue
+ */
+static int
+cleanq_queues_init(uint16_t port, struct lcore_conf *conf, int socket_id)
+{
+    struct port_queues *pq = &conf->ports[port];
+    struct rte_mempool *mbuf_pool = mbuf_pools[socket_id];
+    errval_t err;
+
+    if (port_cleanq_queues[port]) {
+        struct rte_eth_dev *dev = &rte_eth_devices[port];
+
+        pq->nic_rx = (struct cleanq *)dev->data->rx_queues[conf->queue];
+        pq->nic_tx = (struct cleanq *)dev->data->tx_queues[conf->queue];
+        // the TX queue has it from cleanq_pmd_ixgbe_tx_register()
+        err = cleanq_register_mempool(pq->nic_rx, mbuf_pool);
+    } else {
+        err = ethdev_q_create(&pq->eth_q, port, conf->queue, socket_id);
+        if (err_is_fail(err)) {
+            fprintf(stderr, "Failed init ethdev q err=%d\n", err);
+            return err;
+        }
+        pq->nic_rx = ethdev_q_get_rx(pq->eth_q);
+        pq->nic_tx = ethdev_q_get_tx(pq->eth_q);
+        // known to both sides
+        err = cleanq_register_mempool(pq->nic_tx, mbuf_pool);
+    }
+    if (err_is_fail(err)) {
+        fprintf(stderr, "Failed registering mempool err=%d\n", err);
+        return err;
+    }
+
+    for (int i = 0; i < nb_rxd - 1; i++) {
+        struct rte_mbuf *mb = rte_mbuf_raw_alloc(mbuf_pool);
+
+        if (mb == NULL) {
+            fprintf(stderr, "mbuf alloc failed port_id=%u queue_id=%u\n",
+                    port, conf->queue);
+            break;
+        }
+        post_rx(pq, mb);
+    }
+
+    return 0;
+}
+
+static void
+cleanq_queues_destroy(uint16_t port, struct lcore_conf *conf)
+{
+    struct port_queues *pq = &conf->ports[port];
+
+    if (pq->eth_q != NULL)
+        ethdev_q_destroy(pq->eth_q);
+    pq->eth_q = NULL;
+}
+
+/*
+ * RX interrupts for -a intr. An lcore whose ports all sleep arms the
+ * interrupts of its queues and waits on them, as in l3fwd-power.
  */
-static __attribute__((noreturn)) void
-lcore_main(void)
+static int
+intr_init(struct lcore_conf *conf)
 {
+    struct epoll_event ev = { .events = EPOLLIN };
     uint16_t port;
+    int fd;
+
+    conf->epfd = epoll_create1(0);
+    if (conf->epfd < 0)
+        return -1;
+
+    RTE_ETH_FOREACH_DEV(port) {
+        if (err_is_fail(cleanq_rx_intr_fd(conf->ports[port].nic_rx, &fd))) {
+            fprintf(stderr, "No RX interrupts on port %" PRIu16 "\n",
+                    port);
+            return -1;
+        }
+        ev.data.fd = fd;
+        if (epoll_ctl(conf->epfd, EPOLL_CTL_ADD, fd, &ev) != 0)
+            return -1;
+    }
+    return 0;
+}
+
+static void
+intr_wait(struct lcore_conf *conf)
+{
+    struct epoll_event ev[RTE_MAX_ETHPORTS];
+    uint16_t nb_rx = 0;
+    uint16_t port;
+
+    RTE_ETH_FOREACH_DEV(port)
+        cleanq_rx_intr_enable(conf->ports[port].nic_rx);
+
+    // packets that came in before the interrupts were armed raise none
+    RTE_ETH_FOREACH_DEV(port) {
+        uint16_t n = poll_cleanq(conf, port, burst_size);
+
+        if (n > 0)
+            conf->stats.bursts++;
+        nb_rx += n;
+    }
+
+    if (nb_rx == 0)
+        epoll_wait(conf->epfd, ev, RTE_DIM(ev), INTR_TIMEOUT_MS);
+
+    RTE_ETH_FOREACH_DEV(port)
+        cleanq_rx_intr_disable(conf->ports[port].nic_rx);
+}
+#endif
+
+/*
+ * Stats
+ */
+
+struct run_stats {
+    struct lcore_stats lc;
+    // of all ports
+    uint64_t imissed;
+    uint64_t rx_nombuf;
+    uint64_t tsc;
+};
+
+static void
+stats_snapshot(struct run_stats *s)
+{
+    struct rte_eth_stats eth_stats;
+    unsigned lcore_id;
+    uint16_t port;
+
+    memset(s, 0, sizeof(*s));
+    rte_smp_rmb();
+    RTE_LCORE_FOREACH(lcore_id) {
+        const volatile struct lcore_stats *lc = &lcore_conf[lcore_id].stats;
+
+        s->lc.rx_pkts += lc->rx_pkts;
+        s->lc.tx_pkts += lc->tx_pkts;
+        s->lc.dropped += lc->dropped;
+        s->lc.tx_full += lc->tx_full;
+        s->lc.bursts += lc->bursts;
+        s->lc.busy_cycles += lc->busy_cycles;
+    }
+    RTE_ETH_FOREACH_DEV(port) {
+        if (rte_eth_stats_get(port, &eth_stats) != 0)
+            continue;
+        s->imissed += eth_stats.imissed;
+        s->rx_nombuf += eth_stats.rx_nombuf;
+    }
+    s->tsc = rte_rdtsc();
+}
+
+static void
+print_header(void)
+{
+    if (out_format == FORMAT_CSV)
+        printf("type,time,secs,burst,rxd,txd,queues,datapath,mode,poll,cleanq,"
+               "rx_pkts,tx_pkts,rx_mpps,tx_mpps,dropped,tx_full,imissed,"
+               "rx_nombuf,avg_burst,cycles_per_burst,cycles_per_pkt,busy\n");
+}
+
+static inline double
+ratio(uint64_t a, uint64_t b)
+{
+    return b == 0 ? 0 : (double) a / b;
+}
+
+/*
+ * Prints the difference between two snapshots, a line per interval and one
+ * for the whole run
+ */
+static void
+print_stats(const char *type, const struct run_stats *start,
+            const struct run_stats *prev, const struct run_stats *cur)
+{
+    double hz = rte_get_tsc_hz();
+    double time = (cur->tsc - start->tsc) / hz;
+    double secs = (cur->tsc - prev->tsc) / hz;
+    uint64_t rx = cur->lc.rx_pkts - prev->lc.rx_pkts;
+    uint64_t tx = cur->lc.tx_pkts - prev->lc.tx_pkts;
+    uint64_t dropped = cur->lc.dropped - prev->lc.dropped;
+    uint64_t tx_full = cur->lc.tx_full - prev->lc.tx_full;
+    uint64_t imissed = cur->imissed - prev->imissed;
+    uint64_t nombuf = cur->rx_nombuf - prev->rx_nombuf;
+    uint64_t bursts = cur->lc.bursts - prev->lc.bursts;
+    uint64_t busy = cur->lc.busy_cycles - prev->lc.busy_cycles;
+    double rx_mpps = secs > 0 ? rx / secs / 1e6 : 0;
+    double tx_mpps = secs > 0 ? tx / secs / 1e6 : 0;
+    // of the polling lcores
+    double busy_frac = ratio(busy, (cur->tsc - prev->tsc) * nb_queues);
+
+    switch (out_format) {
+    case FORMAT_TEXT:
+        printf("%-8s %8.2f s  rx %8.3f Mpps  tx %8.3f Mpps  burst %5.1f  "
+               "%8.1f cycles/burst  %7.1f cycles/pkt  busy %3.0f%%  "
+               "dropped %" PRIu64 " tx_full %" PRIu64 " missed %" PRIu64
+               " nombuf %" PRIu64 "\n",
+               type, time, rx_mpps, tx_mpps, ratio(rx, bursts),
+               ratio(busy, bursts), ratio(busy, rx), busy_frac * 100,
+               dropped, tx_full, imissed, nombuf);
+        break;
+    case FORMAT_JSON:
+        printf("{\"type\": \"%s\", \"time\": %.3f, \"secs\": %.3f, "
+               "\"burst\": %u, \"rxd\": %u, \"txd\": %u, \"queues\": %u, "
+               "\"datapath\": \"%s\", \"mode\": \"%s\", \"poll\": \"%s\", "
+               "\"cleanq\": %d, "
+               "\"rx_pkts\": %" PRIu64 ", \"tx_pkts\": %" PRIu64 ", "
+               "\"rx_mpps\": %.4f, \"tx_mpps\": %.4f, "
+               "\"dropped\": %" PRIu64 ", \"tx_full\": %" PRIu64 ", "
+               "\"imissed\": %" PRIu64 ", \"rx_nombuf\": %" PRIu64 ", "
+               "\"avg_burst\": %.2f, \"cycles_per_burst\": %.1f, "
+               "\"cycles_per_pkt\": %.2f, \"busy\": %.4f}\n",
+               type, time, secs, burst_size, nb_rxd, nb_txd, nb_queues,
+               datapath_names[datapath], mode_names[fwd_mode],
+               poll_names[poll_mode],
+#ifdef RTE_LIBCLEANQ
+               1,
+#else
+               0,
+#endif
+               rx, tx, rx_mpps, tx_mpps, dropped, tx_full, imissed, nombuf,
+               ratio(rx, bursts), ratio(busy, bursts), ratio(busy, rx),
+               busy_frac);
+        break;
+    case FORMAT_CSV:
+        printf("%s,%.3f,%.3f,%u,%u,%u,%u,%s,%s,%s,%d,%" PRIu64 ",%" PRIu64
+               ",%.4f,%.4f,%" PRIu64 ",%" PRIu64 ",%" PRIu64 ",%" PRIu64
+               ",%.2f,%.1f,%.2f,%.4f\n",
+               type, time, secs, burst_size, nb_rxd, nb_txd, nb_queues,
+               datapath_names[datapath], mode_names[fwd_mode],
+               poll_names[poll_mode],
+#ifdef RTE_LIBCLEANQ
+               1,
+#else
+               0,
+#endif
+               rx, tx, rx_mpps, tx_mpps, dropped, tx_full, imissed, nombuf,
+               ratio(rx, bursts), ratio(busy, bursts), ratio(busy, rx),
+               busy_frac);
+        break;
+    }
+    fflush(stdout);
+}
+
+/*
+ * The lcore main. Every lcore with a queue polls it on all ports, the
+ * master lcore also prints the stats and ends the run.
+ */
+static int
+lcore_main(__attribute__((unused)) void *arg)
+{
+    struct lcore_conf *conf = &lcore_conf[rte_lcore_id()];
+    int master = rte_lcore_id() == rte_get_master_lcore();
+    uint64_t hz = rte_get_tsc_hz();
+    struct run_stats start;
+    struct run_stats prev;
+    struct run_stats cur;
+    uint64_t next_stats = UINT64_MAX;
+    uint64_t end = UINT64_MAX;
+    uint64_t last;
+    uint64_t now;
+    uint16_t port;
+    // with -a power, the lcore runs at the lowest frequency
+    int freq_low = 0;
+#ifdef RTE_LIBCLEANQ
+    // the burst and back off of every port
+    struct cleanq_poll polls[RTE_MAX_ETHPORTS];
+
+    RTE_ETH_FOREACH_DEV(port)
+        cleanq_poll_init(&polls[port], 1, burst_size);
+#endif
+
+    if (master) {
+        stats_snapshot(&start);
+        prev = start;
+        if (stats_interval > 0)
+            next_stats = start.tsc + (uint64_t) (stats_interval * hz);
+        if (run_time > 0)
+            end = start.tsc + (uint64_t) (run_time * hz);
+    }
+
+    if (conf->queue == NO_QUEUE && !master)
+        return 0;
 
     /*
      * Check that the port is on the same NUMA node as the polling thread
@@ -135,147 +790,270 @@ lcore_main(void)
         if (rte_eth_dev_socket_id(port) > 0 &&
                 rte_eth_dev_socket_id(port) !=
                         (int)rte_socket_id())
-            printf("WARNING, port %u is on remote NUMA node to "
+            fprintf(stderr, "WARNING, port %u is on remote NUMA node to "
                     "polling thread.\n\tPerformance will "
                     "not be optimal.\n", port);
 
-    printf("\nCore %u forwarding packets. [Ctrl+C to quit]\n",
-            rte_lcore_id());
+    if (conf->queue != NO_QUEUE)
+        fprintf(stderr, "Core %u %s packets on queue %u\n", rte_lcore_id(),
+                mode_names[fwd_mode], conf->queue);
 
-    /* Run until the application is quit or killed. */
-    for (;;) {
-        /*
-         * Receive packets on a port and echo them
-         */
-        RTE_ETH_FOREACH_DEV(port) {
-            struct ether_addr port_addr;
-            rte_eth_macaddr_get(port, &port_addr);
+    /* Run until the time is up or the application is quit. */
+    last = now = rte_rdtsc();
+    while (!force_quit) {
+        if (conf->queue != NO_QUEUE) {
+            unsigned nb_sleeping = 0;
 
-            /* Get burst of RX packets. */
-            struct rte_mbuf *rx_bufs[BURST_SIZE];
-            const uint16_t nb_rx = rte_eth_rx_burst(port, 0, rx_bufs, BURST_SIZE);
+            RTE_ETH_FOREACH_DEV(port) {
+                uint16_t burst = burst_size;
+                uint16_t nb_rx;
 
-            if (unlikely(nb_rx == 0))
-                continue;
+#ifdef RTE_LIBCLEANQ
+                if (poll_mode != POLL_FIXED)
+                    burst = cleanq_poll_burst(&polls[port]);
 
-            struct rte_mbuf *tx_bufs[BURST_SIZE];
-            uint16_t nb_to_send = 0;
+                if (datapath == DATAPATH_CLEANQ)
+                    nb_rx = poll_cleanq(conf, port, burst);
+                else
+#endif
+                    nb_rx = poll_ethdev(conf, port, burst);
 
-            for (uint16_t buf = 0; buf < nb_rx; buf++) {
-                struct rte_mbuf *buffer = rx_bufs[buf];
+#ifdef RTE_LIBCLEANQ
+                if (poll_mode != POLL_FIXED) {
+                    enum cleanq_poll_state state;
 
-                if (unlikely(!(buffer->packet_type & RTE_PTYPE_L2_ETHER))) {
-                    rte_pktmbuf_free(buffer);
-                    continue;
+                    state = cleanq_poll_update(&polls[port], nb_rx);
+                    if (state != CLEANQ_POLL_BUSY)
+                        cleanq_poll_wait(&polls[port]);
+                    if (state == CLEANQ_POLL_SLEEP)
+                        nb_sleeping++;
                 }
-                
-                struct ether_hdr *eth_hdr = rte_pktmbuf_mtod(buffer, struct ether_hdr *);
-
-                if (is_same_ether_addr(&port_addr, &eth_hdr->d_addr)) {
-                    /* Packet was for us */
-                    LOG(NOTICE, "\nPacket %"PRIu16"/%"PRIu16" received on port %"PRIu16"\n",
-                        buf,
-                        nb_rx,
-                        port
-                    );
-
-                    char type_name[64];
-                    rte_get_ptype_name(buffer->packet_type, type_name, 64);
-                    LOG(NOTICE, "Type: %s\n", type_name);
-
-                    char s_addr[ETHER_ADDR_FMT_SIZE];
-                    char d_addr[ETHER_ADDR_FMT_SIZE];
-                    ether_format_addr(s_addr, ETHER_ADDR_FMT_SIZE, &eth_hdr->s_addr);
-                    ether_format_addr(d_addr, ETHER_ADDR_FMT_SIZE, &eth_hdr->d_addr);
-
-                    LOG(INFO, "MAC: %s -> %s\n", s_addr, d_addr);
-
-                    // Switch hardware addresses
-                    struct ether_addr tmp_hw_addr;
-                    ether_addr_copy(&eth_hdr->s_addr, &tmp_hw_addr);
-                    ether_addr_copy(&eth_hdr->d_addr, &eth_hdr->s_addr);
-                    ether_addr_copy(&tmp_hw_addr, &eth_hdr->d_addr);
-
-                    if (buffer->packet_type & RTE_PTYPE_L3_IPV4) {
-                        struct ipv4_hdr *ip_hdr = rte_pktmbuf_mtod_offset(
-                            buffer,
-                            struct ipv4_hdr *,
-                            sizeof(struct ether_hdr)
-                        );
-
-			            uint8_t ip_hdr_len = (ip_hdr->version_ihl & IPV4_HDR_IHL_MASK) * IPV4_IHL_MULTIPLIER;
-                        LOG(INFO,
-                            "IP: %"PRIu8".%"PRIu8".%"PRIu8".%"PRIu8" -> "
-                            "%"PRIu8".%"PRIu8".%"PRIu8".%"PRIu8" (ID: %"PRIu16")\n",
-                            ip_hdr->src_addr & 0xff,
-                            (ip_hdr->src_addr >> 8) & 0xff,
-                            (ip_hdr->src_addr >> 16) & 0xff,
-                            ip_hdr->src_addr >> 24,
-                            ip_hdr->dst_addr & 0xff,
-                            (ip_hdr->dst_addr >> 8) & 0xff,
-                            (ip_hdr->dst_addr >> 16) & 0xff,
-                            ip_hdr->dst_addr >> 24,
-                            rte_be_to_cpu_16(ip_hdr->packet_id)
-                        );
-
-                        // Switch IP addresses
-                        const uint32_t tmp_ip_addr = ip_hdr->src_addr;
-                        ip_hdr->src_addr = ip_hdr->dst_addr;
-                        ip_hdr->dst_addr = tmp_ip_addr;
-
-                        // Zero checksum
-                        ip_hdr->hdr_checksum = 0;
-
-                        if (buffer->packet_type & RTE_PTYPE_L4_UDP) {
-                            struct udp_hdr *udp_hdr = rte_pktmbuf_mtod_offset(
-                                buffer,
-                                struct udp_hdr *,
-                                sizeof(struct ether_hdr) + ip_hdr_len
-                            );
-                            LOG(INFO, "UDP: %"PRIu16" -> %"PRIu16" (length: %"PRIu16")\n",
-                                rte_be_to_cpu_16(udp_hdr->src_port),
-                                rte_be_to_cpu_16(udp_hdr->dst_port),
-                                rte_be_to_cpu_16(udp_hdr->dgram_len)
-                            );
-
-                            // Switch ports
-                            const uint32_t tmp_udp_port = udp_hdr->src_port;
-                            udp_hdr->src_port = udp_hdr->dst_port;
-                            udp_hdr->dst_port = tmp_udp_port;
-
-                            // New checksum
-                            udp_hdr->dgram_cksum = 0;
-                            udp_hdr->dgram_cksum = rte_ipv4_udptcp_cksum(ip_hdr, udp_hdr);
-                        }
-
-                        // New checksum
-                        ip_hdr->hdr_checksum = rte_ipv4_cksum(ip_hdr);
-                    }
-
-                    // Enqueue buffer for sending
-                    tx_bufs[nb_to_send] = buffer;
-                    nb_to_send++;
-                }
-                else {
-                    rte_pktmbuf_free(buffer);
+#endif
+
+                // one TSC read per poll, the empty ones are not counted
+                now = rte_rdtsc();
+                if (nb_rx > 0) {
+                    conf->stats.bursts++;
+                    conf->stats.busy_cycles += now - last;
                 }
+                last = now;
             }
 
-            if (nb_to_send > 0) {
-                /* Send burst of TX packets, to same port */
-                const uint16_t nb_tx = rte_eth_tx_burst(port, 0, tx_bufs, nb_to_send);
+#ifdef RTE_LIBRTE_POWER
+            // the lowest frequency while all ports sleep
+            if (poll_mode == POLL_POWER &&
+                    freq_low != (nb_sleeping == rte_eth_dev_count_avail())) {
+                freq_low = !freq_low;
+                if (freq_low)
+                    rte_power_freq_min(rte_lcore_id());
+                else
+                    rte_power_freq_max(rte_lcore_id());
+            }
+#else
+            RTE_SET_USED(freq_low);
+#endif
+#ifdef RTE_LIBCLEANQ
+            // the time asleep is not busy
+            if (poll_mode == POLL_INTR &&
+                    nb_sleeping == rte_eth_dev_count_avail()) {
+                intr_wait(conf);
+                last = now = rte_rdtsc();
+            }
+#else
+            RTE_SET_USED(nb_sleeping);
+#endif
+        } else {
+            now = rte_rdtsc();
+        }
 
-                LOG(NOTICE, "%"PRIu16" packets sent over port %"PRIu16"\n", nb_tx, port);
+        if (!master || likely(now < next_stats && now < end))
+            continue;
 
-                /* Free any unsent packets. */
-                if (unlikely(nb_tx < nb_to_send)) {
-                    for (uint16_t buf = nb_tx; buf < nb_to_send; buf++) {
-                        rte_pktmbuf_free(tx_bufs[buf]);
-                    }
-                }
-            }
+        stats_snapshot(&cur);
+        if (now >= end) {
+            force_quit = 1;
+        } else {
+            print_stats("interval", &start, &prev, &cur);
+            prev = cur;
+            next_stats += (uint64_t) (stats_interval * hz);
         }
     }
+
+    if (master) {
+        rte_eal_mp_wait_lcore();
+        stats_snapshot(&cur);
+        print_stats("total", &start, &start, &cur);
+    }
+    return 0;
+}
+
+/*
+ * Frequency scaling of the polling lcores for -a power
+ */
+static void
+power_exit(void)
+{
+#ifdef RTE_LIBRTE_POWER
+    unsigned lcore_id;
+
+    RTE_LCORE_FOREACH(lcore_id)
+        if (lcore_conf[lcore_id].queue != NO_QUEUE)
+            rte_power_exit(lcore_id);
+#endif
+}
+
+static int
+power_init(void)
+{
+#ifdef RTE_LIBRTE_POWER
+    unsigned lcore_id;
+
+    RTE_LCORE_FOREACH(lcore_id) {
+        if (lcore_conf[lcore_id].queue != NO_QUEUE &&
+                rte_power_init(lcore_id) != 0) {
+            power_exit();
+            return -1;
+        }
+    }
+    return 0;
+#else
+    return -1;
+#endif
+}
+
+static void
+signal_handler(int signum)
+{
+    if (signum == SIGINT || signum == SIGTERM)
+        force_quit = 1;
+}
+
+static void
+usage(const char *prgname)
+{
+    fprintf(stderr,
+            "%s [EAL options] -- [-b burst] [-r rxd] [-t txd] [-q queues] "
+            "[-n mbufs] [-d ethdev|cleanq] [-m echo|fwd|drop] [-P] "
+            "[-a fixed|adaptive|power|intr] [-s seconds] [-T seconds] "
+            "[-f text|json|csv] [-v]\n"
+            "  -b  packets per RX and TX burst, at most %d, default %u\n"
+            "  -r  RX descriptors per queue, default %u\n"
+            "  -t  TX descriptors per queue, default %u\n"
+            "  -q  queues per port, one lcore each, default one per lcore\n"
+            "  -n  mbufs per port and queue, default %u\n"
+            "  -d  ethdev: rte_eth_rx_burst()/rte_eth_tx_burst(), cleanq: the\n"
+            "      CleanQ queues of the ports directly, default %s\n"
+            "  -m  echo: send packets for the port back with addresses and\n"
+            "      UDP ports swapped, fwd: send everything unchanged to the\n"
+            "      paired port (0-1, 2-3, ...), drop: free everything,\n"
+            "      default %s\n"
+            "  -P  echo without swapping the UDP ports\n"
+            "  -a  fixed: always poll for -b packets, adaptive: the burst\n"
+            "      follows the load up to -b and empty polls back off,\n"
+            "      power: adaptive and the lowest frequency of the lcore\n"
+            "      while it backs off on all ports, intr: adaptive and\n"
+            "      sleeping on the RX interrupts then (with -d cleanq).\n"
+            "      All but fixed need CleanQ, default %s\n"
+            "  -s  stats interval, 0 for the total only, default %.1f\n"
+            "  -T  run time, 0 until SIGINT, default %.1f\n"
+            "  -f  output format, default %s\n"
+            "  -v  log every packet\n",
+            prgname, MAX_BURST, burst_size, nb_rxd, nb_txd, nb_mbufs,
+            datapath_names[datapath], mode_names[fwd_mode],
+            poll_names[poll_mode], stats_interval, run_time,
+            format_names[out_format]);
+}
+
+static int
+parse_name(const char *arg, const char **names, int nb_names)
+{
+    for (int i = 0; i < nb_names; i++)
+        if (strcmp(arg, names[i]) == 0)
+            return i;
+    return -1;
+}
+
+static int
+parse_args(int argc, char **argv)
+{
+    int opt;
+    int v;
+
+    while ((opt = getopt(argc, argv, "b:r:t:q:n:d:m:Pa:s:T:f:v")) != -1) {
+        switch (opt) {
+        case 'b':
+            v = atoi(optarg);
+            if (v < 1 || v > MAX_BURST)
+                return -1;
+            burst_size = v;
+            break;
+        case 'r':
+            nb_rxd = atoi(optarg);
+            break;
+        case 't':
+            nb_txd = atoi(optarg);
+            break;
+        case 'q':
+            nb_queues = atoi(optarg);
+            break;
+        case 'n':
+            nb_mbufs = atoi(optarg);
+            break;
+        case 'd':
+            v = parse_name(optarg, datapath_names,
+                           RTE_DIM(datapath_names));
+            if (v < 0)
+                return -1;
+            datapath = v;
+            break;
+        case 'm':
+            v = parse_name(optarg, mode_names, RTE_DIM(mode_names));
+            if (v < 0)
+                return -1;
+            fwd_mode = v;
+            break;
+        case 'P':
+            swap_ports = 0;
+            break;
+        case 'a':
+            v = parse_name(optarg, poll_names, RTE_DIM(poll_names));
+            if (v < 0)
+                return -1;
+            poll_mode = v;
+            break;
+        case 's':
+            stats_interval = atof(optarg);
+            break;
+        case 'T':
+            run_time = atof(optarg);
+            break;
+        case 'f':
+            v = parse_name(optarg, format_names, RTE_DIM(format_names));
+            if (v < 0)
+                return -1;
+            out_format = v;
+            break;
+        case 'v':
+            log_packets = 1;
+            break;
+        default:
+            return -1;
+        }
+    }
+
+    if (nb_rxd == 0 || nb_txd == 0 || stats_interval < 0 || run_time < 0)
+        return -1;
+    if (poll_mode == POLL_INTR && datapath != DATAPATH_CLEANQ) {
+        fprintf(stderr, "-a intr needs -d cleanq\n");
+        return -1;
+    }
+#ifndef RTE_LIBCLEANQ
+    if (datapath == DATAPATH_CLEANQ || poll_mode != POLL_FIXED) {
+        fprintf(stderr, "DPDK was built without CleanQ\n");
+        return -1;
+    }
+#endif
+    return 0;
 }
 
 /*
@@ -285,9 +1063,11 @@ lcore_main(void)
 int
 main(int argc, char *argv[])
 {
-    struct rte_mempool *mbuf_pool;
     unsigned nb_ports;
+    unsigned socket_queues[RTE_MAX_NUMA_NODES] = { 0 };
+    unsigned lcore_id;
     uint16_t portid;
+    uint16_t q;
 
     /* Initialize the Environment Abstraction Layer (EAL). */
     int ret = rte_eal_init(argc, argv);
@@ -297,17 +1077,62 @@ main(int argc, char *argv[])
     argc -= ret;
     argv += ret;
 
-    /* Check that there is an even number of ports to send/receive on. */
+    if (parse_args(argc, argv) != 0) {
+        usage(argv[0]);
+        rte_exit(EXIT_FAILURE, "Invalid arguments\n");
+    }
+
+    force_quit = 0;
+    signal(SIGINT, signal_handler);
+    signal(SIGTERM, signal_handler);
+
     nb_ports = rte_eth_dev_count_avail();
     if (nb_ports < 1)
         rte_exit(EXIT_FAILURE, "Error: no ports available\n");
 
-    /* Creates a new mempool in memory to hold the mbufs. */
-    mbuf_pool = rte_pktmbuf_pool_create("MBUF_POOL", NUM_MBUFS * nb_ports,
-        MBUF_CACHE_SIZE, 0, RTE_MBUF_DEFAULT_BUF_SIZE, rte_socket_id());
+    /* One queue per lcore, as many as all ports have. */
+    if (nb_queues == 0 || nb_queues > rte_lcore_count())
+        nb_queues = rte_lcore_count();
+    RTE_ETH_FOREACH_DEV(portid) {
+        struct rte_eth_dev_info dev_info;
+
+        rte_eth_dev_info_get(portid, &dev_info);
+        nb_queues = RTE_MIN(nb_queues, dev_info.max_rx_queues);
+        nb_queues = RTE_MIN(nb_queues, dev_info.max_tx_queues);
+
+        // pairs of ports, the last one of an odd number on its own
+        dst_ports[portid] = portid;
+        if (fwd_mode == MODE_FWD &&
+                rte_eth_dev_is_valid_port(portid ^ 1))
+            dst_ports[portid] = portid ^ 1;
+    }
+
+    q = 0;
+    RTE_LCORE_FOREACH(lcore_id) {
+        if (q < nb_queues) {
+            lcore_conf[lcore_id].queue = q++;
+            socket_queues[rte_lcore_to_socket_id(lcore_id)]++;
+        } else {
+            lcore_conf[lcore_id].queue = NO_QUEUE;
+        }
+    }
+
+    /* Creates a mempool for every socket with queues to hold the mbufs. */
+    for (unsigned socket = 0; socket < RTE_MAX_NUMA_NODES; socket++) {
+        char name[RTE_MEMPOOL_NAMESIZE];
+
+        if (socket_queues[socket] == 0)
+            continue;
 
-    if (mbuf_pool == NULL)
-        rte_exit(EXIT_FAILURE, "Cannot create mbuf pool\n");
+        snprintf(name, sizeof(name), "MBUF_POOL_%u", socket);
+        mbuf_pools[socket] = rte_pktmbuf_pool_create(name,
+            nb_mbufs * nb_ports * socket_queues[socket], MBUF_CACHE_SIZE, 0,
+            RTE_MBUF_DEFAULT_BUF_SIZE, socket);
+
+        if (mbuf_pools[socket] == NULL)
+            rte_exit(EXIT_FAILURE, "Cannot create mbuf pool on socket %u\n",
+                    socket);
+    }
 
     /* Configure log levels */
     rte_log_set_level(RTE_LOGTYPE_PMD, DRIVER_LOG_LEVEL);
@@ -315,21 +1140,70 @@ main(int argc, char *argv[])
 
     rte_log_set_level(rte_log_register("pmd.net.ixgbe.cleanq.tx"), CLEANQ_TX_LOG_LEVEL);
     rte_log_set_level(rte_log_register("pmd.net.ixgbe.cleanq.rx"), CLEANQ_RX_LOG_LEVEL);
-    
+
     logtype = rte_log_register("cleanq.testapp");
     rte_log_set_level(logtype, MAIN_LOG_LEVEL);
 
     /* Initialize all ports. */
     RTE_ETH_FOREACH_DEV(portid)
-        if (port_init(portid, mbuf_pool) != 0)
+        if (port_init(portid) != 0)
             rte_exit(EXIT_FAILURE, "Cannot init port %"PRIu16 "\n",
                     portid);
 
-    if (rte_lcore_count() > 1)
-        printf("\nWARNING: Too many lcores enabled. Only 1 used.\n");
+#ifdef RTE_LIBCLEANQ
+    if (datapath == DATAPATH_CLEANQ) {
+        RTE_LCORE_FOREACH(lcore_id) {
+            if (lcore_conf[lcore_id].queue == NO_QUEUE)
+                continue;
+            RTE_ETH_FOREACH_DEV(portid)
+                if (cleanq_queues_init(portid, &lcore_conf[lcore_id],
+                        rte_lcore_to_socket_id(lcore_id)) != 0)
+                    rte_exit(EXIT_FAILURE, "Cannot init CleanQ queues of "
+                             "port %" PRIu16 "\n", portid);
+            if (poll_mode == POLL_INTR &&
+                    intr_init(&lcore_conf[lcore_id]) != 0)
+                rte_exit(EXIT_FAILURE, "Cannot set up the RX interrupts of "
+                         "lcore %u\n", lcore_id);
+        }
+    }
+#endif
+
+    if (rte_lcore_count() > nb_queues)
+        fprintf(stderr, "\nWARNING: Too many lcores enabled. Only %u used.\n",
+                nb_queues);
 
-    /* Call lcore_main on the master core only. */
-    lcore_main();
+    if (poll_mode == POLL_POWER && power_init() != 0) {
+        fprintf(stderr, "WARNING: no frequency scaling, polling adaptive "
+                "only\n");
+        poll_mode = POLL_ADAPTIVE;
+    }
+
+    print_header();
+
+    /* Call lcore_main on every lcore, the master included. */
+    RTE_LCORE_FOREACH_SLAVE(lcore_id)
+        rte_eal_remote_launch(lcore_main, NULL, lcore_id);
+    lcore_main(NULL);
 
+    RTE_ETH_FOREACH_DEV(portid) {
+        rte_eth_dev_stop(portid);
+#ifdef RTE_LIBCLEANQ
+        // the driver gave back what it held
+        RTE_LCORE_FOREACH(lcore_id)
+            if (lcore_conf[lcore_id].queue != NO_QUEUE &&
+                    datapath == DATAPATH_CLEANQ)
+                cleanq_queues_destroy(portid, &lcore_conf[lcore_id]);
+#endif
+        rte_eth_dev_close(portid);
+    }
+
+    if (poll_mode == POLL_POWER)
+        power_exit();
+#ifdef RTE_LIBCLEANQ
+    if (poll_mode == POLL_INTR)
+        RTE_LCORE_FOREACH(lcore_id)
+            if (lcore_conf[lcore_id].queue != NO_QUEUE)
+                close(lcore_conf[lcore_id].epfd);
+#endif
     return 0;
 }
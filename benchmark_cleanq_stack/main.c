@@ -0,0 +1,578 @@
+/* SPDX-License-Identifier: BSD-3-Clause
+ * Copyright(c) 2010-2015 Intel Corporation
+ */
+
+/*
+ * Measures the CleanQ UDP stack without a NIC or a peer. Every lcore runs a
+ * stack of its own on a reflector queue pair (backends/reflector.h), which
+ * sends every packet straight back, and keeps a window of packets going
+ * around. The stacks are measured one after the other, from the reflector
+ * alone up to UDP on top of IP, so the cost of each layer is the difference
+ * to the stack below it.
+ */
+
+#include <stdint.h>
+#include <inttypes.h>
+#include <string.h>
+#include <stdlib.h>
+#include <getopt.h>
+#include <arpa/inet.h>
+#include <rte_eal.h>
+#include <rte_cycles.h>
+#include <rte_lcore.h>
+#include <rte_launch.h>
+#include <rte_mbuf.h>
+#include <rte_ether.h>
+#include <rte_ip.h>
+#include <cleanq.h>
+#include <cleanq_module.h>
+#include <cleanq_dpdk.h>
+#include <cleanq_lat.h>
+#ifdef RTE_LIBRTE_METRICS
+#include <rte_metrics.h>
+#include <cleanq_metrics.h>
+#endif
+#include <cleanq_ip.h>
+#include <cleanq_udp.h>
+#include <cleanq_udp_ip.h>
+#include <cleanq_pkt_headers.h>
+#include <backends/reflector.h>
+
+// per lcore and stack, the pools are shared by the lcores of a NUMA socket
+#define NUM_RX_BUFS 512
+#define MAX_WINDOW 256
+#define MBUF_CACHE_SIZE 250
+
+#define SRC_PORT 2000
+// the reflected packets have to come back to SRC_PORT
+#define DST_PORT SRC_PORT
+
+enum stack_type {
+    STACK_REFLECTOR,
+    STACK_IP,
+    STACK_UDP,
+    STACK_UDP_IP,
+    NB_STACKS,
+};
+
+static const char *stack_names[NB_STACKS] = {
+    "reflector", "ip", "udp", "udp_ip",
+};
+
+// the stack whose cost is subtracted to get the cost of the top layer
+static const int stack_below[NB_STACKS] = {
+    -1, STACK_REFLECTOR, STACK_IP, STACK_REFLECTOR,
+};
+
+// settings, see usage()
+static double run_time = 1.0;
+static uint32_t window = 32;
+static uint32_t payload_len = 64;
+static uint32_t burst = 32;
+static int stacks_enabled[NB_STACKS] = { 1, 1, 1, 1 };
+static int dump_hist;
+
+static uint32_t src_ip;
+static uint32_t dst_ip;
+static struct ether_addr src_mac = {{ 0x02, 0, 0, 0, 0, 0x01 }};
+static struct ether_addr dst_mac = {{ 0x02, 0, 0, 0, 0, 0x02 }};
+
+// how often the RTT histograms go to librte_metrics
+#define METRICS_PERIOD_US 1000000
+
+struct lcore_conf {
+    int enabled;
+    struct reflector_q *refl;
+    // received packets and posted buffers, sent packets and completions
+    struct cleanq *rx;
+    struct cleanq *tx;
+    // the modules poll RX first in cleanq_dequeue(), which leaves the
+    // completions on the reflector once the window keeps RX busy
+    cleanq_dequeue_t deq_rx;
+    cleanq_dequeue_t deq_tx;
+    struct rte_mempool *pool;
+    uint64_t base_addr;
+    genoffset_t headroom;
+    struct cleanq_buf window[MAX_WINDOW];
+
+    // results of the last run
+    uint64_t pkts;
+    uint64_t cycles;
+    uint64_t errors;
+    // round trip times in TSC cycles
+    struct cleanq_lat_hist rtt;
+} __rte_cache_aligned;
+
+static struct lcore_conf lcore_conf[RTE_MAX_LCORE];
+static struct rte_mempool *mbuf_pools[RTE_MAX_NUMA_NODES];
+
+static inline uint8_t *
+buf_data(struct lcore_conf *conf, const struct cleanq_buf *b)
+{
+    return (uint8_t *) conf->base_addr + b->offset + conf->headroom +
+           b->valid_data;
+}
+
+/*
+ * Writes Ethernet, IP and UDP headers into a buffer, the reflector and the
+ * IP stack need them, the other stacks overwrite them
+ */
+static void
+init_frame(uint8_t *pkt)
+{
+    struct ether_hdr *eth = (struct ether_hdr *) pkt;
+    struct ipv4_hdr *ip = (struct ipv4_hdr *) (eth + 1);
+    struct udp_hdr *udp = (struct udp_hdr *) (ip + 1);
+
+    ether_addr_copy(&dst_mac, &eth->d_addr);
+    ether_addr_copy(&src_mac, &eth->s_addr);
+    eth->ether_type = rte_cpu_to_be_16(ETHER_TYPE_IPv4);
+
+    memset(ip, 0, sizeof(*ip));
+    ip->version_ihl = 0x45;
+    ip->total_length = rte_cpu_to_be_16(sizeof(*ip) + sizeof(*udp) +
+                                        payload_len);
+    ip->time_to_live = 64;
+    ip->next_proto_id = IPPROTO_UDP;
+    ip->src_addr = src_ip;
+    ip->dst_addr = dst_ip;
+    ip->hdr_checksum = rte_ipv4_cksum(ip);
+
+    udp->src = rte_cpu_to_be_16(SRC_PORT);
+    udp->dest = rte_cpu_to_be_16(DST_PORT);
+    udp->len = rte_cpu_to_be_16(sizeof(*udp) + payload_len);
+    udp->chksum = 0;
+
+    memset(udp + 1, 0, payload_len);
+}
+
+/*
+ * Sets up the stack of an lcore, posts its receive buffers and takes the
+ * buffers of the window
+ */
+static int
+stack_init(struct lcore_conf *conf, enum stack_type type, int socket_id)
+{
+    errval_t err;
+    struct cleanq *nic_rx;
+    struct cleanq *nic_tx;
+    struct cleanq_buf cqbuf;
+    regionid_t rid;
+
+    err = reflector_create(&conf->refl, socket_id);
+    if (err_is_fail(err)) {
+        printf("Failed init reflector err=%d\n", err);
+        return err;
+    }
+    nic_rx = reflector_get_rx(conf->refl);
+    nic_tx = reflector_get_tx(conf->refl);
+
+    switch (type) {
+    case STACK_REFLECTOR:
+        conf->rx = nic_rx;
+        conf->tx = nic_tx;
+        conf->deq_rx = conf->deq_tx = cleanq_dequeue;
+        break;
+    case STACK_IP: {
+        struct ip_q *q;
+        err = ip_create(&q, nic_rx, nic_tx, UDP_PROT, src_ip, dst_ip,
+                        &src_mac, &dst_mac, socket_id);
+        conf->rx = conf->tx = (struct cleanq *) q;
+        conf->deq_rx = ip_dequeue_rx;
+        conf->deq_tx = ip_dequeue_tx;
+        break;
+    }
+    case STACK_UDP: {
+        struct udp_q *q;
+        err = udp_create(&q, nic_rx, nic_tx, SRC_PORT, DST_PORT, src_ip,
+                         dst_ip, &src_mac, &dst_mac, socket_id);
+        conf->rx = conf->tx = (struct cleanq *) q;
+        conf->deq_rx = udp_dequeue_rx;
+        conf->deq_tx = udp_dequeue_tx;
+        break;
+    }
+    case STACK_UDP_IP: {
+        struct udp_ip_q *q;
+        err = udp_ip_create(&q, nic_rx, nic_tx, SRC_PORT, DST_PORT, src_ip,
+                            dst_ip, &src_mac, &dst_mac, socket_id);
+        conf->rx = conf->tx = (struct cleanq *) q;
+        conf->deq_rx = udp_ip_dequeue_rx;
+        conf->deq_tx = udp_ip_dequeue_tx;
+        break;
+    }
+    default:
+        return -1;
+    }
+    if (err_is_fail(err)) {
+        printf("Failed init %s stack err=%d\n", stack_names[type], err);
+        return err;
+    }
+
+    err = cleanq_register_mempool(conf->tx, conf->pool);
+    if (err_is_fail(err)) {
+        printf("Failed registering mempool err=%d\n", err);
+        return err;
+    }
+
+    err = cleanq_mempool_region(conf->tx, conf->pool, &rid,
+                                &conf->base_addr);
+    if (err_is_fail(err))
+        return err;
+    conf->headroom = sizeof(struct rte_mbuf) +
+                     rte_pktmbuf_priv_size(conf->pool);
+
+    for (uint32_t i = 0; i < NUM_RX_BUFS + window; i++) {
+        struct rte_mbuf *mb = rte_mbuf_raw_alloc(conf->pool);
+        if (mb == NULL) {
+            printf("mbuf alloc failed\n");
+            return -1;
+        }
+
+        mbuf_to_cleanq_buf(conf->tx, mb, &cqbuf);
+        init_frame(buf_data(conf, &cqbuf));
+
+        if (i < window) {
+            cqbuf.valid_length = UDP_HEADERS_LEN + payload_len;
+            conf->window[i] = cqbuf;
+            continue;
+        }
+
+        err = cleanq_enqueue(conf->rx, cqbuf.rid, cqbuf.offset, cqbuf.length,
+                             cqbuf.valid_data, 0, NETIF_RXFLAG);
+        if (err_is_fail(err)) {
+            printf("Adding buffer %u failed err=%d\n", i, err);
+            return err;
+        }
+    }
+
+    return 0;
+}
+
+static inline errval_t
+send_pkt(struct lcore_conf *conf, struct cleanq_buf *b, uint64_t now)
+{
+    // the time it was sent goes into the payload
+    *(uint64_t *) (buf_data(conf, b) + UDP_HEADERS_LEN) = now;
+
+    return cleanq_enqueue(conf->tx, b->rid, b->offset, b->length,
+                          b->valid_data, b->valid_length,
+                          NETIF_TXFLAG | (b->flags & 0xFFFF));
+}
+
+// handles a buffer dequeued from the stack, a received packet is sent back
+static inline void
+handle_buf(struct lcore_conf *conf, struct cleanq_buf *b)
+{
+    errval_t err;
+
+    if (b->flags & NETIF_RXFLAG) {
+        // per packet, the reflector can return it within the same burst
+        uint64_t now = rte_rdtsc();
+        uint64_t sent = *(uint64_t *) (buf_data(conf, b) + UDP_HEADERS_LEN);
+
+        conf->pkts++;
+        cleanq_lat_add(&conf->rtt, now > sent ? now - sent : 0);
+        err = send_pkt(conf, b, now);
+        if (err_is_ok(err))
+            return;
+        conf->errors++;
+    }
+
+    // send completion or not sent, goes back to the receive side
+    err = cleanq_enqueue(conf->rx, b->rid, b->offset, b->length,
+                         b->valid_data, 0, NETIF_RXFLAG);
+    if (err_is_fail(err))
+        conf->errors++;
+}
+
+/*
+ * Keeps the window going around the stack of the lcore for run_time
+ */
+static int
+lcore_run(__attribute__((unused)) void *arg)
+{
+    struct lcore_conf *conf = &lcore_conf[rte_lcore_id()];
+    struct cleanq_buf b;
+    uint64_t start;
+    uint64_t end;
+    uint64_t now;
+    errval_t err;
+
+    if (!conf->enabled)
+        return 0;
+
+    conf->pkts = 0;
+    conf->errors = 0;
+    memset(&conf->rtt, 0, sizeof(conf->rtt));
+
+    start = rte_rdtsc();
+    end = start + (uint64_t) (run_time * rte_get_tsc_hz());
+
+    for (uint32_t i = 0; i < window; i++) {
+        conf->window[i].flags = rte_cpu_to_be_16(DST_PORT);
+        if (err_is_fail(send_pkt(conf, &conf->window[i], start)))
+            conf->errors++;
+    }
+
+    now = start;
+    while (now < end) {
+        for (uint32_t i = 0; i < burst; i++) {
+            err = conf->deq_rx(conf->rx, &b.rid, &b.offset, &b.length,
+                               &b.valid_data, &b.valid_length, &b.flags);
+            if (err_is_fail(err))
+                break;
+            handle_buf(conf, &b);
+        }
+
+        for (uint32_t i = 0; i < burst; i++) {
+            err = conf->deq_tx(conf->tx, &b.rid, &b.offset, &b.length,
+                               &b.valid_data, &b.valid_length, &b.flags);
+            if (err_is_fail(err))
+                break;
+            handle_buf(conf, &b);
+        }
+
+        now = rte_rdtsc();
+    }
+    conf->cycles = now - start;
+
+    return 0;
+}
+
+struct stack_result {
+    int valid;
+    double mpps;
+    double cycles_per_pkt;
+};
+
+static void
+print_hist(const struct cleanq_lat_hist *hist, double ns_per_cycle)
+{
+    for (uint32_t b = 0; b < CLEANQ_LAT_BUCKETS; b++) {
+        if (hist->count[b] == 0)
+            continue;
+        printf("    %10.0f ns %12" PRIu64 "\n",
+               cleanq_lat_bucket_low(b) * ns_per_cycle, hist->count[b]);
+    }
+}
+
+/*
+ * Runs a stack on all lcores and prints the throughput, the cycles per
+ * packet and the round trip times
+ */
+static void
+run_stack(enum stack_type type, struct stack_result *results)
+{
+    static struct cleanq_lat_hist rtt;
+    struct stack_result *res = &results[type];
+    double ns_per_cycle = 1e9 / rte_get_tsc_hz();
+    uint64_t pkts = 0;
+    uint64_t cycles = 0;
+    uint64_t errors = 0;
+    uint64_t reflected;
+    uint64_t refl_dropped;
+    uint64_t dropped = 0;
+    unsigned lcore_id;
+
+    RTE_LCORE_FOREACH(lcore_id) {
+        struct lcore_conf *conf = &lcore_conf[lcore_id];
+
+        if (!conf->enabled)
+            continue;
+        if (stack_init(conf, type, rte_lcore_to_socket_id(lcore_id)) != 0)
+            rte_exit(EXIT_FAILURE, "Cannot init %s stack on lcore %u\n",
+                     stack_names[type], lcore_id);
+    }
+
+    rte_eal_mp_remote_launch(lcore_run, NULL, CALL_MASTER);
+    rte_eal_mp_wait_lcore();
+
+    memset(&rtt, 0, sizeof(rtt));
+    res->mpps = 0;
+    RTE_LCORE_FOREACH(lcore_id) {
+        struct lcore_conf *conf = &lcore_conf[lcore_id];
+
+        if (!conf->enabled)
+            continue;
+        pkts += conf->pkts;
+        cycles += conf->cycles;
+        errors += conf->errors;
+        res->mpps += conf->pkts / (conf->cycles * ns_per_cycle / 1e9) / 1e6;
+        for (uint32_t b = 0; b < CLEANQ_LAT_BUCKETS; b++)
+            rtt.count[b] += conf->rtt.count[b];
+        reflector_get_stats(conf->refl, &reflected, &refl_dropped);
+        dropped += refl_dropped;
+    }
+    res->valid = pkts > 0;
+    res->cycles_per_pkt = pkts > 0 ? (double) cycles / pkts : 0;
+
+    printf("%-10s %8.3f Mpps %8.1f cycles/pkt", stack_names[type], res->mpps,
+           res->cycles_per_pkt);
+    if (stack_below[type] >= 0 && results[stack_below[type]].valid)
+        printf(" (%s %+.1f over %s)", stack_names[type],
+               res->cycles_per_pkt -
+               results[stack_below[type]].cycles_per_pkt,
+               stack_names[stack_below[type]]);
+    printf("\n");
+    printf("           RTT ns p50 %.0f p99 %.0f p99.9 %.0f p99.99 %.0f, "
+           "dropped %" PRIu64 " errors %" PRIu64 "\n",
+           cleanq_lat_percentile(&rtt, 0.5) * ns_per_cycle,
+           cleanq_lat_percentile(&rtt, 0.99) * ns_per_cycle,
+           cleanq_lat_percentile(&rtt, 0.999) * ns_per_cycle,
+           cleanq_lat_percentile(&rtt, 0.9999) * ns_per_cycle, dropped,
+           errors);
+    if (dump_hist)
+        print_hist(&rtt, ns_per_cycle);
+}
+
+static void
+usage(const char *prgname)
+{
+    printf("%s [EAL options] -- [-t seconds] [-w window] [-p payload] "
+           "[-b burst] [-s stack,...] [-H]\n"
+           "  -t  run time of every stack, default %.1f s\n"
+           "  -w  packets going around per lcore, at most %d, default %u\n"
+           "  -p  UDP payload length, default %u\n"
+           "  -b  buffers dequeued at once, default %u\n"
+           "  -s  stacks to run out of reflector,ip,udp,udp_ip, default all\n"
+           "  -H  print the RTT histograms\n",
+           prgname, run_time, MAX_WINDOW, window, payload_len, burst);
+}
+
+static int
+parse_stacks(char *list)
+{
+    char *name;
+
+    memset(stacks_enabled, 0, sizeof(stacks_enabled));
+    for (name = strtok(list, ","); name != NULL; name = strtok(NULL, ",")) {
+        int found = 0;
+
+        for (int s = 0; s < NB_STACKS; s++) {
+            if (strcmp(name, stack_names[s]) == 0) {
+                stacks_enabled[s] = 1;
+                found = 1;
+            }
+        }
+        if (!found)
+            return -1;
+    }
+    return 0;
+}
+
+static int
+parse_args(int argc, char **argv)
+{
+    int opt;
+
+    while ((opt = getopt(argc, argv, "t:w:p:b:s:H")) != -1) {
+        switch (opt) {
+        case 't':
+            run_time = atof(optarg);
+            break;
+        case 'w':
+            window = atoi(optarg);
+            break;
+        case 'p':
+            payload_len = atoi(optarg);
+            break;
+        case 'b':
+            burst = atoi(optarg);
+            break;
+        case 's':
+            if (parse_stacks(optarg) != 0)
+                return -1;
+            break;
+        case 'H':
+            dump_hist = 1;
+            break;
+        default:
+            return -1;
+        }
+    }
+
+    if (run_time <= 0 || window < 1 || window > MAX_WINDOW || burst < 1 ||
+        payload_len < sizeof(uint64_t) ||
+        UDP_HEADERS_LEN + payload_len > RTE_MBUF_DEFAULT_DATAROOM)
+        return -1;
+    return 0;
+}
+
+int
+main(int argc, char *argv[])
+{
+    unsigned socket_lcores[RTE_MAX_NUMA_NODES] = { 0 };
+    struct stack_result results[NB_STACKS];
+    unsigned lcore_id;
+
+    int ret = rte_eal_init(argc, argv);
+    if (ret < 0)
+        rte_exit(EXIT_FAILURE, "Error with EAL initialization\n");
+
+    argc -= ret;
+    argv += ret;
+
+    if (parse_args(argc, argv) != 0) {
+        usage(argv[0]);
+        rte_exit(EXIT_FAILURE, "Invalid arguments\n");
+    }
+
+    src_ip = inet_addr("10.0.0.1");
+    dst_ip = inet_addr("10.0.0.2");
+
+    RTE_LCORE_FOREACH(lcore_id) {
+        lcore_conf[lcore_id].enabled = 1;
+        socket_lcores[rte_lcore_to_socket_id(lcore_id)]++;
+    }
+
+    /*
+     * The stacks of a finished run are left as they are, so the pools hold
+     * the buffers of all runs
+     */
+    for (unsigned socket = 0; socket < RTE_MAX_NUMA_NODES; socket++) {
+        char name[RTE_MEMPOOL_NAMESIZE];
+
+        if (socket_lcores[socket] == 0)
+            continue;
+
+        snprintf(name, sizeof(name), "MBUF_POOL_%u", socket);
+        mbuf_pools[socket] = rte_pktmbuf_pool_create(name,
+            (NUM_RX_BUFS + MAX_WINDOW) * NB_STACKS * socket_lcores[socket] +
+            MBUF_CACHE_SIZE * socket_lcores[socket], MBUF_CACHE_SIZE, 0,
+            RTE_MBUF_DEFAULT_BUF_SIZE, socket);
+
+        if (mbuf_pools[socket] == NULL)
+            rte_exit(EXIT_FAILURE, "Cannot create mbuf pool on socket %u\n",
+                    socket);
+    }
+
+    RTE_LCORE_FOREACH(lcore_id)
+        lcore_conf[lcore_id].pool =
+            mbuf_pools[rte_lcore_to_socket_id(lcore_id)];
+
+#ifdef RTE_LIBRTE_METRICS
+    /*
+     * The RTTs of the running stack as cleanq_stack_rtt_* metrics. They
+     * belong to no port, dpdk-procinfo --metrics shows them if there is
+     * one at all (e.g. --vdev net_null0)
+     */
+    rte_metrics_init(rte_socket_id());
+    RTE_LCORE_FOREACH(lcore_id)
+        cleanq_metrics_add_latency(&lcore_conf[lcore_id].rtt,
+                                   RTE_METRICS_GLOBAL, "stack_rtt");
+    if (err_is_fail(cleanq_metrics_start(METRICS_PERIOD_US)))
+        printf("WARNING: CleanQ metrics are not updated\n");
+#endif
+
+    printf("%u lcores, window %u, payload %u bytes, %.1f s per stack, "
+           "TSC %" PRIu64 " Hz\n", rte_lcore_count(), window, payload_len,
+           run_time, rte_get_tsc_hz());
+
+    memset(results, 0, sizeof(results));
+    for (int s = 0; s < NB_STACKS; s++) {
+        if (stacks_enabled[s])
+            run_stack((enum stack_type) s, results);
+    }
+
+    return 0;
+}
@@ -4,6 +4,7 @@
 
 #include <stdint.h>
 #include <inttypes.h>
+#include <string.h>
 #include <rte_eal.h>
 #include <rte_ethdev.h>
 #include <rte_cycles.h>
@@ -13,8 +14,16 @@
 #include <cleanq.h>
 #include <cleanq_pmd_ixgbe.h>
 #include <cleanq_udp.h>
+#include <cleanq_udp_ip.h>
+#include <cleanq_arp.h>
+#include <cleanq_static.h>
 #include <cleanq_dpdk.h>
 #include <cleanq_pkt_headers.h>
+#include <backends/ethdev.h>
+#ifdef RTE_LIBRTE_METRICS
+#include <rte_metrics.h>
+#include <cleanq_metrics.h>
+#endif
 #include <arpa/inet.h>
 #else
 #include <rte_ether.h>
@@ -25,6 +34,7 @@
 #define RX_RING_SIZE 1024
 #define TX_RING_SIZE 1024
 
+// per queue, the mempools are shared by the queues of a NUMA socket
 #define NUM_MBUFS 8191
 #define MBUF_CACHE_SIZE 250
 #define BURST_SIZE 32
@@ -50,52 +60,278 @@ static const struct rte_eth_conf port_conf_default = {
 };
 
 #define CLEANQ_STACK
+// use the fused UDP/IP module instead of UDP on top of IP
+//#define CLEANQ_FUSED_STACK
 #ifdef CLEANQ_STACK
+// the stack is always UDP on top, bind it at compile time
+#ifdef CLEANQ_FUSED_STACK
+CLEANQ_STATIC_QUEUE(udp_stack, udp_ip_enqueue, udp_ip_dequeue)
+CLEANQ_STATIC_DEQUEUE(udp_stack_dequeue_rx, udp_ip_dequeue_rx)
+CLEANQ_STATIC_DEQUEUE(udp_stack_dequeue_tx, udp_ip_dequeue_tx)
+#else
+CLEANQ_STATIC_QUEUE(udp_stack, udp_enqueue, udp_dequeue)
+CLEANQ_STATIC_DEQUEUE(udp_stack_dequeue_rx, udp_dequeue_rx)
+CLEANQ_STATIC_DEQUEUE(udp_stack_dequeue_tx, udp_dequeue_tx)
+#endif
+
+/*
+ * Send completions are reaped once every TX_REAP_INTERVAL RX polls, or
+ * earlier when TX_REAP_THRESHOLD packets were sent since the last time, so
+ * the RX ring does not run out of buffers.
+ */
+#define TX_REAP_INTERVAL 32
+#define TX_REAP_THRESHOLD 256
+
+// udp, ip, arp rx/tx and nic rx/tx
+#define STACK_MAX_LAYERS 6
+// how often the statistics of the layers go to librte_metrics
+#define METRICS_PERIOD_US 1000000
+
 #define SRC_PORT 2000
 #define DST_PORT 2000
+// defaults, can be given on the command line (see usage())
 static const char* src_ip_str = "10.110.4.180";
 static const char* dst_ip_str = "10.110.4.72";
+static const char* netmask_str = "255.255.252.0";
+static const char* gateway_str = "0.0.0.0";
 static uint32_t src_ip;
 static uint32_t dst_ip;
-static struct ether_addr dst_mac = {
-	.addr_bytes = {0x00, 0x1b, 0x21, 0x8F, 0x1B, 0x21},
-};
 static struct ether_addr src_mac;
-struct udp_q* udp_q;
-struct cleanq* cleanq_udp;
+// the destination MAC is resolved with ARP
+static struct arp_table* arp_table;
+#endif
 
-static struct cleanq* nic_rx;
-static struct cleanq* nic_tx;
-static uint64_t num_pkt = 0;
+/*
+ * Every lcore polls its own RSS queue of the ports. With the CleanQ stack it
+ * runs a stack of its own on the queue, only the addresses and the ARP
+ * neighbor table are shared.
+ */
+#define NO_QUEUE UINT16_MAX
+
+struct lcore_conf {
+    uint16_t queue;
+#ifdef CLEANQ_STACK
+    struct arp_q* arp_q;
+#ifdef CLEANQ_FUSED_STACK
+    struct udp_ip_q* udp_q;
+#else
+    struct udp_q* udp_q;
 #endif
+    struct cleanq* cleanq_udp;
+    struct cleanq* nic_rx;
+    struct cleanq* nic_tx;
+    // wraps the ethdev queues if the driver has no CleanQ queues
+    struct ethdev_q* eth_q;
+    uint32_t rx_polls;
+    uint32_t tx_pending;
+#endif
+    uint64_t num_pkt;
+} __rte_cache_aligned;
+
+static struct lcore_conf lcore_conf[RTE_MAX_LCORE];
+static uint16_t nb_queues;
+static struct rte_mempool *mbuf_pools[RTE_MAX_NUMA_NODES];
 /* basicfwd.c: Basic DPDK skeleton forwarding example. */
 
 /*
- * Initializes a given port using global settings and with the RX buffers
- * coming from the mbuf_pool passed as a parameter.
+ * The queues of ixgbe are CleanQ queues, the ones of other drivers are
+ * wrapped with the ethdev backend
+ */
+static int
+port_has_cleanq_queues(const struct rte_eth_dev_info *dev_info)
+{
+#ifdef RTE_LIBCLEANQ
+    return strcmp(dev_info->driver_name, "net_ixgbe") == 0;
+#else
+    return 0;
+#endif
+}
+
+#ifdef CLEANQ_STACK
+struct stack_layer {
+    const char *name;
+    struct cleanq *q;
+};
+
+// the layers of the stack of an lcore, top to bottom
+static unsigned
+stack_layers(struct lcore_conf *conf, struct stack_layer *layers)
+{
+    unsigned n = 0;
+
+#ifdef CLEANQ_FUSED_STACK
+    layers[n++] = (struct stack_layer) { "udp_ip", conf->cleanq_udp };
+#else
+    layers[n++] = (struct stack_layer) { "udp", conf->cleanq_udp };
+    layers[n++] = (struct stack_layer) { "ip", udp_get_ip(conf->udp_q) };
+#endif
+    layers[n++] = (struct stack_layer) { "arp_rx", arp_get_rx(conf->arp_q) };
+    layers[n++] = (struct stack_layer) { "arp_tx", arp_get_tx(conf->arp_q) };
+    layers[n++] = (struct stack_layer) { "nic_rx", conf->nic_rx };
+    layers[n++] = (struct stack_layer) { "nic_tx", conf->nic_tx };
+    return n;
+}
+
+/*
+ * A line per layer of the stack of an lcore, so the layer that drops or
+ * runs out of buffers can be told apart
+ */
+static void
+print_stack_stats(struct lcore_conf *conf)
+{
+    struct stack_layer layers[STACK_MAX_LAYERS];
+    struct cleanq_stats st;
+    unsigned n = stack_layers(conf, layers);
+
+    for (unsigned i = 0; i < n; i++) {
+        if (err_is_fail(cleanq_get_stats(layers[i].q, &st)))
+            continue;
+        printf("Core %u %-6s enq %"PRIu64" deq %"PRIu64" full %"PRIu64
+               " empty %"PRIu64" invalid %"PRIu64" dropped %"PRIu64
+               " occupancy %"PRIu64"/%"PRIu64"\n", rte_lcore_id(),
+               layers[i].name, st.enq, st.deq, st.full, st.empty,
+               st.invalid, st.dropped, st.occupancy, st.high_watermark);
+    }
+}
+#endif
+
+#ifdef CLEANQ_STACK
+/*
+ * Sets up the stack of an lcore on its queue of the port
+ */
+static int
+stack_init(uint16_t port, struct lcore_conf *conf, int socket_id,
+           int cleanq_queues)
+{
+    errval_t err;
+    struct rte_mempool *mbuf_pool = mbuf_pools[socket_id];
+    struct cleanq_buf cqbuf;
+
+    if (cleanq_queues) {
+        struct rte_eth_dev *dev = &rte_eth_devices[port];
+
+        conf->nic_rx = (struct cleanq *)dev->data->rx_queues[conf->queue];
+        conf->nic_tx = (struct cleanq *)dev->data->tx_queues[conf->queue];
+    } else {
+        err = ethdev_q_create(&conf->eth_q, port, conf->queue, socket_id);
+        if (err_is_fail(err)) {
+	    printf("Failed init ethdev q err=%d", err);
+            return err;
+        }
+        conf->nic_rx = ethdev_q_get_rx(conf->eth_q);
+        conf->nic_tx = ethdev_q_get_tx(conf->eth_q);
+    }
+
+    err = arp_create(&conf->arp_q, arp_table, conf->nic_rx, conf->nic_tx,
+                     socket_id);
+    if (err_is_fail(err)) {
+	printf("Failed init ARP q err=%d", err);
+        return err;
+    }
+#ifdef CLEANQ_FUSED_STACK
+    err = udp_ip_create(&conf->udp_q, arp_get_rx(conf->arp_q),
+                        arp_get_tx(conf->arp_q), SRC_PORT, DST_PORT, src_ip,
+                        dst_ip, &src_mac, NULL, socket_id);
+#else
+    err = udp_create(&conf->udp_q, arp_get_rx(conf->arp_q),
+                     arp_get_tx(conf->arp_q), SRC_PORT, DST_PORT, src_ip,
+                     dst_ip, &src_mac, NULL, socket_id);
+#endif
+    if (err_is_fail(err)) {
+	printf("Failed init UDP q err=%d", err);
+        return err;
+    }
+   
+    conf->cleanq_udp = (struct cleanq *) conf->udp_q;
+
+    // buffers are checked once at the UDP queue, IP and NIC trust it
+    err = cleanq_set_validation(conf->cleanq_udp, CLEANQ_VALIDATE_OUTERMOST);
+    if (err_is_fail(err)) {
+	printf("Failed setting validation policy err=%d ", err);
+        return err;
+    }
+
+    err = cleanq_register_mempool(conf->cleanq_udp, mbuf_pool);
+    if (err_is_fail(err)) {
+	printf("Failed registering mempool err=%d ", err);
+        return err;
+    }
+
+    // fill up RX queue with buffers
+    for (int i  = 0 ; i < RX_RING_SIZE -1 ; i++) {
+	struct rte_mbuf *mb = rte_mbuf_raw_alloc(mbuf_pool);
+	if (mb == NULL) {
+		printf("mbuf alloc failed port_id=%u "
+			"queue_id=%u", (unsigned) port,
+			(unsigned) conf->queue);
+
+		rte_eth_devices[port].data->rx_mbuf_alloc_failed++;
+		break;
+	}
+
+	mbuf_to_cleanq_buf(conf->nic_rx, mb, &cqbuf);
+
+	cqbuf.flags |= NETIF_RXFLAG;
+	err = cleanq_enqueue(
+		conf->cleanq_udp,
+		cqbuf.rid,
+		cqbuf.offset,
+		cqbuf.length,
+		cqbuf.valid_data,
+		cqbuf.valid_length,
+		cqbuf.flags
+	);
+	if (err_is_fail(err)) {
+	   printf("Adding buffer %d failed err=%d", i, err);
+	   rte_mbuf_raw_free(mb);
+	   break;
+	}
+    }
+
+    return 0;
+}
+#endif
+
+/*
+ * Initializes a given port with one RX and TX queue per lcore, spread with
+ * RSS. The buffers of a queue come from the mempool of the NUMA socket of
+ * its lcore.
  */
 static inline int
-port_init(uint16_t port, struct rte_mempool *mbuf_pool)
+port_init(uint16_t port)
 {
     struct rte_eth_conf port_conf = port_conf_default;
-    const uint16_t rx_rings = 1, tx_rings = 1;
     uint16_t nb_rxd = RX_RING_SIZE;
     uint16_t nb_txd = TX_RING_SIZE;
     int retval;
-    uint16_t q;
+    unsigned lcore_id;
     struct rte_eth_dev_info dev_info;
     struct rte_eth_txconf txconf;
+    int cleanq_queues;
 
     if (!rte_eth_dev_is_valid_port(port))
         return -1;
 
     rte_eth_dev_info_get(port, &dev_info);
-    if (dev_info.tx_offload_capa & DEV_TX_OFFLOAD_MBUF_FAST_FREE)
+    cleanq_queues = port_has_cleanq_queues(&dev_info);
+    // not with the ethdev backend, it sends header mbufs with the buffer
+    // attached, which the fast free cannot release
+    if (cleanq_queues &&
+            (dev_info.tx_offload_capa & DEV_TX_OFFLOAD_MBUF_FAST_FREE))
         port_conf.txmode.offloads |=
             DEV_TX_OFFLOAD_MBUF_FAST_FREE;
 
+    if (nb_queues > 1) {
+        port_conf.rxmode.mq_mode = ETH_MQ_RX_RSS;
+        port_conf.rx_adv_conf.rss_conf.rss_hf =
+            (ETH_RSS_IP | ETH_RSS_UDP) & dev_info.flow_type_rss_offloads;
+        // the driver spreads the packets itself, if at all
+        if (port_conf.rx_adv_conf.rss_conf.rss_hf == 0)
+            port_conf.rxmode.mq_mode = ETH_MQ_RX_NONE;
+    }
+
     /* Configure the Ethernet device. */
-    retval = rte_eth_dev_configure(port, rx_rings, tx_rings, &port_conf);
+    retval = rte_eth_dev_configure(port, nb_queues, nb_queues, &port_conf);
     if (retval != 0)
         return retval;
 
@@ -103,24 +339,28 @@ port_init(uint16_t port, struct rte_mempool *mbuf_pool)
     if (retval != 0)
         return retval;
 
-    /* Allocate and set up 1 RX queue per Ethernet port. */
-    for (q = 0; q < rx_rings; q++) {
-        retval = rte_eth_rx_queue_setup(port, q, nb_rxd,
-                rte_eth_dev_socket_id(port), NULL, mbuf_pool);
+    txconf = dev_info.default_txconf;
+    txconf.offloads = port_conf.txmode.offloads;
+
+    /* Allocate and set up the RX and TX queue of every lcore. */
+    RTE_LCORE_FOREACH(lcore_id) {
+        uint16_t q = lcore_conf[lcore_id].queue;
+        unsigned socket = rte_lcore_to_socket_id(lcore_id);
+
+        if (q == NO_QUEUE)
+            continue;
+
+        retval = rte_eth_rx_queue_setup(port, q, nb_rxd, socket, NULL,
+                mbuf_pools[socket]);
         if (retval < 0)
             return retval;
-    }
 
-    txconf = dev_info.default_txconf;
-    txconf.offloads = port_conf.txmode.offloads;
-    /* Allocate and set up 1 TX queue per Ethernet port. */
-    for (q = 0; q < tx_rings; q++) {
-        retval = rte_eth_tx_queue_setup(port, q, nb_txd,
-                rte_eth_dev_socket_id(port), &txconf);
+        retval = rte_eth_tx_queue_setup(port, q, nb_txd, socket, &txconf);
         if (retval < 0)
             return retval;
 #ifdef RTE_LIBCLEANQ
-        cleanq_pmd_ixgbe_tx_register(port, q, mbuf_pool);
+        if (cleanq_queues)
+            cleanq_pmd_ixgbe_tx_register(port, q, mbuf_pools[socket]);
 #endif
     }
 
@@ -133,82 +373,63 @@ port_init(uint16_t port, struct rte_mempool *mbuf_pool)
     rte_eth_macaddr_get(port, &src_mac);
     char addr_string[ETHER_ADDR_FMT_SIZE];
     ether_format_addr(addr_string, ETHER_ADDR_FMT_SIZE, &src_mac);
-    printf("Port %u MAC: %s\n", port, addr_string);
+    printf("Port %u MAC: %s, %u queues\n", port, addr_string, nb_queues);
 
     /* Enable RX in promiscuous mode for the Ethernet device. */
     rte_eth_promiscuous_enable(port);
 
 #ifdef CLEANQ_STACK
     errval_t err;
-    struct rte_eth_dev *dev;
-    struct cleanq_buf cqbuf;
 
     src_ip = inet_addr(src_ip_str);
     dst_ip = inet_addr(dst_ip_str);
-    dev = &rte_eth_devices[0];
 
-    nic_rx = (struct cleanq *)dev->data->rx_queues[0];
-    nic_tx = (struct cleanq *)dev->data->tx_queues[0];
-    err = udp_create(&udp_q, nic_rx, nic_tx, SRC_PORT, DST_PORT,
-                    src_ip, dst_ip, &src_mac, &dst_mac); 
+    err = arp_table_create(&arp_table, src_ip, inet_addr(netmask_str),
+                           inet_addr(gateway_str), &src_mac,
+                           rte_eth_dev_socket_id(port));
     if (err_is_fail(err)) {
-	printf("Failed init UDP q err=%d", err);
-        return err;
-    }
-   
-    cleanq_udp = (struct cleanq *) udp_q;
-
-    err = cleanq_register_mempool(cleanq_udp, mbuf_pool);
-    if (err_is_fail(err)) {
-	printf("Failed registering mempool err=%d ", err);
+	printf("Failed init ARP table err=%d", err);
         return err;
     }
 
-    // fill up RX queue with buffers
-    for (int i  = 0 ; i < RX_RING_SIZE -1 ; i++) {
-	struct rte_mbuf *mb = rte_mbuf_raw_alloc(mbuf_pool);
-	if (mb == NULL) {
-		printf("mbuf alloc failed port_id=%u "
-			"queue_id=%u", (unsigned) 0,
-			(unsigned) 0);
+    RTE_LCORE_FOREACH(lcore_id) {
+        if (lcore_conf[lcore_id].queue == NO_QUEUE)
+            continue;
 
-		rte_eth_devices[0].data->rx_mbuf_alloc_failed++;
-		break;
-	}
-
-	mbuf_to_cleanq_buf(nic_rx, mb, &cqbuf);
+        retval = stack_init(port, &lcore_conf[lcore_id],
+                            rte_lcore_to_socket_id(lcore_id), cleanq_queues);
+        if (retval != 0)
+            return retval;
 
-	cqbuf.flags |= NETIF_RXFLAG;
-	err = cleanq_enqueue(
-		cleanq_udp,
-		cqbuf.rid,
-		cqbuf.offset,
-		cqbuf.length,
-		cqbuf.valid_data,
-		cqbuf.valid_length,
-		cqbuf.flags
-	);
-	if (err_is_fail(err)) {
-	   printf("Adding buffer %d failed err=%d", i, err);
-	   rte_mbuf_raw_free(mb);
-	   break;
-	}
+#ifdef RTE_LIBRTE_METRICS
+        // the queues of a layer on the port are summed up
+        struct stack_layer layers[STACK_MAX_LAYERS];
+        unsigned n = stack_layers(&lcore_conf[lcore_id], layers);
+        for (unsigned i = 0; i < n; i++) {
+            err = cleanq_metrics_add_queue(layers[i].q, port, layers[i].name);
+            if (err_is_fail(err))
+                printf("No metrics for %s err=%d\n", layers[i].name, err);
+        }
+#endif
     }
-	
 #endif
 
     return 0;
 }
 
 /*
- * The lcore main. This is the main thread that does the work, reading from
+ * The lcore main. Every lcore with a queue does the work on it, reading from
  * an input port and writing to an output port.
  */
-static __attribute__((noreturn)) void
-lcore_main(void)
+static int
+lcore_main(__attribute__((unused)) void *arg)
 {
+    struct lcore_conf *conf = &lcore_conf[rte_lcore_id()];
     uint16_t port;
 
+    if (conf->queue == NO_QUEUE)
+        return 0;
+
     /*
      * Check that the port is on the same NUMA node as the polling thread
      * for best performance.
@@ -221,8 +442,8 @@ lcore_main(void)
                     "polling thread.\n\tPerformance will "
                     "not be optimal.\n", port);
 
-    printf("\nCore %u forwarding packets. [Ctrl+C to quit]\n",
-            rte_lcore_id());
+    printf("\nCore %u forwarding packets on queue %u. [Ctrl+C to quit]\n",
+            rte_lcore_id(), conf->queue);
 
     /* Run until the application is quit or killed. */
     for (;;) {
@@ -243,27 +464,37 @@ lcore_main(void)
 	    errval_t err;
 	    for (uint16_t i = 0; i < BURST_SIZE; i++) {
 	        /* Try to dequeue */
-                err = cleanq_dequeue(cleanq_udp, &cqbuf.rid, &cqbuf.offset,
+                err = udp_stack_dequeue_rx(conf->cleanq_udp, &cqbuf.rid, &cqbuf.offset,
                                      &cqbuf.length, &cqbuf.valid_data,
                                      &cqbuf.valid_length, &cqbuf.flags);
 
                 if (err_is_fail(err)) {
-		    if ((err != CLEANQ_ERR_IP_WRONG_IP) && 
-		         err != CLEANQ_ERR_QUEUE_EMPTY) {
-		    }
                     break;
                 }
 
-		if (cqbuf.flags & NETIF_RXFLAG) {
-			flags[nb_rx] = cqbuf.flags;
-			cleanq_buf_to_mbuf(nic_rx, cqbuf, &rx_bufs[nb_rx]);
+		flags[nb_rx] = cqbuf.flags;
+		cleanq_buf_to_mbuf(conf->nic_rx, cqbuf, &rx_bufs[nb_rx]);
+		nb_rx++;
+	    }
+
+	    /* Reap send completions and give the buffers back to RX */
+	    if (++conf->rx_polls >= TX_REAP_INTERVAL ||
+		conf->tx_pending >= TX_REAP_THRESHOLD) {
+		conf->rx_polls = 0;
+		conf->tx_pending = 0;
+		for (;;) {
+                    err = udp_stack_dequeue_tx(conf->cleanq_udp, &cqbuf.rid,
+                                         &cqbuf.offset, &cqbuf.length,
+                                         &cqbuf.valid_data,
+                                         &cqbuf.valid_length, &cqbuf.flags);
+                    if (err_is_fail(err)) {
+                        break;
+                    }
 
-			nb_rx++;
-		} else {
                     cqbuf.flags = 0;
                     cqbuf.flags |= NETIF_RXFLAG;
-			err = cleanq_enqueue(
-				cleanq_udp,
+			err = udp_stack_enqueue(
+				conf->cleanq_udp,
 				cqbuf.rid,
 				cqbuf.offset,
 				2176,
@@ -275,31 +506,38 @@ lcore_main(void)
 	    }
 
 #else
-            const uint16_t nb_rx = rte_eth_rx_burst(port, 0, rx_bufs, BURST_SIZE);
+            const uint16_t nb_rx = rte_eth_rx_burst(port, conf->queue, rx_bufs,
+                                                    BURST_SIZE);
 #endif
 
             if (unlikely(nb_rx == 0))
                 continue;
 
-	    num_pkt += nb_rx;
+	    conf->num_pkt += nb_rx;
 
-	    if ((num_pkt % 1000000) == 0) {
-	    	printf("Received %lu packets!\n", num_pkt);
+	    if ((conf->num_pkt % 1000000) == 0) {
+	    	printf("Core %u received %lu packets!\n", rte_lcore_id(),
+		       conf->num_pkt);
+#ifdef CLEANQ_STACK
+		print_stack_stats(conf);
+#endif
 	    }
 #ifdef CLEANQ_STACK
             if (nb_rx > 0) {
 		uint16_t i = 0;
 		for (; i < nb_rx; i++) {
 
-		    mbuf_to_cleanq_buf(cleanq_udp, rx_bufs[i], &cqbuf);
+		    mbuf_to_cleanq_buf(conf->cleanq_udp, rx_bufs[i], &cqbuf);
 		    cqbuf.flags = 0;
                     cqbuf.flags = flags[i] & 0xFFFF; // take port bits
                     cqbuf.flags |= NETIF_TXFLAG;
 
-		    err = cleanq_enqueue(cleanq_udp, cqbuf.rid, cqbuf.offset,
+		    err = udp_stack_enqueue(conf->cleanq_udp, cqbuf.rid, cqbuf.offset,
 				    	 cqbuf.length, cqbuf.valid_data,
 					 cqbuf.valid_length, cqbuf.flags);
-                    if (err_is_fail(err)) {
+                    if (err_is_ok(err)) {
+                        conf->tx_pending++;
+                    } else {
 			for (uint16_t j = i; j < nb_rx; j++) {
 		            rte_pktmbuf_free(rx_bufs[j]);
 			}
@@ -311,11 +549,6 @@ lcore_main(void)
             }
 	    nb_rx = 0;
 #else
-            const uint16_t nb_rx = rte_eth_rx_burst(port, 0, rx_bufs, BURST_SIZE);
-
-            if (unlikely(nb_rx == 0))
-                continue;
-
             struct rte_mbuf *tx_bufs[BURST_SIZE];
             uint16_t nb_to_send = 0;
 
@@ -421,7 +654,8 @@ lcore_main(void)
 
             if (nb_to_send > 0) {
                 // Send burst of TX packets, to same port 
-                const uint16_t nb_tx = rte_eth_tx_burst(port, 0, tx_bufs, nb_to_send);
+                const uint16_t nb_tx = rte_eth_tx_burst(port, conf->queue,
+                                                        tx_bufs, nb_to_send);
 
                 LOG(NOTICE, "%"PRIu16" packets sent over port %"PRIu16"\n", nb_tx, port);
 
@@ -439,6 +673,16 @@ lcore_main(void)
     }
 }
 
+#ifdef CLEANQ_STACK
+static void
+usage(const char *prgname)
+{
+    printf("%s [EAL options] -- [src_ip dst_ip [netmask [gateway]]]\n"
+           "  defaults: %s %s %s %s\n",
+           prgname, src_ip_str, dst_ip_str, netmask_str, gateway_str);
+}
+#endif
+
 /*
  * The main function, which does initialization and calls the per-lcore
  * functions.
@@ -446,9 +690,11 @@ lcore_main(void)
 int
 main(int argc, char *argv[])
 {
-    struct rte_mempool *mbuf_pool;
     unsigned nb_ports;
+    unsigned socket_queues[RTE_MAX_NUMA_NODES] = { 0 };
+    unsigned lcore_id;
     uint16_t portid;
+    uint16_t q;
 
     /* Initialize the Environment Abstraction Layer (EAL). */
     int ret = rte_eal_init(argc, argv);
@@ -458,17 +704,62 @@ main(int argc, char *argv[])
     argc -= ret;
     argv += ret;
 
+#ifdef CLEANQ_STACK
+    if (argc == 2 || argc > 5) {
+        usage(argv[0]);
+        rte_exit(EXIT_FAILURE, "Invalid arguments\n");
+    }
+    if (argc > 2) {
+        src_ip_str = argv[1];
+        dst_ip_str = argv[2];
+    }
+    if (argc > 3)
+        netmask_str = argv[3];
+    if (argc > 4)
+        gateway_str = argv[4];
+#endif
+
     /* Check that there is an even number of ports to send/receive on. */
     nb_ports = rte_eth_dev_count_avail();
     if (nb_ports < 1)
         rte_exit(EXIT_FAILURE, "Error: no ports available\n");
 
-    /* Creates a new mempool in memory to hold the mbufs. */
-    mbuf_pool = rte_pktmbuf_pool_create("MBUF_POOL", NUM_MBUFS * nb_ports,
-        MBUF_CACHE_SIZE, 0, RTE_MBUF_DEFAULT_BUF_SIZE, rte_socket_id());
+    /* One queue per lcore, as many as all ports have. */
+    nb_queues = rte_lcore_count();
+    RTE_ETH_FOREACH_DEV(portid) {
+        struct rte_eth_dev_info dev_info;
 
-    if (mbuf_pool == NULL)
-        rte_exit(EXIT_FAILURE, "Cannot create mbuf pool\n");
+        rte_eth_dev_info_get(portid, &dev_info);
+        nb_queues = RTE_MIN(nb_queues, dev_info.max_rx_queues);
+        nb_queues = RTE_MIN(nb_queues, dev_info.max_tx_queues);
+    }
+
+    q = 0;
+    RTE_LCORE_FOREACH(lcore_id) {
+        if (q < nb_queues) {
+            lcore_conf[lcore_id].queue = q++;
+            socket_queues[rte_lcore_to_socket_id(lcore_id)]++;
+        } else {
+            lcore_conf[lcore_id].queue = NO_QUEUE;
+        }
+    }
+
+    /* Creates a mempool for every socket with queues to hold the mbufs. */
+    for (unsigned socket = 0; socket < RTE_MAX_NUMA_NODES; socket++) {
+        char name[RTE_MEMPOOL_NAMESIZE];
+
+        if (socket_queues[socket] == 0)
+            continue;
+
+        snprintf(name, sizeof(name), "MBUF_POOL_%u", socket);
+        mbuf_pools[socket] = rte_pktmbuf_pool_create(name,
+            NUM_MBUFS * nb_ports * socket_queues[socket], MBUF_CACHE_SIZE, 0,
+            RTE_MBUF_DEFAULT_BUF_SIZE, socket);
+
+        if (mbuf_pools[socket] == NULL)
+            rte_exit(EXIT_FAILURE, "Cannot create mbuf pool on socket %u\n",
+                    socket);
+    }
 
     /* Configure log levels */
     rte_log_set_level(RTE_LOGTYPE_PMD, DRIVER_LOG_LEVEL);
@@ -480,17 +771,31 @@ main(int argc, char *argv[])
     logtype = rte_log_register("cleanq.testapp");
     rte_log_set_level(logtype, MAIN_LOG_LEVEL);
 
+#if defined(CLEANQ_STACK) && defined(RTE_LIBRTE_METRICS)
+    /* The layers of the stacks are exported for librte_telemetry */
+    rte_metrics_init(rte_socket_id());
+#endif
+
     /* Initialize all ports. */
     RTE_ETH_FOREACH_DEV(portid)
-        if (port_init(portid, mbuf_pool) != 0)
+        if (port_init(portid) != 0)
             rte_exit(EXIT_FAILURE, "Cannot init port %"PRIu16 "\n",
                     portid);
 
-    if (rte_lcore_count() > 1)
-        printf("\nWARNING: Too many lcores enabled. Only 1 used.\n");
+#if defined(CLEANQ_STACK) && defined(RTE_LIBRTE_METRICS)
+    if (err_is_fail(cleanq_metrics_start(METRICS_PERIOD_US)))
+        printf("\nWARNING: CleanQ metrics are not updated\n");
+#endif
+
+    if (rte_lcore_count() > nb_queues)
+        printf("\nWARNING: Too many lcores enabled. Only %u used.\n",
+                nb_queues);
 
-    /* Call lcore_main on the master core only. */
-    lcore_main();
+    /* Call lcore_main on every lcore, the master included. */
+    RTE_LCORE_FOREACH_SLAVE(lcore_id)
+        rte_eal_remote_launch(lcore_main, NULL, lcore_id);
+    lcore_main(NULL);
 
+    rte_eal_mp_wait_lcore();
     return 0;
 }
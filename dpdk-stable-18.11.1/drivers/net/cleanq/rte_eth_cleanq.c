@@ -0,0 +1,1388 @@
+/* SPDX-License-Identifier: BSD-3-Clause
+ * Copyright(c) 2017 ETH Zurich
+ */
+
+#include <sys/queue.h>
+
+#include "rte_eth_cleanq.h"
+#include <rte_mbuf.h>
+#include <rte_ethdev_driver.h>
+#include <rte_malloc.h>
+#include <rte_bus_vdev.h>
+#include <rte_kvargs.h>
+#include <rte_errno.h>
+#include <rte_ring.h>
+
+#include <cleanq.h>
+#include <cleanq_dpdk.h>
+#include <cleanq_udp.h>
+#include <backends/loopback_devif.h>
+#include <backends/debug.h>
+#include <backends/af_packet.h>
+#ifdef RTE_LIBRTE_VHOST
+#include <backends/vhost_user.h>
+#endif
+
+/*
+ * The ethdev does to its CleanQ queues what the application would do to a
+ * NIC queue: RX queues are given empty mbufs with NETIF_RXFLAG and hand
+ * them back filled, TX queues are given mbufs with NETIF_TXFLAG and hand
+ * them back once sent. Buffers are described relative to the mempool they
+ * come from, which is registered with the queue as a region the first time
+ * an mbuf of it is seen.
+ *
+ * When RX and TX queue of an index are the same CleanQ queue, a dequeue on
+ * either side can return both kinds of buffers. The RX side frees send
+ * completions, the TX side keeps the packets it received for the next RX
+ * burst.
+ *
+ * With zero_copy=1 the af_packet RX queue posts no mbufs, the packets are
+ * attached to mbufs in place in the kernel ring. Freeing such an mbuf,
+ * from any lcore, gives the frame back on the next RX burst. They cannot
+ * be sent through a cleanq port and have to be freed before the port is
+ * closed.
+ */
+
+#define ETH_CLEANQ_BACKEND_ARG		"backend"
+#define ETH_CLEANQ_QUEUES_ARG		"queues"
+#define ETH_CLEANQ_DEBUG_ARG		"debug"
+#define ETH_CLEANQ_IFACE_ARG		"iface"
+#define ETH_CLEANQ_PATH_ARG		"path"
+#define ETH_CLEANQ_INTERNAL_ARG		"internal"
+#define ETH_CLEANQ_ZERO_COPY_ARG	"zero_copy"
+#define ETH_CLEANQ_BACKEND_LOOPBACK	"loopback"
+#define ETH_CLEANQ_BACKEND_AF_PACKET	"af_packet"
+#define ETH_CLEANQ_BACKEND_VHOST_USER	"vhost_user"
+
+/* mempools a queue can have buffers of */
+#define ETH_CLEANQ_MAX_POOLS	8
+/* mbufs posted to an RX queue at once */
+#define ETH_CLEANQ_RX_REFILL	32
+/* received packets the TX side of a shared queue can hold */
+#define ETH_CLEANQ_BACKLOG	256
+/* packets an RX queue can have out in place with zero_copy=1 */
+#define ETH_CLEANQ_ZC_BUFS	1024
+
+static const char *valid_arguments[] = {
+	ETH_CLEANQ_BACKEND_ARG,
+	ETH_CLEANQ_QUEUES_ARG,
+	ETH_CLEANQ_DEBUG_ARG,
+	ETH_CLEANQ_IFACE_ARG,
+	ETH_CLEANQ_PATH_ARG,
+	ETH_CLEANQ_INTERNAL_ARG,
+	ETH_CLEANQ_ZERO_COPY_ARG,
+	NULL
+};
+
+struct cleanq_internal_args {
+	struct cleanq * const *rx_queues;
+	const unsigned int nb_rx_queues;
+	struct cleanq * const *tx_queues;
+	const unsigned int nb_tx_queues;
+	const unsigned int numa_node;
+	const struct rte_eth_cleanq_conf *conf;
+	void *addr; /* self addr for sanity check */
+};
+
+/* a mempool registered with a CleanQ queue */
+struct pool_region {
+	struct rte_mempool *mp;
+	uint64_t base;
+	regionid_t rid;
+	int owned; /* registered by us, deregistered on close */
+};
+
+/* a CleanQ queue, shared by RX and TX queue of an index if both use it */
+struct cleanq_stack {
+	struct cleanq *q;
+	struct pool_region pools[ETH_CLEANQ_MAX_POOLS];
+	unsigned int nb_pools;
+	/* received packets dequeued by the TX side */
+	struct rte_mbuf *backlog[ETH_CLEANQ_BACKLOG];
+	unsigned int bl_head;
+	unsigned int bl_tail;
+};
+
+/* a packet handed out in place, see ETH_CLEANQ_ZERO_COPY_ARG */
+struct zc_buf {
+	struct rte_mbuf_ext_shared_info shinfo;
+	struct cleanq_rx_queue *r;
+	struct cleanq_buf b;
+};
+
+struct cleanq_rx_queue {
+	struct cleanq_stack *stack;
+	struct rte_mempool *mp;
+	uint16_t port_id;
+	uint16_t nb_desc;
+	uint16_t posted;
+	int shared;
+	int loopback;
+	/* zero-copy, packets of region zc_rid at zc_va are attached in place */
+	int zc;
+	regionid_t zc_rid;
+	void *zc_va;
+	struct zc_buf *zc_bufs;
+	struct zc_buf **zc_free;
+	unsigned int zc_nb_free;
+	/* freed by any lcore, given back by the RX burst */
+	struct rte_ring *zc_done;
+	uint64_t rx_pkts;
+	uint64_t rx_bytes;
+	uint64_t err_pkts;
+	uint64_t rx_nombuf;
+};
+
+struct cleanq_tx_queue {
+	struct cleanq_stack *stack;
+	uint64_t flags;
+	int shared;
+	int loopback;
+	uint64_t tx_pkts;
+	uint64_t tx_bytes;
+	uint64_t err_pkts;
+};
+
+/* queues created from the device arguments, destroyed on close */
+struct cleanq_owned {
+	/* in the order to destroy them, modules before what they sit on */
+	struct cleanq *queues[3 * RTE_PMD_CLEANQ_MAX_QUEUES];
+	unsigned int nb_queues;
+	struct af_packet_q *af_packet;
+	/* the RX queue handing out packets in place, if any */
+	struct cleanq *zc_queue;
+	regionid_t zc_rid;
+	void *zc_va;
+#ifdef RTE_LIBRTE_VHOST
+	struct vhost_user_q *vhost_user;
+#endif
+};
+
+struct pmd_internals {
+	unsigned int max_rx_queues;
+	unsigned int max_tx_queues;
+	struct cleanq_owned owned;
+
+	struct cleanq_rx_queue rx_cleanq_queues[RTE_PMD_CLEANQ_MAX_QUEUES];
+	struct cleanq_tx_queue tx_cleanq_queues[RTE_PMD_CLEANQ_MAX_QUEUES];
+	struct cleanq_stack stacks[2 * RTE_PMD_CLEANQ_MAX_QUEUES];
+	unsigned int nb_stacks;
+
+	struct ether_addr address;
+};
+
+static struct rte_eth_link pmd_link = {
+		.link_speed = ETH_SPEED_NUM_10G,
+		.link_duplex = ETH_LINK_FULL_DUPLEX,
+		.link_status = ETH_LINK_DOWN,
+		.link_autoneg = ETH_LINK_FIXED,
+};
+
+static int eth_cleanq_logtype;
+
+#define PMD_LOG(level, fmt, args...) \
+	rte_log(RTE_LOG_ ## level, eth_cleanq_logtype, \
+		"%s(): " fmt "\n", __func__, ##args)
+
+/*
+ * Mempool regions
+ */
+
+/* a mempool is registered as one region from its first to its last byte */
+static int
+mempool_contiguous(const struct rte_mempool *mp)
+{
+	const struct rte_mempool_memhdr *hdr, *prev = NULL;
+
+	STAILQ_FOREACH(hdr, &mp->mem_list, next) {
+		if (prev != NULL &&
+				RTE_PTR_ADD(prev->addr, prev->len) != hdr->addr)
+			return 0;
+		prev = hdr;
+	}
+	return prev != NULL;
+}
+
+static struct pool_region *
+stack_pool_add(struct cleanq_stack *s, struct rte_mempool *mp)
+{
+	struct pool_region *p;
+	errval_t err;
+	int owned = 0;
+
+	if (s->nb_pools == ETH_CLEANQ_MAX_POOLS)
+		return NULL;
+
+	if (!mempool_contiguous(mp)) {
+		PMD_LOG(ERR, "mempool %s is not virtually contiguous",
+			mp->name);
+		return NULL;
+	}
+
+	p = &s->pools[s->nb_pools];
+
+	/* the application may have registered it already */
+	err = cleanq_mempool_region(s->q, mp, &p->rid, &p->base);
+	if (err_is_fail(err)) {
+		err = cleanq_register_mempool(s->q, mp);
+		if (err_is_fail(err)) {
+			PMD_LOG(ERR, "cannot register mempool %s: %d",
+				mp->name, err);
+			return NULL;
+		}
+		err = cleanq_mempool_region(s->q, mp, &p->rid, &p->base);
+		if (err_is_fail(err))
+			return NULL;
+		owned = 1;
+	}
+
+	p->mp = mp;
+	p->owned = owned;
+	s->nb_pools++;
+	return p;
+}
+
+static inline struct pool_region *
+stack_pool(struct cleanq_stack *s, struct rte_mempool *mp)
+{
+	unsigned int i;
+
+	for (i = 0; i < s->nb_pools; i++) {
+		if (s->pools[i].mp == mp)
+			return &s->pools[i];
+	}
+	return stack_pool_add(s, mp);
+}
+
+static inline struct pool_region *
+stack_region(struct cleanq_stack *s, regionid_t rid)
+{
+	unsigned int i;
+
+	for (i = 0; i < s->nb_pools; i++) {
+		if (s->pools[i].rid == rid)
+			return &s->pools[i];
+	}
+	return NULL;
+}
+
+static void
+stack_release(struct cleanq_stack *s)
+{
+	struct cleanq_buf b;
+	struct pool_region *p;
+
+	while (s->bl_tail != s->bl_head) {
+		rte_pktmbuf_free(s->backlog[s->bl_tail % ETH_CLEANQ_BACKLOG]);
+		s->bl_tail++;
+	}
+
+	/* take back what the queue is done with, e.g. unsent completions */
+	while (cleanq_dequeue(s->q, &b.rid, &b.offset, &b.length,
+			&b.valid_data, &b.valid_length, &b.flags) ==
+			CLEANQ_ERR_OK) {
+		p = stack_region(s, b.rid);
+		if (p != NULL)
+			rte_pktmbuf_free((struct rte_mbuf *)
+					(uintptr_t)(p->base + b.offset));
+	}
+}
+
+/* after all stacks are released, another may have the same mempool */
+static void
+stack_deregister(struct cleanq_stack *s)
+{
+	unsigned int i;
+
+	/* buffers still posted to the queue cannot be taken back */
+	for (i = 0; i < s->nb_pools; i++) {
+		if (s->pools[i].owned)
+			cleanq_deregister_mempool(s->q, s->pools[i].mp);
+	}
+	s->nb_pools = 0;
+}
+
+static inline struct rte_mbuf *
+buf_to_mbuf(struct pool_region *p, genoffset_t offset,
+		genoffset_t valid_data, genoffset_t valid_length)
+{
+	struct rte_mbuf *m = (struct rte_mbuf *)(uintptr_t)(p->base + offset);
+
+	m->data_off = valid_data;
+	m->data_len = valid_length;
+	m->pkt_len = valid_length;
+	return m;
+}
+
+/*
+ * Datapath
+ */
+
+static void
+eth_cleanq_rx_refill(struct cleanq_rx_queue *r)
+{
+	struct cleanq_stack *s = r->stack;
+	struct rte_mbuf *bufs[ETH_CLEANQ_RX_REFILL];
+	struct pool_region *p;
+	unsigned int n, i;
+	errval_t err = CLEANQ_ERR_OK;
+
+	p = stack_pool(s, r->mp);
+	if (unlikely(p == NULL))
+		return;
+
+	while (r->posted < r->nb_desc) {
+		n = RTE_MIN(r->nb_desc - r->posted, ETH_CLEANQ_RX_REFILL);
+		if (rte_pktmbuf_alloc_bulk(r->mp, bufs, n) != 0) {
+			r->rx_nombuf += n;
+			return;
+		}
+
+		for (i = 0; i < n; i++) {
+			struct rte_mbuf *m = bufs[i];
+
+			err = cleanq_enqueue(s->q, p->rid,
+					(uintptr_t)m - p->base, m->buf_len,
+					m->data_off, 0, NETIF_RXFLAG);
+			if (err_is_fail(err))
+				break;
+			r->posted++;
+		}
+
+		if (i < n) {
+			/* the queue holds fewer buffers than descriptors */
+			if (err == CLEANQ_ERR_QUEUE_FULL)
+				r->nb_desc = r->posted;
+			while (i < n)
+				rte_pktmbuf_free(bufs[i++]);
+			return;
+		}
+	}
+}
+
+static void
+eth_cleanq_zc_free(void *addr __rte_unused, void *opaque)
+{
+	struct zc_buf *z = opaque;
+
+	/* sized for all of them, cannot fail */
+	rte_ring_mp_enqueue(z->r->zc_done, z);
+}
+
+/* gives the packets freed since the last burst back to the queue */
+static void
+eth_cleanq_rx_zc_done(struct cleanq_rx_queue *r)
+{
+	struct zc_buf *done[ETH_CLEANQ_RX_REFILL];
+	struct cleanq_buf *b;
+	unsigned int n, i;
+
+	while ((n = rte_ring_sc_dequeue_burst(r->zc_done, (void **)done,
+			ETH_CLEANQ_RX_REFILL, NULL)) > 0) {
+		for (i = 0; i < n; i++) {
+			b = &done[i]->b;
+			if (unlikely(err_is_fail(cleanq_enqueue(r->stack->q,
+					b->rid, b->offset, b->length,
+					b->valid_data, b->valid_length,
+					NETIF_RXFLAG))))
+				r->err_pkts++;
+			r->zc_free[r->zc_nb_free++] = done[i];
+		}
+	}
+}
+
+/* attaches a packet in place to an mbuf, gives it back if it cannot */
+static struct rte_mbuf *
+eth_cleanq_rx_zc(struct cleanq_rx_queue *r, const struct cleanq_buf *b)
+{
+	struct rte_mbuf *m = NULL;
+	struct zc_buf *z;
+
+	if (likely(r->zc_nb_free > 0 && b->valid_length <= UINT16_MAX))
+		m = rte_pktmbuf_alloc(r->mp);
+	if (unlikely(m == NULL)) {
+		cleanq_enqueue(r->stack->q, b->rid, b->offset, b->length,
+				b->valid_data, b->valid_length, NETIF_RXFLAG);
+		r->rx_nombuf++;
+		return NULL;
+	}
+
+	z = r->zc_free[--r->zc_nb_free];
+	z->b = *b;
+	rte_mbuf_ext_refcnt_set(&z->shinfo, 1);
+	rte_pktmbuf_attach_extbuf(m,
+			RTE_PTR_ADD(r->zc_va, b->offset + b->valid_data),
+			RTE_BAD_IOVA, b->valid_length, &z->shinfo);
+	m->data_len = b->valid_length;
+	m->pkt_len = b->valid_length;
+	return m;
+}
+
+static uint16_t
+eth_cleanq_rx(void *q, struct rte_mbuf **bufs, uint16_t nb_bufs)
+{
+	struct cleanq_rx_queue *r = q;
+	struct cleanq_stack *s = r->stack;
+	struct cleanq_buf b;
+	struct pool_region *p;
+	struct rte_mbuf *m;
+	uint64_t bytes = 0;
+	uint16_t nb_rx = 0;
+	unsigned int tries;
+	errval_t err;
+
+	while (nb_rx < nb_bufs && s->bl_tail != s->bl_head) {
+		m = s->backlog[s->bl_tail++ % ETH_CLEANQ_BACKLOG];
+		bytes += m->pkt_len;
+		bufs[nb_rx++] = m;
+	}
+
+	if (r->zc)
+		eth_cleanq_rx_zc_done(r);
+
+	/* bounded, the queue may drop what it dequeued and keep going */
+	for (tries = 0; nb_rx < nb_bufs && tries < 2 * nb_bufs; tries++) {
+		err = cleanq_dequeue(s->q, &b.rid, &b.offset, &b.length,
+				&b.valid_data, &b.valid_length, &b.flags);
+		if (err == CLEANQ_ERR_QUEUE_EMPTY)
+			break;
+		if (unlikely(err_is_fail(err))) {
+			r->err_pkts++;
+			continue;
+		}
+
+		if (r->zc && b.rid == r->zc_rid) {
+			m = eth_cleanq_rx_zc(r, &b);
+			if (m == NULL)
+				continue;
+			m->port = r->port_id;
+			bytes += m->pkt_len;
+			bufs[nb_rx++] = m;
+			continue;
+		}
+
+		p = stack_region(s, b.rid);
+		if (unlikely(p == NULL)) {
+			r->err_pkts++;
+			continue;
+		}
+
+		m = buf_to_mbuf(p, b.offset, b.valid_data, b.valid_length);
+		if (r->shared && !r->loopback && !(b.flags & NETIF_RXFLAG)) {
+			rte_pktmbuf_free(m);
+			continue;
+		}
+
+		if (!r->loopback)
+			r->posted--;
+		m->port = r->port_id;
+		bytes += m->pkt_len;
+		bufs[nb_rx++] = m;
+	}
+
+	/* with zero-copy the packets stay in the ring */
+	if (!r->loopback && !r->zc)
+		eth_cleanq_rx_refill(r);
+
+	r->rx_pkts += nb_rx;
+	r->rx_bytes += bytes;
+	return nb_rx;
+}
+
+static void
+eth_cleanq_tx_reap(struct cleanq_tx_queue *t, unsigned int max)
+{
+	struct cleanq_stack *s = t->stack;
+	struct cleanq_buf b;
+	struct pool_region *p;
+	struct rte_mbuf *m;
+	unsigned int i;
+	errval_t err;
+
+	for (i = 0; i < max; i++) {
+		if (t->shared && s->bl_head - s->bl_tail == ETH_CLEANQ_BACKLOG)
+			return;
+
+		err = cleanq_dequeue(s->q, &b.rid, &b.offset, &b.length,
+				&b.valid_data, &b.valid_length, &b.flags);
+		if (err == CLEANQ_ERR_QUEUE_EMPTY)
+			return;
+		if (unlikely(err_is_fail(err)))
+			continue;
+
+		p = stack_region(s, b.rid);
+		if (unlikely(p == NULL))
+			continue;
+
+		m = buf_to_mbuf(p, b.offset, b.valid_data, b.valid_length);
+		if (t->shared && (b.flags & NETIF_RXFLAG)) {
+			/* the RX queue posted it, hand it over on its next burst */
+			s->backlog[s->bl_head++ % ETH_CLEANQ_BACKLOG] = m;
+			continue;
+		}
+		rte_pktmbuf_free(m);
+	}
+}
+
+static uint16_t
+eth_cleanq_tx(void *q, struct rte_mbuf **bufs, uint16_t nb_bufs)
+{
+	struct cleanq_tx_queue *t = q;
+	struct cleanq_stack *s = t->stack;
+	struct pool_region *p;
+	uint64_t bytes = 0;
+	uint16_t nb_tx;
+	errval_t err;
+
+	/* the loopback queues have no send completions, just packets */
+	if (!t->loopback)
+		eth_cleanq_tx_reap(t, nb_bufs);
+
+	for (nb_tx = 0; nb_tx < nb_bufs; nb_tx++) {
+		struct rte_mbuf *m = bufs[nb_tx];
+
+		p = stack_pool(s, m->pool);
+		if (unlikely(p == NULL || m->nb_segs != 1 ||
+				!RTE_MBUF_DIRECT(m))) {
+			/* drop what the queue cannot describe */
+			t->err_pkts++;
+			rte_pktmbuf_free(m);
+			continue;
+		}
+
+		err = cleanq_enqueue(s->q, p->rid, (uintptr_t)m - p->base,
+				m->buf_len, m->data_off, m->data_len,
+				NETIF_TXFLAG | NETIF_TXFLAG_LAST | t->flags);
+		if (err == CLEANQ_ERR_QUEUE_FULL)
+			break;
+		if (unlikely(err_is_fail(err))) {
+			t->err_pkts++;
+			rte_pktmbuf_free(m);
+			continue;
+		}
+		bytes += m->pkt_len;
+		t->tx_pkts++;
+	}
+
+	t->tx_bytes += bytes;
+	return nb_tx;
+}
+
+/*
+ * Control path
+ */
+
+static int
+eth_dev_configure(struct rte_eth_dev *dev __rte_unused) { return 0; }
+
+static int
+eth_dev_start(struct rte_eth_dev *dev)
+{
+	dev->data->dev_link.link_status = ETH_LINK_UP;
+	return 0;
+}
+
+static void
+eth_dev_stop(struct rte_eth_dev *dev)
+{
+	dev->data->dev_link.link_status = ETH_LINK_DOWN;
+}
+
+static int
+eth_dev_set_link_down(struct rte_eth_dev *dev)
+{
+	dev->data->dev_link.link_status = ETH_LINK_DOWN;
+	return 0;
+}
+
+static int
+eth_dev_set_link_up(struct rte_eth_dev *dev)
+{
+	dev->data->dev_link.link_status = ETH_LINK_UP;
+	return 0;
+}
+
+static int
+eth_rx_queue_setup(struct rte_eth_dev *dev, uint16_t rx_queue_id,
+				    uint16_t nb_rx_desc,
+				    unsigned int socket_id __rte_unused,
+				    const struct rte_eth_rxconf *rx_conf __rte_unused,
+				    struct rte_mempool *mb_pool)
+{
+	struct pmd_internals *internals = dev->data->dev_private;
+	struct cleanq_rx_queue *r = &internals->rx_cleanq_queues[rx_queue_id];
+
+	if (!mempool_contiguous(mb_pool)) {
+		PMD_LOG(ERR, "mempool %s is not virtually contiguous",
+			mb_pool->name);
+		return -EINVAL;
+	}
+
+	r->mp = mb_pool;
+	r->port_id = dev->data->port_id;
+	r->nb_desc = nb_rx_desc;
+
+	/* register it now rather than on the first burst */
+	if (stack_pool(r->stack, mb_pool) == NULL)
+		return -ENOMEM;
+
+	dev->data->rx_queues[rx_queue_id] = r;
+	return 0;
+}
+
+static int
+eth_tx_queue_setup(struct rte_eth_dev *dev, uint16_t tx_queue_id,
+				    uint16_t nb_tx_desc __rte_unused,
+				    unsigned int socket_id __rte_unused,
+				    const struct rte_eth_txconf *tx_conf __rte_unused)
+{
+	struct pmd_internals *internals = dev->data->dev_private;
+	dev->data->tx_queues[tx_queue_id] = &internals->tx_cleanq_queues[tx_queue_id];
+	return 0;
+}
+
+static void
+eth_dev_info(struct rte_eth_dev *dev,
+		struct rte_eth_dev_info *dev_info)
+{
+	struct pmd_internals *internals = dev->data->dev_private;
+	dev_info->max_mac_addrs = 1;
+	dev_info->max_rx_pktlen = (uint32_t)-1;
+	dev_info->max_rx_queues = (uint16_t)internals->max_rx_queues;
+	dev_info->max_tx_queues = (uint16_t)internals->max_tx_queues;
+	dev_info->min_rx_bufsize = 0;
+}
+
+static int
+eth_stats_get(struct rte_eth_dev *dev, struct rte_eth_stats *stats)
+{
+	unsigned int i;
+	const struct pmd_internals *internal = dev->data->dev_private;
+
+	for (i = 0; i < dev->data->nb_rx_queues; i++) {
+		const struct cleanq_rx_queue *r = &internal->rx_cleanq_queues[i];
+
+		if (i < RTE_ETHDEV_QUEUE_STAT_CNTRS) {
+			stats->q_ipackets[i] = r->rx_pkts;
+			stats->q_ibytes[i] = r->rx_bytes;
+		}
+		stats->ipackets += r->rx_pkts;
+		stats->ibytes += r->rx_bytes;
+		stats->ierrors += r->err_pkts;
+		stats->rx_nombuf += r->rx_nombuf;
+	}
+
+	for (i = 0; i < dev->data->nb_tx_queues; i++) {
+		const struct cleanq_tx_queue *t = &internal->tx_cleanq_queues[i];
+
+		if (i < RTE_ETHDEV_QUEUE_STAT_CNTRS) {
+			stats->q_opackets[i] = t->tx_pkts;
+			stats->q_obytes[i] = t->tx_bytes;
+			stats->q_errors[i] = t->err_pkts;
+		}
+		stats->opackets += t->tx_pkts;
+		stats->obytes += t->tx_bytes;
+		stats->oerrors += t->err_pkts;
+	}
+
+	return 0;
+}
+
+static void
+eth_stats_reset(struct rte_eth_dev *dev)
+{
+	unsigned int i;
+	struct pmd_internals *internal = dev->data->dev_private;
+
+	for (i = 0; i < dev->data->nb_rx_queues; i++) {
+		struct cleanq_rx_queue *r = &internal->rx_cleanq_queues[i];
+
+		r->rx_pkts = 0;
+		r->rx_bytes = 0;
+		r->err_pkts = 0;
+		r->rx_nombuf = 0;
+	}
+	for (i = 0; i < dev->data->nb_tx_queues; i++) {
+		struct cleanq_tx_queue *t = &internal->tx_cleanq_queues[i];
+
+		t->tx_pkts = 0;
+		t->tx_bytes = 0;
+		t->err_pkts = 0;
+	}
+}
+
+static int
+eth_cleanq_rx_zc_setup(struct cleanq_rx_queue *r, const struct cleanq_owned *o,
+		unsigned int numa_node)
+{
+	char ring_name[RTE_RING_NAMESIZE];
+	unsigned int i;
+
+	snprintf(ring_name, sizeof(ring_name), "cleanq_zc_%p", (void *)r);
+	r->zc_done = rte_ring_create(ring_name, ETH_CLEANQ_ZC_BUFS, numa_node,
+			RING_F_SC_DEQ | RING_F_EXACT_SZ);
+	r->zc_bufs = rte_zmalloc_socket(ring_name,
+			ETH_CLEANQ_ZC_BUFS * sizeof(r->zc_bufs[0]), 0, numa_node);
+	r->zc_free = rte_zmalloc_socket(ring_name,
+			ETH_CLEANQ_ZC_BUFS * sizeof(r->zc_free[0]), 0, numa_node);
+	if (r->zc_done == NULL || r->zc_bufs == NULL || r->zc_free == NULL)
+		return -1;
+
+	for (i = 0; i < ETH_CLEANQ_ZC_BUFS; i++) {
+		r->zc_bufs[i].shinfo.free_cb = eth_cleanq_zc_free;
+		r->zc_bufs[i].shinfo.fcb_opaque = &r->zc_bufs[i];
+		r->zc_bufs[i].r = r;
+		r->zc_free[i] = &r->zc_bufs[i];
+	}
+	r->zc_nb_free = ETH_CLEANQ_ZC_BUFS;
+	r->zc_rid = o->zc_rid;
+	r->zc_va = o->zc_va;
+	r->zc = 1;
+	return 0;
+}
+
+static void
+eth_cleanq_rx_zc_release(struct cleanq_rx_queue *r)
+{
+	rte_ring_free(r->zc_done);
+	rte_free(r->zc_bufs);
+	rte_free(r->zc_free);
+	r->zc_done = NULL;
+	r->zc_bufs = NULL;
+	r->zc_free = NULL;
+	r->zc = 0;
+}
+
+static void
+owned_destroy(struct cleanq_owned *o)
+{
+	unsigned int i;
+
+	for (i = 0; i < o->nb_queues; i++)
+		cleanq_destroy(o->queues[i]);
+	o->nb_queues = 0;
+
+	if (o->af_packet != NULL)
+		af_packet_destroy(o->af_packet);
+	o->af_packet = NULL;
+
+#ifdef RTE_LIBRTE_VHOST
+	if (o->vhost_user != NULL)
+		vhost_user_destroy(o->vhost_user);
+	o->vhost_user = NULL;
+#endif
+}
+
+static void
+eth_dev_close(struct rte_eth_dev *dev)
+{
+	struct pmd_internals *internals = dev->data->dev_private;
+	unsigned int i;
+
+	for (i = 0; i < internals->nb_stacks; i++)
+		stack_release(&internals->stacks[i]);
+	for (i = 0; i < internals->nb_stacks; i++)
+		stack_deregister(&internals->stacks[i]);
+
+	internals->nb_stacks = 0;
+
+	/* the packets in place have to be freed by now */
+	for (i = 0; i < internals->max_rx_queues; i++)
+		eth_cleanq_rx_zc_release(&internals->rx_cleanq_queues[i]);
+
+	owned_destroy(&internals->owned);
+}
+
+static void
+eth_mac_addr_remove(struct rte_eth_dev *dev __rte_unused,
+	uint32_t index __rte_unused)
+{
+}
+
+static int
+eth_mac_addr_add(struct rte_eth_dev *dev __rte_unused,
+	struct ether_addr *mac_addr __rte_unused,
+	uint32_t index __rte_unused,
+	uint32_t vmdq __rte_unused)
+{
+	return 0;
+}
+
+static void
+eth_queue_release(void *q __rte_unused) { ; }
+static int
+eth_link_update(struct rte_eth_dev *dev __rte_unused,
+		int wait_to_complete __rte_unused) { return 0; }
+
+static const struct eth_dev_ops ops = {
+	.dev_start = eth_dev_start,
+	.dev_stop = eth_dev_stop,
+	.dev_close = eth_dev_close,
+	.dev_set_link_up = eth_dev_set_link_up,
+	.dev_set_link_down = eth_dev_set_link_down,
+	.dev_configure = eth_dev_configure,
+	.dev_infos_get = eth_dev_info,
+	.rx_queue_setup = eth_rx_queue_setup,
+	.tx_queue_setup = eth_tx_queue_setup,
+	.rx_queue_release = eth_queue_release,
+	.tx_queue_release = eth_queue_release,
+	.link_update = eth_link_update,
+	.stats_get = eth_stats_get,
+	.stats_reset = eth_stats_reset,
+	.mac_addr_remove = eth_mac_addr_remove,
+	.mac_addr_add = eth_mac_addr_add,
+};
+
+static struct cleanq_stack *
+internals_stack(struct pmd_internals *internals, struct cleanq *q)
+{
+	struct cleanq_stack *s;
+	unsigned int i;
+
+	for (i = 0; i < internals->nb_stacks; i++) {
+		if (internals->stacks[i].q == q)
+			return &internals->stacks[i];
+	}
+
+	s = &internals->stacks[internals->nb_stacks++];
+	s->q = q;
+	return s;
+}
+
+static int
+do_eth_dev_cleanq_create(const char *name, struct rte_vdev_device *vdev,
+		struct cleanq * const rx_queues[], const unsigned int nb_rx_queues,
+		struct cleanq * const tx_queues[], const unsigned int nb_tx_queues,
+		const unsigned int numa_node,
+		const struct rte_eth_cleanq_conf *conf,
+		const struct cleanq_owned *owned)
+{
+	static const struct rte_eth_cleanq_conf default_conf;
+	struct rte_eth_dev_data *data = NULL;
+	struct pmd_internals *internals = NULL;
+	struct rte_eth_dev *eth_dev = NULL;
+	void **rx_queues_local = NULL;
+	void **tx_queues_local = NULL;
+	unsigned int i;
+
+	PMD_LOG(INFO, "Creating CleanQ-backed ethdev on numa socket %u",
+			numa_node);
+
+	if (conf == NULL)
+		conf = &default_conf;
+
+	rx_queues_local = rte_zmalloc_socket(name,
+			sizeof(void *) * nb_rx_queues, 0, numa_node);
+	if (rx_queues_local == NULL) {
+		rte_errno = ENOMEM;
+		goto error;
+	}
+
+	tx_queues_local = rte_zmalloc_socket(name,
+			sizeof(void *) * nb_tx_queues, 0, numa_node);
+	if (tx_queues_local == NULL) {
+		rte_errno = ENOMEM;
+		goto error;
+	}
+
+	internals = rte_zmalloc_socket(name, sizeof(*internals), 0, numa_node);
+	if (internals == NULL) {
+		rte_errno = ENOMEM;
+		goto error;
+	}
+
+	for (i = 0; owned != NULL && owned->zc_queue != NULL &&
+			i < nb_rx_queues; i++) {
+		if (rx_queues[i] == owned->zc_queue &&
+				eth_cleanq_rx_zc_setup(
+					&internals->rx_cleanq_queues[i],
+					owned, numa_node) != 0) {
+			rte_errno = ENOMEM;
+			goto error;
+		}
+	}
+
+	/* reserve an ethdev entry */
+	eth_dev = rte_eth_dev_allocate(name);
+	if (eth_dev == NULL) {
+		rte_errno = ENOSPC;
+		goto error;
+	}
+
+	data = eth_dev->data;
+	data->rx_queues = rx_queues_local;
+	data->tx_queues = tx_queues_local;
+
+	if (owned != NULL)
+		internals->owned = *owned;
+	internals->max_rx_queues = nb_rx_queues;
+	internals->max_tx_queues = nb_tx_queues;
+	for (i = 0; i < nb_rx_queues; i++) {
+		struct cleanq_rx_queue *r = &internals->rx_cleanq_queues[i];
+
+		r->stack = internals_stack(internals, rx_queues[i]);
+		r->shared = i < nb_tx_queues && tx_queues[i] == rx_queues[i];
+		r->loopback = conf->loopback;
+		data->rx_queues[i] = r;
+	}
+	for (i = 0; i < nb_tx_queues; i++) {
+		struct cleanq_tx_queue *t = &internals->tx_cleanq_queues[i];
+
+		t->stack = internals_stack(internals, tx_queues[i]);
+		t->shared = i < nb_rx_queues && tx_queues[i] == rx_queues[i];
+		t->loopback = conf->loopback;
+		t->flags = conf->tx_flags;
+		data->tx_queues[i] = t;
+	}
+
+	data->dev_private = internals;
+	data->nb_rx_queues = (uint16_t)nb_rx_queues;
+	data->nb_tx_queues = (uint16_t)nb_tx_queues;
+	data->dev_link = pmd_link;
+	data->mac_addrs = &internals->address;
+	eth_random_addr(internals->address.addr_bytes);
+
+	eth_dev->device = &vdev->device;
+	eth_dev->dev_ops = &ops;
+	data->kdrv = RTE_KDRV_NONE;
+	data->numa_node = numa_node;
+
+	eth_dev->rx_pkt_burst = eth_cleanq_rx;
+	eth_dev->tx_pkt_burst = eth_cleanq_tx;
+
+	rte_eth_dev_probing_finish(eth_dev);
+
+	return data->port_id;
+
+error:
+	for (i = 0; internals != NULL && i < nb_rx_queues; i++)
+		eth_cleanq_rx_zc_release(&internals->rx_cleanq_queues[i]);
+	rte_free(rx_queues_local);
+	rte_free(tx_queues_local);
+	rte_free(internals);
+
+	return -1;
+}
+
+int
+rte_eth_from_cleanq(const char *name, struct cleanq *const rx_queues[],
+		const unsigned int nb_rx_queues,
+		struct cleanq *const tx_queues[],
+		const unsigned int nb_tx_queues,
+		const unsigned int numa_node,
+		const struct rte_eth_cleanq_conf *conf)
+{
+	struct cleanq_internal_args args = {
+		.rx_queues = rx_queues,
+		.nb_rx_queues = nb_rx_queues,
+		.tx_queues = tx_queues,
+		.nb_tx_queues = nb_tx_queues,
+		.numa_node = numa_node,
+		.conf = conf,
+		.addr = &args,
+	};
+	char args_str[32] = { 0 };
+	char cleanq_name[RTE_ETH_NAME_MAX_LEN] = { 0 };
+	uint16_t port_id = RTE_MAX_ETHPORTS;
+	int ret;
+
+	/* do some parameter checking */
+	if (rx_queues == NULL && nb_rx_queues > 0) {
+		rte_errno = EINVAL;
+		return -1;
+	}
+	if (tx_queues == NULL && nb_tx_queues > 0) {
+		rte_errno = EINVAL;
+		return -1;
+	}
+	if (nb_rx_queues > RTE_PMD_CLEANQ_MAX_QUEUES ||
+			nb_tx_queues > RTE_PMD_CLEANQ_MAX_QUEUES) {
+		rte_errno = EINVAL;
+		return -1;
+	}
+
+	snprintf(args_str, sizeof(args_str), "%s=%p",
+		ETH_CLEANQ_INTERNAL_ARG, &args);
+	snprintf(cleanq_name, sizeof(cleanq_name), "net_cleanq_%s", name);
+
+	ret = rte_vdev_init(cleanq_name, args_str);
+	if (ret) {
+		rte_errno = EINVAL;
+		return -1;
+	}
+
+	rte_eth_dev_get_port_by_name(cleanq_name, &port_id);
+
+	return port_id;
+}
+
+/*
+ * Queues created from the device arguments
+ */
+
+struct cleanq_devargs {
+	const char *backend;
+	unsigned int queues;
+	int debug;
+	int zero_copy;
+	const char *iface;
+	const char *path;
+};
+
+/* checks that the ethdev only hands the queue buffers it owns */
+static errval_t
+wrap_debug(struct cleanq_owned *o, unsigned int numa_node, struct cleanq **q)
+{
+	struct debug_q *dq;
+	errval_t err;
+
+	err = debug_create(&dq, *q, numa_node);
+	if (err_is_fail(err))
+		return err;
+
+	/* destroyed before the queue below */
+	memmove(&o->queues[1], &o->queues[0],
+		o->nb_queues * sizeof(o->queues[0]));
+	o->queues[0] = (struct cleanq *)dq;
+	o->nb_queues++;
+	*q = (struct cleanq *)dq;
+	return CLEANQ_ERR_OK;
+}
+
+static int
+create_loopback(const struct cleanq_devargs *a, unsigned int numa_node,
+		struct cleanq_owned *o, struct cleanq *rxq[], struct cleanq *txq[])
+{
+	struct loopback_queue *lq;
+	unsigned int i;
+
+	for (i = 0; i < a->queues; i++) {
+		if (err_is_fail(loopback_queue_create(&lq, numa_node)))
+			return -1;
+		o->queues[o->nb_queues++] = (struct cleanq *)lq;
+
+		rxq[i] = (struct cleanq *)lq;
+		if (a->debug && err_is_fail(wrap_debug(o, numa_node, &rxq[i])))
+			return -1;
+
+		/* each queue sends to itself */
+		txq[i] = rxq[i];
+	}
+	return 0;
+}
+
+static int
+create_af_packet(const struct cleanq_devargs *a, unsigned int numa_node,
+		struct cleanq_owned *o, struct cleanq *rxq[], struct cleanq *txq[])
+{
+	if (a->iface == NULL || a->queues != 1) {
+		PMD_LOG(ERR, ETH_CLEANQ_BACKEND_AF_PACKET " needs "
+			ETH_CLEANQ_IFACE_ARG " and supports one queue");
+		return -1;
+	}
+
+	if (err_is_fail(af_packet_create(&o->af_packet, a->iface,
+			numa_node))) {
+		PMD_LOG(ERR, "cannot open %s", a->iface);
+		return -1;
+	}
+
+	rxq[0] = af_packet_get_rx(o->af_packet);
+	txq[0] = af_packet_get_tx(o->af_packet);
+
+	if (a->zero_copy) {
+		struct capref cap;
+
+		/* a region of the queue like the mempools */
+		af_packet_get_rx_ring(o->af_packet, &cap);
+		if (err_is_fail(cleanq_register(rxq[0], cap, &o->zc_rid)) ||
+				err_is_fail(cleanq_control(rxq[0],
+					CLEANQ_CTRL_AF_PACKET_ZERO_COPY, 1,
+					NULL))) {
+			PMD_LOG(ERR, "cannot hand out packets in place on %s",
+				a->iface);
+			return -1;
+		}
+		o->zc_queue = rxq[0];
+		o->zc_va = cap.vaddr;
+	}
+
+	if (a->debug && (err_is_fail(wrap_debug(o, numa_node, &rxq[0])) ||
+			err_is_fail(wrap_debug(o, numa_node, &txq[0]))))
+		return -1;
+	return 0;
+}
+
+#ifdef RTE_LIBRTE_VHOST
+static int
+create_vhost_user(const struct cleanq_devargs *a, unsigned int numa_node,
+		struct cleanq_owned *o, struct cleanq *rxq[], struct cleanq *txq[])
+{
+	if (a->path == NULL || a->queues != 1) {
+		PMD_LOG(ERR, ETH_CLEANQ_BACKEND_VHOST_USER " needs "
+			ETH_CLEANQ_PATH_ARG " and supports one queue");
+		return -1;
+	}
+
+	if (err_is_fail(vhost_user_create(&o->vhost_user, a->path,
+			numa_node))) {
+		PMD_LOG(ERR, "cannot create vhost-user socket %s", a->path);
+		return -1;
+	}
+
+	rxq[0] = vhost_user_get_rx(o->vhost_user);
+	txq[0] = vhost_user_get_tx(o->vhost_user);
+	if (a->debug && (err_is_fail(wrap_debug(o, numa_node, &rxq[0])) ||
+			err_is_fail(wrap_debug(o, numa_node, &txq[0]))))
+		return -1;
+	return 0;
+}
+#endif
+
+static int
+eth_dev_cleanq_create(const char *name, struct rte_vdev_device *vdev,
+		const unsigned int numa_node, const struct cleanq_devargs *a)
+{
+	static const struct rte_eth_cleanq_conf loopback_conf = {
+		.loopback = 1,
+	};
+	struct cleanq *rxq[RTE_PMD_CLEANQ_MAX_QUEUES];
+	struct cleanq *txq[RTE_PMD_CLEANQ_MAX_QUEUES];
+	struct cleanq_owned o;
+	int ret;
+
+	memset(&o, 0, sizeof(o));
+
+	if (strcmp(a->backend, ETH_CLEANQ_BACKEND_AF_PACKET) == 0) {
+		ret = create_af_packet(a, numa_node, &o, rxq, txq);
+		if (ret == 0)
+			ret = do_eth_dev_cleanq_create(name, vdev, rxq,
+					a->queues, txq, a->queues, numa_node,
+					NULL, &o);
+#ifdef RTE_LIBRTE_VHOST
+	} else if (strcmp(a->backend, ETH_CLEANQ_BACKEND_VHOST_USER) == 0) {
+		ret = create_vhost_user(a, numa_node, &o, rxq, txq);
+		if (ret == 0)
+			ret = do_eth_dev_cleanq_create(name, vdev, rxq,
+					a->queues, txq, a->queues, numa_node,
+					NULL, &o);
+#endif
+	} else {
+		ret = create_loopback(a, numa_node, &o, rxq, txq);
+		if (ret == 0)
+			ret = do_eth_dev_cleanq_create(name, vdev, rxq,
+					a->queues, txq, a->queues, numa_node,
+					&loopback_conf, &o);
+	}
+
+	if (ret < 0) {
+		owned_destroy(&o);
+		return -1;
+	}
+	return 0;
+}
+
+static int
+parse_internal_args(const char *key __rte_unused, const char *value,
+		void *data)
+{
+	struct cleanq_internal_args **internal_args = data;
+	void *args;
+
+	sscanf(value, "%p", &args);
+
+	*internal_args = args;
+
+	if ((*internal_args)->addr != args)
+		return -1;
+
+	return 0;
+}
+
+static int
+parse_string(const char *key __rte_unused, const char *value, void *data)
+{
+	const char **str = data;
+
+	*str = value;
+	return 0;
+}
+
+static int
+parse_uint(const char *key __rte_unused, const char *value, void *data)
+{
+	unsigned int *n = data;
+	char *end;
+
+	errno = 0;
+	*n = strtoul(value, &end, 10);
+	if (errno != 0 || *end != '\0')
+		return -1;
+	return 0;
+}
+
+static int
+rte_pmd_cleanq_probe(struct rte_vdev_device *dev)
+{
+	const char *name, *params;
+	struct rte_kvargs *kvlist = NULL;
+	struct cleanq_internal_args *internal_args;
+	struct cleanq_devargs a = {
+		.backend = ETH_CLEANQ_BACKEND_LOOPBACK,
+		.queues = 1,
+		.debug = 0,
+		.zero_copy = 0,
+		.iface = NULL,
+		.path = NULL,
+	};
+	unsigned int debug = 0;
+	unsigned int zero_copy = 0;
+	int ret = 0;
+
+	name = rte_vdev_device_name(dev);
+	params = rte_vdev_device_args(dev);
+
+	PMD_LOG(INFO, "Initializing pmd_cleanq for %s", name);
+
+	if (params != NULL && params[0] != '\0') {
+		kvlist = rte_kvargs_parse(params, valid_arguments);
+		if (kvlist == NULL) {
+			PMD_LOG(ERR, "invalid parameters for %s", name);
+			return -EINVAL;
+		}
+	}
+
+	if (kvlist != NULL &&
+			rte_kvargs_count(kvlist, ETH_CLEANQ_INTERNAL_ARG) == 1) {
+		ret = rte_kvargs_process(kvlist, ETH_CLEANQ_INTERNAL_ARG,
+					 parse_internal_args,
+					 &internal_args);
+		if (ret < 0)
+			goto out_free;
+
+		ret = do_eth_dev_cleanq_create(name, dev,
+			internal_args->rx_queues,
+			internal_args->nb_rx_queues,
+			internal_args->tx_queues,
+			internal_args->nb_tx_queues,
+			internal_args->numa_node,
+			internal_args->conf,
+			NULL);
+		if (ret >= 0)
+			ret = 0;
+		goto out_free;
+	}
+
+	if (kvlist != NULL) {
+		ret = rte_kvargs_process(kvlist, ETH_CLEANQ_BACKEND_ARG,
+					 parse_string, &a.backend);
+		if (ret < 0)
+			goto out_free;
+		ret = rte_kvargs_process(kvlist, ETH_CLEANQ_IFACE_ARG,
+					 parse_string, &a.iface);
+		if (ret < 0)
+			goto out_free;
+		ret = rte_kvargs_process(kvlist, ETH_CLEANQ_PATH_ARG,
+					 parse_string, &a.path);
+		if (ret < 0)
+			goto out_free;
+		ret = rte_kvargs_process(kvlist, ETH_CLEANQ_QUEUES_ARG,
+					 parse_uint, &a.queues);
+		if (ret < 0)
+			goto out_free;
+		ret = rte_kvargs_process(kvlist, ETH_CLEANQ_DEBUG_ARG,
+					 parse_uint, &debug);
+		if (ret < 0)
+			goto out_free;
+		ret = rte_kvargs_process(kvlist, ETH_CLEANQ_ZERO_COPY_ARG,
+					 parse_uint, &zero_copy);
+		if (ret < 0)
+			goto out_free;
+	}
+
+	if (a.queues == 0 || a.queues > RTE_PMD_CLEANQ_MAX_QUEUES) {
+		PMD_LOG(ERR, "%s: between 1 and %d queues are supported",
+			name, RTE_PMD_CLEANQ_MAX_QUEUES);
+		ret = -EINVAL;
+		goto out_free;
+	}
+	a.debug = debug != 0;
+	a.zero_copy = zero_copy != 0;
+
+	/* the debug queue would have to know the ring region as well */
+	if (a.zero_copy && (a.debug ||
+			strcmp(a.backend, ETH_CLEANQ_BACKEND_AF_PACKET) != 0)) {
+		PMD_LOG(ERR, "%s: " ETH_CLEANQ_ZERO_COPY_ARG " needs "
+			ETH_CLEANQ_BACKEND_AF_PACKET " without "
+			ETH_CLEANQ_DEBUG_ARG, name);
+		ret = -EINVAL;
+		goto out_free;
+	}
+
+	if (strcmp(a.backend, ETH_CLEANQ_BACKEND_LOOPBACK) != 0 &&
+			strcmp(a.backend, ETH_CLEANQ_BACKEND_AF_PACKET) != 0
+#ifdef RTE_LIBRTE_VHOST
+			&& strcmp(a.backend, ETH_CLEANQ_BACKEND_VHOST_USER) != 0
+#endif
+			) {
+		PMD_LOG(ERR, "unknown backend %s, use rte_eth_from_cleanq() "
+			"for others than " ETH_CLEANQ_BACKEND_LOOPBACK ", "
+			ETH_CLEANQ_BACKEND_AF_PACKET " and "
+			ETH_CLEANQ_BACKEND_VHOST_USER, a.backend);
+		ret = -EINVAL;
+		goto out_free;
+	}
+
+	ret = eth_dev_cleanq_create(name, dev, rte_socket_id(), &a);
+
+out_free:
+	rte_kvargs_free(kvlist);
+	return ret;
+}
+
+static int
+rte_pmd_cleanq_remove(struct rte_vdev_device *dev)
+{
+	const char *name = rte_vdev_device_name(dev);
+	struct rte_eth_dev *eth_dev = NULL;
+
+	if (name == NULL)
+		return -EINVAL;
+
+	PMD_LOG(INFO, "Un-Initializing pmd_cleanq for %s", name);
+
+	/* find an ethdev entry */
+	eth_dev = rte_eth_dev_allocated(name);
+	if (eth_dev == NULL)
+		return -ENODEV;
+
+	eth_dev_stop(eth_dev);
+	eth_dev_close(eth_dev);
+
+	/* mac_addrs must not be freed alone because part of dev_private */
+	eth_dev->data->mac_addrs = NULL;
+	rte_eth_dev_release_port(eth_dev);
+	return 0;
+}
+
+static struct rte_vdev_driver pmd_cleanq_drv = {
+	.probe = rte_pmd_cleanq_probe,
+	.remove = rte_pmd_cleanq_remove,
+};
+
+RTE_PMD_REGISTER_VDEV(net_cleanq, pmd_cleanq_drv);
+RTE_PMD_REGISTER_PARAM_STRING(net_cleanq,
+	ETH_CLEANQ_BACKEND_ARG "=" ETH_CLEANQ_BACKEND_LOOPBACK "|"
+	ETH_CLEANQ_BACKEND_AF_PACKET "|" ETH_CLEANQ_BACKEND_VHOST_USER " "
+	ETH_CLEANQ_QUEUES_ARG "=<int> "
+	ETH_CLEANQ_DEBUG_ARG "=0|1 "
+	ETH_CLEANQ_ZERO_COPY_ARG "=0|1 "
+	ETH_CLEANQ_IFACE_ARG "=<ifname> "
+	ETH_CLEANQ_PATH_ARG "=<socket>");
+
+RTE_INIT(eth_cleanq_init_log)
+{
+	eth_cleanq_logtype = rte_log_register("pmd.net.cleanq");
+	if (eth_cleanq_logtype >= 0)
+		rte_log_set_level(eth_cleanq_logtype, RTE_LOG_NOTICE);
+}
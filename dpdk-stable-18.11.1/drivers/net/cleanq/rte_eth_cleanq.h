@@ -0,0 +1,76 @@
+/* SPDX-License-Identifier: BSD-3-Clause
+ * Copyright(c) 2017 ETH Zurich
+ */
+
+#ifndef _RTE_ETH_CLEANQ_H_
+#define _RTE_ETH_CLEANQ_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+
+struct cleanq;
+
+/** Maximum number of RX and TX queues of a CleanQ backed ethdev */
+#define RTE_PMD_CLEANQ_MAX_QUEUES 16
+
+/**
+ * How the ethdev drives its CleanQ queues
+ */
+struct rte_eth_cleanq_conf {
+	/**
+	 * ORed into the flags of every buffer sent, e.g. the destination
+	 * port of a UDP queue (see cleanq_udp.h)
+	 */
+	uint64_t tx_flags;
+	/**
+	 * The queues return the buffers sent on them as received packets,
+	 * like the loopback backend. No buffers are posted for receiving.
+	 */
+	int loopback;
+};
+
+/**
+ * Create a new ethdev port from a set of CleanQ queues
+ *
+ * The queues can be any CleanQ queue or stack of modules, e.g. a UDP
+ * queue on top of a NIC queue or a debug queue on top of another queue.
+ * Like a NIC queue, an RX queue is given mbufs of the mempool of the
+ * ethdev RX queue to receive into, and hands back sent mbufs once they are
+ * no longer in use. The mempools are registered with the queues as needed.
+ *
+ * The same CleanQ queue can be passed as RX and TX queue of the same
+ * index. It then has to be polled from a single lcore.
+ *
+ * @param name
+ *    name to be given to the new ethdev port
+ * @param rx_queues
+ *    pointer to array of CleanQ queues to be used as RX queues
+ * @param nb_rx_queues
+ *    number of elements in the rx_queues array
+ * @param tx_queues
+ *    pointer to array of CleanQ queues to be used as TX queues
+ * @param nb_tx_queues
+ *    number of elements in the tx_queues array
+ * @param numa_node
+ *    the numa node on which the memory for this port is to be allocated
+ * @param conf
+ *    how to use the queues, NULL for the defaults of a NIC queue
+ * @return
+ *    the port number of the newly created the ethdev or -1 on error.
+ */
+int rte_eth_from_cleanq(const char *name,
+		struct cleanq *const rx_queues[],
+		const unsigned int nb_rx_queues,
+		struct cleanq *const tx_queues[],
+		const unsigned int nb_tx_queues,
+		const unsigned int numa_node,
+		const struct rte_eth_cleanq_conf *conf);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -50,15 +50,21 @@ errval_t ixgbe_cleanq_deregister(
 	return CLEANQ_ERR_OK;
 }
 
+/* TDT is written on every enqueue, there is nothing to flush */
+errval_t ixgbe_cleanq_notify(struct cleanq *q __rte_unused)
+{
+	return CLEANQ_ERR_OK;
+}
+
 /*
  * ===========================================================================
  * TX
  * ===========================================================================
  */
-errval_t ixgbe_tx_cleanq_create(struct ixgbe_tx_queue *txq)
+errval_t ixgbe_tx_cleanq_create(struct ixgbe_tx_queue *txq, int socket_id)
 {
 	errval_t err;
-	err = cleanq_init((struct cleanq *)txq);
+	err = cleanq_init_socket((struct cleanq *)txq, socket_id);
 	if (err_is_fail(err)) {
 		return err;
 	}
@@ -66,9 +72,30 @@ errval_t ixgbe_tx_cleanq_create(struct ixgbe_tx_queue *txq)
 	txq->f.deq = ixgbe_tx_cleanq_dequeue;
 	txq->f.reg = ixgbe_cleanq_register;
 	txq->f.dereg = ixgbe_cleanq_deregister;
+	txq->f.notify = ixgbe_cleanq_notify;
+	txq->f.ctrl = ixgbe_tx_cleanq_control;
 	return CLEANQ_ERR_OK;
 }
 
+errval_t ixgbe_tx_cleanq_control(
+	struct cleanq *q,
+	uint64_t cmd,
+	uint64_t value __rte_unused,
+	uint64_t *result)
+{
+	struct ixgbe_tx_queue *txq = (struct ixgbe_tx_queue *)q;
+
+	switch (cmd) {
+	case CLEANQ_CTRL_SET_VALIDATION:
+	case CLEANQ_CTRL_SET_REGION_HEADROOM:
+		return CLEANQ_ERR_OK;
+	case CLEANQ_CTRL_GET_STATS:
+		return cleanq_stats_control(&txq->cq_stats, result);
+	default:
+		return CLEANQ_ERR_INVALID_CTRL;
+	}
+}
+
 errval_t ixgbe_tx_cleanq_enqueue(
 	struct cleanq *q,
 	regionid_t region_id,
@@ -103,6 +130,7 @@ errval_t ixgbe_tx_cleanq_enqueue(
 	 */
 	if (unlikely(txq->tx_recl - txq->tx_tail - 1 == 0)) {
 		PMD_CLEANQ_LOG_TX(NOTICE, "No free descriptor (%"PRIu16")", txq->tx_tail);
+		txq->cq_stats.full++;
 		return CLEANQ_ERR_QUEUE_FULL;
 	}
 
@@ -143,6 +171,7 @@ errval_t ixgbe_tx_cleanq_enqueue(
 
 	IXGBE_PCI_REG_WRITE(txq->tdt_reg_addr, txq->tx_tail);
 
+	cleanq_stats_enq(&txq->cq_stats, CLEANQ_ERR_OK, pkt_len);
 	PMD_CLEANQ_LOG_TX_STATUS(INFO, txq);
 	return CLEANQ_ERR_OK;
 }
@@ -164,6 +193,7 @@ errval_t ixgbe_tx_cleanq_dequeue(
 
 	if (likely(txq->tx_recl == txq->tx_tail)) {
 		PMD_CLEANQ_LOG_TX(DEBUG, "No descriptors enqueued to HW (%"PRIu16")", txq->tx_recl);
+		txq->cq_stats.empty++;
 		return CLEANQ_ERR_QUEUE_EMPTY;
 	}
 
@@ -171,6 +201,7 @@ errval_t ixgbe_tx_cleanq_dequeue(
 	status = rte_le_to_cpu_32(txq->tx_ring[txq->tx_next_dd].wb.status);
 	if (!(status & IXGBE_ADVTXD_STAT_DD)) {
 		PMD_CLEANQ_LOG_TX(DEBUG, "No buffer to dequeue (%"PRIx32")", status);
+		txq->cq_stats.empty++;
 		return CLEANQ_ERR_QUEUE_EMPTY;
 	}
 
@@ -210,6 +241,7 @@ errval_t ixgbe_tx_cleanq_dequeue(
     *valid_length = cqbuf.valid_length;
     *misc_flags = cqbuf.flags;
 
+	cleanq_stats_deq(&txq->cq_stats, CLEANQ_ERR_OK, cqbuf.valid_length);
 	PMD_CLEANQ_LOG_TX_STATUS(INFO, txq);
 	return CLEANQ_ERR_OK;
 }
@@ -323,10 +355,139 @@ rx_desc_error_to_pkt_flags(uint32_t rx_status)
 	return pkt_flags;
 }
 
-errval_t ixgbe_rx_cleanq_create(struct ixgbe_rx_queue *rxq)
+/*
+ * Puts an mbuf into the descriptor at the tail, the caller checks that there
+ * is a free one and writes RDT
+ */
+static inline void
+ixgbe_rx_cleanq_post(struct ixgbe_rx_queue *rxq, struct rte_mbuf *mb)
+{
+	volatile union ixgbe_adv_rx_desc *rxdp;
+	uint64_t dma_addr;
+
+	rxdp = &rxq->rx_ring[rxq->rx_tail];
+
+	/* populate the static rte mbuf fields */
+	mb->port = rxq->port_id;
+	rte_mbuf_refcnt_set(mb, 1);
+	mb->data_off = RTE_PKTMBUF_HEADROOM;
+	rxq->sw_ring[rxq->rx_tail].mbuf = mb;
+
+	/* populate the descriptor */
+	dma_addr = rte_mbuf_data_iova_default(mb);
+	rxdp->read.hdr_addr = 0;
+	rxdp->read.pkt_addr = rte_cpu_to_le_64(dma_addr);
+
+	PMD_CLEANQ_LOG_RX(INFO, "Enqueued buffer %"PRIu16"", rxq->rx_tail);
+
+	rxq->rx_tail = (uint16_t)(rxq->rx_tail + 1);
+	if (rxq->rx_tail >= rxq->nb_rx_desc) {
+		rxq->rx_tail = 0;
+	}
+
+	/* an empty receive buffer, no bytes */
+	cleanq_stats_enq(&rxq->cq_stats, CLEANQ_ERR_OK, 0);
+}
+
+/*
+ * Refills the free descriptors from the mempool of the queue. The mbufs are
+ * taken in bulk and enqueued as any other buffer, but the tail is written
+ * once, a refill of a whole burst is a single MMIO write instead of one per
+ * buffer.
+ */
+uint16_t
+ixgbe_rx_cleanq_refill(struct ixgbe_rx_queue *rxq, uint16_t nb_bufs)
+{
+	struct cleanq *q = (struct cleanq *)rxq;
+	struct rte_mbuf *mbs[IXGBE_CLEANQ_REFILL_BULK];
+	struct cleanq_buf cqbuf;
+	uint16_t nb_done = 0;
+	uint16_t n, i;
+
+	PMD_CLEANQ_LOG_RX(DEBUG, "Refilling %"PRIu16" buffers", nb_bufs);
+
+	rxq->cq_refilling = 1;
+	while (nb_done < nb_bufs) {
+		n = RTE_MIN(nb_bufs - nb_done, IXGBE_CLEANQ_REFILL_BULK);
+
+		if (unlikely(rte_mempool_get_bulk(rxq->mb_pool, (void **)mbs,
+						  n) != 0)) {
+			PMD_CLEANQ_LOG_RX(NOTICE, "mbuf alloc failed port_id=%u "
+				"queue_id=%u", (unsigned) rxq->port_id,
+				(unsigned) rxq->queue_id);
+
+			rte_eth_devices[rxq->port_id].data->rx_mbuf_alloc_failed += n;
+			break;
+		}
+
+		for (i = 0; i < n; i++) {
+			mbuf_to_cleanq_buf(q, mbs[i], &cqbuf);
+
+			PMD_CLEANQ_LOG_CQBUF(RX, DEBUG, cqbuf);
+
+			if (err_is_fail(cleanq_enqueue(q, cqbuf.rid, cqbuf.offset,
+					cqbuf.length, cqbuf.valid_data,
+					cqbuf.valid_length, cqbuf.flags))) {
+				break;
+			}
+		}
+		nb_done += i;
+		if (unlikely(i < n)) {
+			rte_mempool_put_bulk(rxq->mb_pool, (void **)&mbs[i], n - i);
+			break;
+		}
+	}
+	rxq->cq_refilling = 0;
+
+	if (nb_done > 0) {
+		cleanq_notify(q);
+	}
+	return nb_done;
+}
+
+/* Hands the buffers enqueued since the last write of RDT to the HW */
+errval_t ixgbe_rx_cleanq_notify(struct cleanq *q)
+{
+	struct ixgbe_rx_queue *rxq = (struct ixgbe_rx_queue *)q;
+
+	IXGBE_PCI_REG_WRITE(rxq->rdt_reg_addr, rxq->rx_tail);
+
+	PMD_CLEANQ_LOG_RX_STATUS(INFO, rxq);
+	return CLEANQ_ERR_OK;
+}
+
+/*
+ * The RX interrupts are those of the ethdev queue, set up as for the
+ * non-CleanQ datapath when the port is configured with intr_conf.rxq
+ */
+errval_t ixgbe_rx_cleanq_control(
+	struct cleanq *q,
+	uint64_t cmd,
+	uint64_t value __rte_unused,
+	uint64_t *result)
+{
+	struct ixgbe_rx_queue *rxq = (struct ixgbe_rx_queue *)q;
+
+	switch (cmd) {
+	case CLEANQ_CTRL_SET_VALIDATION:
+	case CLEANQ_CTRL_SET_REGION_HEADROOM:
+		return CLEANQ_ERR_OK;
+	case CLEANQ_CTRL_RX_INTR_ENABLE:
+	case CLEANQ_CTRL_RX_INTR_DISABLE:
+	case CLEANQ_CTRL_RX_INTR_FD:
+		return cleanq_ethdev_rx_intr_control(rxq->port_id,
+			rxq->queue_id, cmd, result);
+	case CLEANQ_CTRL_GET_STATS:
+		return cleanq_stats_control(&rxq->cq_stats, result);
+	default:
+		return CLEANQ_ERR_INVALID_CTRL;
+	}
+}
+
+errval_t ixgbe_rx_cleanq_create(struct ixgbe_rx_queue *rxq, int socket_id)
 {
 	errval_t err;
-	err = cleanq_init((struct cleanq *)rxq);
+	err = cleanq_init_socket((struct cleanq *)rxq, socket_id);
 	if (err_is_fail(err)) {
 		return err;
 	}
@@ -334,6 +495,8 @@ errval_t ixgbe_rx_cleanq_create(struct ixgbe_rx_queue *rxq)
 	rxq->f.deq = ixgbe_rx_cleanq_dequeue;
 	rxq->f.reg = ixgbe_cleanq_register;
 	rxq->f.dereg = ixgbe_cleanq_deregister;
+	rxq->f.notify = ixgbe_rx_cleanq_notify;
+	rxq->f.ctrl = ixgbe_rx_cleanq_control;
 	return CLEANQ_ERR_OK;
 }
 
@@ -347,11 +510,6 @@ errval_t ixgbe_rx_cleanq_enqueue(
     uint64_t misc_flags)
 {
 	struct ixgbe_rx_queue *rxq = (struct ixgbe_rx_queue *)q;
-
-	volatile union ixgbe_adv_rx_desc *rxdp;
-	struct ixgbe_rx_entry *rxep;
-	uint64_t dma_addr;
-
 	struct rte_mbuf *mb;
 	struct cleanq_buf cqbuf = {
 		.offset = offset,
@@ -370,30 +528,14 @@ errval_t ixgbe_rx_cleanq_enqueue(
 	 */
 	if (unlikely(rxq->rx_recl - rxq->rx_tail - 1 == 0)) {
 		PMD_CLEANQ_LOG_RX(NOTICE, "No free descriptor (%"PRIu16")", rxq->rx_tail);
+		rxq->cq_stats.full++;
 		return CLEANQ_ERR_QUEUE_FULL;
 	}
 
-	rxep = &rxq->sw_ring[rxq->rx_tail];
-	rxdp = &rxq->rx_ring[rxq->rx_tail];
-	
-	/* populate the static rte mbuf fields */
-	mb->port = rxq->port_id;
-	rte_mbuf_refcnt_set(mb, 1);
-	mb->data_off = RTE_PKTMBUF_HEADROOM;
-	rxep->mbuf = mb;
-
- 	/* populate the descriptor */
-	dma_addr = rte_mbuf_data_iova_default(mb);
-	rxdp->read.hdr_addr = 0;
-	rxdp->read.pkt_addr = rte_cpu_to_le_64(dma_addr);
-
-	PMD_CLEANQ_LOG_RX(INFO, "Enqueued buffer %"PRIu16"", rxq->rx_tail);
-
-	rxq->rx_tail = (uint16_t)(rxq->rx_tail + 1);
-	if (rxq->rx_tail >= rxq->nb_rx_desc) {
-		rxq->rx_tail = 0;
+	ixgbe_rx_cleanq_post(rxq, mb);
+	if (rxq->cq_refilling) {
+		return CLEANQ_ERR_OK;
 	}
-
 	IXGBE_PCI_REG_WRITE(rxq->rdt_reg_addr, rxq->rx_tail);
 
 	PMD_CLEANQ_LOG_RX_STATUS(INFO, rxq);
@@ -422,6 +564,7 @@ errval_t ixgbe_rx_cleanq_dequeue(
 
     if (unlikely(rxq->rx_recl == rxq->rx_tail)) {
 		PMD_CLEANQ_LOG_RX(NOTICE, "Not descriptors enqueued to HW (%"PRIu16")", rxq->rx_recl);
+		rxq->cq_stats.empty++;
 		return CLEANQ_ERR_QUEUE_EMPTY;
 	}
 
@@ -436,6 +579,7 @@ errval_t ixgbe_rx_cleanq_dequeue(
 	/* Check whether there is a packet to receive */
 	if (!(status & IXGBE_RXDADV_STAT_DD)) {
 		PMD_CLEANQ_LOG_RX(DEBUG, "No buffer to dequeue (%"PRIx32")", status);
+		rxq->cq_stats.empty++;
 		return CLEANQ_ERR_QUEUE_EMPTY;
 	}
 
@@ -489,6 +633,7 @@ errval_t ixgbe_rx_cleanq_dequeue(
     *valid_length = cqbuf.valid_length;
     *misc_flags = cqbuf.flags;
 
+	cleanq_stats_deq(&rxq->cq_stats, CLEANQ_ERR_OK, pkt_len);
 	PMD_CLEANQ_LOG_RX_STATUS(INFO, rxq);
 	return CLEANQ_ERR_OK;
 }
@@ -60,7 +60,15 @@ errval_t ixgbe_cleanq_deregister(
 	struct cleanq *q,
     regionid_t region_id);
 
-errval_t ixgbe_tx_cleanq_create(struct ixgbe_tx_queue *txq);
+errval_t ixgbe_cleanq_notify(struct cleanq *q);
+
+errval_t ixgbe_tx_cleanq_create(struct ixgbe_tx_queue *txq, int socket_id);
+
+errval_t ixgbe_tx_cleanq_control(
+	struct cleanq *q,
+	uint64_t cmd,
+	uint64_t value,
+	uint64_t *result);
 
 errval_t ixgbe_tx_cleanq_enqueue(
 	struct cleanq *q,
@@ -80,7 +88,22 @@ errval_t ixgbe_tx_cleanq_dequeue(
     genoffset_t* valid_length,
     uint64_t* misc_flags);
 
-errval_t ixgbe_rx_cleanq_create(struct ixgbe_rx_queue *rxq);
+/* mbufs taken from the mempool at once by ixgbe_rx_cleanq_refill() */
+#define IXGBE_CLEANQ_REFILL_BULK 64
+/* smallest refill batch of an idle queue, the largest is rx_free_thresh */
+#define IXGBE_CLEANQ_REFILL_MIN 4
+
+uint16_t ixgbe_rx_cleanq_refill(struct ixgbe_rx_queue *rxq, uint16_t nb_bufs);
+
+errval_t ixgbe_rx_cleanq_notify(struct cleanq *q);
+
+errval_t ixgbe_rx_cleanq_create(struct ixgbe_rx_queue *rxq, int socket_id);
+
+errval_t ixgbe_rx_cleanq_control(
+	struct cleanq *q,
+	uint64_t cmd,
+	uint64_t value,
+	uint64_t *result);
 
 errval_t ixgbe_rx_cleanq_enqueue(
     struct cleanq *q,
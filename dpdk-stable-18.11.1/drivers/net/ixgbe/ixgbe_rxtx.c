@@ -2001,45 +2001,20 @@ ixgbe_recv_pkts_cleanq(void *rx_queue, struct rte_mbuf **rx_pkts,
 	struct cleanq_buf cqbuf;
 
 	/* Refill buffers
-	 * Never enqueue all, as the HW sees this as a full descriptor ring
+	 * Never enqueue all, as the HW sees this as a full descriptor ring.
+	 * The refill batch follows the packets received per burst as the
+	 * burst of a cleanq_poll loop does: small when they come one by one,
+	 * up to rx_free_thresh under load. If fewer than a burst are left to
+	 * the HW it refills right away.
 	 */
 	int32_t nb_bufs = rxq->rx_recl - rxq->rx_tail - 1;
 	if (nb_bufs < 0) {
 		nb_bufs += rxq->nb_rx_desc;
 	}
 
-	PMD_CLEANQ_LOG_RX(DEBUG, "Refilling %"PRIu16" buffers", nb_bufs);
-
-	for (uint16_t i = 0; i < nb_bufs; i++) {
-		struct rte_mbuf *mb = rte_mbuf_raw_alloc(rxq->mb_pool);
-		if (mb == NULL) {
-			PMD_CLEANQ_LOG_RX(NOTICE, "mbuf alloc failed port_id=%u "
-				"queue_id=%u", (unsigned) rxq->port_id,
-				(unsigned) rxq->queue_id);
-
-			rte_eth_devices[rxq->port_id].data->rx_mbuf_alloc_failed++;
-			break;
-		}
-
-		PMD_CLEANQ_LOG_RX(DEBUG, "mbuf: %p", mb);
-
-		mbuf_to_cleanq_buf(q, mb, &cqbuf);
-
-		PMD_CLEANQ_LOG_CQBUF(RX, DEBUG, cqbuf);
-
-		err = cleanq_enqueue(
-			q,
-			cqbuf.rid,
-			cqbuf.offset,
-			cqbuf.length,
-			cqbuf.valid_data,
-			cqbuf.valid_length,
-			cqbuf.flags
-		);
-		if(err_is_fail(err)) {
-			rte_mbuf_raw_free(mb);
-			break;
-		}
+	if (nb_bufs >= cleanq_poll_burst(&rxq->cq_refill) ||
+	    rxq->nb_rx_desc - 1 - nb_bufs < nb_pkts) {
+		ixgbe_rx_cleanq_refill(rxq, (uint16_t)nb_bufs);
 	}
 
 	uint16_t nb_rx = 0;
@@ -2068,6 +2043,7 @@ ixgbe_recv_pkts_cleanq(void *rx_queue, struct rte_mbuf **rx_pkts,
 		nb_rx++;
 	}
 
+	cleanq_poll_update(&rxq->cq_refill, nb_rx);
 	return nb_rx;
 }
 #endif
@@ -2787,7 +2763,7 @@ ixgbe_dev_tx_queue_setup(struct rte_eth_dev *dev,
 
 	
 #ifdef RTE_LIBCLEANQ
-	if (err_is_fail(ixgbe_tx_cleanq_create(txq))) {
+	if (err_is_fail(ixgbe_tx_cleanq_create(txq, (int)socket_id))) {
 		ixgbe_tx_queue_release(txq);
 		return -ENOMEM;
 	}
@@ -2979,6 +2955,9 @@ ixgbe_reset_rx_queue(struct ixgbe_adapter *adapter, struct ixgbe_rx_queue *rxq)
 
 #ifdef RTE_LIBCLEANQ
 	rxq->rx_recl = 0;
+	rxq->cq_refilling = 0;
+	cleanq_poll_init(&rxq->cq_refill, IXGBE_CLEANQ_REFILL_MIN,
+			 rxq->rx_free_thresh);
 #endif
 }
 
@@ -3234,7 +3213,7 @@ ixgbe_dev_rx_queue_setup(struct rte_eth_dev *dev,
 	dev->data->rx_queues[queue_idx] = rxq;
 
 #ifdef RTE_LIBCLEANQ
-	if (err_is_fail(ixgbe_rx_cleanq_create(rxq))) {
+	if (err_is_fail(ixgbe_rx_cleanq_create(rxq, (int)socket_id))) {
 		ixgbe_rx_queue_release(rxq);
 		return -ENOMEM;
 	}
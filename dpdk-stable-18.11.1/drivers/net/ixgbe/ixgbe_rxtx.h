@@ -7,6 +7,7 @@
 
 #ifdef RTE_LIBCLEANQ
 #include <cleanq_module.h>
+#include <cleanq_poll.h>
 #endif
 
 /*
@@ -117,6 +118,8 @@ struct ixgbe_rx_queue {
 	uint16_t            rx_tail;  /**< current value of RDT register. */
 #ifdef RTE_LIBCLEANQ
 	uint16_t			rx_recl;  /**< Latest reclaimed buffer */
+	uint8_t			cq_refilling; /**< RDT is written after the refill */
+	struct cleanq_poll	cq_refill; /**< batch of the rx_burst refills */
 #endif
 	uint16_t            nb_rx_hold; /**< number of held free RX desc. */
 	uint16_t rx_nb_avail; /**< nr of staged pkts ready to ret to app */
@@ -147,6 +150,9 @@ struct ixgbe_rx_queue {
 	struct rte_mbuf fake_mbuf;
 	/** hold packets to return to application */
 	struct rte_mbuf *rx_stage[RTE_PMD_IXGBE_RX_MAX_BURST*2];
+#ifdef RTE_LIBCLEANQ
+	struct cleanq_stats cq_stats; /**< see cleanq_get_stats() */
+#endif
 };
 
 /**
@@ -254,6 +260,9 @@ struct ixgbe_tx_queue {
 	uint8_t		    using_ipsec;
 	/**< indicates that IPsec TX feature is in use */
 #endif
+#ifdef RTE_LIBCLEANQ
+	struct cleanq_stats cq_stats; /**< see cleanq_get_stats() */
+#endif
 };
 
 struct ixgbe_txq_ops {
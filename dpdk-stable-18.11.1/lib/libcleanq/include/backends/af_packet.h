@@ -0,0 +1,89 @@
+/*
+ * Copyright (c) 2017 ETH Zurich.
+ * All rights reserved.
+ *
+ * This file is distributed under the terms in the attached LICENSE file.
+ * If you do not find this file, copies can be found by writing to:
+ * ETH Zurich D-INFK, Universitaetstr. 6, CH-8092 Zurich. Attn: Systems Group.
+ */
+
+#ifndef _AF_PACKET_DEVQ_H_
+#define _AF_PACKET_DEVQ_H_
+
+#include <stdint.h>
+#include <cleanq.h>
+
+/*
+ * Queue pair on a Linux network interface through PACKET_MMAP rings, for
+ * running the CleanQ stack on veth pairs or any other interface without a
+ * DPDK driver.
+ *
+ * The receive side reads a TPACKET_V3 ring, the kernel hands over blocks
+ * of packets at once. Buffers posted with cleanq_enqueue() are filled by
+ * copying the next packet into them. With CLEANQ_CTRL_AF_PACKET_ZERO_COPY
+ * set and no buffers posted, cleanq_dequeue() returns the packet in place
+ * in the ring instead; the buffer then has to be enqueued again on the
+ * receive side once done with it, which gives the frame back to the
+ * kernel. The ring has to be registered as a region for that, like any
+ * other memory through the queue on top of the stack, see
+ * af_packet_get_rx_ring(); until then packets are only copied.
+ *
+ * Both sides share the regions registered with either of them, a region
+ * registered with one side can be used on the other as well.
+ *
+ * The send side copies buffers into a TX ring. The buffers are returned
+ * by cleanq_dequeue() right away, the ring is flushed to the kernel with
+ * sendto() for every buffer enqueued with CLEANQ_FLAG_LAST, every
+ * AF_PACKET_TX_BATCH buffers and on cleanq_notify(). Buffers shorter than
+ * an Ethernet header are rejected, frames the kernel cannot send (e.g.
+ * larger than the MTU) are dropped by it without stopping the ring.
+ */
+
+struct af_packet_q;
+struct cleanq;
+
+/*
+ * Control request of the receive side: value non-zero hands out packets in
+ * place in the ring when no buffers are posted, off by default
+ */
+#define CLEANQ_CTRL_AF_PACKET_ZERO_COPY (CLEANQ_CTRL_BACKEND_BASE | 0x200)
+
+/**
+ * @brief creates a queue pair on a network interface
+ *
+ * @param q             Return pointer to the queue pair
+ * @param ifname        name of the interface, e.g. veth0
+ * @param socket_id     NUMA socket to allocate the queue on or
+ *                      CLEANQ_SOCKET_ID_ANY
+ *
+ * @returns error on failure or CLEANQ_ERR_OK on success
+ */
+errval_t af_packet_create(struct af_packet_q** q, const char* ifname,
+                          int socket_id);
+
+errval_t af_packet_destroy(struct af_packet_q* q);
+
+/*
+ * The receive and send side of the queue pair, e.g. to be passed as nic_rx
+ * and nic_tx to the modules of libcleanq_udp
+ */
+struct cleanq* af_packet_get_rx(struct af_packet_q* q);
+struct cleanq* af_packet_get_tx(struct af_packet_q* q);
+
+/**
+ * @brief returns the memory of the receive ring, to be registered with
+ *        cleanq_register() for zero-copy. Packets dequeued in place are
+ *        at cap.vaddr + offset + valid_data. Deregister it only with no
+ *        such packets held.
+ *
+ * @param q             the queue pair
+ * @param cap           return value, the ring memory
+ */
+void af_packet_get_rx_ring(struct af_packet_q* q, struct capref* cap);
+
+/**
+ * @brief returns the MAC address of the interface
+ */
+void af_packet_get_mac(struct af_packet_q* q, uint8_t mac[6]);
+
+#endif // _AF_PACKET_DEVQ_H_
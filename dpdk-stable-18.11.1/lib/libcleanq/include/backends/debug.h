@@ -13,9 +13,18 @@
 struct debug_q;
 
 /**
+ * @brief stacks a debugging queue on top of another queue
+ *
+ * @param q                     Return pointer to the debug queue
+ * @param other_q               The queue to check buffer ownership of
+ * @param socket_id             NUMA socket the ownership tracking is
+ *                              allocated on or CLEANQ_SOCKET_ID_ANY
+ *
+ * @returns error on failure or CLEANQ_ERR_OK on success
  */
 errval_t debug_create(struct debug_q** q,
-                      struct cleanq* other_q);
+                      struct cleanq* other_q,
+                      int socket_id);
 
 errval_t debug_dump_region(struct debug_q* que, regionid_t rid);
 
@@ -32,7 +41,7 @@ void debug_dump_history(struct debug_q* q);
  * @param cap                   cap to the region
  * @param rid                  the regionid of the region
  *
- * @returns error on failure or SYS_ERR_OK on success
+ * @returns error on failure or CLEANQ_ERR_OK on success
  */
 errval_t debug_add_region(struct debug_q*, struct capref cap,
                           regionid_t rid);
@@ -43,7 +52,7 @@ errval_t debug_add_region(struct debug_q*, struct capref cap,
  * @param q                     Return pointer to the descriptor queue
  * @param rid                  the regionid of the region
  *
- * @returns error on failure or SYS_ERR_OK on success
+ * @returns error on failure or CLEANQ_ERR_OK on success
  */
 errval_t debug_remove_region(struct debug_q*, regionid_t rid);
 #endif /* DEVIF_DEBUG_H_ */
@@ -0,0 +1,72 @@
+/*
+ * Copyright (c) 2017 ETH Zurich.
+ * All rights reserved.
+ *
+ * This file is distributed under the terms in the attached LICENSE file.
+ * If you do not find this file, copies can be found by writing to:
+ * ETH Zurich D-INFK, Universitaetstr. 6, CH-8092 Zurich. Attn: Systems Group.
+ */
+
+#ifndef _ETHDEV_DEVQ_H_
+#define _ETHDEV_DEVQ_H_
+
+#include <stdint.h>
+#include <cleanq.h>
+
+/*
+ * Queue pair on an RX and TX queue of an ethdev whose driver does not
+ * implement CleanQ queues itself (net_tap, net_ring, ...), so the CleanQ
+ * stack can run on it. The ethdev queues have to be set up and the port
+ * started before.
+ *
+ * Buffers are mbufs of mempools registered with the queues (see
+ * cleanq_register_mempool()), a region registered with one side is known
+ * to the other as well. The receive side copies what the driver received
+ * into the buffers posted with cleanq_enqueue(), in order, at valid_data
+ * of the buffer. The driver receives into the mempool its queue was set
+ * up with. Until a buffer is posted, packets wait in the driver. Chained
+ * mbufs and packets larger than the posted buffer are dropped.
+ *
+ * The send side sends the mbufs in place: the driver gets a header mbuf of
+ * the queue pair with the data of the buffer attached, the buffer is
+ * returned once the driver or whoever received it freed the header. The
+ * mbufs themselves are not touched. Buffers are sent in bursts of
+ * ETHDEV_Q_BURST, every buffer enqueued with CLEANQ_FLAG_LAST and
+ * cleanq_notify() send right away. The send queue of the ethdev must not
+ * use DEV_TX_OFFLOAD_MBUF_FAST_FREE.
+ */
+
+struct ethdev_q;
+struct cleanq;
+
+#define ETHDEV_Q_BURST 32
+
+/**
+ * @brief creates a queue pair on a queue of an ethdev
+ *
+ * @param q             Return pointer to the queue pair
+ * @param port_id       the port
+ * @param queue_id      the RX and TX queue of the port to use
+ * @param socket_id     NUMA socket to allocate the queue on or
+ *                      CLEANQ_SOCKET_ID_ANY
+ *
+ * @returns error on failure or CLEANQ_ERR_OK on success
+ */
+errval_t ethdev_q_create(struct ethdev_q** q, uint16_t port_id,
+                         uint16_t queue_id, int socket_id);
+
+/**
+ * @brief destroys the queue pair, buffers that were not dequeued go back to
+ *        their mempool. Those the driver still holds stay with it, the
+ *        queue pair is not freed then. Stop the port first.
+ */
+errval_t ethdev_q_destroy(struct ethdev_q* q);
+
+/*
+ * The receive and send side of the queue pair, e.g. to be passed as nic_rx
+ * and nic_tx to the modules of libcleanq_udp
+ */
+struct cleanq* ethdev_q_get_rx(struct ethdev_q* q);
+struct cleanq* ethdev_q_get_tx(struct ethdev_q* q);
+
+#endif // _ETHDEV_DEVQ_H_
@@ -9,6 +9,9 @@
 #ifndef IPCQ_H_
 #define IPCQ_H_ 1
 
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
 #include <cleanq.h>
 
 #define IPCQ_DEFAULT_SIZE 64
@@ -16,6 +19,22 @@
 #define IPCQ_MEM_SIZE IPCQ_DEFAULT_SIZE*IPCQ_ALIGNMENT
 
 struct ipcq;
+struct ipcq_conn;
+struct ipcq_listener;
+
+/*
+ * Descriptor encoding used on the shared memory rings. The compact format
+ * packs four descriptors into a cache line but limits the offset to 32 bit,
+ * lengths to 16 bit, region ids to 16 bit and only keeps the low 12 and
+ * the bits 28-31 of the flags. Regions registered with a compact queue get
+ * 16 bit ids, the ones of a queue stacked on it have to fit as well. A compact ring holds at most 16383
+ * descriptors, larger ring memory is not used. Connections set up over a
+ * socket do not use compact rings larger than IPCQ_COMPACT_MAX_RING_SIZE.
+ */
+typedef enum {
+    IPCQ_DESC_DEFAULT = 0,  ///< one 64 byte descriptor per cache line
+    IPCQ_DESC_COMPACT = 1,  ///< 16 byte descriptors
+} ipcq_desc_format_t;
 
 typedef errval_t (*ipcq_register_t)(struct ipcq *q, struct capref cap,
                                     regionid_t region_id);
@@ -35,6 +54,12 @@ struct ipcq_func_pointer {
  * @param name_recv             Name of the memory use for receiving messages
  * @param clear                 Write 0 to memory
  * @param f                     Function pointers to be called on message recv
+ * @param socket_id             NUMA socket the queue state and the descriptor
+ *                              rings are placed on or CLEANQ_SOCKET_ID_ANY
+ * @param format                Descriptor format, both endpoints have to
+ *                              ask for the same one. The endpoint that comes
+ *                              up second fails with CLEANQ_ERR_INIT_QUEUE
+ *                              on a mismatch.
  *
  * @returns error on failure or SYS_ERR_OK on success
  */
@@ -43,8 +68,153 @@ errval_t ipcq_create(struct ipcq** q,
                      char* name_send,
                      char* name_recv,
                      bool clear, 
-                     struct ipcq_func_pointer* f);
+                     struct ipcq_func_pointer* f,
+                     int socket_id,
+                     ipcq_desc_format_t format);
+
+/**
+ * @brief returns the descriptor format negotiated at create time
+ *
+ * @param q                     The descriptor queue
+ *
+ * @returns the descriptor format used on the rings of this queue
+ */
+ipcq_desc_format_t ipcq_get_desc_format(struct ipcq* q);
+
+errval_t ipcq_destroy(struct ipcq* q);
+
+/*
+ * Connection setup over a UNIX domain socket
+ *
+ * Instead of agreeing on shared memory names, a dataplane listens on a
+ * socket and applications connect to it. On connect the two negotiate the
+ * number of queue pairs, the ring size and the descriptor format; the
+ * listening side then creates the rings of all queue pairs in one memfd
+ * and passes its file descriptor to the other side (SCM_RIGHTS). Nothing
+ * is left behind in /dev/shm: the memory goes away with the last mapping.
+ * A path starting with '@' is a socket in the abstract namespace.
+ *
+ * Regions are shared the same way. ipcq_conn_alloc_region() creates the
+ * memory and hands its file descriptor to the other side, which maps it
+ * once the region is registered on one of the queues. The mapping is kept
+ * until the region is freed with ipcq_conn_free_region() or the connection
+ * is destroyed.
+ */
 
-errval_t icpq_destroy(struct ipcq* q);
+#define IPCQ_MAX_QUEUES 256
+#define IPCQ_MAX_RING_SIZE (1 << 20)
+// largest ring with compact descriptors, all of it holds descriptors
+#define IPCQ_COMPACT_MAX_RING_SIZE (1 << 18)
+
+// ipcq_conn_alloc_region(): back the region with huge pages
+#define IPCQ_REGION_HUGETLB 0x1
+
+struct ipcq_conn_params {
+    uint32_t num_queues;        ///< queue pairs
+    uint32_t ring_size;         ///< bytes per ring, power of two from
+                                ///< IPCQ_MEM_SIZE to IPCQ_MAX_RING_SIZE,
+                                ///< IPCQ_COMPACT_MAX_RING_SIZE for
+                                ///< IPCQ_DESC_COMPACT
+    ipcq_desc_format_t format;
+};
+
+/**
+ * @brief creates a socket to accept connections on
+ *
+ * @param l                     Return pointer to the listener
+ * @param path                  Path of the socket, an existing file is
+ *                              replaced
+ * @param limits                Most queue pairs and largest ring size handed
+ *                              out, and the preferred descriptor format
+ *
+ * @returns CLEANQ_ERR_INIT_QUEUE if the limits are invalid, e.g. a compact
+ *          ring larger than IPCQ_COMPACT_MAX_RING_SIZE, CLEANQ_ERR_OK on
+ *          success
+ */
+errval_t ipcq_listen(struct ipcq_listener** l, const char* path,
+                     const struct ipcq_conn_params* limits);
+
+/**
+ * @brief file descriptor of the listener, readable when a connection is
+ *        waiting to be accepted
+ */
+int ipcq_listener_get_fd(struct ipcq_listener* l);
+
+/**
+ * @brief waits for the next connection and sets up its queue pairs. The
+ *        requests of the other side are cut down to the limits, a format
+ *        other than IPCQ_DESC_DEFAULT and the preferred one falls back to
+ *        IPCQ_DESC_DEFAULT.
+ *
+ * @param l                     The listener
+ * @param c                     Return pointer to the connection
+ * @param f                     Called when the other side registers or
+ *                              deregisters a region, may be NULL
+ * @param socket_id             NUMA socket of the queue state or
+ *                              CLEANQ_SOCKET_ID_ANY
+ *
+ * @returns error on failure or CLEANQ_ERR_OK on success
+ */
+errval_t ipcq_accept(struct ipcq_listener* l, struct ipcq_conn** c,
+                     struct ipcq_func_pointer* f, int socket_id);
+
+/**
+ * @brief closes the socket and removes its file. Connections accepted on it
+ *        stay up.
+ */
+errval_t ipcq_listener_destroy(struct ipcq_listener* l);
+
+/**
+ * @brief connects to a listener and sets up the queue pairs
+ *
+ * @param c                     Return pointer to the connection
+ * @param path                  Path of the socket
+ * @param params                Requested queue pairs, ring size and format,
+ *                              see ipcq_conn_get_params() for what was agreed
+ * @param f                     Called when the other side registers or
+ *                              deregisters a region, may be NULL
+ * @param socket_id             NUMA socket of the queue state or
+ *                              CLEANQ_SOCKET_ID_ANY
+ *
+ * @returns error on failure or CLEANQ_ERR_OK on success
+ */
+errval_t ipcq_connect(struct ipcq_conn** c, const char* path,
+                      const struct ipcq_conn_params* params,
+                      struct ipcq_func_pointer* f, int socket_id);
+
+/**
+ * @brief returns what the two sides agreed on
+ */
+void ipcq_conn_get_params(struct ipcq_conn* c, struct ipcq_conn_params* params);
+
+/**
+ * @brief returns queue pair i of the connection, from 0 to num_queues - 1
+ */
+struct ipcq* ipcq_conn_get_queue(struct ipcq_conn* c, uint32_t i);
+
+/**
+ * @brief allocates memory the other side can map, to be registered on the
+ *        queues of the connection
+ *
+ * @param c                     The connection
+ * @param len                   Size of the region, rounded up to pages
+ * @param flags                 IPCQ_REGION_HUGETLB or 0
+ * @param cap                   Return value, the memory
+ *
+ * @returns error on failure or CLEANQ_ERR_OK on success
+ */
+errval_t ipcq_conn_alloc_region(struct ipcq_conn* c, size_t len, int flags,
+                                struct capref* cap);
+
+/**
+ * @brief unmaps a region of ipcq_conn_alloc_region(), after deregistering it,
+ *        and tells the other side to unmap it as well
+ */
+errval_t ipcq_conn_free_region(struct ipcq_conn* c, struct capref* cap);
+
+/**
+ * @brief destroys the queue pairs and closes the connection
+ */
+errval_t ipcq_conn_destroy(struct ipcq_conn* c);
 
 #endif /* IPCQ_H_ */
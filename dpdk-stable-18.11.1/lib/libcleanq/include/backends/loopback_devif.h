@@ -12,7 +12,16 @@
 
 struct loopback_queue;
 
-errval_t loopback_queue_create(struct loopback_queue** q);
+/**
+ * @brief creates a loopback queue
+ *
+ * @param q             Return pointer to the loopback queue
+ * @param socket_id     NUMA socket to allocate the queue on or
+ *                      CLEANQ_SOCKET_ID_ANY
+ *
+ * @returns error on failure or CLEANQ_ERR_OK on success
+ */
+errval_t loopback_queue_create(struct loopback_queue** q, int socket_id);
 
 
 #endif // _LOOPBACK_DEVQ_H_
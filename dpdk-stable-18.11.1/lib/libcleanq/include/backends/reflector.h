@@ -0,0 +1,60 @@
+/*
+ * Copyright (c) 2017 ETH Zurich.
+ * All rights reserved.
+ *
+ * This file is distributed under the terms in the attached LICENSE file.
+ * If you do not find this file, copies can be found by writing to:
+ * ETH Zurich D-INFK, Universitaetstr. 6, CH-8092 Zurich. Attn: Systems Group.
+ */
+
+#ifndef _REFLECTOR_DEVQ_H_
+#define _REFLECTOR_DEVQ_H_
+
+#include <stdint.h>
+#include <cleanq.h>
+
+/*
+ * Queue pair that stands in for a NIC with a peer that echoes everything
+ * back, so a stack of modules can be run and measured without hardware.
+ *
+ * A buffer enqueued on the send side is copied into the next buffer posted
+ * on the receive side, with the Ethernet addresses, and for IPv4 the IP
+ * addresses and UDP ports, swapped. The checksums stay valid. The received
+ * buffer is returned by cleanq_dequeue() on the receive side with the flags
+ * it was posted with, the sent one right away on the send side. Packets for
+ * which no buffer is posted are dropped.
+ *
+ * Regions registered on either side are known to both.
+ */
+
+struct reflector_q;
+struct cleanq;
+
+/**
+ * @brief creates a reflector queue pair
+ *
+ * @param q             Return pointer to the queue pair
+ * @param socket_id     NUMA socket to allocate the queue on or
+ *                      CLEANQ_SOCKET_ID_ANY
+ *
+ * @returns error on failure or CLEANQ_ERR_OK on success
+ */
+errval_t reflector_create(struct reflector_q** q, int socket_id);
+
+errval_t reflector_destroy(struct reflector_q* q);
+
+/*
+ * The receive and send side of the queue pair, e.g. to be passed as nic_rx
+ * and nic_tx to the modules of libcleanq_udp
+ */
+struct cleanq* reflector_get_rx(struct reflector_q* q);
+struct cleanq* reflector_get_tx(struct reflector_q* q);
+
+/**
+ * @brief returns the number of packets reflected and dropped for lack of
+ *        a posted buffer
+ */
+void reflector_get_stats(struct reflector_q* q, uint64_t* reflected,
+                         uint64_t* dropped);
+
+#endif // _REFLECTOR_DEVQ_H_
@@ -0,0 +1,92 @@
+/*
+ * Copyright (c) 2017 ETH Zurich.
+ * All rights reserved.
+ *
+ * This file is distributed under the terms in the attached LICENSE file.
+ * If you do not find this file, copies can be found by writing to:
+ * ETH Zurich D-INFK, Universitaetstr. 6, CH-8092 Zurich. Attn: Systems Group.
+ */
+
+#ifndef _VHOST_USER_DEVQ_H_
+#define _VHOST_USER_DEVQ_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <cleanq.h>
+
+/*
+ * Queue pair on the virtio-net device of a VM or container, connected
+ * through a vhost-user socket (QEMU, or virtio_user in another DPDK
+ * process). Only the first queue pair of the device is used, the vrings
+ * are polled and no offloads are negotiated.
+ *
+ * The receive side returns what the guest sends. Buffers posted with
+ * cleanq_enqueue() are filled by copying. With
+ * CLEANQ_CTRL_VHOST_USER_ZERO_COPY set and no buffers posted,
+ * cleanq_dequeue() returns the guest buffer itself: the guest memory
+ * regions are regions of both sides (see vhost_user_get_region()),
+ * registered once the device is up. Their ids are taken from the region
+ * pools when the queue pair is created, two sets that the memory tables of
+ * the guest use in turn. Such a buffer goes back to the guest when it is
+ * enqueued on the receive side again. Queues stacked on top have to add
+ * the regions with cleanq_add_region() to pass those buffers on.
+ *
+ * The send side copies into the buffers the guest posted for receiving,
+ * the buffers are returned by cleanq_dequeue() right away.
+ *
+ * When the guest goes away or remaps its memory, buffers still dequeued in
+ * place are unmapped and enqueueing them again is a no-op. That holds for
+ * the mapping before the current one only, buffers of older mappings must
+ * not be enqueued. Until the device is up the receive side is empty and the
+ * send side full.
+ */
+
+struct vhost_user_q;
+struct cleanq;
+
+/*
+ * Control request of the receive side: value non-zero hands out the guest
+ * buffers in place when no buffers are posted, off by default
+ */
+#define CLEANQ_CTRL_VHOST_USER_ZERO_COPY (CLEANQ_CTRL_BACKEND_BASE | 0x300)
+
+/**
+ * @brief creates a vhost-user socket and the queue pair for the device
+ *        connecting to it
+ *
+ * @param q             Return pointer to the queue pair
+ * @param path          path of the UNIX socket, created by us
+ * @param socket_id     NUMA socket to allocate the queue on or
+ *                      CLEANQ_SOCKET_ID_ANY
+ *
+ * @returns error on failure or CLEANQ_ERR_OK on success
+ */
+errval_t vhost_user_create(struct vhost_user_q** q, const char* path,
+                           int socket_id);
+
+errval_t vhost_user_destroy(struct vhost_user_q* q);
+
+/*
+ * The receive and send side of the queue pair, e.g. to be passed as nic_rx
+ * and nic_tx to the modules of libcleanq_udp
+ */
+struct cleanq* vhost_user_get_rx(struct vhost_user_q* q);
+struct cleanq* vhost_user_get_tx(struct vhost_user_q* q);
+
+/**
+ * @brief returns where a guest memory region is mapped, to access buffers
+ *        dequeued in place. The mapping changes when the guest reconnects,
+ *        so call it from the thread using the receive side.
+ *
+ * @param q             the queue pair
+ * @param rid           region id of a buffer dequeued in place
+ * @param va            return value, the address of the region
+ * @param len           return value, its size
+ *
+ * @returns CLEANQ_ERR_INVALID_REGION_ID if rid is not a region of the
+ *          current guest, CLEANQ_ERR_OK otherwise
+ */
+errval_t vhost_user_get_region(struct vhost_user_q* q, regionid_t rid,
+                               void** va, size_t* len);
+
+#endif // _VHOST_USER_DEVQ_H_
@@ -14,8 +14,58 @@
 #include <string.h>
 #include <assert.h>
 
+#include <rte_memory.h>
+
 #define CLEANQ_FLAG_LAST (1UL << 30)
 
+// Allocate queue state without NUMA placement (plain libc heap)
+#define CLEANQ_SOCKET_ID_ANY (-1)
+
+/*
+ * Control requests every queue module has to handle (or pass on to the
+ * queues it is stacked on). Backend specific requests start at
+ * CLEANQ_CTRL_BACKEND_BASE.
+ */
+#define CLEANQ_CTRL_SET_VALIDATION 1
+#define CLEANQ_CTRL_SET_REGION_HEADROOM 2
+#define CLEANQ_CTRL_BACKEND_BASE (1UL << 16)
+
+/*
+ * RX interrupts of the device below a receive queue (see
+ * cleanq_rx_intr_enable). Modules pass them on, queues without interrupts
+ * return CLEANQ_ERR_INVALID_CTRL.
+ */
+#define CLEANQ_CTRL_RX_INTR_ENABLE 3
+#define CLEANQ_CTRL_RX_INTR_DISABLE 4
+#define CLEANQ_CTRL_RX_INTR_FD 5
+
+/*
+ * The statistics of a queue (see cleanq_get_stats). Every queue and module
+ * answers it for itself, it is not passed on.
+ */
+#define CLEANQ_CTRL_GET_STATS 6
+
+// value of CLEANQ_CTRL_SET_REGION_HEADROOM, region id in the lower and
+// headroom in the upper 32 bits (see cleanq_set_region_headroom)
+#define CLEANQ_CTRL_REGION_HEADROOM(rid, headroom) \
+    (((uint64_t) (headroom) << 32) | (uint32_t) (rid))
+#define CLEANQ_CTRL_REGION_HEADROOM_RID(value) ((regionid_t) ((value) & 0xFFFFFFFF))
+#define CLEANQ_CTRL_REGION_HEADROOM_LEN(value) ((genoffset_t) ((value) >> 32))
+
+/*
+ * Which buffers a queue checks against its registered regions
+ * (see cleanq_set_validation)
+ */
+typedef enum {
+    // check buffers passed to cleanq_enqueue/cleanq_dequeue of this queue,
+    // but not the ones a module stacked on top passes down (default)
+    CLEANQ_VALIDATE_OUTERMOST = 0,
+    // check at every layer of a queue stack
+    CLEANQ_VALIDATE_FULL = 1,
+    // never check, every user of the queue is trusted
+    CLEANQ_VALIDATE_TRUSTED = 2,
+} cleanq_validation_t;
+
 typedef uint32_t regionid_t;
 typedef uint32_t bufferid_t;
 typedef uint64_t genoffset_t;
@@ -39,6 +89,39 @@ struct cleanq_buf{
     regionid_t rid; // 44
 };
 
+/*
+ * Counters of one queue, or one side of a queue with separate receive and
+ * transmit queues. They are only written by the lcore running the datapath
+ * of the queue, other lcores read them with cleanq_get_stats().
+ */
+struct cleanq_stats {
+    // buffers and valid bytes enqueued/dequeued
+    uint64_t enq;
+    uint64_t deq;
+    uint64_t enq_bytes;
+    uint64_t deq_bytes;
+    // enqueues that failed with CLEANQ_ERR_QUEUE_FULL
+    uint64_t full;
+    // dequeues that failed with CLEANQ_ERR_QUEUE_EMPTY
+    uint64_t empty;
+    // buffers the queue rejected, e.g. not owned ones in the debug queue.
+    // The region checks of cleanq_enqueue() happen before and are not counted
+    uint64_t invalid;
+    // packets the queue dropped: received ones that fail the checksum,
+    // address or port checks of a module, ones to send that are returned
+    // unsent (e.g. no ARP answer)
+    uint64_t dropped;
+    // received packets dropped for the error of the same name
+    uint64_t drop_chksum;       // CLEANQ_ERR_IP_CHKSUM
+    uint64_t drop_wrong_ip;     // CLEANQ_ERR_IP_WRONG_IP
+    uint64_t drop_wrong_proto;  // CLEANQ_ERR_IP_WRONG_PROTO
+    uint64_t drop_wrong_port;   // CLEANQ_ERR_UDP_WRONG_PORT
+    // buffers in the queue (enq - deq), filled in by cleanq_get_stats()
+    uint64_t occupancy;
+    // highest occupancy so far
+    uint64_t high_watermark;
+} __rte_cache_aligned;
+
 typedef enum {
     CLEANQ_ERR_OK = 0,
     CLEANQ_ERR_INIT_QUEUE,
@@ -57,16 +140,17 @@ typedef enum {
     CLEANQ_ERR_UDP_WRONG_PORT,
     CLEANQ_ERR_IP_WRONG_IP,
     CLEANQ_ERR_IP_WRONG_PROTO,
-    CLEANQ_ERR_IP_CHKSUM
+    CLEANQ_ERR_IP_CHKSUM,
+    CLEANQ_ERR_INVALID_CTRL
 } errval_t;
 
 
-inline int err_is_ok(errval_t err) 
+static inline int err_is_ok(errval_t err) 
 {
     return err == CLEANQ_ERR_OK;
 }
 
-inline int err_is_fail(errval_t err) 
+static inline int err_is_fail(errval_t err) 
 {
     return err != CLEANQ_ERR_OK;
 }
@@ -189,6 +273,99 @@ errval_t cleanq_control(struct cleanq *q,
                       uint64_t value,
                       uint64_t *result);
 
+/**
+ * @brief Set how buffers on this queue and the queues it is stacked on are
+ *        checked against the registered regions. Debug builds
+ *        (CONFIG_RTE_LIBCLEANQ_DEBUG) check every buffer regardless.
+ *
+ * @param q          The device queue to call the operation on
+ * @param policy     The validation policy, the queues below get the same
+ *
+ * @returns error on failure or SYS_ERR_OK on success
+ *
+ */
+errval_t cleanq_set_validation(struct cleanq *q,
+                               cleanq_validation_t policy);
+
+/**
+ * @brief Set the layout of the buffers of a region: valid_data of a buffer
+ *        is relative to offset + headroom. For a mempool of mbufs the
+ *        headroom is the struct rte_mbuf (and private area) in front of the
+ *        data, cleanq_register_mempool() sets it. The default is 0.
+ *
+ *        Modules place their headers and payload by this, the queues below
+ *        get the same layout.
+ *
+ * @param q          The device queue to call the operation on
+ * @param region_id  The region the layout is for
+ * @param headroom   Bytes from the start of a buffer to its data area
+ *
+ * @returns error on failure or SYS_ERR_OK on success
+ *
+ */
+errval_t cleanq_set_region_headroom(struct cleanq *q,
+                                    regionid_t region_id,
+                                    genoffset_t headroom);
+
+/**
+ * @brief Arm the RX interrupt of a receive queue: the next packet the device
+ *        receives makes the file descriptor of cleanq_rx_intr_fd() readable.
+ *        The interrupt fires once, it is armed again after every wakeup.
+ *
+ *        As with rte_eth_dev_rx_intr_enable() the port has to be configured
+ *        with intr_conf.rxq set. A packet that came in before the interrupt
+ *        was armed does not fire it, so the queue is polled once more after
+ *        arming and before sleeping.
+ *
+ * @param q          The receive queue
+ *
+ * @returns error on failure or SYS_ERR_OK on success
+ *
+ */
+errval_t cleanq_rx_intr_enable(struct cleanq *q);
+
+/**
+ * @brief Disarm the RX interrupt of a receive queue, to be called when
+ *        polling again after a wakeup
+ *
+ * @param q          The receive queue
+ *
+ * @returns error on failure or SYS_ERR_OK on success
+ *
+ */
+errval_t cleanq_rx_intr_disable(struct cleanq *q);
+
+/**
+ * @brief Get the event fd the RX interrupts of a receive queue are signalled
+ *        on. It can be waited on with epoll()/poll() (the 8 byte counter has
+ *        to be read after a wakeup) or added to an rte_epoll instance with
+ *        rte_eth_dev_rx_intr_ctl_q() as in l3fwd-power.
+ *
+ * @param q          The receive queue
+ * @param fd         Return pointer to the fd
+ *
+ * @returns error on failure or SYS_ERR_OK on success
+ *
+ */
+errval_t cleanq_rx_intr_fd(struct cleanq *q, int *fd);
+
+/**
+ * @brief Read the statistics of a queue. Only this layer is counted, the
+ *        queues a module is stacked on have their own statistics, so
+ *        comparing the layers of a stack shows where packets are dropped.
+ *
+ *        The counters are read while the datapath keeps running, they are
+ *        consistent each on its own but not with each other. There is no
+ *        reset, the difference of two snapshots covers an interval.
+ *
+ * @param q          The device queue to call the operation on
+ * @param stats      Return pointer to a snapshot of the counters
+ *
+ * @returns error on failure or SYS_ERR_OK on success
+ *
+ */
+errval_t cleanq_get_stats(struct cleanq *q, struct cleanq_stats *stats);
+
 
  /**
   * @brief destroys the device queue
@@ -23,6 +23,42 @@ cleanq_register_mempool(struct cleanq *q, struct rte_mempool *mp);
 errval_t
 cleanq_deregister_mempool(struct cleanq *q, struct rte_mempool *mp);
 
+/**
+ * @brief Looks up the region of a mempool registered with
+ *        cleanq_register_mempool(), so that mbufs of it can be converted
+ *        without searching the region pool every time
+ *
+ * @param q             queue the mempool was registered with
+ * @param mp            the mempool
+ * @param rid           return value, the region id
+ * @param base_addr     return value, the address that buffer offsets
+ *                      are relative to
+ *
+ * @returns CLEANQ_ERR_INVALID_REGION_ID if the mempool is not registered
+ */
+errval_t
+cleanq_mempool_region(struct cleanq *q, struct rte_mempool *mp,
+                      regionid_t *rid, uint64_t *base_addr);
+
+/**
+ * @brief Handles the CLEANQ_CTRL_RX_INTR_* requests for a queue on top of an
+ *        ethdev RX queue with the rte_eth_dev_rx_intr_*() functions. After
+ *        a wakeup the event fd is read by CLEANQ_CTRL_RX_INTR_DISABLE with
+ *        rte_epoll_wait(), so it is only readable again after the next
+ *        interrupt. Queues the application added to an rte_epoll instance
+ *        with rte_eth_dev_rx_intr_ctl_q() are read by its rte_epoll_wait().
+ *
+ * @param port_id       the port
+ * @param queue_id      the RX queue of the port
+ * @param request       CLEANQ_CTRL_RX_INTR_ENABLE, _DISABLE or _FD
+ * @param result        return value, the fd for CLEANQ_CTRL_RX_INTR_FD
+ *
+ * @returns CLEANQ_ERR_INVALID_CTRL if the port has no RX interrupts
+ */
+errval_t
+cleanq_ethdev_rx_intr_control(uint16_t port_id, uint16_t queue_id,
+                              uint64_t request, uint64_t *result);
+
 void
 mbuf_to_cleanq_buf(
     struct cleanq *q,
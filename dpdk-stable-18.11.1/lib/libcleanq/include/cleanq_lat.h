@@ -0,0 +1,93 @@
+/*
+ * Copyright (c) 2017 ETH Zurich.
+ * All rights reserved.
+ *
+ * This file is distributed under the terms in the attached LICENSE file.
+ * If you do not find this file, copies can be found by writing to:
+ * ETH Zurich D-INFK, Universitaetstr. 6, CH-8092 Zurich. Attn: Systems Group.
+ */
+#ifndef CLEANQ_LAT_H_
+#define CLEANQ_LAT_H_ 1
+
+/*
+ * Latency histogram in TSC cycles
+ *
+ * Values below CLEANQ_LAT_SUB have a bucket each, above that every power of
+ * two is split into CLEANQ_LAT_SUB buckets, so a bucket is at most 1/8 of
+ * its value wide. A histogram is written by one lcore with cleanq_lat_add(),
+ * others can read it at any time (see cleanq_metrics_add_latency()).
+ */
+
+#include <stdint.h>
+#include <rte_common.h>
+#include <rte_memory.h>
+
+#define CLEANQ_LAT_SUB_BITS 3
+#define CLEANQ_LAT_SUB (1 << CLEANQ_LAT_SUB_BITS)
+#define CLEANQ_LAT_BUCKETS ((64 - CLEANQ_LAT_SUB_BITS + 1) * CLEANQ_LAT_SUB)
+
+struct cleanq_lat_hist {
+    uint64_t count[CLEANQ_LAT_BUCKETS];
+} __rte_cache_aligned;
+
+static inline uint32_t
+cleanq_lat_bucket(uint64_t cycles)
+{
+    uint32_t shift;
+
+    if (cycles < CLEANQ_LAT_SUB)
+        return cycles;
+    shift = 63 - __builtin_clzll(cycles) - CLEANQ_LAT_SUB_BITS;
+    return ((shift + 1) << CLEANQ_LAT_SUB_BITS) +
+           ((cycles >> shift) & (CLEANQ_LAT_SUB - 1));
+}
+
+// lowest value of a bucket
+static inline uint64_t
+cleanq_lat_bucket_low(uint32_t b)
+{
+    uint32_t shift;
+
+    if (b < CLEANQ_LAT_SUB)
+        return b;
+    shift = (b >> CLEANQ_LAT_SUB_BITS) - 1;
+    return ((uint64_t) (CLEANQ_LAT_SUB + (b & (CLEANQ_LAT_SUB - 1)))) << shift;
+}
+
+static inline void
+cleanq_lat_add(struct cleanq_lat_hist *h, uint64_t cycles)
+{
+    h->count[cleanq_lat_bucket(cycles)]++;
+}
+
+static inline uint64_t
+cleanq_lat_total(const struct cleanq_lat_hist *h)
+{
+    uint64_t total = 0;
+
+    for (uint32_t b = 0; b < CLEANQ_LAT_BUCKETS; b++)
+        total += h->count[b];
+    return total;
+}
+
+// the lowest value of the bucket of the p-quantile (0 < p < 1), in cycles
+static inline uint64_t
+cleanq_lat_percentile(const struct cleanq_lat_hist *h, double p)
+{
+    uint64_t total = cleanq_lat_total(h);
+    uint64_t sum = 0;
+    uint64_t target;
+
+    if (total == 0)
+        return 0;
+
+    target = RTE_MAX((uint64_t) (p * total), (uint64_t) 1);
+    for (uint32_t b = 0; b < CLEANQ_LAT_BUCKETS; b++) {
+        sum += h->count[b];
+        if (sum >= target)
+            return cleanq_lat_bucket_low(b);
+    }
+    return 0;
+}
+
+#endif /* CLEANQ_LAT_H_ */
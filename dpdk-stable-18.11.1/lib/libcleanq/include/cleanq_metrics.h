@@ -0,0 +1,94 @@
+/*
+ * Copyright (c) 2017 ETH Zurich.
+ * All rights reserved.
+ *
+ * This file is distributed under the terms in the attached LICENSE file.
+ * If you do not find this file, copies can be found by writing to:
+ * ETH Zurich D-INFK, Universitaetstr. 6, CH-8092 Zurich. Attn: Systems Group.
+ */
+#ifndef CLEANQ_METRICS_H_
+#define CLEANQ_METRICS_H_ 1
+
+/*
+ * Exports the statistics of CleanQ queues through librte_metrics
+ *
+ * Queues are added with the name of their layer and the port they run on.
+ * Every layer gets the metrics cleanq_<layer>_<counter>, one for every
+ * counter of struct cleanq_stats, summed over the queues of the layer on a
+ * port (the high watermark is the highest of them). Queues not belonging to
+ * a port are added with RTE_METRICS_GLOBAL. librte_telemetry reports the
+ * metrics of a port next to its xstats, dpdk-procinfo --metrics shows them
+ * as well.
+ *
+ * cleanq_metrics_update() copies the counters into the metrics, it only
+ * reads them (cleanq_get_stats()) and can run on any thread while the
+ * datapath keeps going. cleanq_metrics_start() runs it periodically with
+ * an EAL alarm, no lcore is needed for it.
+ *
+ *   rte_metrics_init(rte_socket_id());
+ *   cleanq_metrics_add_queue(nic_rx, port, "nic_rx");
+ *   cleanq_metrics_add_queue(udp, port, "udp");
+ *   cleanq_metrics_start(1000000);
+ */
+
+#include <stdint.h>
+#include <cleanq.h>
+
+struct cleanq_lat_hist;
+
+// layer names are at most this long (the metric names are limited)
+#define CLEANQ_METRICS_LAYER_LEN 32
+
+/**
+ * @brief Adds a queue to the exported ones
+ *
+ * @param q          The queue, it has to answer CLEANQ_CTRL_GET_STATS
+ * @param port_id    The port the queue runs on or RTE_METRICS_GLOBAL
+ * @param layer      The layer of the queue, e.g. "nic_rx" or "udp"
+ *
+ * @returns error on failure or SYS_ERR_OK on success
+ */
+errval_t cleanq_metrics_add_queue(struct cleanq *q, int port_id,
+                                  const char *layer);
+
+/**
+ * @brief Adds a latency histogram (cleanq_lat.h) of a layer. The layer gets
+ *        the metrics cleanq_<layer>_lat_count and _lat_p50_ns, _lat_p99_ns,
+ *        _lat_p999_ns over the histograms of the layer on a port.
+ *
+ * @param h          The histogram, written by the datapath
+ * @param port_id    The port or RTE_METRICS_GLOBAL
+ * @param layer      The layer the latency is measured at
+ *
+ * @returns error on failure or SYS_ERR_OK on success
+ */
+errval_t cleanq_metrics_add_latency(const struct cleanq_lat_hist *h,
+                                    int port_id, const char *layer);
+
+/**
+ * @brief Stops exporting a queue or histogram, before it is destroyed. The
+ *        metrics of its layer stay registered.
+ *
+ * @param source     The queue or histogram
+ */
+void cleanq_metrics_remove(const void *source);
+
+/**
+ * @brief Copies the counters of all added queues and histograms into the
+ *        metrics
+ *
+ * @returns error on failure or SYS_ERR_OK on success
+ */
+errval_t cleanq_metrics_update(void);
+
+/**
+ * @brief Runs cleanq_metrics_update() every period_us microseconds on the
+ *        EAL interrupt thread, until cleanq_metrics_stop()
+ *
+ * @returns error on failure or SYS_ERR_OK on success
+ */
+errval_t cleanq_metrics_start(uint64_t period_us);
+
+void cleanq_metrics_stop(void);
+
+#endif /* CLEANQ_METRICS_H_ */
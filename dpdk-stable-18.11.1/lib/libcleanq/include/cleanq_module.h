@@ -152,9 +152,145 @@ struct cleanq {
 
 errval_t cleanq_init(struct cleanq *q);
 
+/**
+ * @brief Same as cleanq_init, but the region management of the queue is
+ *        allocated on the given NUMA socket
+ *
+ * @param q          The device queue to initialize
+ * @param socket_id  NUMA socket of the lcore/device using the queue or
+ *                   CLEANQ_SOCKET_ID_ANY
+ *
+ * @returns error on failure or SYS_ERR_OK on success
+ */
+errval_t cleanq_init_socket(struct cleanq *q, int socket_id);
+
+/**
+ * @brief Allocates zeroed memory for queue state. With a socket id the
+ *        memory is taken from the DPDK heap of that socket, with
+ *        CLEANQ_SOCKET_ID_ANY it comes from the libc heap so that queues
+ *        can still be used without an initialized EAL.
+ *
+ * @param size       Number of bytes to allocate
+ * @param socket_id  NUMA socket or CLEANQ_SOCKET_ID_ANY
+ *
+ * @returns pointer to the memory or NULL on failure
+ */
+void* cleanq_malloc_socket(size_t size, int socket_id);
+
+/**
+ * @brief Frees memory allocated by cleanq_malloc_socket
+ *
+ * @param ptr        The memory to free
+ * @param socket_id  The socket id that was used for the allocation
+ */
+void cleanq_free_socket(void* ptr, int socket_id);
+
 errval_t cleanq_add_region(struct cleanq*, struct capref cap,
                          regionid_t rid);
 
 errval_t cleanq_remove_region(struct cleanq*, regionid_t rid);
 
+/**
+ * @brief check a buffer passed to the datapath of a queue against its
+ *        regions, as cleanq_enqueue/cleanq_dequeue do. Skipped if the
+ *        queue is trusted.
+ *
+ * @returns non-zero if the buffer is valid or does not need a check
+ */
+int cleanq_buffer_valid(struct cleanq* q,
+                        regionid_t region_id,
+                        genoffset_t offset,
+                        genoffset_t length,
+                        genoffset_t valid_data,
+                        genoffset_t valid_length);
+
+/**
+ * @brief check a buffer a module passes to (or gets from) a queue it is
+ *        stacked on. Only done if the lower queue does full validation.
+ *
+ * @returns non-zero if the buffer is valid or does not need a check
+ */
+int cleanq_buffer_valid_inner(struct cleanq* q,
+                              regionid_t region_id,
+                              genoffset_t offset,
+                              genoffset_t length,
+                              genoffset_t valid_data,
+                              genoffset_t valid_length);
+
+/*
+ * ===========================================================================
+ * Statistics
+ * ===========================================================================
+ */
+/*
+ * A queue keeps a struct cleanq_stats per side, counts the result of every
+ * enqueue/dequeue of its datapath functions with these and answers
+ * CLEANQ_CTRL_GET_STATS with cleanq_stats_control(). Modules count what
+ * they get from the queue below themselves, a packet they drop is counted
+ * with cleanq_stats_drop() and not as a dequeue.
+ */
+static inline void cleanq_stats_enq(struct cleanq_stats* s, errval_t err,
+                                    genoffset_t valid_length)
+{
+    if (err == CLEANQ_ERR_OK) {
+        s->enq++;
+        s->enq_bytes += valid_length;
+        if (s->enq > s->deq + s->high_watermark) {
+            s->high_watermark = s->enq - s->deq;
+        }
+    } else if (err == CLEANQ_ERR_QUEUE_FULL) {
+        s->full++;
+    } else {
+        s->invalid++;
+    }
+}
+
+static inline void cleanq_stats_deq(struct cleanq_stats* s, errval_t err,
+                                    genoffset_t valid_length)
+{
+    if (err == CLEANQ_ERR_OK) {
+        s->deq++;
+        s->deq_bytes += valid_length;
+    } else if (err == CLEANQ_ERR_QUEUE_EMPTY) {
+        s->empty++;
+    } else {
+        s->invalid++;
+    }
+}
+
+// a received buffer the queue gave back to the queue below
+static inline void cleanq_stats_drop(struct cleanq_stats* s)
+{
+    s->dropped++;
+}
+
+// the same for a packet that failed a check, counted by the error returned
+static inline void cleanq_stats_drop_err(struct cleanq_stats* s, errval_t err)
+{
+    s->dropped++;
+    switch (err) {
+    case CLEANQ_ERR_IP_CHKSUM:
+        s->drop_chksum++;
+        break;
+    case CLEANQ_ERR_IP_WRONG_IP:
+        s->drop_wrong_ip++;
+        break;
+    case CLEANQ_ERR_IP_WRONG_PROTO:
+        s->drop_wrong_proto++;
+        break;
+    case CLEANQ_ERR_UDP_WRONG_PORT:
+        s->drop_wrong_port++;
+        break;
+    default:
+        break;
+    }
+}
+
+static inline errval_t cleanq_stats_control(struct cleanq_stats* s,
+                                            uint64_t* result)
+{
+    *result = (uint64_t) (uintptr_t) s;
+    return CLEANQ_ERR_OK;
+}
+
 #endif /* QUEUE_INTERFACE_BACKEND_H_ */
@@ -0,0 +1,146 @@
+/*
+ * Copyright (c) 2017 ETH Zurich.
+ * All rights reserved.
+ *
+ * This file is distributed under the terms in the attached LICENSE file.
+ * If you do not find this file, copies can be found by writing to:
+ * ETH Zurich D-INFK, Universitaetstr. 6, CH-8092 Zurich. Attn: Systems Group.
+ */
+#ifndef CLEANQ_POLL_H_
+#define CLEANQ_POLL_H_ 1
+
+/*
+ * Adaptive polling of a CleanQ RX queue
+ *
+ * A poll loop asks cleanq_poll_burst() how many buffers to dequeue and
+ * reports how many it got with cleanq_poll_update(). The burst follows the
+ * occupancy of the queue: it doubles when a poll comes back full and halves
+ * when several polls in a row used less than a quarter of it or a poll came
+ * back empty. At low load the packets are handed on as they come, under
+ * load the burst grows to max_burst and the per-burst costs are spread over
+ * more packets.
+ *
+ * Empty polls back off: after idle_polls empty polls in a row every further
+ * empty poll spins in cleanq_poll_wait() for 1, 2, 4, ... rte_pause() up to
+ * max_pause. The state returned by cleanq_poll_update() tells the loop when
+ * the queue went idle or is asleep (the back off is at max_pause), so it can
+ * lower the frequency of the core or sleep. The first packet resets it.
+ *
+ *   cleanq_poll_init(&p, 1, 64);
+ *   for (;;) {
+ *       n = rx_burst(q, bufs, cleanq_poll_burst(&p));
+ *       if (cleanq_poll_update(&p, n) != CLEANQ_POLL_BUSY)
+ *           cleanq_poll_wait(&p);
+ *       ...
+ *   }
+ */
+
+#include <stdint.h>
+#include <rte_branch_prediction.h>
+#include <rte_common.h>
+#include <rte_pause.h>
+
+// defaults of cleanq_poll_init(), they can be changed afterwards
+#define CLEANQ_POLL_SHRINK_POLLS 4
+#define CLEANQ_POLL_IDLE_POLLS 64
+#define CLEANQ_POLL_MAX_PAUSE 1024
+
+enum cleanq_poll_state {
+    // packets, or not enough empty polls to back off
+    CLEANQ_POLL_BUSY,
+    // empty polls, backing off
+    CLEANQ_POLL_IDLE,
+    // the back off is at max_pause
+    CLEANQ_POLL_SLEEP,
+};
+
+struct cleanq_poll {
+    uint16_t burst;
+    uint16_t min_burst;
+    uint16_t max_burst;
+    // polls in a row below a quarter of the burst before it is halved
+    uint16_t shrink_polls;
+    // empty polls in a row before backing off
+    uint32_t idle_polls;
+    uint32_t max_pause;
+
+    uint16_t nb_low;
+    uint32_t nb_empty;
+    // rte_pause() per empty poll, 0 until idle
+    uint32_t pause;
+};
+
+static inline void
+cleanq_poll_init(struct cleanq_poll *p, uint16_t min_burst, uint16_t max_burst)
+{
+    if (min_burst == 0)
+        min_burst = 1;
+    if (max_burst < min_burst)
+        max_burst = min_burst;
+
+    p->burst = min_burst;
+    p->min_burst = min_burst;
+    p->max_burst = max_burst;
+    p->shrink_polls = CLEANQ_POLL_SHRINK_POLLS;
+    p->idle_polls = CLEANQ_POLL_IDLE_POLLS;
+    p->max_pause = CLEANQ_POLL_MAX_PAUSE;
+    p->nb_low = 0;
+    p->nb_empty = 0;
+    p->pause = 0;
+}
+
+// the number of buffers the next poll should dequeue at most
+static inline uint16_t
+cleanq_poll_burst(const struct cleanq_poll *p)
+{
+    return p->burst;
+}
+
+/*
+ * Takes the number of buffers the last poll returned and adapts the burst
+ * and the back off
+ */
+static inline enum cleanq_poll_state
+cleanq_poll_update(struct cleanq_poll *p, uint16_t nb_rx)
+{
+    if (likely(nb_rx > 0)) {
+        p->nb_empty = 0;
+        p->pause = 0;
+
+        if (nb_rx >= p->burst) {
+            p->nb_low = 0;
+            p->burst = RTE_MIN(p->burst * 2, p->max_burst);
+        } else if (nb_rx < p->burst / 4) {
+            if (++p->nb_low >= p->shrink_polls) {
+                p->nb_low = 0;
+                p->burst = RTE_MAX(p->burst / 2, p->min_burst);
+            }
+        } else {
+            p->nb_low = 0;
+        }
+        return CLEANQ_POLL_BUSY;
+    }
+
+    // a gap in the traffic does not throw away the burst of a loaded queue,
+    // an idle one is down to min_burst after a few polls
+    p->burst = RTE_MAX(p->burst / 2, p->min_burst);
+    p->nb_low = 0;
+    if (p->nb_empty < p->idle_polls) {
+        p->nb_empty++;
+        return CLEANQ_POLL_BUSY;
+    }
+
+    if (p->pause < p->max_pause)
+        p->pause = p->pause == 0 ? 1 : RTE_MIN(p->pause * 2, p->max_pause);
+    return p->pause < p->max_pause ? CLEANQ_POLL_IDLE : CLEANQ_POLL_SLEEP;
+}
+
+// spins for the current back off
+static inline void
+cleanq_poll_wait(const struct cleanq_poll *p)
+{
+    for (uint32_t i = 0; i < p->pause; i++)
+        rte_pause();
+}
+
+#endif /* CLEANQ_POLL_H_ */
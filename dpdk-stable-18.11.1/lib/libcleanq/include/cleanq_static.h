@@ -0,0 +1,142 @@
+/*
+ * Copyright (c) 2017 ETH Zurich.
+ * All rights reserved.
+ *
+ * This file is distributed under the terms in the attached LICENSE file.
+ * If you do not find this file, copies can be found by writing to:
+ * ETH Zurich D-INFK, Universitaetstr. 6, CH-8092 Zurich. Attn: Systems Group.
+ */
+#ifndef CLEANQ_STATIC_H_
+#define CLEANQ_STATIC_H_ 1
+
+/*
+ * Statically dispatched CleanQ datapath
+ *
+ * A queue stack that is always the same (e.g. UDP -> IP -> ixgbe) does not
+ * need to go through the function pointers of struct cleanq on every call.
+ * The macros in here call a known enqueue/dequeue function directly, so the
+ * compiler can inline it (or at least avoid the indirect call and the
+ * retpoline). The function pointers stay the ABI: if the queue at hand does
+ * not use the expected function, the call falls back to the pointer.
+ *
+ * Defining CLEANQ_STATIC_UNCHECKED removes the fallback. The queue then has
+ * to be of the expected type, which is only asserted.
+ *
+ * Example for an application that always uses the UDP module:
+ *
+ *   CLEANQ_STATIC_QUEUE(udp_stack, udp_enqueue, udp_dequeue)
+ *
+ *   err = udp_stack_enqueue(q, rid, offset, length, valid_data,
+ *                           valid_length, flags);
+ */
+
+#include <assert.h>
+#include <stdbool.h>
+#include <rte_branch_prediction.h>
+
+#include <cleanq.h>
+#include <cleanq_module.h>
+
+/*
+ * Declares an externally defined enqueue/dequeue function so it can be bound
+ * with the macros below.
+ */
+#define CLEANQ_STATIC_DECLARE_ENQ(fn)                                       \
+    errval_t fn(struct cleanq* q, regionid_t region_id, genoffset_t offset, \
+                genoffset_t length, genoffset_t valid_data,                 \
+                genoffset_t valid_length, uint64_t misc_flags)
+
+#define CLEANQ_STATIC_DECLARE_DEQ(fn)                                       \
+    errval_t fn(struct cleanq* q, regionid_t* region_id,                    \
+                genoffset_t* offset, genoffset_t* length,                   \
+                genoffset_t* valid_data, genoffset_t* valid_length,         \
+                uint64_t* misc_flags)
+
+/*
+ * Call fn on the queue q if it is the queue's enqueue/dequeue function,
+ * otherwise call through the function pointer.
+ */
+#ifdef CLEANQ_STATIC_UNCHECKED
+#define CLEANQ_STATIC_ENQ(fn, q, ...) \
+    (assert((q)->f.enq == (fn)), (fn)((q), __VA_ARGS__))
+
+#define CLEANQ_STATIC_DEQ(fn, q, ...) \
+    (assert((q)->f.deq == (fn)), (fn)((q), __VA_ARGS__))
+#else
+#define CLEANQ_STATIC_ENQ(fn, q, ...)                   \
+    (likely((q)->f.enq == (fn)) ? (fn)((q), __VA_ARGS__) \
+                                : (q)->f.enq((q), __VA_ARGS__))
+
+#define CLEANQ_STATIC_DEQ(fn, q, ...)                   \
+    (likely((q)->f.deq == (fn)) ? (fn)((q), __VA_ARGS__) \
+                                : (q)->f.deq((q), __VA_ARGS__))
+#endif
+
+/*
+ * Defines name##_enqueue() and name##_dequeue(), typed entry points that
+ * behave like cleanq_enqueue()/cleanq_dequeue() (including the validation
+ * of the buffer) but bind the top of the queue stack at compile time.
+ */
+#define CLEANQ_STATIC_QUEUE(name, enq_fn, deq_fn)                            \
+static inline errval_t name##_enqueue(struct cleanq* q, regionid_t region_id,\
+                                      genoffset_t offset, genoffset_t length,\
+                                      genoffset_t valid_data,                \
+                                      genoffset_t valid_length,              \
+                                      uint64_t misc_flags)                   \
+{                                                                            \
+    if (!cleanq_buffer_valid(q, region_id, offset, length, valid_data,       \
+                             valid_length)) {                                \
+        return CLEANQ_ERR_INVALID_BUFFER_ARGS;                               \
+    }                                                                        \
+    return CLEANQ_STATIC_ENQ(enq_fn, q, region_id, offset, length,           \
+                             valid_data, valid_length, misc_flags);          \
+}                                                                            \
+                                                                             \
+static inline errval_t name##_dequeue(struct cleanq* q,                      \
+                                      regionid_t* region_id,                 \
+                                      genoffset_t* offset,                   \
+                                      genoffset_t* length,                   \
+                                      genoffset_t* valid_data,               \
+                                      genoffset_t* valid_length,             \
+                                      uint64_t* misc_flags)                  \
+{                                                                            \
+    errval_t err;                                                            \
+    err = CLEANQ_STATIC_DEQ(deq_fn, q, region_id, offset, length,            \
+                            valid_data, valid_length, misc_flags);           \
+    if (err_is_fail(err)) {                                                  \
+        return err;                                                          \
+    }                                                                        \
+    if (!cleanq_buffer_valid(q, *region_id, *offset, *length, *valid_data,   \
+                             *valid_length)) {                               \
+        return CLEANQ_ERR_INVALID_BUFFER_ARGS;                               \
+    }                                                                        \
+    return CLEANQ_ERR_OK;                                                    \
+}
+
+/*
+ * Defines name() that dequeues with fn and validates the buffer like
+ * cleanq_dequeue(). For module entry points that are not part of struct
+ * cleanq (e.g. udp_dequeue_rx()), so fn is called without any check that
+ * it belongs to the queue.
+ */
+#define CLEANQ_STATIC_DEQUEUE(name, fn)                                      \
+static inline errval_t name(struct cleanq* q, regionid_t* region_id,         \
+                            genoffset_t* offset, genoffset_t* length,        \
+                            genoffset_t* valid_data,                         \
+                            genoffset_t* valid_length,                       \
+                            uint64_t* misc_flags)                            \
+{                                                                            \
+    errval_t err;                                                            \
+    err = fn(q, region_id, offset, length, valid_data, valid_length,         \
+             misc_flags);                                                    \
+    if (err_is_fail(err)) {                                                  \
+        return err;                                                          \
+    }                                                                        \
+    if (!cleanq_buffer_valid(q, *region_id, *offset, *length, *valid_data,   \
+                             *valid_length)) {                               \
+        return CLEANQ_ERR_INVALID_BUFFER_ARGS;                               \
+    }                                                                        \
+    return CLEANQ_ERR_OK;                                                    \
+}
+
+#endif /* CLEANQ_STATIC_H_ */
@@ -0,0 +1,706 @@
+/*
+ * Copyright (c) 2017 ETH Zurich.
+ * All rights reserved.
+ *
+ * This file is distributed under the terms in the attached LICENSE file.
+ * If you do not find this file, copies can be found by writing to:
+ * ETH Zurich D-INFK, Universitaetstr. 6, CH-8092 Zurich. Attn: Systems Group.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stddef.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <arpa/inet.h>
+#include <net/if.h>
+#include <linux/if_ether.h>
+#include <linux/if_packet.h>
+
+#include <cleanq.h>
+#include <cleanq_module.h>
+#include <backends/af_packet.h>
+
+#include "backends/queue_pair.h"
+
+//#define DEBUG_ENABLED
+
+#if defined(DEBUG_ENABLED)
+#define DEBUG(x...) do { printf("AF_PACKET: %s:%d: ", __func__, __LINE__); \
+                         printf(x); \
+                    } while (0)
+#else
+#define DEBUG(x...) ((void)0)
+#endif
+
+/*
+ * RX ring, TPACKET_V3. The kernel fills a block with as many packets as fit
+ * and hands it over when it is full or after AF_PACKET_BLOCK_TIMEOUT_MS.
+ */
+#define AF_PACKET_BLOCK_SIZE (1 << 20)
+#define AF_PACKET_BLOCK_NR 16
+#define AF_PACKET_RX_FRAME_SIZE 2048
+#define AF_PACKET_BLOCK_TIMEOUT_MS 1
+
+// TX ring, TPACKET_V2 with one packet per frame, frames packed into blocks
+#define AF_PACKET_TX_FRAME_SIZE 2048
+#define AF_PACKET_TX_FRAME_NR 1024
+#define AF_PACKET_TX_BLOCK_SIZE (1 << 16)
+
+// flush the TX ring to the kernel after this many buffers at the latest
+#define AF_PACKET_TX_BATCH 32
+
+// buffers that can be posted for copying received packets into
+#define AF_PACKET_MAX_POSTED 1024
+
+struct af_packet_q {
+    struct cleanq rx_q;
+    struct cleanq tx_q;
+
+    int rx_fd;
+    int tx_fd;
+    uint8_t mac[6];
+
+    // RX ring
+    uint8_t* rx_ring;
+    size_t rx_ring_len;
+    regionid_t rx_ring_rid;
+    int rx_ring_reg;                // registered, see af_packet_get_rx_ring()
+    uint32_t cur_block;
+    uint32_t pkts_left;             // packets of cur_block not handed out yet
+    struct tpacket3_hdr* next_pkt;
+    // packets of a block still in use, the block goes back to the kernel
+    // when it drops to zero
+    uint32_t block_refs[AF_PACKET_BLOCK_NR];
+    struct buf_fifo posted;
+    int zero_copy;                  // see CLEANQ_CTRL_AF_PACKET_ZERO_COPY
+
+    // TX ring
+    uint8_t* tx_ring;
+    size_t tx_ring_len;
+    uint32_t tx_head;
+    uint32_t tx_unsent;
+    struct buf_fifo sent;
+
+    // regions registered on either side
+    struct region_vaddr regions[MAX_NUM_REGIONS];
+    int socket_id;
+
+    struct cleanq_stats rx_stats;
+    struct cleanq_stats tx_stats;
+};
+
+static inline struct af_packet_q* af_packet_from_rx(struct cleanq* q)
+{
+    return (struct af_packet_q*) q;
+}
+
+static inline struct af_packet_q* af_packet_from_tx(struct cleanq* q)
+{
+    return (struct af_packet_q*) ((uint8_t*) q - offsetof(struct af_packet_q, tx_q));
+}
+
+/*
+ * Receive side
+ */
+
+static inline struct tpacket_block_desc* rx_block(struct af_packet_q* que,
+                                                  uint32_t block)
+{
+    return (struct tpacket_block_desc*) (que->rx_ring +
+                                         (size_t) block * AF_PACKET_BLOCK_SIZE);
+}
+
+static void rx_release(struct af_packet_q* que, uint32_t block)
+{
+    if (--que->block_refs[block] == 0) {
+        __atomic_store_n(&rx_block(que, block)->hdr.bh1.block_status,
+                         TP_STATUS_KERNEL, __ATOMIC_RELEASE);
+    }
+}
+
+// next received packet, NULL if the kernel has not handed over any
+static struct tpacket3_hdr* rx_next(struct af_packet_q* que, uint32_t* block)
+{
+    struct tpacket_block_desc* bd;
+    struct tpacket3_hdr* pkt;
+    struct sockaddr_ll* sll;
+
+    for (;;) {
+        if (que->pkts_left == 0) {
+            // still holding packets of it from the last round
+            if (que->block_refs[que->cur_block] > 0) {
+                return NULL;
+            }
+
+            bd = rx_block(que, que->cur_block);
+            if (!(__atomic_load_n(&bd->hdr.bh1.block_status, __ATOMIC_ACQUIRE) &
+                  TP_STATUS_USER)) {
+                return NULL;
+            }
+
+            if (bd->hdr.bh1.num_pkts == 0) {
+                bd->hdr.bh1.block_status = TP_STATUS_KERNEL;
+                que->cur_block = (que->cur_block + 1) % AF_PACKET_BLOCK_NR;
+                continue;
+            }
+
+            que->pkts_left = bd->hdr.bh1.num_pkts;
+            que->block_refs[que->cur_block] = bd->hdr.bh1.num_pkts;
+            que->next_pkt = (struct tpacket3_hdr*) ((uint8_t*) bd +
+                            bd->hdr.bh1.offset_to_first_pkt);
+        }
+
+        pkt = que->next_pkt;
+        *block = que->cur_block;
+        que->next_pkt = (struct tpacket3_hdr*) ((uint8_t*) pkt +
+                                                pkt->tp_next_offset);
+        if (--que->pkts_left == 0) {
+            que->cur_block = (que->cur_block + 1) % AF_PACKET_BLOCK_NR;
+        }
+
+        // the socket also sees what we send
+        sll = (struct sockaddr_ll*) ((uint8_t*) pkt +
+                                     TPACKET_ALIGN(sizeof(struct tpacket3_hdr)));
+        if (sll->sll_pkttype == PACKET_OUTGOING) {
+            rx_release(que, *block);
+            continue;
+        }
+
+        return pkt;
+    }
+}
+
+static errval_t af_packet_rx_enqueue(struct cleanq* q, regionid_t rid,
+                                     genoffset_t offset, genoffset_t length,
+                                     genoffset_t valid_data,
+                                     genoffset_t valid_length, uint64_t flags)
+{
+    struct af_packet_q* que = af_packet_from_rx(q);
+
+    // a packet dequeued in place is given back
+    if (que->rx_ring_reg && rid == que->rx_ring_rid) {
+        rx_release(que, offset / AF_PACKET_BLOCK_SIZE);
+        cleanq_stats_enq(&que->rx_stats, CLEANQ_ERR_OK, valid_length);
+        return CLEANQ_ERR_OK;
+    }
+
+    if (fifo_full(&que->posted)) {
+        que->rx_stats.full++;
+        return CLEANQ_ERR_QUEUE_FULL;
+    }
+
+    fifo_push(&que->posted, rid, offset, length, valid_data, valid_length,
+              flags);
+    cleanq_stats_enq(&que->rx_stats, CLEANQ_ERR_OK, valid_length);
+    return CLEANQ_ERR_OK;
+}
+
+static errval_t af_packet_rx_dequeue(struct cleanq* q, regionid_t* rid,
+                                     genoffset_t* offset, genoffset_t* length,
+                                     genoffset_t* valid_data,
+                                     genoffset_t* valid_length, uint64_t* flags)
+{
+    struct af_packet_q* que = af_packet_from_rx(q);
+    struct tpacket3_hdr* pkt;
+    struct cleanq_buf* b;
+    uint32_t block;
+    uint32_t len;
+
+    // without zero-copy, packets wait in the ring for a buffer
+    if (!(que->zero_copy && que->rx_ring_reg) && fifo_empty(&que->posted)) {
+        que->rx_stats.empty++;
+        return CLEANQ_ERR_QUEUE_EMPTY;
+    }
+
+    pkt = rx_next(que, &block);
+    if (pkt == NULL) {
+        que->rx_stats.empty++;
+        return CLEANQ_ERR_QUEUE_EMPTY;
+    }
+
+    if (fifo_empty(&que->posted)) {
+        *rid = que->rx_ring_rid;
+        *offset = (uint8_t*) pkt - que->rx_ring;
+        *valid_data = pkt->tp_mac;
+        *valid_length = pkt->tp_snaplen;
+        *length = pkt->tp_mac + pkt->tp_snaplen;
+        *flags = 0;
+        cleanq_stats_deq(&que->rx_stats, CLEANQ_ERR_OK, *valid_length);
+        return CLEANQ_ERR_OK;
+    }
+
+    b = fifo_pop(&que->posted);
+    len = pkt->tp_snaplen;
+    if (len > b->length - b->valid_data) {
+        len = b->length - b->valid_data;
+    }
+
+    memcpy(region_buf_start(que->regions, b->rid, b->offset,
+                            b->valid_data),
+           (uint8_t*) pkt + pkt->tp_mac, len);
+    rx_release(que, block);
+
+    *rid = b->rid;
+    *offset = b->offset;
+    *length = b->length;
+    *valid_data = b->valid_data;
+    *valid_length = len;
+    *flags = b->flags;
+    cleanq_stats_deq(&que->rx_stats, CLEANQ_ERR_OK, len);
+    return CLEANQ_ERR_OK;
+}
+
+/*
+ * Send side
+ */
+
+static inline struct tpacket2_hdr* tx_frame(struct af_packet_q* que,
+                                            uint32_t frame)
+{
+    return (struct tpacket2_hdr*) (que->tx_ring +
+                                   (size_t) frame * AF_PACKET_TX_FRAME_SIZE);
+}
+
+static void tx_kick(struct af_packet_q* que)
+{
+    if (que->tx_unsent == 0) {
+        return;
+    }
+
+    // EAGAIN/ENOBUFS leave the frames queued, they go with the next kick
+    if (sendto(que->tx_fd, NULL, 0, MSG_DONTWAIT, NULL, 0) >= 0) {
+        que->tx_unsent = 0;
+    }
+}
+
+static errval_t af_packet_tx_enqueue(struct cleanq* q, regionid_t rid,
+                                     genoffset_t offset, genoffset_t length,
+                                     genoffset_t valid_data,
+                                     genoffset_t valid_length, uint64_t flags)
+{
+    struct af_packet_q* que = af_packet_from_tx(q);
+    struct tpacket2_hdr* hdr = tx_frame(que, que->tx_head);
+    const size_t data_off = TPACKET2_HDRLEN - sizeof(struct sockaddr_ll);
+
+    // the kernel would reject runts as TP_STATUS_WRONG_FORMAT
+    if (valid_length < ETH_HLEN ||
+        valid_length > AF_PACKET_TX_FRAME_SIZE - data_off) {
+        que->tx_stats.invalid++;
+        return CLEANQ_ERR_INVALID_BUFFER_ARGS;
+    }
+
+    if (fifo_full(&que->sent) ||
+        (__atomic_load_n(&hdr->tp_status, __ATOMIC_ACQUIRE) &
+         (TP_STATUS_SEND_REQUEST | TP_STATUS_SENDING))) {
+        tx_kick(que);
+        que->tx_stats.full++;
+        return CLEANQ_ERR_QUEUE_FULL;
+    }
+
+    memcpy((uint8_t*) hdr + data_off,
+           region_buf_start(que->regions, rid, offset, valid_data),
+           valid_length);
+    hdr->tp_len = valid_length;
+    hdr->tp_snaplen = valid_length;
+    __atomic_store_n(&hdr->tp_status, TP_STATUS_SEND_REQUEST,
+                     __ATOMIC_RELEASE);
+
+    que->tx_head = (que->tx_head + 1) % AF_PACKET_TX_FRAME_NR;
+    que->tx_unsent++;
+
+    // copied, so the buffer is done already
+    fifo_push(&que->sent, rid, offset, length, valid_data, valid_length,
+              flags);
+
+    if ((flags & CLEANQ_FLAG_LAST) || que->tx_unsent >= AF_PACKET_TX_BATCH) {
+        tx_kick(que);
+    }
+    cleanq_stats_enq(&que->tx_stats, CLEANQ_ERR_OK, valid_length);
+    return CLEANQ_ERR_OK;
+}
+
+static errval_t af_packet_tx_dequeue(struct cleanq* q, regionid_t* rid,
+                                     genoffset_t* offset, genoffset_t* length,
+                                     genoffset_t* valid_data,
+                                     genoffset_t* valid_length, uint64_t* flags)
+{
+    struct af_packet_q* que = af_packet_from_tx(q);
+    struct cleanq_buf* b;
+
+    tx_kick(que);
+
+    if (fifo_empty(&que->sent)) {
+        que->tx_stats.empty++;
+        return CLEANQ_ERR_QUEUE_EMPTY;
+    }
+
+    b = fifo_pop(&que->sent);
+    *rid = b->rid;
+    *offset = b->offset;
+    *length = b->length;
+    *valid_data = b->valid_data;
+    *valid_length = b->valid_length;
+    *flags = b->flags;
+    cleanq_stats_deq(&que->tx_stats, CLEANQ_ERR_OK, b->valid_length);
+    return CLEANQ_ERR_OK;
+}
+
+/*
+ * Both sides
+ */
+
+static errval_t af_packet_notify(struct cleanq* q)
+{
+    tx_kick(af_packet_from_tx(q));
+    return CLEANQ_ERR_OK;
+}
+
+static errval_t af_packet_rx_notify(struct cleanq* q)
+{
+    tx_kick(af_packet_from_rx(q));
+    return CLEANQ_ERR_OK;
+}
+
+static errval_t af_packet_register(struct af_packet_q* que,
+                                   struct cleanq* other, struct capref cap,
+                                   regionid_t rid)
+{
+    errval_t err;
+
+    err = region_register(que->regions, other, cap, rid);
+    if (err_is_fail(err)) {
+        return err;
+    }
+
+    if (cap.vaddr == que->rx_ring) {
+        que->rx_ring_rid = rid;
+        que->rx_ring_reg = 1;
+    }
+    return CLEANQ_ERR_OK;
+}
+
+static errval_t af_packet_deregister(struct af_packet_q* que, regionid_t rid)
+{
+    errval_t err;
+
+    err = region_deregister(que->regions, rid);
+    if (err_is_fail(err)) {
+        return err;
+    }
+
+    if (que->rx_ring_reg && rid == que->rx_ring_rid) {
+        que->rx_ring_reg = 0;
+    }
+    return CLEANQ_ERR_OK;
+}
+
+static errval_t af_packet_control(struct af_packet_q* que, uint64_t cmd,
+                                  uint64_t value)
+{
+    if (cmd == CLEANQ_CTRL_SET_REGION_HEADROOM) {
+        return region_set_headroom(que->regions, value);
+    }
+
+    if (cmd == CLEANQ_CTRL_AF_PACKET_ZERO_COPY) {
+        que->zero_copy = value != 0;
+        return CLEANQ_ERR_OK;
+    }
+
+    return queue_pair_control(cmd);
+}
+
+static errval_t af_packet_rx_register(struct cleanq* q, struct capref cap,
+                                      regionid_t rid)
+{
+    struct af_packet_q* que = af_packet_from_rx(q);
+    return af_packet_register(que, &que->tx_q, cap, rid);
+}
+
+static errval_t af_packet_rx_deregister(struct cleanq* q, regionid_t rid)
+{
+    return af_packet_deregister(af_packet_from_rx(q), rid);
+}
+
+static errval_t af_packet_rx_control(struct cleanq* q, uint64_t cmd,
+                                     uint64_t value, uint64_t* result)
+{
+    if (cmd == CLEANQ_CTRL_GET_STATS) {
+        return cleanq_stats_control(&af_packet_from_rx(q)->rx_stats, result);
+    }
+    return af_packet_control(af_packet_from_rx(q), cmd, value);
+}
+
+static errval_t af_packet_tx_register(struct cleanq* q, struct capref cap,
+                                      regionid_t rid)
+{
+    struct af_packet_q* que = af_packet_from_tx(q);
+    return af_packet_register(que, &que->rx_q, cap, rid);
+}
+
+static errval_t af_packet_tx_deregister(struct cleanq* q, regionid_t rid)
+{
+    return af_packet_deregister(af_packet_from_tx(q), rid);
+}
+
+static errval_t af_packet_tx_control(struct cleanq* q, uint64_t cmd,
+                                     uint64_t value, uint64_t* result)
+{
+    if (cmd == CLEANQ_CTRL_GET_STATS) {
+        return cleanq_stats_control(&af_packet_from_tx(q)->tx_stats, result);
+    }
+    return af_packet_control(af_packet_from_tx(q), cmd, value);
+}
+
+/*
+ * Setup
+ */
+
+static int af_packet_socket(const char* ifname, int protocol, int version,
+                            int* ifindex)
+{
+    struct sockaddr_ll sll;
+    struct ifreq ifr;
+    int fd;
+
+    fd = socket(AF_PACKET, SOCK_RAW, protocol);
+    if (fd < 0) {
+        return -1;
+    }
+
+    if (setsockopt(fd, SOL_PACKET, PACKET_VERSION, &version,
+                   sizeof(version)) < 0) {
+        goto fail;
+    }
+
+    memset(&ifr, 0, sizeof(ifr));
+    strncpy(ifr.ifr_name, ifname, IFNAMSIZ - 1);
+    if (ioctl(fd, SIOCGIFINDEX, &ifr) < 0) {
+        goto fail;
+    }
+    *ifindex = ifr.ifr_ifindex;
+
+    memset(&sll, 0, sizeof(sll));
+    sll.sll_family = AF_PACKET;
+    sll.sll_protocol = protocol;
+    sll.sll_ifindex = *ifindex;
+    // protocol 0 binds for sending only
+    if (bind(fd, (struct sockaddr*) &sll, sizeof(sll)) < 0) {
+        goto fail;
+    }
+
+    return fd;
+
+fail:
+    close(fd);
+    return -1;
+}
+
+static errval_t af_packet_open(struct af_packet_q* que, const char* ifname)
+{
+    struct tpacket_req3 rx_req;
+    struct tpacket_req tx_req;
+    struct ifreq ifr;
+    int ifindex;
+
+    que->rx_fd = af_packet_socket(ifname, htons(ETH_P_ALL), TPACKET_V3,
+                                  &ifindex);
+    if (que->rx_fd < 0) {
+        DEBUG("RX socket on %s failed: %s\n", ifname, strerror(errno));
+        return CLEANQ_ERR_INIT_QUEUE;
+    }
+
+    memset(&rx_req, 0, sizeof(rx_req));
+    rx_req.tp_block_size = AF_PACKET_BLOCK_SIZE;
+    rx_req.tp_block_nr = AF_PACKET_BLOCK_NR;
+    rx_req.tp_frame_size = AF_PACKET_RX_FRAME_SIZE;
+    rx_req.tp_frame_nr = (AF_PACKET_BLOCK_SIZE / AF_PACKET_RX_FRAME_SIZE) *
+                         AF_PACKET_BLOCK_NR;
+    rx_req.tp_retire_blk_tov = AF_PACKET_BLOCK_TIMEOUT_MS;
+    if (setsockopt(que->rx_fd, SOL_PACKET, PACKET_RX_RING, &rx_req,
+                   sizeof(rx_req)) < 0) {
+        DEBUG("RX ring failed: %s\n", strerror(errno));
+        return CLEANQ_ERR_INIT_QUEUE;
+    }
+
+    que->rx_ring_len = (size_t) AF_PACKET_BLOCK_SIZE * AF_PACKET_BLOCK_NR;
+    que->rx_ring = mmap(NULL, que->rx_ring_len, PROT_READ | PROT_WRITE,
+                        MAP_SHARED, que->rx_fd, 0);
+    if (que->rx_ring == MAP_FAILED) {
+        que->rx_ring = NULL;
+        return CLEANQ_ERR_INIT_QUEUE;
+    }
+
+    memset(&ifr, 0, sizeof(ifr));
+    strncpy(ifr.ifr_name, ifname, IFNAMSIZ - 1);
+    if (ioctl(que->rx_fd, SIOCGIFHWADDR, &ifr) < 0) {
+        return CLEANQ_ERR_INIT_QUEUE;
+    }
+    memcpy(que->mac, ifr.ifr_hwaddr.sa_data, 6);
+
+    // TPACKET_V2 for sending, V3 TX rings need recent kernels
+    que->tx_fd = af_packet_socket(ifname, 0, TPACKET_V2, &ifindex);
+    if (que->tx_fd < 0) {
+        DEBUG("TX socket on %s failed: %s\n", ifname, strerror(errno));
+        return CLEANQ_ERR_INIT_QUEUE;
+    }
+
+#ifdef PACKET_QDISC_BYPASS
+    // best effort, the queueing discipline is only a detour for us
+    int one = 1;
+    setsockopt(que->tx_fd, SOL_PACKET, PACKET_QDISC_BYPASS, &one, sizeof(one));
+#endif
+
+    // without it the kernel stops at a frame it cannot send, e.g. one larger
+    // than the MTU, marks it TP_STATUS_WRONG_FORMAT and sends nothing after
+    // it; with it such frames are skipped
+    int loss = 1;
+    if (setsockopt(que->tx_fd, SOL_PACKET, PACKET_LOSS, &loss,
+                   sizeof(loss)) < 0) {
+        DEBUG("PACKET_LOSS failed: %s\n", strerror(errno));
+        return CLEANQ_ERR_INIT_QUEUE;
+    }
+
+    memset(&tx_req, 0, sizeof(tx_req));
+    tx_req.tp_block_size = AF_PACKET_TX_BLOCK_SIZE;
+    tx_req.tp_block_nr = AF_PACKET_TX_FRAME_NR * AF_PACKET_TX_FRAME_SIZE /
+                         AF_PACKET_TX_BLOCK_SIZE;
+    tx_req.tp_frame_size = AF_PACKET_TX_FRAME_SIZE;
+    tx_req.tp_frame_nr = AF_PACKET_TX_FRAME_NR;
+    if (setsockopt(que->tx_fd, SOL_PACKET, PACKET_TX_RING, &tx_req,
+                   sizeof(tx_req)) < 0) {
+        DEBUG("TX ring failed: %s\n", strerror(errno));
+        return CLEANQ_ERR_INIT_QUEUE;
+    }
+
+    que->tx_ring_len = (size_t) AF_PACKET_TX_FRAME_SIZE * AF_PACKET_TX_FRAME_NR;
+    que->tx_ring = mmap(NULL, que->tx_ring_len, PROT_READ | PROT_WRITE,
+                        MAP_SHARED, que->tx_fd, 0);
+    if (que->tx_ring == MAP_FAILED) {
+        que->tx_ring = NULL;
+        return CLEANQ_ERR_INIT_QUEUE;
+    }
+
+    return CLEANQ_ERR_OK;
+}
+
+static void af_packet_close(struct af_packet_q* que)
+{
+    if (que->rx_ring != NULL) {
+        munmap(que->rx_ring, que->rx_ring_len);
+    }
+    if (que->tx_ring != NULL) {
+        munmap(que->tx_ring, que->tx_ring_len);
+    }
+    if (que->rx_fd >= 0) {
+        close(que->rx_fd);
+    }
+    if (que->tx_fd >= 0) {
+        close(que->tx_fd);
+    }
+    cleanq_free_socket(que->posted.bufs, que->socket_id);
+    cleanq_free_socket(que->sent.bufs, que->socket_id);
+}
+
+/*
+ * Public functions
+ */
+
+errval_t af_packet_create(struct af_packet_q** q, const char* ifname,
+                          int socket_id)
+{
+    errval_t err;
+    struct af_packet_q* que;
+
+    que = cleanq_malloc_socket(sizeof(struct af_packet_q), socket_id);
+    if (que == NULL) {
+        return CLEANQ_ERR_MALLOC_FAIL;
+    }
+    memset(que, 0, sizeof(struct af_packet_q));
+    que->socket_id = socket_id;
+    que->rx_fd = -1;
+    que->tx_fd = -1;
+
+    err = fifo_init(&que->posted, AF_PACKET_MAX_POSTED, socket_id);
+    if (err_is_fail(err)) {
+        goto fail;
+    }
+    err = fifo_init(&que->sent, AF_PACKET_TX_FRAME_NR, socket_id);
+    if (err_is_fail(err)) {
+        goto fail;
+    }
+
+    err = af_packet_open(que, ifname);
+    if (err_is_fail(err)) {
+        goto fail;
+    }
+
+    err = cleanq_init_socket(&que->rx_q, socket_id);
+    if (err_is_fail(err)) {
+        goto fail;
+    }
+
+    err = cleanq_init_socket(&que->tx_q, socket_id);
+    if (err_is_fail(err)) {
+        goto fail;
+    }
+
+    que->rx_q.f.reg = af_packet_rx_register;
+    que->rx_q.f.dereg = af_packet_rx_deregister;
+    que->rx_q.f.ctrl = af_packet_rx_control;
+    que->rx_q.f.notify = af_packet_rx_notify;
+    que->rx_q.f.enq = af_packet_rx_enqueue;
+    que->rx_q.f.deq = af_packet_rx_dequeue;
+    que->rx_q.f.destroy = queue_pair_side_destroy;
+
+    que->tx_q.f.reg = af_packet_tx_register;
+    que->tx_q.f.dereg = af_packet_tx_deregister;
+    que->tx_q.f.ctrl = af_packet_tx_control;
+    que->tx_q.f.notify = af_packet_notify;
+    que->tx_q.f.enq = af_packet_tx_enqueue;
+    que->tx_q.f.deq = af_packet_tx_dequeue;
+    que->tx_q.f.destroy = queue_pair_side_destroy;
+
+    *q = que;
+    return CLEANQ_ERR_OK;
+
+fail:
+    af_packet_close(que);
+    cleanq_free_socket(que, socket_id);
+    return err;
+}
+
+errval_t af_packet_destroy(struct af_packet_q* q)
+{
+    cleanq_destroy(&q->rx_q);
+    cleanq_destroy(&q->tx_q);
+    af_packet_close(q);
+    cleanq_free_socket(q, q->socket_id);
+    return CLEANQ_ERR_OK;
+}
+
+struct cleanq* af_packet_get_rx(struct af_packet_q* q)
+{
+    return &q->rx_q;
+}
+
+struct cleanq* af_packet_get_tx(struct af_packet_q* q)
+{
+    return &q->tx_q;
+}
+
+void af_packet_get_rx_ring(struct af_packet_q* q, struct capref* cap)
+{
+    cap->vaddr = q->rx_ring;
+    cap->paddr = (uint64_t) (uintptr_t) q->rx_ring;
+    cap->len = q->rx_ring_len;
+}
+
+void af_packet_get_mac(struct af_packet_q* q, uint8_t mac[6])
+{
+    memcpy(mac, q->mac, 6);
+}
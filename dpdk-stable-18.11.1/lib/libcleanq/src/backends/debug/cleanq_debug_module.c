@@ -10,6 +10,7 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <stdbool.h>
+#include <rte_common.h>
 #include <cleanq.h>
 #include <cleanq_module.h>
 #include <backends/debug.h>
@@ -20,6 +21,8 @@
 //#define DQ_ENABLE_HIST
 #define HIST_SIZE 128
 #define MAX_STR_SIZE 128
+// tracking churn is high, refill in bigger chunks than a page
+#define DEBUG_SLAB_REFILL_SIZE (64 * 1024)
 
 /*
  * This is a debugging interface for the device queue interface that
@@ -89,6 +92,7 @@ struct debug_q {
     struct slab_allocator alloc_list;
     uint16_t hist_head;
     struct operation history[HIST_SIZE];
+    struct cleanq_stats stats;
 };
 
 static void dump_list(struct memory_list* region)
@@ -196,7 +200,7 @@ static errval_t debug_register(struct cleanq* q, struct capref cap,
         que->regions->buffers->next = NULL;
         DEBUG("Register rid=%"PRIu32" size=%"PRIu64" \n", rid, 
               id.bytes);
-        return SYS_ERR_OK;
+        return CLEANQ_ERR_OK;
     }
 
     struct memory_list* ele = que->regions;
@@ -229,7 +233,7 @@ static errval_t debug_register(struct cleanq* q, struct capref cap,
     DEBUG("Register rid=%"PRIu32" size=%"PRIu64" \n", rid, 
           id.bytes);
 
-    return SYS_ERR_OK;
+    return CLEANQ_ERR_OK;
 }
 
 static errval_t debug_deregister(struct cleanq* q, regionid_t rid) 
@@ -263,7 +267,7 @@ static errval_t debug_deregister(struct cleanq* q, regionid_t rid)
             slab_free(&que->alloc, ele->buffers);
             slab_free(&que->alloc_list, ele);
 
-            return SYS_ERR_OK;
+            return CLEANQ_ERR_OK;
         } else {
 
             DEBUG("Destroy error rid=%d offset=%"PRIu64" length=%"PRIu64" "
@@ -295,7 +299,7 @@ static errval_t debug_deregister(struct cleanq* q, regionid_t rid)
                 slab_free(&que->alloc, next->buffers);
                 slab_free(&que->alloc_list, next);
 
-                return SYS_ERR_OK;
+                return CLEANQ_ERR_OK;
             } else {
                 DEBUG("Destroy error rid=%d offset=%"PRIu64" length=%"PRIu64" "
                        "should be offset=0 length=%"PRIu64"\n",
@@ -320,6 +324,17 @@ static errval_t debug_control(struct cleanq* q, uint64_t cmd, uint64_t value,
 {
     DEBUG("control \n");
     struct debug_q* que = (struct debug_q*) q;
+    if (cmd == CLEANQ_CTRL_GET_STATS) {
+        return cleanq_stats_control(&que->stats, result);
+    }
+    if (cmd == CLEANQ_CTRL_SET_VALIDATION) {
+        return cleanq_set_validation(que->q, (cleanq_validation_t) value);
+    }
+    if (cmd == CLEANQ_CTRL_SET_REGION_HEADROOM) {
+        return cleanq_set_region_headroom(que->q,
+                                          CLEANQ_CTRL_REGION_HEADROOM_RID(value),
+                                          CLEANQ_CTRL_REGION_HEADROOM_LEN(value));
+    }
     return que->q->f.ctrl(que->q, cmd, value, result);
 }
 
@@ -666,13 +681,13 @@ static errval_t find_region(struct debug_q* que, struct memory_list** list,
     }
 
     *list = region;
-    return SYS_ERR_OK;
+    return CLEANQ_ERR_OK;
 }
 
-static errval_t debug_enqueue(struct cleanq* q, regionid_t rid, 
-                              genoffset_t offset, genoffset_t length,
-                              genoffset_t valid_data, genoffset_t valid_length,
-                              uint64_t flags)
+static errval_t debug_check_enqueue(struct cleanq* q, regionid_t rid, 
+                                    genoffset_t offset, genoffset_t length,
+                                    genoffset_t valid_data,
+                                    genoffset_t valid_length, uint64_t flags)
 {
     assert(length > 0);
     DEBUG("enqueue offset %"PRIu64" \n", offset);
@@ -707,7 +722,7 @@ static errval_t debug_enqueue(struct cleanq* q, regionid_t rid,
             }   
 
             remove_split_buffer(que, region, buffer, offset, length);
-            return SYS_ERR_OK;          
+            return CLEANQ_ERR_OK;          
         } else {
             printf("Bounds check failed only buffer offset=%lu length=%lu " 
                   " buf->offset=%lu buf->len=%lu\n", offset, length,
@@ -732,7 +747,7 @@ static errval_t debug_enqueue(struct cleanq* q, regionid_t rid,
             }   
 
             remove_split_buffer(que, region, buffer, offset, length);
-            return SYS_ERR_OK;          
+            return CLEANQ_ERR_OK;          
         }
         buffer = buffer->next;
     }  
@@ -746,9 +761,10 @@ static errval_t debug_enqueue(struct cleanq* q, regionid_t rid,
     return CLEANQ_ERR_INVALID_BUFFER_ARGS;
 }
 
-static errval_t debug_dequeue(struct cleanq* q, regionid_t* rid, genoffset_t* offset,
-                              genoffset_t* length, genoffset_t* valid_data,
-                              genoffset_t* valid_length, uint64_t* flags)
+static errval_t debug_check_dequeue(struct cleanq* q, regionid_t* rid,
+                                    genoffset_t* offset, genoffset_t* length,
+                                    genoffset_t* valid_data,
+                                    genoffset_t* valid_length, uint64_t* flags)
 {
     errval_t err;
     struct debug_q* que = (struct debug_q*) q;
@@ -788,7 +804,7 @@ static errval_t debug_dequeue(struct cleanq* q, regionid_t* rid, genoffset_t* of
             que->regions->buffers->offset = 0;
             que->regions->buffers->length = *offset + *length;
             que->regions->buffers->next = NULL;
-            return SYS_ERR_OK;
+            return CLEANQ_ERR_OK;
         }
 
         struct memory_list* ele = que->regions;
@@ -816,7 +832,7 @@ static errval_t debug_dequeue(struct cleanq* q, regionid_t* rid, genoffset_t* of
         ele->buffers->offset = 0;
         ele->buffers->length = *offset + *length;
         ele->buffers->next = NULL;
-        return SYS_ERR_OK;
+        return CLEANQ_ERR_OK;
     }
 
     if (region->not_consistent) {
@@ -837,14 +853,14 @@ static errval_t debug_dequeue(struct cleanq* q, regionid_t* rid, genoffset_t* of
         region->buffers->length = *length;
         region->buffers->next = NULL;
         region->buffers->prev = NULL;
-        return SYS_ERR_OK;
+        return CLEANQ_ERR_OK;
     }
 
     if (buffer->next == NULL) {
         if (!buffer_in_bounds(*offset, *length, buffer->offset,
                               buffer->length)) {
             insert_merge_buffer(que, region, buffer, *offset, *length);
-            return SYS_ERR_OK;
+            return CLEANQ_ERR_OK;
         } else {
             return CLEANQ_ERR_BUFFER_NOT_IN_USE;
         }
@@ -858,7 +874,7 @@ static errval_t debug_dequeue(struct cleanq* q, regionid_t* rid, genoffset_t* of
             if (!buffer_in_bounds(*offset, *length, buffer->offset, 
                 buffer->length)) {
                 insert_merge_buffer(que, region, buffer, *offset, *length);
-                return SYS_ERR_OK;
+                return CLEANQ_ERR_OK;
             } else {
                 return CLEANQ_ERR_BUFFER_NOT_IN_USE;
             }
@@ -869,16 +885,45 @@ static errval_t debug_dequeue(struct cleanq* q, regionid_t* rid, genoffset_t* of
     if (!buffer_in_bounds(*offset, *length, buffer->offset, 
         buffer->length)) {
         insert_merge_buffer(que, region, buffer, *offset, *length);
-        return SYS_ERR_OK;
+        return CLEANQ_ERR_OK;
     }
 
     return CLEANQ_ERR_BUFFER_NOT_IN_USE;
 }
 
-static errval_t debug_destroy(struct cleanq* cleanq)
+// buffers that fail the ownership checks are counted as invalid
+static errval_t debug_enqueue(struct cleanq* q, regionid_t rid,
+                              genoffset_t offset, genoffset_t length,
+                              genoffset_t valid_data, genoffset_t valid_length,
+                              uint64_t flags)
+{
+    errval_t err;
+    struct debug_q* que = (struct debug_q*) q;
+
+    err = debug_check_enqueue(q, rid, offset, length, valid_data,
+                              valid_length, flags);
+    cleanq_stats_enq(&que->stats, err, valid_length);
+    return err;
+}
+
+static errval_t debug_dequeue(struct cleanq* q, regionid_t* rid, genoffset_t* offset,
+                              genoffset_t* length, genoffset_t* valid_data,
+                              genoffset_t* valid_length, uint64_t* flags)
+{
+    errval_t err;
+    struct debug_q* que = (struct debug_q*) q;
+
+    err = debug_check_dequeue(q, rid, offset, length, valid_data,
+                              valid_length, flags);
+    cleanq_stats_deq(&que->stats, err,
+                     err == CLEANQ_ERR_OK ? *valid_length : 0);
+    return err;
+}
+
+static errval_t debug_destroy(struct cleanq* cleanq __rte_unused)
 {
     // TODO cleanup
-    return SYS_ERR_OK;
+    return CLEANQ_ERR_OK;
 }
 
 /**
@@ -886,21 +931,25 @@ static errval_t debug_destroy(struct cleanq* cleanq)
  *
  */
 
-errval_t debug_create(struct debug_q** q, struct cleanq* other_q)
+errval_t debug_create(struct debug_q** q, struct cleanq* other_q,
+                      int socket_id)
 {
     errval_t err;
     struct debug_q* que;
-    que = (struct debug_q*) calloc(1, sizeof(struct debug_q));
+    que = (struct debug_q*) cleanq_malloc_socket(sizeof(struct debug_q),
+                                                 socket_id);
     assert(que);
 
-    slab_init(&que->alloc, sizeof(struct memory_ele),
-              slab_default_refill);
+    slab_init_socket(&que->alloc, sizeof(struct memory_ele),
+                     slab_default_refill, socket_id);
+    slab_set_refill_size(&que->alloc, DEBUG_SLAB_REFILL_SIZE);
    
-    slab_init(&que->alloc_list, sizeof(struct memory_list),
-              slab_default_refill);
+    slab_init_socket(&que->alloc_list, sizeof(struct memory_list),
+                     slab_default_refill, socket_id);
+    slab_set_refill_size(&que->alloc_list, DEBUG_SLAB_REFILL_SIZE);
 
     que->q = other_q;
-    err = cleanq_init(&que->my_q, false);
+    err = cleanq_init_socket(&que->my_q, socket_id);
     if (err_is_fail(err)) {
         return err;
     }   
@@ -913,7 +962,7 @@ errval_t debug_create(struct debug_q** q, struct cleanq* other_q)
     que->my_q.f.deq = debug_dequeue;
     que->my_q.f.destroy = debug_destroy;
     *q = que;
-    return SYS_ERR_OK;
+    return CLEANQ_ERR_OK;
 }
 
 errval_t debug_dump_region(struct debug_q* que, regionid_t rid) 
@@ -928,7 +977,7 @@ errval_t debug_dump_region(struct debug_q* que, regionid_t rid)
     }
 
     dump_list(region);
-    return SYS_ERR_OK;
+    return CLEANQ_ERR_OK;
 }
 
 
@@ -936,6 +985,8 @@ void debug_dump_history(struct debug_q* q)
 {
 #ifdef DQ_ENABLE_HIST
     dump_history(q);
+#else
+    RTE_SET_USED(q);
 #endif
 }
 
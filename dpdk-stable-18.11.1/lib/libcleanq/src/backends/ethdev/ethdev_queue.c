@@ -0,0 +1,580 @@
+/*
+ * Copyright (c) 2017 ETH Zurich.
+ * All rights reserved.
+ *
+ * This file is distributed under the terms in the attached LICENSE file.
+ * If you do not find this file, copies can be found by writing to:
+ * ETH Zurich D-INFK, Universitaetstr. 6, CH-8092 Zurich. Attn: Systems Group.
+ */
+
+#include <stdio.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <stddef.h>
+#include <string.h>
+
+#include <rte_ethdev.h>
+#include <rte_mbuf.h>
+#include <rte_memcpy.h>
+
+#include <cleanq.h>
+#include <cleanq_module.h>
+#include <cleanq_dpdk.h>
+#include <backends/ethdev.h>
+
+#include "region_pool.h"
+#include "backends/queue_pair.h"
+
+//#define DEBUG_ENABLED
+
+#if defined(DEBUG_ENABLED)
+#define DEBUG(x...) do { printf("ETHDEV: %s:%d: ", __func__, __LINE__); \
+                         printf(x); \
+                    } while (0)
+#else
+#define DEBUG(x...) ((void)0)
+#endif
+
+// buffers posted on the receive side and not dequeued yet
+#define ETHDEV_Q_MAX_POSTED 4096
+// buffers enqueued on the send side and not dequeued yet
+#define ETHDEV_Q_MAX_SENT 4096
+
+/*
+ * The driver gets a header mbuf of the queue with the data of the buffer
+ * attached, it calls back when it frees the header
+ */
+struct sent_buf {
+    struct rte_mbuf* hdr;
+    struct cleanq_buf buf;
+    struct rte_mbuf_ext_shared_info shinfo;
+    uint32_t done;
+};
+
+struct ethdev_q {
+    struct cleanq rx_q;
+    struct cleanq tx_q;
+
+    uint16_t port_id;
+    uint16_t queue_id;
+
+    // received by the driver, not copied yet
+    struct rte_mbuf* rx_pkts[ETHDEV_Q_BURST];
+    uint16_t rx_next;
+    uint16_t rx_count;
+
+    // filled in enqueue order
+    struct buf_fifo posted;
+
+    // in enqueue order, the last tx_unsent are not handed to the driver yet
+    struct sent_buf sent[ETHDEV_Q_MAX_SENT];
+    uint32_t sent_head;
+    uint32_t sent_tail;
+    uint32_t tx_unsent;
+    struct rte_mempool* tx_hdrs;
+
+    int socket_id;
+
+    struct cleanq_stats rx_stats;
+    struct cleanq_stats tx_stats;
+};
+
+static inline struct ethdev_q* ethdev_from_rx(struct cleanq* q)
+{
+    return (struct ethdev_q*) q;
+}
+
+static inline struct ethdev_q* ethdev_from_tx(struct cleanq* q)
+{
+    return (struct ethdev_q*) ((uint8_t*) q - offsetof(struct ethdev_q, tx_q));
+}
+
+static inline struct rte_mbuf* buf_to_mbuf(struct cleanq* q, regionid_t rid,
+                                           genoffset_t offset)
+{
+    uint64_t base = base_addr_of_region(q->pool, rid);
+
+    if (base == 0) {
+        return NULL;
+    }
+    return (struct rte_mbuf*) (base + offset);
+}
+
+/*
+ * Receive side
+ */
+
+static errval_t ethdev_rx_enqueue(struct cleanq* q, regionid_t rid,
+                                  genoffset_t offset, genoffset_t length,
+                                  genoffset_t valid_data,
+                                  genoffset_t valid_length, uint64_t flags)
+{
+    struct ethdev_q* que = ethdev_from_rx(q);
+
+    if (buf_to_mbuf(q, rid, offset) == NULL) {
+        que->rx_stats.invalid++;
+        return CLEANQ_ERR_INVALID_REGION_ID;
+    }
+
+    if (valid_data >= length) {
+        que->rx_stats.invalid++;
+        return CLEANQ_ERR_INVALID_BUFFER_ARGS;
+    }
+
+    if (fifo_full(&que->posted)) {
+        que->rx_stats.full++;
+        return CLEANQ_ERR_QUEUE_FULL;
+    }
+
+    fifo_push(&que->posted, rid, offset, length, valid_data, 0, flags);
+    cleanq_stats_enq(&que->rx_stats, CLEANQ_ERR_OK, valid_length);
+    return CLEANQ_ERR_OK;
+}
+
+static errval_t ethdev_rx_dequeue(struct cleanq* q, regionid_t* rid,
+                                  genoffset_t* offset, genoffset_t* length,
+                                  genoffset_t* valid_data,
+                                  genoffset_t* valid_length, uint64_t* flags)
+{
+    struct ethdev_q* que = ethdev_from_rx(q);
+    struct rte_mbuf* in;
+    struct rte_mbuf* mb;
+    struct cleanq_buf* b;
+
+    for (;;) {
+        // packets wait in the driver for a buffer
+        if (fifo_empty(&que->posted)) {
+            que->rx_stats.empty++;
+            return CLEANQ_ERR_QUEUE_EMPTY;
+        }
+
+        if (que->rx_next == que->rx_count) {
+            que->rx_next = 0;
+            que->rx_count = rte_eth_rx_burst(que->port_id, que->queue_id,
+                                             que->rx_pkts, ETHDEV_Q_BURST);
+            if (que->rx_count == 0) {
+                que->rx_stats.empty++;
+                return CLEANQ_ERR_QUEUE_EMPTY;
+            }
+        }
+
+        b = fifo_peek(&que->posted);
+        mb = buf_to_mbuf(q, b->rid, b->offset);
+        if (unlikely(mb == NULL)) {
+            // the region of the buffer is gone
+            que->posted.tail++;
+            cleanq_stats_drop(&que->rx_stats);
+            continue;
+        }
+
+        in = que->rx_pkts[que->rx_next++];
+        if (likely(in->nb_segs == 1 &&
+                   in->data_len <= b->length - b->valid_data)) {
+            break;
+        }
+
+        DEBUG("dropping mbuf %p of %u bytes\n", (void*) in, in->pkt_len);
+        rte_pktmbuf_free(in);
+        cleanq_stats_drop(&que->rx_stats);
+    }
+
+    // the driver received into its own mbuf, the data goes into the
+    // buffer posted first
+    rte_memcpy((uint8_t*) mb->buf_addr + b->valid_data,
+               rte_pktmbuf_mtod(in, void*), in->data_len);
+    mb->data_off = b->valid_data;
+    mb->data_len = in->data_len;
+    mb->pkt_len = in->data_len;
+    mb->nb_segs = 1;
+    mb->next = NULL;
+    // the mbuf keeps its own buffer
+    mb->ol_flags = (mb->ol_flags & (IND_ATTACHED_MBUF | EXT_ATTACHED_MBUF)) |
+                   (in->ol_flags & ~(IND_ATTACHED_MBUF | EXT_ATTACHED_MBUF));
+    mb->packet_type = in->packet_type;
+    mb->hash = in->hash;
+    rte_pktmbuf_free(in);
+    que->posted.tail++;
+
+    *rid = b->rid;
+    *offset = b->offset;
+    *length = b->length;
+    *valid_data = b->valid_data;
+    *valid_length = mb->data_len;
+    *flags = b->flags;
+    cleanq_stats_deq(&que->rx_stats, CLEANQ_ERR_OK, mb->data_len);
+    return CLEANQ_ERR_OK;
+}
+
+/*
+ * Send side
+ */
+
+static void tx_flush(struct ethdev_q* que)
+{
+    struct rte_mbuf* pkts[ETHDEV_Q_BURST];
+    uint32_t first;
+    uint16_t num, sent;
+
+    while (que->tx_unsent > 0) {
+        first = que->sent_head - que->tx_unsent;
+        num = RTE_MIN(que->tx_unsent, (uint32_t) ETHDEV_Q_BURST);
+        for (uint16_t i = 0; i < num; i++) {
+            pkts[i] = que->sent[(first + i) % ETHDEV_Q_MAX_SENT].hdr;
+        }
+
+        sent = rte_eth_tx_burst(que->port_id, que->queue_id, pkts, num);
+        que->tx_unsent -= sent;
+        if (sent < num) {
+            return;
+        }
+    }
+}
+
+// the driver freed the header, it is done with the data
+static void tx_done(void* addr __rte_unused, void* opaque)
+{
+    struct sent_buf* s = opaque;
+
+    __atomic_store_n(&s->done, 1, __ATOMIC_RELEASE);
+}
+
+static errval_t ethdev_tx_enqueue(struct cleanq* q, regionid_t rid,
+                                  genoffset_t offset, genoffset_t length,
+                                  genoffset_t valid_data,
+                                  genoffset_t valid_length, uint64_t flags)
+{
+    struct ethdev_q* que = ethdev_from_tx(q);
+    struct rte_mbuf* mb = buf_to_mbuf(q, rid, offset);
+    struct rte_mbuf* hdr;
+    struct sent_buf* s;
+
+    if (mb == NULL) {
+        que->tx_stats.invalid++;
+        return CLEANQ_ERR_INVALID_REGION_ID;
+    }
+
+    // there are as many headers as entries, some may still be in the driver
+    if (que->sent_head - que->sent_tail == ETHDEV_Q_MAX_SENT ||
+        (hdr = rte_pktmbuf_alloc(que->tx_hdrs)) == NULL) {
+        tx_flush(que);
+        que->tx_stats.full++;
+        return CLEANQ_ERR_QUEUE_FULL;
+    }
+
+    s = &que->sent[que->sent_head % ETHDEV_Q_MAX_SENT];
+    s->done = 0;
+    s->shinfo.free_cb = tx_done;
+    s->shinfo.fcb_opaque = s;
+    rte_mbuf_ext_refcnt_set(&s->shinfo, 1);
+    rte_pktmbuf_attach_extbuf(hdr, mb->buf_addr, mb->buf_iova, mb->buf_len,
+                              &s->shinfo);
+    hdr->data_off = valid_data;
+    hdr->data_len = valid_length;
+    hdr->pkt_len = valid_length;
+
+    s->hdr = hdr;
+    s->buf.rid = rid;
+    s->buf.offset = offset;
+    s->buf.length = length;
+    s->buf.valid_data = valid_data;
+    s->buf.valid_length = valid_length;
+    s->buf.flags = flags;
+    que->sent_head++;
+    que->tx_unsent++;
+
+    if ((flags & CLEANQ_FLAG_LAST) || que->tx_unsent >= ETHDEV_Q_BURST) {
+        tx_flush(que);
+    }
+    cleanq_stats_enq(&que->tx_stats, CLEANQ_ERR_OK, valid_length);
+    return CLEANQ_ERR_OK;
+}
+
+static errval_t ethdev_tx_dequeue(struct cleanq* q, regionid_t* rid,
+                                  genoffset_t* offset, genoffset_t* length,
+                                  genoffset_t* valid_data,
+                                  genoffset_t* valid_length, uint64_t* flags)
+{
+    struct ethdev_q* que = ethdev_from_tx(q);
+    struct sent_buf* s;
+
+    tx_flush(que);
+
+    // completions are returned in order
+    if (que->sent_head - que->sent_tail == que->tx_unsent) {
+        que->tx_stats.empty++;
+        return CLEANQ_ERR_QUEUE_EMPTY;
+    }
+
+    s = &que->sent[que->sent_tail % ETHDEV_Q_MAX_SENT];
+    if (!__atomic_load_n(&s->done, __ATOMIC_ACQUIRE)) {
+        que->tx_stats.empty++;
+        return CLEANQ_ERR_QUEUE_EMPTY;
+    }
+    que->sent_tail++;
+
+    *rid = s->buf.rid;
+    *offset = s->buf.offset;
+    *length = s->buf.length;
+    *valid_data = s->buf.valid_data;
+    *valid_length = s->buf.valid_length;
+    *flags = s->buf.flags;
+    cleanq_stats_deq(&que->tx_stats, CLEANQ_ERR_OK, s->buf.valid_length);
+    return CLEANQ_ERR_OK;
+}
+
+/*
+ * Both sides
+ */
+
+static errval_t ethdev_notify(struct cleanq* q)
+{
+    tx_flush(ethdev_from_tx(q));
+    return CLEANQ_ERR_OK;
+}
+
+static errval_t ethdev_rx_notify(struct cleanq* q __rte_unused)
+{
+    return CLEANQ_ERR_OK;
+}
+
+/*
+ * Both sides have to know the mbufs. The modules add the region to both
+ * themselves, a region registered or deregistered with one side directly is
+ * added to or removed from the other.
+ */
+
+static bool has_region(struct cleanq* q, struct capref* cap, regionid_t rid)
+{
+    uint64_t base = base_addr_of_region(q->pool, rid);
+
+    if (cap != NULL && base != cap->paddr) {
+        return false;
+    }
+    return base != 0 && region_with_base_addr(q->pool, base) == rid;
+}
+
+static errval_t ethdev_register(struct cleanq* other, struct capref cap,
+                                regionid_t rid)
+{
+    if (has_region(other, &cap, rid)) {
+        return CLEANQ_ERR_OK;
+    }
+    return cleanq_add_region(other, cap, rid);
+}
+
+static errval_t ethdev_deregister(struct cleanq* other, regionid_t rid)
+{
+    if (!has_region(other, NULL, rid)) {
+        return CLEANQ_ERR_OK;
+    }
+    return cleanq_remove_region(other, rid);
+}
+
+static errval_t ethdev_control(struct ethdev_q* que, uint64_t cmd,
+                               uint64_t value)
+{
+    // mbufs know where their data starts
+    if (cmd == CLEANQ_CTRL_SET_REGION_HEADROOM) {
+        if (!has_region(&que->rx_q, NULL,
+                        CLEANQ_CTRL_REGION_HEADROOM_RID(value))) {
+            return CLEANQ_ERR_INVALID_REGION_ID;
+        }
+        return CLEANQ_ERR_OK;
+    }
+
+    return queue_pair_control(cmd);
+}
+
+// RX interrupts are those of the ethdev queue
+static errval_t ethdev_rx_control(struct cleanq* q, uint64_t cmd,
+                                  uint64_t value, uint64_t* result)
+{
+    struct ethdev_q* que = ethdev_from_rx(q);
+
+    if (cmd == CLEANQ_CTRL_RX_INTR_ENABLE ||
+        cmd == CLEANQ_CTRL_RX_INTR_DISABLE ||
+        cmd == CLEANQ_CTRL_RX_INTR_FD) {
+        return cleanq_ethdev_rx_intr_control(que->port_id, que->queue_id,
+                                             cmd, result);
+    }
+
+    if (cmd == CLEANQ_CTRL_GET_STATS) {
+        return cleanq_stats_control(&que->rx_stats, result);
+    }
+
+    return ethdev_control(que, cmd, value);
+}
+
+static errval_t ethdev_tx_control(struct cleanq* q, uint64_t cmd,
+                                  uint64_t value, uint64_t* result)
+{
+    if (cmd == CLEANQ_CTRL_GET_STATS) {
+        return cleanq_stats_control(&ethdev_from_tx(q)->tx_stats, result);
+    }
+
+    return ethdev_control(ethdev_from_tx(q), cmd, value);
+}
+
+static errval_t ethdev_rx_register(struct cleanq* q, struct capref cap,
+                                   regionid_t rid)
+{
+    return ethdev_register(&ethdev_from_rx(q)->tx_q, cap, rid);
+}
+
+static errval_t ethdev_rx_deregister(struct cleanq* q, regionid_t rid)
+{
+    return ethdev_deregister(&ethdev_from_rx(q)->tx_q, rid);
+}
+
+static errval_t ethdev_tx_register(struct cleanq* q, struct capref cap,
+                                   regionid_t rid)
+{
+    return ethdev_register(&ethdev_from_tx(q)->rx_q, cap, rid);
+}
+
+static errval_t ethdev_tx_deregister(struct cleanq* q, regionid_t rid)
+{
+    return ethdev_deregister(&ethdev_from_tx(q)->rx_q, rid);
+}
+
+/*
+ * Public functions
+ */
+
+errval_t ethdev_q_create(struct ethdev_q** q, uint16_t port_id,
+                         uint16_t queue_id, int socket_id)
+{
+    errval_t err;
+    struct ethdev_q* que;
+    struct rte_eth_dev_info info;
+    char name[RTE_MEMPOOL_NAMESIZE];
+
+    if (!rte_eth_dev_is_valid_port(port_id)) {
+        return CLEANQ_ERR_INIT_QUEUE;
+    }
+
+    rte_eth_dev_info_get(port_id, &info);
+    if (queue_id >= info.nb_rx_queues || queue_id >= info.nb_tx_queues) {
+        return CLEANQ_ERR_INIT_QUEUE;
+    }
+
+    que = cleanq_malloc_socket(sizeof(struct ethdev_q), socket_id);
+    if (que == NULL) {
+        return CLEANQ_ERR_MALLOC_FAIL;
+    }
+    memset(que, 0, sizeof(struct ethdev_q));
+    que->port_id = port_id;
+    que->queue_id = queue_id;
+    que->socket_id = socket_id;
+
+    err = fifo_init(&que->posted, ETHDEV_Q_MAX_POSTED, socket_id);
+    if (err_is_fail(err)) {
+        goto fail;
+    }
+
+    // no data room, the data of the buffers is attached
+    snprintf(name, sizeof(name), "ethdev_q_%p", (void*) que);
+    que->tx_hdrs = rte_pktmbuf_pool_create(name, ETHDEV_Q_MAX_SENT, 0, 0, 0,
+                                           socket_id);
+    if (que->tx_hdrs == NULL) {
+        err = CLEANQ_ERR_MALLOC_FAIL;
+        goto fail;
+    }
+
+    err = cleanq_init_socket(&que->rx_q, socket_id);
+    if (err_is_fail(err)) {
+        goto fail_hdrs;
+    }
+
+    err = cleanq_init_socket(&que->tx_q, socket_id);
+    if (err_is_fail(err)) {
+        cleanq_destroy(&que->rx_q);
+        goto fail_hdrs;
+    }
+
+    que->rx_q.f.reg = ethdev_rx_register;
+    que->rx_q.f.dereg = ethdev_rx_deregister;
+    que->rx_q.f.ctrl = ethdev_rx_control;
+    que->rx_q.f.notify = ethdev_rx_notify;
+    que->rx_q.f.enq = ethdev_rx_enqueue;
+    que->rx_q.f.deq = ethdev_rx_dequeue;
+    que->rx_q.f.destroy = queue_pair_side_destroy;
+
+    que->tx_q.f.reg = ethdev_tx_register;
+    que->tx_q.f.dereg = ethdev_tx_deregister;
+    que->tx_q.f.ctrl = ethdev_tx_control;
+    que->tx_q.f.notify = ethdev_notify;
+    que->tx_q.f.enq = ethdev_tx_enqueue;
+    que->tx_q.f.deq = ethdev_tx_dequeue;
+    que->tx_q.f.destroy = queue_pair_side_destroy;
+
+    *q = que;
+    return CLEANQ_ERR_OK;
+
+fail_hdrs:
+    rte_mempool_free(que->tx_hdrs);
+fail:
+    cleanq_free_socket(que->posted.bufs, socket_id);
+    cleanq_free_socket(que, socket_id);
+    return err;
+}
+
+errval_t ethdev_q_destroy(struct ethdev_q* q)
+{
+    struct rte_mbuf* mb;
+    struct cleanq_buf* b;
+    struct sent_buf* s;
+    uint32_t held = 0;
+
+    while (q->rx_next < q->rx_count) {
+        rte_pktmbuf_free(q->rx_pkts[q->rx_next++]);
+    }
+
+    // buffers that were not dequeued go back to their mempool
+    while (!fifo_empty(&q->posted)) {
+        b = fifo_pop(&q->posted);
+        mb = buf_to_mbuf(&q->rx_q, b->rid, b->offset);
+        if (mb != NULL) {
+            rte_pktmbuf_free(mb);
+        }
+    }
+
+    while (q->sent_tail != q->sent_head) {
+        s = &q->sent[q->sent_tail % ETHDEV_Q_MAX_SENT];
+        if (q->sent_head - q->sent_tail <= q->tx_unsent) {
+            rte_pktmbuf_free(s->hdr);
+        }
+        q->sent_tail++;
+        if (!__atomic_load_n(&s->done, __ATOMIC_ACQUIRE)) {
+            held++;
+            continue;
+        }
+        mb = buf_to_mbuf(&q->tx_q, s->buf.rid, s->buf.offset);
+        if (mb != NULL) {
+            rte_pktmbuf_free(mb);
+        }
+    }
+
+    cleanq_destroy(&q->rx_q);
+    cleanq_destroy(&q->tx_q);
+
+    // the driver still calls back into the queue when it frees those
+    if (held > 0) {
+        DEBUG("%u buffers still held by the driver, queue not freed\n", held);
+        return CLEANQ_ERR_OK;
+    }
+    rte_mempool_free(q->tx_hdrs);
+    cleanq_free_socket(q->posted.bufs, q->socket_id);
+    cleanq_free_socket(q, q->socket_id);
+    return CLEANQ_ERR_OK;
+}
+
+struct cleanq* ethdev_q_get_rx(struct ethdev_q* q)
+{
+    return &q->rx_q;
+}
+
+struct cleanq* ethdev_q_get_tx(struct ethdev_q* q)
+{
+    return &q->tx_q;
+}
@@ -8,6 +8,8 @@
  */
 
 #include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
 #include <cleanq.h>
 #include <cleanq_module.h>
 #include <backends/ipcq.h>
@@ -16,11 +18,23 @@
 #include <sys/mman.h>
 #include <sys/stat.h>
 #include <fcntl.h>
+#include <rte_atomic.h>
+#include <rte_common.h>
+#ifdef RTE_EAL_NUMA_AWARE_HUGEPAGES
+#include <numaif.h>
+#endif
 #include "ipcq_debug.h"
+#include "ipcq_internal.h"
+#include "region_pool.h"
 
 #define CMD_REG 1
 #define CMD_DEREG 2
 
+// written to the ring header by the endpoint that set up the memory
+#define IPCQ_HDR_MAGIC 0x49504351
+// written by the other endpoint if it comes up first
+#define IPCQ_HDR_MAGIC_PEER 0x49504350
+
 struct __attribute__((aligned(IPCQ_ALIGNMENT))) desc {
     genoffset_t offset; // 8
     genoffset_t length; // 16
@@ -33,8 +47,44 @@ struct __attribute__((aligned(IPCQ_ALIGNMENT))) desc {
     uint8_t pad[4];
 };
 
+/*
+ * Compact descriptor, four per cache line. seq_cmd is written last and
+ * holds the low bits of the sequence number and the command, so a single
+ * 16 bit store hands the descriptor over to the other side.
+ */
+#define IPCQ_COMPACT_SEQ_MASK 0x3FFF
+#define IPCQ_COMPACT_CMD_SHIFT 14
+// with more slots a stale or never written slot matches the sequence bits
+#define IPCQ_COMPACT_MAX_SLOTS IPCQ_COMPACT_SEQ_MASK
+// misc_flags bits that survive the compact encoding
+#define IPCQ_COMPACT_FLAGS_LOW 0xFFFUL
+#define IPCQ_COMPACT_FLAGS_HIGH 0xF0000000UL
+#define IPCQ_COMPACT_FLAGS_HIGH_SHIFT 16
+
+struct __attribute__((aligned(16))) desc_compact {
+    union {
+        struct {
+            uint32_t offset; // 4
+            uint16_t length; // 6
+            uint16_t valid_data; // 8
+            uint16_t valid_length; // 10
+            uint16_t flags; // 12
+        } buf;
+        struct __attribute__((packed)) {
+            uint64_t base; // 8
+            uint32_t len; // 12
+        } reg;
+    };
+    uint16_t rid; // 14
+    volatile uint16_t seq_cmd; // 16
+};
+
 union __attribute__((aligned(IPCQ_ALIGNMENT))) pointer {
-    volatile size_t value;
+    struct {
+        volatile size_t value;
+        volatile uint32_t format;
+        volatile uint32_t magic;
+    };
     uint8_t pad[64];
 };
 
@@ -48,12 +98,19 @@ struct ipcq {
 
     // General info
     size_t slots;
+    size_t mem_size;
     char* name;
     bool bound_done;
+    int socket_id;
+    ipcq_desc_format_t format;
  
     // Descriptor Ring
+    void* tx_mem;   // NULL if the rings belong to a connection
+    void* rx_mem;
     struct desc* rx_descs;
     struct desc* tx_descs;
+    struct desc_compact* rx_cdescs;
+    struct desc_compact* tx_cdescs;
     
     // Flow control
     uint64_t rx_seq;
@@ -69,6 +126,12 @@ struct ipcq {
     // linked list
     struct ipcq* next;
     uint64_t qid;  
+
+    // set up over a socket, see ipcq_socket.c
+    struct ipcq_conn* conn;
+
+    // buffers sent to and received from the other endpoint
+    struct cleanq_stats stats;
 };
 
 struct ipcq_endpoint_state {
@@ -136,7 +199,7 @@ static inline errval_t ipcq_enqueue_internal(struct ipcq* queue,
     IPCQ_DEBUG("tx_seq=%lu tx_seq_ack=%lu rx_seq_ack=%lu \n", q->tx_seq, 
                q->tx_seq_ack->value, q->rx_seq_ack->value);
 
-    return SYS_ERR_OK;
+    return CLEANQ_ERR_OK;
 
 }
 /**
@@ -152,7 +215,7 @@ static inline errval_t ipcq_enqueue_internal(struct ipcq* queue,
  * @param valid_length          Length of the valid data of the buffer
  * @param misc_flags            Miscellaneous flags
  *
- * @returns error if queue is full or SYS_ERR_OK on success
+ * @returns error if queue is full or CLEANQ_ERR_OK on success
  */
 static errval_t ipcq_enqueue(struct cleanq* queue,
                               regionid_t region_id,
@@ -162,22 +225,40 @@ static errval_t ipcq_enqueue(struct cleanq* queue,
                               genoffset_t valid_length,
                               uint64_t misc_flags)
 {
-    return ipcq_enqueue_internal((struct ipcq*) queue, region_id, offset, length, 
-                                 valid_data, valid_length, misc_flags, 0);
+    struct ipcq* q = (struct ipcq*) queue;
+    errval_t err;
+
+    err = ipcq_enqueue_internal(q, region_id, offset, length,
+                                valid_data, valid_length, misc_flags, 0);
+    cleanq_stats_enq(&q->stats, err, valid_length);
+    return err;
 }
 
 
 static errval_t ipc_reg(struct ipcq* q, struct capref cap, uint32_t rid)
 {
     errval_t err;
+    void* va;
+
+    // the address is the one of the other process
+    if (q->conn != NULL) {
+        va = ipcq_conn_translate(q->conn, (uint64_t) cap.vaddr, cap.len);
+        if (va != NULL) {
+            cap.vaddr = va;
+            cap.paddr = (uint64_t) va;
+        }
+    }
+
     err = cleanq_add_region((struct cleanq*) q, cap, rid);
     if (err_is_fail(err)) {        
         // should not happen, but is fine!
-        return SYS_ERR_OK;
+        return CLEANQ_ERR_OK;
     }
 
-    err = q->f.reg(q, cap, rid);
-    return SYS_ERR_OK;
+    if (q->f.reg != NULL) {
+        err = q->f.reg(q, cap, rid);
+    }
+    return CLEANQ_ERR_OK;
 }
 
 static errval_t ipc_dereg(struct ipcq* q, regionid_t rid)
@@ -186,11 +267,13 @@ static errval_t ipc_dereg(struct ipcq* q, regionid_t rid)
     err = cleanq_remove_region((struct cleanq*) q, rid);
     if (err_is_fail(err)) { 
         // should not happen, but is fine!
-        return SYS_ERR_OK;
+        return CLEANQ_ERR_OK;
     }
 
-    err = q->f.dereg(q, rid);
-    return SYS_ERR_OK;
+    if (q->f.dereg != NULL) {
+        err = q->f.dereg(q, rid);
+    }
+    return CLEANQ_ERR_OK;
 }
 
 /**
@@ -209,7 +292,7 @@ static errval_t ipc_dereg(struct ipcq* q, regionid_t rid)
  *                              data of the buffer
  * @param misc_flags            Return pointer to miscellaneous flags
  *
- * @returns error if queue is empty or SYS_ERR_OK on success
+ * @returns error if queue is empty or CLEANQ_ERR_OK on success
  */
 static struct capref cap;
 static errval_t ipcq_dequeue(struct cleanq* queue,
@@ -224,6 +307,7 @@ static errval_t ipcq_dequeue(struct cleanq* queue,
     errval_t err;
 
     if (!ipcq_can_read(queue)) {
+        q->stats.empty++;
         return CLEANQ_ERR_QUEUE_EMPTY;
     }
 
@@ -264,10 +348,192 @@ static errval_t ipcq_dequeue(struct cleanq* queue,
 
         q->rx_seq++;
         q->rx_seq_ack->value = q->rx_seq;
+        cleanq_stats_deq(&q->stats, CLEANQ_ERR_OK, *valid_length);
+    }
+    IPCQ_DEBUG("rx_seq_ack=%lu tx_seq_ack=%lu \n", q->rx_seq_ack->value,
+               q->tx_seq_ack->value);
+    return CLEANQ_ERR_OK;
+}
+
+/*
+ * Compact descriptor format
+ */
+
+static bool ipcq_compact_can_read(struct ipcq *q)
+{
+    uint16_t seq = q->rx_cdescs[q->rx_seq % q->slots].seq_cmd;
+
+    // the slot still holds the descriptor of the last round
+    return (seq & IPCQ_COMPACT_SEQ_MASK) == (q->rx_seq & IPCQ_COMPACT_SEQ_MASK);
+}
+
+static inline uint16_t ipcq_compact_flags(uint64_t misc_flags)
+{
+    return (misc_flags & IPCQ_COMPACT_FLAGS_LOW) |
+           ((misc_flags & IPCQ_COMPACT_FLAGS_HIGH) >>
+            IPCQ_COMPACT_FLAGS_HIGH_SHIFT);
+}
+
+static inline uint64_t ipcq_compact_misc_flags(uint16_t flags)
+{
+    return (flags & IPCQ_COMPACT_FLAGS_LOW) |
+           (((uint64_t) flags << IPCQ_COMPACT_FLAGS_HIGH_SHIFT) &
+            IPCQ_COMPACT_FLAGS_HIGH);
+}
+
+static inline void ipcq_compact_publish(struct ipcq* q, size_t head,
+                                        uint64_t cmd)
+{
+    // descriptor has to be visible before the sequence number
+    rte_smp_wmb();
+    q->tx_cdescs[head].seq_cmd = (q->tx_seq & IPCQ_COMPACT_SEQ_MASK) |
+                                 (cmd << IPCQ_COMPACT_CMD_SHIFT);
+    q->tx_seq++;
+
+    IPCQ_DEBUG("tx_seq=%lu tx_seq_ack=%lu rx_seq_ack=%lu \n", q->tx_seq, 
+               q->tx_seq_ack->value, q->rx_seq_ack->value);
+}
+
+static errval_t ipcq_compact_enqueue(struct cleanq* queue,
+                                     regionid_t region_id,
+                                     genoffset_t offset,
+                                     genoffset_t length,
+                                     genoffset_t valid_data,
+                                     genoffset_t valid_length,
+                                     uint64_t misc_flags)
+{
+    struct ipcq* q = (struct ipcq*) queue;
+    size_t head = q->tx_seq % q->slots;
+
+    if (!ipcq_can_write(queue)) {
+        q->stats.full++;
+        return CLEANQ_ERR_QUEUE_FULL;
+    }
+
+    if (offset > UINT32_MAX || length > UINT16_MAX ||
+        valid_data > UINT16_MAX || valid_length > UINT16_MAX) {
+        q->stats.invalid++;
+        return CLEANQ_ERR_INVALID_BUFFER_ARGS;
+    }
+
+    if (region_id > UINT16_MAX) {
+        q->stats.invalid++;
+        return CLEANQ_ERR_INVALID_REGION_ID;
+    }
+
+    if (misc_flags & ~(IPCQ_COMPACT_FLAGS_LOW | IPCQ_COMPACT_FLAGS_HIGH)) {
+        q->stats.invalid++;
+        return CLEANQ_ERR_UNKNOWN_FLAG;
+    }
+
+    q->tx_cdescs[head].rid = region_id;
+    q->tx_cdescs[head].buf.offset = offset;
+    q->tx_cdescs[head].buf.length = length;
+    q->tx_cdescs[head].buf.valid_data = valid_data;
+    q->tx_cdescs[head].buf.valid_length = valid_length;
+    q->tx_cdescs[head].buf.flags = ipcq_compact_flags(misc_flags);
+
+    ipcq_compact_publish(q, head, 0);
+
+    cleanq_stats_enq(&q->stats, CLEANQ_ERR_OK, valid_length);
+    return CLEANQ_ERR_OK;
+}
+
+static errval_t ipcq_compact_dequeue(struct cleanq* queue,
+                                     regionid_t* region_id,
+                                     genoffset_t* offset,
+                                     genoffset_t* length,
+                                     genoffset_t* valid_data,
+                                     genoffset_t* valid_length,
+                                     uint64_t* misc_flags)
+{
+    struct ipcq* q = (struct ipcq*) queue;
+    struct desc_compact* desc;
+    uint64_t cmd;
+
+    if (!ipcq_compact_can_read(q)) {
+        q->stats.empty++;
+        return CLEANQ_ERR_QUEUE_EMPTY;
+    }
+
+    // do not read the descriptor before its sequence number
+    rte_smp_rmb();
+
+    desc = &q->rx_cdescs[q->rx_seq % q->slots];
+    cmd = desc->seq_cmd >> IPCQ_COMPACT_CMD_SHIFT;
+    *region_id = desc->rid;
+
+    if (cmd != 0) {
+        // handle special message reg/dereg! 
+        if (cmd == CMD_REG) {
+            cap.len = desc->reg.len;
+            cap.vaddr = (void*) desc->reg.base;
+            cap.paddr = desc->reg.base;
+            ipc_reg(q, cap, *region_id);
+        } else {
+            ipc_dereg(q, *region_id);
+        }
+        q->rx_seq++;
+        q->rx_seq_ack->value = q->rx_seq;
+
+        IPCQ_DEBUG("rx_seq_ack=%lu tx_seq_ack=%lu reg/dereg\n", 
+                   q->rx_seq_ack->value, q->tx_seq_ack->value);
+        // try dequeing again
+        return ipcq_compact_dequeue(queue, region_id, offset,
+                                    length, valid_data, valid_length,
+                                    misc_flags);
     }
+
+    *offset = desc->buf.offset;
+    *length = desc->buf.length;
+    *valid_data = desc->buf.valid_data;
+    *valid_length = desc->buf.valid_length;
+    *misc_flags = ipcq_compact_misc_flags(desc->buf.flags);
+
+    q->rx_seq++;
+    q->rx_seq_ack->value = q->rx_seq;
+
     IPCQ_DEBUG("rx_seq_ack=%lu tx_seq_ack=%lu \n", q->rx_seq_ack->value,
                q->tx_seq_ack->value);
-    return SYS_ERR_OK;
+    cleanq_stats_deq(&q->stats, CLEANQ_ERR_OK, *valid_length);
+    return CLEANQ_ERR_OK;
+}
+
+static errval_t ipcq_compact_control(struct ipcq* q, regionid_t rid,
+                                     uint64_t base, uint64_t len,
+                                     uint64_t cmd)
+{
+    size_t head = q->tx_seq % q->slots;
+
+    if (len > UINT32_MAX) {
+        return CLEANQ_ERR_INVALID_REGION_ARGS;
+    }
+
+    if (rid > UINT16_MAX) {
+        return CLEANQ_ERR_INVALID_REGION_ID;
+    }
+
+    while (!ipcq_can_write(q)) {}
+
+    q->tx_cdescs[head].rid = rid;
+    q->tx_cdescs[head].reg.base = base;
+    q->tx_cdescs[head].reg.len = len;
+
+    ipcq_compact_publish(q, head, cmd);
+
+    return CLEANQ_ERR_OK;
+}
+
+static errval_t ipcq_compact_register(struct cleanq* q, struct capref cap,
+                                      regionid_t rid)
+{
+    return ipcq_compact_control((struct ipcq*) q, rid, (uint64_t) cap.vaddr,
+                                cap.len, CMD_REG);
+}
+
+static errval_t ipcq_compact_deregister(struct cleanq* q, regionid_t rid)
+{
+    return ipcq_compact_control((struct ipcq*) q, rid, 0, 0, CMD_DEREG);
 }
 
 static errval_t ipcq_register(struct cleanq* q, struct capref cap,
@@ -283,23 +549,44 @@ static errval_t ipcq_register(struct cleanq* q, struct capref cap,
 
 
 
-/**
- * @brief Destroys a descriptor queue and frees its resources
- *
- * @param que                     The descriptor queue
- *
- * @returns error on failure or SYS_ERR_OK on success
- */
-errval_t ipcq_destroy(struct cleanq* que)
+static errval_t ipcq_destroy_queue(struct cleanq* que)
 {
     struct ipcq* q = (struct ipcq*) que;
 
-    munmap(q->tx_descs, IPCQ_MEM_SIZE);
-    munmap(q->rx_descs, IPCQ_MEM_SIZE);
+    if (q->tx_mem != NULL) {
+        munmap(q->tx_mem, q->mem_size);
+    }
+    if (q->rx_mem != NULL) {
+        munmap(q->rx_mem, q->mem_size);
+    }
     free(q->name);
-    free(q);
+    cleanq_free_socket(q, q->socket_id);
+
+    return CLEANQ_ERR_OK;
+}
+
+errval_t ipcq_destroy(struct ipcq* q)
+{
+    return cleanq_destroy(&q->q);
+}
 
-    return SYS_ERR_OK;
+static errval_t ipcq_notify(struct cleanq* q __rte_unused)
+{
+    // the other endpoint polls
+    return CLEANQ_ERR_OK;
+}
+
+static errval_t ipcq_control(struct cleanq* q, uint64_t request,
+                             uint64_t value __rte_unused, uint64_t* result)
+{
+    // the policy is applied by cleanq_enqueue() and cleanq_dequeue()
+    if (request == CLEANQ_CTRL_SET_VALIDATION) {
+        return CLEANQ_ERR_OK;
+    }
+    if (request == CLEANQ_CTRL_GET_STATS) {
+        return cleanq_stats_control(&((struct ipcq*) q)->stats, result);
+    }
+    return CLEANQ_ERR_INVALID_CTRL;
 }
 
 static errval_t ipcq_deregister(struct cleanq* q, regionid_t rid)
@@ -311,82 +598,224 @@ static errval_t ipcq_deregister(struct cleanq* q, regionid_t rid)
                                  CMD_DEREG);
 }
 
-errval_t ipcq_create(struct ipcq** q,
-                     char* name_send,
-                     char* name_recv,
-                     bool clear,
-                     struct ipcq_func_pointer* f)
+/*
+ * The descriptor rings are shared memory, so they can not come from the
+ * DPDK heap. Instead set a memory policy before the pages are first touched.
+ */
+static void ipcq_bind_socket(void* addr, size_t len, int socket_id)
 {
-    IPCQ_DEBUG("create start\n");
-    errval_t err;
-    struct ipcq* tmp;
+#ifdef RTE_EAL_NUMA_AWARE_HUGEPAGES
+    unsigned long mask;
 
-    // Init basic struct fields
-    tmp = (struct ipcq*) calloc(sizeof(struct ipcq), 1);
-    assert(tmp != NULL);
-    
-    int fd_send = shm_open(name_send, O_RDWR | O_CREAT, 0777);
-    int fd_recv = shm_open(name_recv, O_RDWR | O_CREAT, 0777);
-    assert((fd_send != 0) && (fd_recv != 0));
+    if (socket_id == CLEANQ_SOCKET_ID_ANY) {
+        return;
+    }
 
-    ftruncate(fd_send, IPCQ_MEM_SIZE);
-    ftruncate(fd_recv, IPCQ_MEM_SIZE);
+    mask = 1UL << socket_id;
+    if (mbind(addr, len, MPOL_PREFERRED, &mask, sizeof(mask) * 8, 0) != 0) {
+        IPCQ_DEBUG("mbind to socket %d failed\n", socket_id);
+    }
+#endif
+}
 
-    tmp->f.dereg = f->dereg;
-    tmp->f.reg = f->reg;
+/*
+ * Both endpoints have to ask for the same descriptor format. The endpoint
+ * that clears the rings writes its format to both ring headers, the other
+ * endpoint checks against it, or announces its own format if it comes up
+ * first.
+ */
+static errval_t ipcq_negotiate_format(struct ipcq* q, bool clear,
+                                      ipcq_desc_format_t format)
+{
+    union pointer* tx_hdr = q->tx_seq_ack;
+    union pointer* rx_hdr = q->rx_seq_ack;
+    uint32_t magic = rx_hdr->magic;
+
+    if ((clear && magic == IPCQ_HDR_MAGIC_PEER) ||
+        (!clear && magic == IPCQ_HDR_MAGIC)) {
+        if (rx_hdr->format != format) {
+            IPCQ_DEBUG("descriptor format %u, other endpoint uses %u\n",
+                       format, rx_hdr->format);
+            return CLEANQ_ERR_INIT_QUEUE;
+        }
+    }
+    q->format = format;
 
-    IPCQ_DEBUG("Mapping TX frame\n");
-    tmp->tx_descs = (struct desc*) mmap(NULL, 
-                    IPCQ_MEM_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, 
-                    fd_send, 0);
-    if (tmp->tx_descs == NULL) {
-        err = LIB_ERR_MALLOC_FAIL;
-        goto cleanup1;
+    if (clear) {
+        memset(q->rx_descs, 0, q->mem_size);
+        memset(q->tx_descs, 0, q->mem_size);
+    } else if (magic == IPCQ_HDR_MAGIC) {
+        return CLEANQ_ERR_OK;
     }
 
-    IPCQ_DEBUG("Mapping RX frame\n");
-    tmp->rx_descs = (struct desc*) mmap(NULL, 
-                    IPCQ_MEM_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, 
-                    fd_recv, 0);
-    if (tmp->rx_descs == NULL) {
-        err = LIB_ERR_MALLOC_FAIL;
-        goto cleanup2;
+    tx_hdr->format = format;
+    rx_hdr->format = format;
+    rte_smp_wmb();
+    tx_hdr->magic = clear ? IPCQ_HDR_MAGIC : IPCQ_HDR_MAGIC_PEER;
+    rx_hdr->magic = clear ? IPCQ_HDR_MAGIC : IPCQ_HDR_MAGIC_PEER;
+
+    return CLEANQ_ERR_OK;
+}
+
+ipcq_desc_format_t ipcq_get_desc_format(struct ipcq* q)
+{
+    return q->format;
+}
+
+size_t ipcq_ring_slots(size_t mem_size, ipcq_desc_format_t format)
+{
+    // the first cache line holds the header
+    if (format == IPCQ_DESC_COMPACT) {
+        return RTE_MIN((mem_size - IPCQ_ALIGNMENT) /
+                       sizeof(struct desc_compact),
+                       (size_t) IPCQ_COMPACT_MAX_SLOTS);
     }
+    return mem_size / sizeof(struct desc) - 1;
+}
 
-    if (clear) {
-        memset(tmp->rx_descs, 0, IPCQ_MEM_SIZE);
-        memset(tmp->tx_descs, 0, IPCQ_MEM_SIZE);
+errval_t ipcq_create_mem(struct ipcq** q,
+                         void* tx_mem,
+                         void* rx_mem,
+                         size_t mem_size,
+                         bool clear,
+                         struct ipcq_func_pointer* f,
+                         int socket_id,
+                         ipcq_desc_format_t format,
+                         struct ipcq_conn* conn)
+{
+    errval_t err;
+    struct ipcq* tmp;
+
+    tmp = (struct ipcq*) cleanq_malloc_socket(sizeof(struct ipcq), socket_id);
+    if (tmp == NULL) {
+        return CLEANQ_ERR_MALLOC_FAIL;
     }
+    tmp->socket_id = socket_id;
+    tmp->mem_size = mem_size;
+    tmp->conn = conn;
+
+    if (f != NULL) {
+        tmp->f.dereg = f->dereg;
+        tmp->f.reg = f->reg;
+    }
+
+    tmp->tx_descs = (struct desc*) tx_mem;
+    tmp->rx_descs = (struct desc*) rx_mem;
+
+    ipcq_bind_socket(tmp->tx_descs, mem_size, socket_id);
+    ipcq_bind_socket(tmp->rx_descs, mem_size, socket_id);
 
-    IPCQ_DEBUG("INIT TX/RX queue done %p %p \n", tmp->tx_descs, tmp->rx_descs);
     tmp->tx_seq_ack = (union pointer*) tmp->tx_descs;
     tmp->rx_seq_ack = (union pointer*) tmp->rx_descs;
+    err = ipcq_negotiate_format(tmp, clear, format);
+    if (err_is_fail(err)) {
+        cleanq_free_socket(tmp, socket_id);
+        return err;
+    }
+
+    IPCQ_DEBUG("INIT TX/RX queue done %p %p \n", tmp->tx_descs, tmp->rx_descs);
     tmp->tx_seq_ack->value = 0;
     tmp->rx_seq_ack->value = 0;
-    tmp->tx_descs++;
-    tmp->rx_descs++;
-    tmp->slots = IPCQ_DEFAULT_SIZE-1;
     tmp->rx_seq = 1;
     tmp->tx_seq = 1;
 
-    cleanq_init(&tmp->q, false);
+    err = cleanq_init_socket(&tmp->q, socket_id);
+    if (err_is_fail(err)) {
+        cleanq_free_socket(tmp, socket_id);
+        return err;
+    }
 
-    tmp->q.f.enq = ipcq_enqueue;
-    tmp->q.f.deq = ipcq_dequeue;
-    tmp->q.f.reg = ipcq_register;
-    tmp->q.f.dereg = ipcq_deregister;
+    tmp->slots = ipcq_ring_slots(mem_size, tmp->format);
+    if (tmp->format == IPCQ_DESC_COMPACT) {
+        tmp->tx_cdescs = (struct desc_compact*) (tmp->tx_descs + 1);
+        tmp->rx_cdescs = (struct desc_compact*) (tmp->rx_descs + 1);
+
+        tmp->q.f.enq = ipcq_compact_enqueue;
+        tmp->q.f.deq = ipcq_compact_dequeue;
+        tmp->q.f.reg = ipcq_compact_register;
+        tmp->q.f.dereg = ipcq_compact_deregister;
+        // the ids of the regions registered here have to fit the descriptors,
+        // the ones of regions added by a queue above are checked on use
+        region_pool_set_id_mask(tmp->q.pool, UINT16_MAX);
+    } else {
+        tmp->q.f.enq = ipcq_enqueue;
+        tmp->q.f.deq = ipcq_dequeue;
+        tmp->q.f.reg = ipcq_register;
+        tmp->q.f.dereg = ipcq_deregister;
+    }
+    tmp->q.f.notify = ipcq_notify;
+    tmp->q.f.ctrl = ipcq_control;
+    tmp->q.f.destroy = ipcq_destroy_queue;
+    tmp->tx_descs++;
+    tmp->rx_descs++;
 
     *q = tmp;
+    return CLEANQ_ERR_OK;
+}
+
+errval_t ipcq_create(struct ipcq** q,
+                     char* name_send,
+                     char* name_recv,
+                     bool clear,
+                     struct ipcq_func_pointer* f,
+                     int socket_id,
+                     ipcq_desc_format_t format)
+{
+    IPCQ_DEBUG("create start\n");
+    errval_t err = CLEANQ_ERR_MALLOC_FAIL;
+    void* tx_mem = MAP_FAILED;
+    void* rx_mem = MAP_FAILED;
+
+    int fd_send = shm_open(name_send, O_RDWR | O_CREAT, 0777);
+    int fd_recv = shm_open(name_recv, O_RDWR | O_CREAT, 0777);
+    if (fd_send < 0 || fd_recv < 0 ||
+        ftruncate(fd_send, IPCQ_MEM_SIZE) != 0 ||
+        ftruncate(fd_recv, IPCQ_MEM_SIZE) != 0) {
+        err = CLEANQ_ERR_INIT_QUEUE;
+        goto cleanup;
+    }
+
+    IPCQ_DEBUG("Mapping TX frame\n");
+    tx_mem = mmap(NULL, IPCQ_MEM_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED,
+                  fd_send, 0);
+    if (tx_mem == MAP_FAILED) {
+        goto cleanup;
+    }
+
+    IPCQ_DEBUG("Mapping RX frame\n");
+    rx_mem = mmap(NULL, IPCQ_MEM_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED,
+                  fd_recv, 0);
+    if (rx_mem == MAP_FAILED) {
+        goto cleanup;
+    }
+
+    err = ipcq_create_mem(q, tx_mem, rx_mem, IPCQ_MEM_SIZE, clear, f,
+                          socket_id, format, NULL);
+    if (err_is_fail(err)) {
+        goto cleanup;
+    }
+    (*q)->tx_mem = tx_mem;
+    (*q)->rx_mem = rx_mem;
+
+    close(fd_send);
+    close(fd_recv);
 
     IPCQ_DEBUG("create end %p \n", *q);
-    return SYS_ERR_OK;
+    return CLEANQ_ERR_OK;
 
-cleanup2:
-    munmap(tmp->rx_descs, IPCQ_MEM_SIZE);
-cleanup1:
-    munmap(tmp->tx_descs, IPCQ_MEM_SIZE);
+cleanup:
+    if (rx_mem != MAP_FAILED) {
+        munmap(rx_mem, IPCQ_MEM_SIZE);
+    }
+    if (tx_mem != MAP_FAILED) {
+        munmap(tx_mem, IPCQ_MEM_SIZE);
+    }
+    if (fd_send >= 0) {
+        close(fd_send);
+    }
+    if (fd_recv >= 0) {
+        close(fd_recv);
+    }
 
     return err;
-
 }
-
@@ -0,0 +1,48 @@
+/*
+ * Copyright (c) 2017 ETH Zurich.
+ * All rights reserved.
+ *
+ * This file is distributed under the terms in the attached LICENSE file.
+ * If you do not find this file, copies can be found by writing to:
+ * ETH Zurich D-INFK, Universitaetstr. 6, CH-8092 Zurich. Attn: Systems Group.
+ */
+#ifndef IPCQ_INTERNAL_H_
+#define IPCQ_INTERNAL_H_ 1
+
+#include <stdbool.h>
+#include <backends/ipcq.h>
+
+/*
+ * Shared between the queue and the socket setup
+ */
+
+/**
+ * @brief number of descriptors of a ring in mem_size bytes
+ */
+size_t ipcq_ring_slots(size_t mem_size, ipcq_desc_format_t format);
+
+/**
+ * @brief sets up a queue on rings that are already mapped. The memory stays
+ *        owned by the caller.
+ *
+ * @param conn                  Connection the queue belongs to or NULL
+ */
+errval_t ipcq_create_mem(struct ipcq** q,
+                         void* tx_mem,
+                         void* rx_mem,
+                         size_t mem_size,
+                         bool clear,
+                         struct ipcq_func_pointer* f,
+                         int socket_id,
+                         ipcq_desc_format_t format,
+                         struct ipcq_conn* conn);
+
+/**
+ * @brief translates an address of the other process into ours, for regions
+ *        it shared with ipcq_conn_alloc_region()
+ *
+ * @returns the address or NULL if no shared region covers it
+ */
+void* ipcq_conn_translate(struct ipcq_conn* c, uint64_t va, size_t len);
+
+#endif /* IPCQ_INTERNAL_H_ */
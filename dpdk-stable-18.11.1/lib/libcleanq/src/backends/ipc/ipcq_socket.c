@@ -0,0 +1,772 @@
+/*
+ * Copyright (c) 2017 ETH Zurich.
+ * All rights reserved.
+ *
+ * This file is distributed under the terms in the attached LICENSE file.
+ * If you do not find this file, copies can be found by writing to:
+ * ETH Zurich D-INFK, Universitaetstr. 6, CH-8092 Zurich. Attn: Systems Group.
+ */
+
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/time.h>
+
+#include <rte_common.h>
+
+#include <cleanq.h>
+#include <cleanq_module.h>
+#include <backends/ipcq.h>
+#include "ipcq_debug.h"
+#include "ipcq_internal.h"
+
+#ifndef MFD_CLOEXEC
+#define MFD_CLOEXEC 0x0001U
+#endif
+#ifndef MFD_HUGETLB
+#define MFD_HUGETLB 0x0004U
+#endif
+
+/*
+ * Protocol
+ *
+ * Messages on a SOCK_SEQPACKET socket, all of them struct ipcq_msg:
+ *
+ *   listener                           connecting side
+ *      HELLO (limits, formats) ---------->
+ *          <----------- INIT (requested queues, ring size, format)
+ *      CONFIG (agreed values) + fd ------>
+ *          <---------------------------- CONNECTED
+ *
+ * Afterwards either side sends REGION + fd for every region it allocates,
+ * before the region is registered on a queue, and REGION_FREE for every
+ * region it frees, after the region is deregistered.
+ */
+
+#define IPCQ_SOCK_MAGIC 0x49504353
+#define IPCQ_SOCK_VERSION 1
+
+#define IPCQ_MSG_HELLO 1
+#define IPCQ_MSG_INIT 2
+#define IPCQ_MSG_CONFIG 3
+#define IPCQ_MSG_CONNECTED 4
+#define IPCQ_MSG_REGION 5
+#define IPCQ_MSG_REGION_FREE 6
+
+// how long the other side may take to answer during the setup
+#define IPCQ_SOCK_TIMEOUT_MS 1000
+// the accepting side may still be busy with other connections
+#define IPCQ_SOCK_HELLO_TIMEOUT_MS 10000
+
+#define IPCQ_HUGE_PAGE_SIZE (2UL << 20)
+
+struct ipcq_msg {
+    uint32_t magic;
+    uint16_t version;
+    uint16_t type;
+    uint32_t num_queues;
+    uint32_t ring_size;
+    uint32_t format;    // HELLO: bit mask of the formats supported
+    uint32_t pad;
+    uint64_t addr;      // REGION, REGION_FREE: address at the sender
+    uint64_t len;       // REGION, CONFIG: size of the memory of the fd
+};
+
+// region of the other side, mapped by us
+struct peer_region {
+    uint64_t addr;
+    uint64_t len;
+    void* va;
+};
+
+struct ipcq_listener {
+    int fd;
+    char path[sizeof(((struct sockaddr_un*) 0)->sun_path)];
+    struct ipcq_conn_params limits;
+};
+
+struct ipcq_conn {
+    int fd;
+    struct ipcq_conn_params params;
+
+    // rings of all queue pairs
+    void* ring_mem;
+    size_t ring_mem_size;
+    struct ipcq** queues;
+
+    // regions of the other side, filled when a registration needs them
+    pthread_mutex_t lock;
+    struct peer_region* peer;
+    uint32_t num_peer;
+    uint32_t max_peer;
+};
+
+/*
+ * Messages
+ */
+
+static errval_t msg_send(int fd, uint16_t type, struct ipcq_msg* msg,
+                         int pass_fd)
+{
+    char cbuf[CMSG_SPACE(sizeof(int))];
+    struct iovec iov;
+    struct msghdr mh;
+    struct cmsghdr* cmsg;
+
+    msg->magic = IPCQ_SOCK_MAGIC;
+    msg->version = IPCQ_SOCK_VERSION;
+    msg->type = type;
+
+    memset(&mh, 0, sizeof(mh));
+    iov.iov_base = msg;
+    iov.iov_len = sizeof(*msg);
+    mh.msg_iov = &iov;
+    mh.msg_iovlen = 1;
+
+    if (pass_fd >= 0) {
+        memset(cbuf, 0, sizeof(cbuf));
+        mh.msg_control = cbuf;
+        mh.msg_controllen = sizeof(cbuf);
+        cmsg = CMSG_FIRSTHDR(&mh);
+        cmsg->cmsg_level = SOL_SOCKET;
+        cmsg->cmsg_type = SCM_RIGHTS;
+        cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+        memcpy(CMSG_DATA(cmsg), &pass_fd, sizeof(int));
+    }
+
+    if (sendmsg(fd, &mh, MSG_NOSIGNAL) != sizeof(*msg)) {
+        IPCQ_DEBUG("sendmsg failed: %s\n", strerror(errno));
+        return CLEANQ_ERR_INIT_QUEUE;
+    }
+    return CLEANQ_ERR_OK;
+}
+
+/*
+ * Receives the next message, which has to be of the given type or of any
+ * type if it is 0. A file descriptor passed along is returned in pass_fd, -1
+ * if there is none.
+ */
+static errval_t msg_recv(int fd, uint16_t type, struct ipcq_msg* msg,
+                         int* pass_fd, int flags)
+{
+    char cbuf[CMSG_SPACE(sizeof(int))];
+    struct iovec iov;
+    struct msghdr mh;
+    struct cmsghdr* cmsg;
+    ssize_t n;
+    int rfd = -1;
+
+    memset(&mh, 0, sizeof(mh));
+    iov.iov_base = msg;
+    iov.iov_len = sizeof(*msg);
+    mh.msg_iov = &iov;
+    mh.msg_iovlen = 1;
+    mh.msg_control = cbuf;
+    mh.msg_controllen = sizeof(cbuf);
+
+    n = recvmsg(fd, &mh, flags | MSG_CMSG_CLOEXEC);
+    if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+        return CLEANQ_ERR_QUEUE_EMPTY;
+    }
+
+    for (cmsg = CMSG_FIRSTHDR(&mh); n > 0 && cmsg != NULL;
+         cmsg = CMSG_NXTHDR(&mh, cmsg)) {
+        if (cmsg->cmsg_level == SOL_SOCKET &&
+            cmsg->cmsg_type == SCM_RIGHTS) {
+            memcpy(&rfd, CMSG_DATA(cmsg), sizeof(int));
+        }
+    }
+
+    if (n != sizeof(*msg) || (mh.msg_flags & MSG_CTRUNC) ||
+        msg->magic != IPCQ_SOCK_MAGIC || msg->version != IPCQ_SOCK_VERSION ||
+        (type != 0 && msg->type != type)) {
+        IPCQ_DEBUG("unexpected message (%zd bytes, type %u)\n", n,
+                   n == sizeof(*msg) ? msg->type : 0);
+        if (rfd >= 0) {
+            close(rfd);
+        }
+        return CLEANQ_ERR_INIT_QUEUE;
+    }
+
+    if (pass_fd != NULL) {
+        *pass_fd = rfd;
+    } else if (rfd >= 0) {
+        close(rfd);
+    }
+    return CLEANQ_ERR_OK;
+}
+
+static int sock_addr(const char* path, struct sockaddr_un* sa,
+                     socklen_t* len)
+{
+    size_t n = strlen(path);
+
+    if (n == 0 || n >= sizeof(sa->sun_path)) {
+        return -1;
+    }
+
+    memset(sa, 0, sizeof(*sa));
+    sa->sun_family = AF_UNIX;
+    memcpy(sa->sun_path, path, n);
+    // abstract namespace, no file
+    if (path[0] == '@') {
+        sa->sun_path[0] = '\0';
+    }
+    *len = offsetof(struct sockaddr_un, sun_path) + n;
+    return 0;
+}
+
+static void sock_set_timeout(int fd, int ms)
+{
+    struct timeval tv;
+
+    tv.tv_sec = ms / 1000;
+    tv.tv_usec = (ms % 1000) * 1000;
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+    setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+}
+
+// compact rings only have as many slots as their sequence bits can tell
+static bool ring_size_valid(uint32_t size, ipcq_desc_format_t format)
+{
+    if (format == IPCQ_DESC_COMPACT && size > IPCQ_COMPACT_MAX_RING_SIZE) {
+        return false;
+    }
+    return size >= IPCQ_MEM_SIZE && size <= IPCQ_MAX_RING_SIZE &&
+           (size & (size - 1)) == 0;
+}
+
+/*
+ * Connections
+ */
+
+static struct ipcq_conn* conn_alloc(int fd)
+{
+    struct ipcq_conn* c = calloc(1, sizeof(*c));
+
+    if (c == NULL) {
+        return NULL;
+    }
+    c->fd = fd;
+    pthread_mutex_init(&c->lock, NULL);
+    return c;
+}
+
+static void conn_free(struct ipcq_conn* c)
+{
+    uint32_t i;
+
+    for (i = 0; c->queues != NULL && i < c->params.num_queues; i++) {
+        if (c->queues[i] != NULL) {
+            ipcq_destroy(c->queues[i]);
+        }
+    }
+    free(c->queues);
+
+    if (c->ring_mem != NULL) {
+        munmap(c->ring_mem, c->ring_mem_size);
+    }
+
+    for (i = 0; i < c->num_peer; i++) {
+        munmap(c->peer[i].va, c->peer[i].len);
+    }
+    free(c->peer);
+
+    if (c->fd >= 0) {
+        close(c->fd);
+    }
+    pthread_mutex_destroy(&c->lock);
+    free(c);
+}
+
+/*
+ * Ring 2i carries the descriptors from the listening to the connecting
+ * side of queue pair i, ring 2i + 1 the other direction.
+ */
+static errval_t conn_create_queues(struct ipcq_conn* c, bool listener,
+                                   struct ipcq_func_pointer* f, int socket_id)
+{
+    errval_t err;
+    uint8_t* to_conn;
+    uint8_t* to_listener;
+    uint32_t i;
+
+    c->queues = calloc(c->params.num_queues, sizeof(*c->queues));
+    if (c->queues == NULL) {
+        return CLEANQ_ERR_MALLOC_FAIL;
+    }
+
+    for (i = 0; i < c->params.num_queues; i++) {
+        to_conn = (uint8_t*) c->ring_mem + 2 * i * c->params.ring_size;
+        to_listener = to_conn + c->params.ring_size;
+
+        // the listener sets up the rings before passing them on
+        if (listener) {
+            err = ipcq_create_mem(&c->queues[i], to_conn, to_listener,
+                                  c->params.ring_size, true, f, socket_id,
+                                  c->params.format, c);
+        } else {
+            err = ipcq_create_mem(&c->queues[i], to_listener, to_conn,
+                                  c->params.ring_size, false, f, socket_id,
+                                  c->params.format, c);
+        }
+        if (err_is_fail(err)) {
+            return err;
+        }
+    }
+    return CLEANQ_ERR_OK;
+}
+
+static errval_t conn_map_rings(struct ipcq_conn* c, int fd)
+{
+    c->ring_mem_size = (size_t) 2 * c->params.num_queues *
+                       c->params.ring_size;
+    c->ring_mem = mmap(NULL, c->ring_mem_size, PROT_READ | PROT_WRITE,
+                       MAP_SHARED, fd, 0);
+    if (c->ring_mem == MAP_FAILED) {
+        c->ring_mem = NULL;
+        return CLEANQ_ERR_MALLOC_FAIL;
+    }
+    return CLEANQ_ERR_OK;
+}
+
+static void conn_unmap_region(struct ipcq_conn* c, uint64_t addr,
+                              uint64_t len)
+{
+    uint32_t i;
+
+    for (i = 0; i < c->num_peer; i++) {
+        if (c->peer[i].addr == addr && c->peer[i].len == len) {
+            munmap(c->peer[i].va, c->peer[i].len);
+            c->peer[i] = c->peer[--c->num_peer];
+            return;
+        }
+    }
+}
+
+// maps and unmaps the regions as the other side allocated and freed them
+static void conn_recv_regions(struct ipcq_conn* c)
+{
+    struct peer_region* p;
+    struct ipcq_msg msg;
+    void* va;
+    int fd;
+
+    while (err_is_ok(msg_recv(c->fd, 0, &msg, &fd, MSG_DONTWAIT))) {
+        if (msg.type == IPCQ_MSG_REGION_FREE) {
+            conn_unmap_region(c, msg.addr, msg.len);
+        }
+        if (msg.type != IPCQ_MSG_REGION || fd < 0) {
+            if (fd >= 0) {
+                close(fd);
+            }
+            continue;
+        }
+
+        va = mmap(NULL, msg.len, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        close(fd);
+        if (va == MAP_FAILED) {
+            IPCQ_DEBUG("cannot map region of %lu bytes\n", msg.len);
+            continue;
+        }
+
+        if (c->num_peer == c->max_peer) {
+            c->max_peer = c->max_peer ? 2 * c->max_peer : 8;
+            p = realloc(c->peer, c->max_peer * sizeof(*p));
+            if (p == NULL) {
+                munmap(va, msg.len);
+                c->max_peer = c->num_peer;
+                continue;
+            }
+            c->peer = p;
+        }
+
+        p = &c->peer[c->num_peer++];
+        p->addr = msg.addr;
+        p->len = msg.len;
+        p->va = va;
+    }
+}
+
+static void* conn_lookup(struct ipcq_conn* c, uint64_t va, size_t len)
+{
+    uint32_t i;
+
+    for (i = 0; i < c->num_peer; i++) {
+        if (va >= c->peer[i].addr &&
+            va + len <= c->peer[i].addr + c->peer[i].len) {
+            return (uint8_t*) c->peer[i].va + (va - c->peer[i].addr);
+        }
+    }
+    return NULL;
+}
+
+void* ipcq_conn_translate(struct ipcq_conn* c, uint64_t va, size_t len)
+{
+    void* ret;
+
+    // the region was sent before it was registered, so it is queued. A
+    // freed region is queued as well, its address can be taken again
+    pthread_mutex_lock(&c->lock);
+    conn_recv_regions(c);
+    ret = conn_lookup(c, va, len);
+    pthread_mutex_unlock(&c->lock);
+    return ret;
+}
+
+/*
+ * Listening side
+ */
+
+errval_t ipcq_listen(struct ipcq_listener** l, const char* path,
+                     const struct ipcq_conn_params* limits)
+{
+    struct ipcq_listener* tmp;
+    struct sockaddr_un sa;
+    socklen_t len;
+
+    if (limits->num_queues == 0 || limits->num_queues > IPCQ_MAX_QUEUES ||
+        !ring_size_valid(limits->ring_size, limits->format) ||
+        sock_addr(path, &sa, &len) != 0) {
+        return CLEANQ_ERR_INIT_QUEUE;
+    }
+
+    tmp = calloc(1, sizeof(*tmp));
+    if (tmp == NULL) {
+        return CLEANQ_ERR_MALLOC_FAIL;
+    }
+    strcpy(tmp->path, path);
+    tmp->limits = *limits;
+
+    tmp->fd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+    if (tmp->fd < 0) {
+        free(tmp);
+        return CLEANQ_ERR_INIT_QUEUE;
+    }
+
+    // left behind by an earlier run
+    if (path[0] != '@') {
+        unlink(path);
+    }
+
+    if (bind(tmp->fd, (struct sockaddr*) &sa, len) != 0 ||
+        listen(tmp->fd, SOMAXCONN) != 0) {
+        IPCQ_DEBUG("cannot listen on %s: %s\n", path, strerror(errno));
+        close(tmp->fd);
+        free(tmp);
+        return CLEANQ_ERR_INIT_QUEUE;
+    }
+
+    *l = tmp;
+    return CLEANQ_ERR_OK;
+}
+
+int ipcq_listener_get_fd(struct ipcq_listener* l)
+{
+    return l->fd;
+}
+
+errval_t ipcq_listener_destroy(struct ipcq_listener* l)
+{
+    close(l->fd);
+    if (l->path[0] != '@') {
+        unlink(l->path);
+    }
+    free(l);
+    return CLEANQ_ERR_OK;
+}
+
+errval_t ipcq_accept(struct ipcq_listener* l, struct ipcq_conn** c,
+                     struct ipcq_func_pointer* f, int socket_id)
+{
+    struct ipcq_conn_params* p;
+    struct ipcq_conn* tmp;
+    struct ipcq_msg msg;
+    errval_t err;
+    int mem_fd = -1;
+    int fd;
+
+    do {
+        fd = accept4(l->fd, NULL, NULL, SOCK_CLOEXEC);
+    } while (fd < 0 && errno == EINTR);
+    if (fd < 0) {
+        return CLEANQ_ERR_INIT_QUEUE;
+    }
+    sock_set_timeout(fd, IPCQ_SOCK_TIMEOUT_MS);
+
+    tmp = conn_alloc(fd);
+    if (tmp == NULL) {
+        close(fd);
+        return CLEANQ_ERR_MALLOC_FAIL;
+    }
+    p = &tmp->params;
+
+    memset(&msg, 0, sizeof(msg));
+    msg.num_queues = l->limits.num_queues;
+    msg.ring_size = l->limits.ring_size;
+    msg.format = (1U << IPCQ_DESC_DEFAULT) | (1U << l->limits.format);
+    err = msg_send(fd, IPCQ_MSG_HELLO, &msg, -1);
+    if (err_is_fail(err)) {
+        goto fail;
+    }
+
+    err = msg_recv(fd, IPCQ_MSG_INIT, &msg, NULL, 0);
+    if (err_is_fail(err)) {
+        goto fail;
+    }
+
+    // what was asked for, within our limits
+    p->num_queues = msg.num_queues;
+    if (p->num_queues == 0 || p->num_queues > l->limits.num_queues) {
+        p->num_queues = l->limits.num_queues;
+    }
+    p->format = msg.format == l->limits.format ? l->limits.format :
+                                                 IPCQ_DESC_DEFAULT;
+    p->ring_size = msg.ring_size;
+    if (!ring_size_valid(p->ring_size, p->format) ||
+        p->ring_size > l->limits.ring_size) {
+        p->ring_size = l->limits.ring_size;
+    }
+
+    mem_fd = memfd_create("ipcq", MFD_CLOEXEC);
+    if (mem_fd < 0 ||
+        ftruncate(mem_fd, (off_t) 2 * p->num_queues * p->ring_size) != 0) {
+        err = CLEANQ_ERR_MALLOC_FAIL;
+        goto fail;
+    }
+
+    err = conn_map_rings(tmp, mem_fd);
+    if (err_is_fail(err)) {
+        goto fail;
+    }
+
+    err = conn_create_queues(tmp, true, f, socket_id);
+    if (err_is_fail(err)) {
+        goto fail;
+    }
+
+    memset(&msg, 0, sizeof(msg));
+    msg.num_queues = p->num_queues;
+    msg.ring_size = p->ring_size;
+    msg.format = p->format;
+    msg.len = tmp->ring_mem_size;
+    err = msg_send(fd, IPCQ_MSG_CONFIG, &msg, mem_fd);
+    if (err_is_fail(err)) {
+        goto fail;
+    }
+    close(mem_fd);
+    mem_fd = -1;
+
+    err = msg_recv(fd, IPCQ_MSG_CONNECTED, &msg, NULL, 0);
+    if (err_is_fail(err)) {
+        goto fail;
+    }
+
+    IPCQ_DEBUG("accepted %u queue pairs, %u byte rings, format %u\n",
+               p->num_queues, p->ring_size, p->format);
+    *c = tmp;
+    return CLEANQ_ERR_OK;
+
+fail:
+    if (mem_fd >= 0) {
+        close(mem_fd);
+    }
+    conn_free(tmp);
+    return err;
+}
+
+/*
+ * Connecting side
+ */
+
+errval_t ipcq_connect(struct ipcq_conn** c, const char* path,
+                      const struct ipcq_conn_params* params,
+                      struct ipcq_func_pointer* f, int socket_id)
+{
+    struct ipcq_conn_params* p;
+    struct ipcq_conn* tmp;
+    struct sockaddr_un sa;
+    struct ipcq_msg msg;
+    socklen_t len;
+    errval_t err;
+    int mem_fd = -1;
+    int fd;
+
+    if (sock_addr(path, &sa, &len) != 0) {
+        return CLEANQ_ERR_INIT_QUEUE;
+    }
+
+    fd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+    if (fd < 0) {
+        return CLEANQ_ERR_INIT_QUEUE;
+    }
+    sock_set_timeout(fd, IPCQ_SOCK_TIMEOUT_MS);
+
+    if (connect(fd, (struct sockaddr*) &sa, len) != 0) {
+        IPCQ_DEBUG("cannot connect to %s: %s\n", path, strerror(errno));
+        close(fd);
+        return CLEANQ_ERR_INIT_QUEUE;
+    }
+
+    tmp = conn_alloc(fd);
+    if (tmp == NULL) {
+        close(fd);
+        return CLEANQ_ERR_MALLOC_FAIL;
+    }
+    p = &tmp->params;
+
+    sock_set_timeout(fd, IPCQ_SOCK_HELLO_TIMEOUT_MS);
+    err = msg_recv(fd, IPCQ_MSG_HELLO, &msg, NULL, 0);
+    sock_set_timeout(fd, IPCQ_SOCK_TIMEOUT_MS);
+    if (err_is_fail(err)) {
+        goto fail;
+    }
+
+    memset(&msg, 0, sizeof(msg));
+    msg.num_queues = params->num_queues;
+    msg.ring_size = params->ring_size;
+    msg.format = params->format;
+    err = msg_send(fd, IPCQ_MSG_INIT, &msg, -1);
+    if (err_is_fail(err)) {
+        goto fail;
+    }
+
+    err = msg_recv(fd, IPCQ_MSG_CONFIG, &msg, &mem_fd, 0);
+    if (err_is_fail(err)) {
+        goto fail;
+    }
+
+    p->num_queues = msg.num_queues;
+    p->ring_size = msg.ring_size;
+    p->format = (ipcq_desc_format_t) msg.format;
+    if (mem_fd < 0 || p->num_queues == 0 ||
+        p->num_queues > IPCQ_MAX_QUEUES ||
+        !ring_size_valid(p->ring_size, p->format) ||
+        msg.len != (uint64_t) 2 * p->num_queues * p->ring_size) {
+        err = CLEANQ_ERR_INIT_QUEUE;
+        goto fail;
+    }
+
+    err = conn_map_rings(tmp, mem_fd);
+    close(mem_fd);
+    mem_fd = -1;
+    if (err_is_fail(err)) {
+        goto fail;
+    }
+
+    err = conn_create_queues(tmp, false, f, socket_id);
+    if (err_is_fail(err)) {
+        goto fail;
+    }
+
+    memset(&msg, 0, sizeof(msg));
+    err = msg_send(fd, IPCQ_MSG_CONNECTED, &msg, -1);
+    if (err_is_fail(err)) {
+        goto fail;
+    }
+
+    IPCQ_DEBUG("connected to %s, %u queue pairs, %u byte rings, format %u\n",
+               path, p->num_queues, p->ring_size, p->format);
+    *c = tmp;
+    return CLEANQ_ERR_OK;
+
+fail:
+    if (mem_fd >= 0) {
+        close(mem_fd);
+    }
+    conn_free(tmp);
+    return err;
+}
+
+/*
+ * Both sides
+ */
+
+void ipcq_conn_get_params(struct ipcq_conn* c, struct ipcq_conn_params* params)
+{
+    *params = c->params;
+}
+
+struct ipcq* ipcq_conn_get_queue(struct ipcq_conn* c, uint32_t i)
+{
+    if (i >= c->params.num_queues) {
+        return NULL;
+    }
+    return c->queues[i];
+}
+
+errval_t ipcq_conn_alloc_region(struct ipcq_conn* c, size_t len, int flags,
+                                struct capref* cap)
+{
+    struct ipcq_msg msg;
+    size_t page;
+    errval_t err;
+    void* va;
+    int fd;
+
+    page = (flags & IPCQ_REGION_HUGETLB) ? IPCQ_HUGE_PAGE_SIZE :
+                                           (size_t) sysconf(_SC_PAGESIZE);
+    len = (len + page - 1) & ~(page - 1);
+    if (len == 0) {
+        return CLEANQ_ERR_INVALID_REGION_ARGS;
+    }
+
+    fd = memfd_create("ipcq_region", MFD_CLOEXEC |
+                      ((flags & IPCQ_REGION_HUGETLB) ? MFD_HUGETLB : 0));
+    if (fd < 0) {
+        return CLEANQ_ERR_MALLOC_FAIL;
+    }
+
+    if (ftruncate(fd, len) != 0) {
+        close(fd);
+        return CLEANQ_ERR_MALLOC_FAIL;
+    }
+
+    va = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (va == MAP_FAILED) {
+        close(fd);
+        return CLEANQ_ERR_MALLOC_FAIL;
+    }
+
+    memset(&msg, 0, sizeof(msg));
+    msg.addr = (uint64_t) va;
+    msg.len = len;
+    err = msg_send(c->fd, IPCQ_MSG_REGION, &msg, fd);
+    close(fd);
+    if (err_is_fail(err)) {
+        munmap(va, len);
+        return err;
+    }
+
+    cap->vaddr = va;
+    cap->paddr = (uint64_t) va;
+    cap->len = len;
+    return CLEANQ_ERR_OK;
+}
+
+errval_t ipcq_conn_free_region(struct ipcq_conn* c, struct capref* cap)
+{
+    struct ipcq_msg msg;
+
+    if (munmap(cap->vaddr, cap->len) != 0) {
+        return CLEANQ_ERR_INVALID_REGION_ARGS;
+    }
+
+    // the other side unmaps it before it maps the next region
+    memset(&msg, 0, sizeof(msg));
+    msg.addr = (uint64_t) cap->vaddr;
+    msg.len = cap->len;
+    return msg_send(c->fd, IPCQ_MSG_REGION_FREE, &msg, -1);
+}
+
+errval_t ipcq_conn_destroy(struct ipcq_conn* c)
+{
+    conn_free(c);
+    return CLEANQ_ERR_OK;
+}
@@ -8,6 +8,7 @@
  */
 
 #include <stdlib.h>
+#include <rte_common.h>
 #include <cleanq.h>
 #include <backends/loopback_devif.h>
 #include <cleanq_module.h>
@@ -21,6 +22,8 @@ struct loopback_queue
     size_t head;
     size_t tail;
     size_t num_ele;
+    int socket_id;
+    struct cleanq_stats stats;
 };
 
 static errval_t loopback_enqueue(struct cleanq* q, regionid_t rid, genoffset_t offset,
@@ -32,6 +35,7 @@ static errval_t loopback_enqueue(struct cleanq* q, regionid_t rid, genoffset_t o
 
     if (lq->num_ele == LOOPBACK_QUEUE_SIZE) {
         //debug_printf("enqueue: head=%lu tail=%lu full\n", lq->head, lq->tail);
+        lq->stats.full++;
         return CLEANQ_ERR_QUEUE_FULL;
     }
 
@@ -46,7 +50,8 @@ static errval_t loopback_enqueue(struct cleanq* q, regionid_t rid, genoffset_t o
     lq->head = (lq->head + 1) % LOOPBACK_QUEUE_SIZE;
     lq->num_ele++;
 
-    return SYS_ERR_OK;
+    cleanq_stats_enq(&lq->stats, CLEANQ_ERR_OK, valid_length);
+    return CLEANQ_ERR_OK;
 }
 
 static errval_t loopback_dequeue(struct cleanq* q, regionid_t* rid,
@@ -58,6 +63,7 @@ static errval_t loopback_dequeue(struct cleanq* q, regionid_t* rid,
 
     if (lq->num_ele == 0) {
         //debug_printf("dequeue: head=%lu tail=%lu emtpy\n", lq->head, lq->tail);
+        lq->stats.empty++;
         return CLEANQ_ERR_QUEUE_EMPTY;
     }
 
@@ -72,11 +78,13 @@ static errval_t loopback_dequeue(struct cleanq* q, regionid_t* rid,
 
     lq->tail = (lq->tail + 1) % LOOPBACK_QUEUE_SIZE;
     lq->num_ele--;
-    return SYS_ERR_OK;
+
+    cleanq_stats_deq(&lq->stats, CLEANQ_ERR_OK, *valid_length);
+    return CLEANQ_ERR_OK;
 }
 
 
-static errval_t loopback_notify(struct cleanq *q)
+static errval_t loopback_notify(struct cleanq *q __rte_unused)
 {
 
 #if 0
@@ -94,51 +102,68 @@ static errval_t loopback_notify(struct cleanq *q)
 #endif
    
 
-    return SYS_ERR_OK;
+    return CLEANQ_ERR_OK;
 }
 
-static errval_t loopback_register(struct cleanq *q, struct capref cap,
-                                regionid_t region_id)
+static errval_t loopback_register(struct cleanq *q __rte_unused,
+                                  struct capref cap __rte_unused,
+                                  regionid_t region_id __rte_unused)
 {
-    return SYS_ERR_OK;
+    return CLEANQ_ERR_OK;
 }
 
-static errval_t loopback_deregister(struct cleanq *q, regionid_t region_id)
+static errval_t loopback_deregister(struct cleanq *q __rte_unused,
+                                    regionid_t region_id __rte_unused)
 {
-    return SYS_ERR_OK;
+    return CLEANQ_ERR_OK;
 }
 
 static errval_t loopback_control(struct cleanq *q,
                                  uint64_t request,
-                                 uint64_t value,
+                                 uint64_t value __rte_unused,
                                  uint64_t *result)
 {
     // TODO Might have some options for loopback device?
-    return SYS_ERR_OK;
+    struct loopback_queue *lq = (struct loopback_queue *)q;
+
+    if (request == CLEANQ_CTRL_GET_STATS) {
+        return cleanq_stats_control(&lq->stats, result);
+    }
+    // there is no device that could interrupt
+    if (request == CLEANQ_CTRL_RX_INTR_ENABLE ||
+        request == CLEANQ_CTRL_RX_INTR_DISABLE ||
+        request == CLEANQ_CTRL_RX_INTR_FD) {
+        return CLEANQ_ERR_INVALID_CTRL;
+    }
+    return CLEANQ_ERR_OK;
 }
 
 
 static errval_t loopback_destroy(struct cleanq* q)
 {
-    free((struct loopback_queue*)q);
-    return SYS_ERR_OK;
+    struct loopback_queue *lq = (struct loopback_queue *)q;
+    cleanq_free_socket(lq, lq->socket_id);
+    return CLEANQ_ERR_OK;
 }
 
-errval_t loopback_queue_create(struct loopback_queue** q)
+errval_t loopback_queue_create(struct loopback_queue** q, int socket_id)
 {
     errval_t err;
 
-    struct loopback_queue *lq = (struct loopback_queue*) calloc(1, sizeof(struct loopback_queue));
+    struct loopback_queue *lq = (struct loopback_queue*) 
+                                cleanq_malloc_socket(sizeof(struct loopback_queue),
+                                                     socket_id);
     if (lq == NULL) {
-        return LIB_ERR_MALLOC_FAIL;
+        return CLEANQ_ERR_MALLOC_FAIL;
     }
 
-    err = cleanq_init(&lq->q, false);
+    err = cleanq_init_socket(&lq->q, socket_id);
     if (err_is_fail(err)) {
-        free(lq);
+        cleanq_free_socket(lq, socket_id);
         return err;
     }
 
+    lq->socket_id = socket_id;
     lq->head = 0;
     lq->tail = 0;
     lq->num_ele = 0;
@@ -153,5 +178,5 @@ errval_t loopback_queue_create(struct loopback_queue** q)
 
     *q = lq;
 
-    return SYS_ERR_OK;
+    return CLEANQ_ERR_OK;
 }
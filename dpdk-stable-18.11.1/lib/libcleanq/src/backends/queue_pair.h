@@ -0,0 +1,186 @@
+/*
+ * Copyright (c) 2017 ETH Zurich.
+ * All rights reserved.
+ *
+ * This file is distributed under the terms in the attached LICENSE file.
+ * If you do not find this file, copies can be found by writing to:
+ * ETH Zurich D-INFK, Universitaetstr. 6, CH-8092 Zurich. Attn: Systems Group.
+ */
+
+/*
+ * Helpers of the backends that are a pair of queues, a receive and a send
+ * side in one allocation: the buffer fifos, the region table the two sides
+ * share and the control commands they handle the same way.
+ */
+#ifndef QUEUE_PAIR_H_
+#define QUEUE_PAIR_H_ 1
+
+#include <rte_common.h>
+
+#include <cleanq.h>
+#include <cleanq_module.h>
+
+#define MAX_NUM_REGIONS 64
+
+struct region_vaddr {
+    void* va;
+    regionid_t rid;
+    genoffset_t headroom; // see cleanq_set_region_headroom()
+    struct cleanq* mirror;  // the other side, if we added the region to it
+};
+
+// circular buffer of buffer descriptors
+struct buf_fifo {
+    struct cleanq_buf* bufs;
+    uint32_t size;
+    uint32_t head;
+    uint32_t tail;
+};
+
+static inline errval_t fifo_init(struct buf_fifo* f, uint32_t size,
+                                 int socket_id)
+{
+    f->bufs = cleanq_malloc_socket(size * sizeof(struct cleanq_buf),
+                                   socket_id);
+    if (f->bufs == NULL) {
+        return CLEANQ_ERR_MALLOC_FAIL;
+    }
+    f->size = size;
+    f->head = 0;
+    f->tail = 0;
+    return CLEANQ_ERR_OK;
+}
+
+static inline int fifo_full(struct buf_fifo* f)
+{
+    return f->head - f->tail == f->size;
+}
+
+static inline int fifo_empty(struct buf_fifo* f)
+{
+    return f->head == f->tail;
+}
+
+static inline void fifo_push(struct buf_fifo* f, regionid_t rid,
+                             genoffset_t offset, genoffset_t length,
+                             genoffset_t valid_data, genoffset_t valid_length,
+                             uint64_t flags)
+{
+    struct cleanq_buf* b = &f->bufs[f->head++ % f->size];
+    b->rid = rid;
+    b->offset = offset;
+    b->length = length;
+    b->valid_data = valid_data;
+    b->valid_length = valid_length;
+    b->flags = flags;
+}
+
+static inline struct cleanq_buf* fifo_peek(struct buf_fifo* f)
+{
+    return &f->bufs[f->tail % f->size];
+}
+
+static inline struct cleanq_buf* fifo_pop(struct buf_fifo* f)
+{
+    return &f->bufs[f->tail++ % f->size];
+}
+
+/*
+ * The modules register with the send side only and add the region to the
+ * pools of both sides, so the sides share the table. Regions registered
+ * with one side directly are added to the pool of the other, which keeps
+ * it from handing out their ids again.
+ */
+
+// NULL if the region is not in the table, an empty slot has rid 0 as well
+static inline struct region_vaddr* region_lookup(struct region_vaddr* regions,
+                                                 regionid_t rid)
+{
+    struct region_vaddr* reg = &regions[rid % MAX_NUM_REGIONS];
+
+    if (reg->va == NULL || reg->rid != rid) {
+        return NULL;
+    }
+    return reg;
+}
+
+static inline uint8_t* region_buf_start(struct region_vaddr* regions,
+                                        regionid_t rid, genoffset_t offset,
+                                        genoffset_t valid_data)
+{
+    struct region_vaddr* reg = &regions[rid % MAX_NUM_REGIONS];
+    return (uint8_t*) reg->va + offset + reg->headroom + valid_data;
+}
+
+static inline errval_t region_register(struct region_vaddr* regions,
+                                       struct cleanq* other,
+                                       struct capref cap, regionid_t rid)
+{
+    struct region_vaddr* reg = &regions[rid % MAX_NUM_REGIONS];
+
+    if (reg->va != NULL && (reg->rid != rid || reg->va != cap.vaddr)) {
+        return CLEANQ_ERR_INVALID_REGION_ID;
+    }
+
+    // fails if the modules added it already
+    if (err_is_ok(cleanq_add_region(other, cap, rid))) {
+        reg->mirror = other;
+    }
+
+    reg->va = cap.vaddr;
+    reg->rid = rid;
+    reg->headroom = 0;
+    return CLEANQ_ERR_OK;
+}
+
+static inline errval_t region_deregister(struct region_vaddr* regions,
+                                         regionid_t rid)
+{
+    struct region_vaddr* reg = region_lookup(regions, rid);
+
+    if (reg == NULL) {
+        return CLEANQ_ERR_INVALID_REGION_ID;
+    }
+
+    // only from the side we added it to, otherwise the memory cannot be
+    // registered again
+    if (reg->mirror != NULL) {
+        cleanq_remove_region(reg->mirror, rid);
+        reg->mirror = NULL;
+    }
+    reg->va = NULL;
+    reg->rid = 0;
+    return CLEANQ_ERR_OK;
+}
+
+static inline errval_t region_set_headroom(struct region_vaddr* regions,
+                                           uint64_t value)
+{
+    struct region_vaddr* reg;
+
+    reg = region_lookup(regions, CLEANQ_CTRL_REGION_HEADROOM_RID(value));
+    if (reg == NULL) {
+        return CLEANQ_ERR_INVALID_REGION_ID;
+    }
+    reg->headroom = CLEANQ_CTRL_REGION_HEADROOM_LEN(value);
+    return CLEANQ_ERR_OK;
+}
+
+// commands left after the ones specific to the backend
+static inline errval_t queue_pair_control(uint64_t cmd)
+{
+    // validation is done by the generic code
+    if (cmd == CLEANQ_CTRL_SET_VALIDATION) {
+        return CLEANQ_ERR_OK;
+    }
+
+    return CLEANQ_ERR_INVALID_CTRL;
+}
+
+// the queue pair is freed by the destroy function of the backend
+static inline errval_t queue_pair_side_destroy(struct cleanq* q __rte_unused)
+{
+    return CLEANQ_ERR_OK;
+}
+
+#endif /* QUEUE_PAIR_H_ */
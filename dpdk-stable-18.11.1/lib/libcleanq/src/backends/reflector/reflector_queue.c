@@ -0,0 +1,368 @@
+/*
+ * Copyright (c) 2017 ETH Zurich.
+ * All rights reserved.
+ *
+ * This file is distributed under the terms in the attached LICENSE file.
+ * If you do not find this file, copies can be found by writing to:
+ * ETH Zurich D-INFK, Universitaetstr. 6, CH-8092 Zurich. Attn: Systems Group.
+ */
+
+#include <stdlib.h>
+#include <stddef.h>
+#include <string.h>
+
+#include <rte_common.h>
+#include <rte_memcpy.h>
+#include <rte_ether.h>
+#include <rte_ip.h>
+#include <rte_udp.h>
+
+#include <cleanq.h>
+#include <cleanq_module.h>
+#include <backends/reflector.h>
+
+#include "backends/queue_pair.h"
+
+// buffers that can be posted, received and not dequeued, sent and not
+// dequeued, each
+#define REFLECTOR_QUEUE_SIZE 1024
+
+struct reflector_q {
+    struct cleanq rx_q;
+    struct cleanq tx_q;
+
+    struct buf_fifo posted;
+    struct buf_fifo received;
+    struct buf_fifo sent;
+
+    uint64_t reflected;
+
+    // regions registered on either side
+    struct region_vaddr regions[MAX_NUM_REGIONS];
+    int socket_id;
+
+    // packets the peer drops count as dropped on the receive side
+    struct cleanq_stats rx_stats;
+    struct cleanq_stats tx_stats;
+};
+
+static inline struct reflector_q* reflector_from_rx(struct cleanq* q)
+{
+    return (struct reflector_q*) q;
+}
+
+static inline struct reflector_q* reflector_from_tx(struct cleanq* q)
+{
+    return (struct reflector_q*) ((uint8_t*) q - offsetof(struct reflector_q, tx_q));
+}
+
+static inline errval_t reflector_pop(struct buf_fifo* f, regionid_t* rid,
+                                     genoffset_t* offset, genoffset_t* length,
+                                     genoffset_t* valid_data,
+                                     genoffset_t* valid_length,
+                                     uint64_t* flags)
+{
+    struct cleanq_buf* b;
+
+    if (fifo_empty(f)) {
+        return CLEANQ_ERR_QUEUE_EMPTY;
+    }
+
+    b = fifo_pop(f);
+    *rid = b->rid;
+    *offset = b->offset;
+    *length = b->length;
+    *valid_data = b->valid_data;
+    *valid_length = b->valid_length;
+    *flags = b->flags;
+    return CLEANQ_ERR_OK;
+}
+
+// swaps source and destination of the packet as the peer would answer it
+static void reflect_headers(uint8_t* pkt, genoffset_t len)
+{
+    struct ether_hdr* eth = (struct ether_hdr*) pkt;
+    struct ether_addr mac;
+    struct ipv4_hdr* ip;
+    struct udp_hdr* udp;
+    uint32_t ip_addr;
+    uint16_t port;
+    uint32_t ip_len;
+
+    if (len < sizeof(struct ether_hdr)) {
+        return;
+    }
+    ether_addr_copy(&eth->d_addr, &mac);
+    ether_addr_copy(&eth->s_addr, &eth->d_addr);
+    ether_addr_copy(&mac, &eth->s_addr);
+
+    if (eth->ether_type != rte_cpu_to_be_16(ETHER_TYPE_IPv4) ||
+        len < sizeof(struct ether_hdr) + sizeof(struct ipv4_hdr)) {
+        return;
+    }
+    ip = (struct ipv4_hdr*) (eth + 1);
+    ip_addr = ip->src_addr;
+    ip->src_addr = ip->dst_addr;
+    ip->dst_addr = ip_addr;
+
+    ip_len = (ip->version_ihl & IPV4_HDR_IHL_MASK) * IPV4_IHL_MULTIPLIER;
+    if (ip->next_proto_id != IPPROTO_UDP ||
+        len < sizeof(struct ether_hdr) + ip_len + sizeof(struct udp_hdr)) {
+        return;
+    }
+    udp = (struct udp_hdr*) ((uint8_t*) ip + ip_len);
+    port = udp->src_port;
+    udp->src_port = udp->dst_port;
+    udp->dst_port = port;
+}
+
+/*
+ * Receive side
+ */
+
+static errval_t reflector_rx_enqueue(struct cleanq* q, regionid_t rid,
+                                     genoffset_t offset, genoffset_t length,
+                                     genoffset_t valid_data,
+                                     genoffset_t valid_length, uint64_t flags)
+{
+    struct reflector_q* que = reflector_from_rx(q);
+
+    if (fifo_full(&que->posted)) {
+        que->rx_stats.full++;
+        return CLEANQ_ERR_QUEUE_FULL;
+    }
+
+    fifo_push(&que->posted, rid, offset, length, valid_data, valid_length,
+              flags);
+    cleanq_stats_enq(&que->rx_stats, CLEANQ_ERR_OK, valid_length);
+    return CLEANQ_ERR_OK;
+}
+
+static errval_t reflector_rx_dequeue(struct cleanq* q, regionid_t* rid,
+                                     genoffset_t* offset, genoffset_t* length,
+                                     genoffset_t* valid_data,
+                                     genoffset_t* valid_length,
+                                     uint64_t* flags)
+{
+    struct reflector_q* que = reflector_from_rx(q);
+    errval_t err;
+
+    err = reflector_pop(&que->received, rid, offset, length, valid_data,
+                        valid_length, flags);
+    cleanq_stats_deq(&que->rx_stats, err,
+                     err == CLEANQ_ERR_OK ? *valid_length : 0);
+    return err;
+}
+
+/*
+ * Send side
+ */
+
+static errval_t reflector_tx_enqueue(struct cleanq* q, regionid_t rid,
+                                     genoffset_t offset, genoffset_t length,
+                                     genoffset_t valid_data,
+                                     genoffset_t valid_length, uint64_t flags)
+{
+    struct reflector_q* que = reflector_from_tx(q);
+    struct cleanq_buf* rx;
+    uint8_t* pkt;
+
+    if (fifo_full(&que->sent)) {
+        que->tx_stats.full++;
+        return CLEANQ_ERR_QUEUE_FULL;
+    }
+
+    // the peer would drop it, the buffer stays posted if it is too small
+    rx = fifo_peek(&que->posted);
+    if (fifo_empty(&que->posted) || fifo_full(&que->received) ||
+        rx->valid_data + valid_length > rx->length) {
+        cleanq_stats_drop(&que->rx_stats);
+    } else {
+        pkt = region_buf_start(que->regions, rx->rid, rx->offset,
+                               rx->valid_data);
+        rte_memcpy(pkt, region_buf_start(que->regions, rid, offset,
+                                         valid_data), valid_length);
+        reflect_headers(pkt, valid_length);
+
+        fifo_push(&que->received, rx->rid, rx->offset, rx->length,
+                  rx->valid_data, valid_length, rx->flags);
+        que->posted.tail++;
+        que->reflected++;
+    }
+
+    fifo_push(&que->sent, rid, offset, length, valid_data, valid_length,
+              flags);
+    cleanq_stats_enq(&que->tx_stats, CLEANQ_ERR_OK, valid_length);
+    return CLEANQ_ERR_OK;
+}
+
+static errval_t reflector_tx_dequeue(struct cleanq* q, regionid_t* rid,
+                                     genoffset_t* offset, genoffset_t* length,
+                                     genoffset_t* valid_data,
+                                     genoffset_t* valid_length,
+                                     uint64_t* flags)
+{
+    struct reflector_q* que = reflector_from_tx(q);
+    errval_t err;
+
+    err = reflector_pop(&que->sent, rid, offset, length, valid_data,
+                        valid_length, flags);
+    cleanq_stats_deq(&que->tx_stats, err,
+                     err == CLEANQ_ERR_OK ? *valid_length : 0);
+    return err;
+}
+
+/*
+ * Control path, shared by both sides
+ */
+
+static errval_t reflector_control(struct reflector_q* que, uint64_t cmd,
+                                  uint64_t value)
+{
+    if (cmd == CLEANQ_CTRL_SET_REGION_HEADROOM) {
+        return region_set_headroom(que->regions, value);
+    }
+
+    return queue_pair_control(cmd);
+}
+
+static errval_t reflector_rx_register(struct cleanq* q, struct capref cap,
+                                      regionid_t rid)
+{
+    struct reflector_q* que = reflector_from_rx(q);
+    return region_register(que->regions, &que->tx_q, cap, rid);
+}
+
+static errval_t reflector_rx_deregister(struct cleanq* q, regionid_t rid)
+{
+    return region_deregister(reflector_from_rx(q)->regions, rid);
+}
+
+static errval_t reflector_rx_control(struct cleanq* q, uint64_t cmd,
+                                     uint64_t value, uint64_t* result)
+{
+    if (cmd == CLEANQ_CTRL_GET_STATS) {
+        return cleanq_stats_control(&reflector_from_rx(q)->rx_stats, result);
+    }
+    return reflector_control(reflector_from_rx(q), cmd, value);
+}
+
+static errval_t reflector_tx_register(struct cleanq* q, struct capref cap,
+                                      regionid_t rid)
+{
+    struct reflector_q* que = reflector_from_tx(q);
+    return region_register(que->regions, &que->rx_q, cap, rid);
+}
+
+static errval_t reflector_tx_deregister(struct cleanq* q, regionid_t rid)
+{
+    return region_deregister(reflector_from_tx(q)->regions, rid);
+}
+
+static errval_t reflector_tx_control(struct cleanq* q, uint64_t cmd,
+                                     uint64_t value, uint64_t* result)
+{
+    if (cmd == CLEANQ_CTRL_GET_STATS) {
+        return cleanq_stats_control(&reflector_from_tx(q)->tx_stats, result);
+    }
+    return reflector_control(reflector_from_tx(q), cmd, value);
+}
+
+static errval_t reflector_notify(struct cleanq* q __rte_unused)
+{
+    return CLEANQ_ERR_OK;
+}
+
+static void reflector_free(struct reflector_q* que)
+{
+    cleanq_free_socket(que->posted.bufs, que->socket_id);
+    cleanq_free_socket(que->received.bufs, que->socket_id);
+    cleanq_free_socket(que->sent.bufs, que->socket_id);
+    cleanq_free_socket(que, que->socket_id);
+}
+
+/*
+ * Public functions
+ */
+
+errval_t reflector_create(struct reflector_q** q, int socket_id)
+{
+    errval_t err;
+    struct reflector_q* que;
+
+    que = cleanq_malloc_socket(sizeof(struct reflector_q), socket_id);
+    if (que == NULL) {
+        return CLEANQ_ERR_MALLOC_FAIL;
+    }
+    memset(que, 0, sizeof(struct reflector_q));
+    que->socket_id = socket_id;
+
+    err = fifo_init(&que->posted, REFLECTOR_QUEUE_SIZE, socket_id);
+    if (err_is_ok(err)) {
+        err = fifo_init(&que->received, REFLECTOR_QUEUE_SIZE, socket_id);
+    }
+    if (err_is_ok(err)) {
+        err = fifo_init(&que->sent, REFLECTOR_QUEUE_SIZE, socket_id);
+    }
+    if (err_is_fail(err)) {
+        reflector_free(que);
+        return err;
+    }
+
+    err = cleanq_init_socket(&que->rx_q, socket_id);
+    if (err_is_fail(err)) {
+        reflector_free(que);
+        return err;
+    }
+
+    err = cleanq_init_socket(&que->tx_q, socket_id);
+    if (err_is_fail(err)) {
+        cleanq_destroy(&que->rx_q);
+        reflector_free(que);
+        return err;
+    }
+
+    que->rx_q.f.reg = reflector_rx_register;
+    que->rx_q.f.dereg = reflector_rx_deregister;
+    que->rx_q.f.ctrl = reflector_rx_control;
+    que->rx_q.f.notify = reflector_notify;
+    que->rx_q.f.enq = reflector_rx_enqueue;
+    que->rx_q.f.deq = reflector_rx_dequeue;
+    que->rx_q.f.destroy = queue_pair_side_destroy;
+
+    que->tx_q.f.reg = reflector_tx_register;
+    que->tx_q.f.dereg = reflector_tx_deregister;
+    que->tx_q.f.ctrl = reflector_tx_control;
+    que->tx_q.f.notify = reflector_notify;
+    que->tx_q.f.enq = reflector_tx_enqueue;
+    que->tx_q.f.deq = reflector_tx_dequeue;
+    que->tx_q.f.destroy = queue_pair_side_destroy;
+
+    *q = que;
+    return CLEANQ_ERR_OK;
+}
+
+errval_t reflector_destroy(struct reflector_q* q)
+{
+    cleanq_destroy(&q->rx_q);
+    cleanq_destroy(&q->tx_q);
+    reflector_free(q);
+    return CLEANQ_ERR_OK;
+}
+
+struct cleanq* reflector_get_rx(struct reflector_q* q)
+{
+    return &q->rx_q;
+}
+
+struct cleanq* reflector_get_tx(struct reflector_q* q)
+{
+    return &q->tx_q;
+}
+
+void reflector_get_stats(struct reflector_q* q, uint64_t* reflected,
+                         uint64_t* dropped)
+{
+    *reflected = q->reflected;
+    *dropped = q->rx_stats.dropped;
+}
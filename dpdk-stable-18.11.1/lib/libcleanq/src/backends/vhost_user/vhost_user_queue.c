@@ -0,0 +1,1169 @@
+/*
+ * Copyright (c) 2017 ETH Zurich.
+ * All rights reserved.
+ *
+ * This file is distributed under the terms in the attached LICENSE file.
+ * If you do not find this file, copies can be found by writing to:
+ * ETH Zurich D-INFK, Universitaetstr. 6, CH-8092 Zurich. Attn: Systems Group.
+ */
+
+#include <stdio.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <stddef.h>
+#include <string.h>
+#include <linux/virtio_net.h>
+
+#include <rte_pause.h>
+#include <rte_spinlock.h>
+#include <rte_vhost.h>
+
+#include <cleanq.h>
+#include <cleanq_module.h>
+#include <backends/vhost_user.h>
+
+#include "region_pool.h"
+#include "backends/queue_pair.h"
+
+//#define DEBUG_ENABLED
+
+#if defined(DEBUG_ENABLED)
+#define DEBUG(x...) do { printf("VHOST_USER: %s:%d: ", __func__, __LINE__); \
+                         printf(x); \
+                    } while (0)
+#else
+#define DEBUG(x...) ((void)0)
+#endif
+
+#ifndef VIRTIO_F_VERSION_1
+#define VIRTIO_F_VERSION_1 32
+#endif
+
+/*
+ * What the guest may negotiate. No offloads, so the virtio-net headers are
+ * all zero, no indirect descriptors and no event index, without it
+ * rte_vhost_vring_call() only has to look at the flags of the rings.
+ */
+#define VHOST_USER_FEATURES ((1ULL << VIRTIO_NET_F_MRG_RXBUF) | \
+                             (1ULL << VIRTIO_F_ANY_LAYOUT) | \
+                             (1ULL << VIRTIO_F_VERSION_1) | \
+                             (1ULL << VHOST_USER_F_PROTOCOL_FEATURES))
+
+// vrings of the first queue pair, named as seen from the guest
+#define VHOST_USER_GUEST_RX 0
+#define VHOST_USER_GUEST_TX 1
+
+#define VHOST_USER_MAX_RING_SIZE 1024
+#define VHOST_USER_MAX_REGIONS 8
+#define VHOST_USER_MAX_DEVS 16
+
+// buffers that can be posted for copying received packets into
+#define VHOST_USER_MAX_POSTED 1024
+// send completions not dequeued yet
+#define VHOST_USER_MAX_SENT 1024
+
+/*
+ * Region ids of the guest memory are taken from the region pools when the
+ * queue is created, two banks of them. The memory tables use them in turn,
+ * so that buffers of the mapping before are not taken for buffers of the
+ * current one.
+ */
+#define VHOST_USER_BANKS 2
+#define VHOST_USER_BANK(gen) ((gen) % VHOST_USER_BANKS)
+
+struct guest_region {
+    uint64_t gpa;
+    uint64_t size;
+    uint8_t* va;
+    regionid_t rid;
+};
+
+// the device, set up by the vhost-user thread before it is running
+struct vhost_user_dev {
+    int vid;
+    uint32_t seq;           // configuration, changes with every reload
+    uint32_t first_seq;     // configuration the device came up with
+    uint32_t mem_gen;       // memory table, changes when the guest remaps
+    uint32_t hdr_len;
+    struct rte_vhost_vring vring[2];
+    uint16_t last_avail[2];
+    struct guest_region regions[VHOST_USER_MAX_REGIONS];
+    uint32_t nregions;
+};
+
+// state of one vring, only touched by the thread using the side
+struct vhost_user_side {
+    int busy;               // in the datapath, see side_enter()
+    uint32_t seq;           // configuration the state is for, 0 if none yet
+    uint32_t mem_gen;       // memory table of the regions added
+    int vid;
+    uint16_t vring_idx;
+    uint32_t hdr_len;
+    struct rte_vhost_vring vr;
+    uint16_t last_avail;
+    uint16_t last_used;
+    int call;               // used entries the guest was not told about
+};
+
+// guest buffer dequeued in place, by descriptor index
+struct inflight {
+    regionid_t rid;
+    genoffset_t offset;
+    int active;
+};
+
+struct vhost_user_q {
+    struct cleanq rx_q;
+    struct cleanq tx_q;
+
+    char path[256];
+    int socket_id;
+
+    // written by the vhost-user thread
+    struct vhost_user_dev dev;
+    uint32_t running_seq;   // dev.seq while the device runs, 0 otherwise
+    uint32_t last_seq;
+    uint32_t last_mem_gen;
+    int up;                 // between new_device and destroy_device
+    int enabled[2];
+
+    struct vhost_user_side rx;  // the guest TX vring
+    struct vhost_user_side tx;  // the guest RX vring
+
+    // receive side
+    int zero_copy;
+    struct buf_fifo posted;
+    struct inflight inflight[VHOST_USER_MAX_RING_SIZE];
+    // descriptors in the order they were handed out, mostly returned so
+    uint16_t order[VHOST_USER_MAX_RING_SIZE];
+    uint32_t order_head;
+    uint32_t order_tail;
+
+    // send side
+    struct buf_fifo sent;
+
+    // regions registered on either side
+    struct region_vaddr regions[MAX_NUM_REGIONS];
+    // ids of the guest regions, the same in the pools of both sides
+    regionid_t guest_rids[VHOST_USER_BANKS][VHOST_USER_MAX_REGIONS];
+
+    struct cleanq_stats rx_stats;
+    struct cleanq_stats tx_stats;
+};
+
+// queues with a socket, for the callbacks of the vhost-user thread
+static struct vhost_user_q* vhost_user_qs[VHOST_USER_MAX_DEVS];
+static rte_spinlock_t vhost_user_qs_lock = RTE_SPINLOCK_INITIALIZER;
+
+static inline struct vhost_user_q* vhost_user_from_rx(struct cleanq* q)
+{
+    return (struct vhost_user_q*) q;
+}
+
+static inline struct vhost_user_q* vhost_user_from_tx(struct cleanq* q)
+{
+    return (struct vhost_user_q*) ((uint8_t*) q -
+                                   offsetof(struct vhost_user_q, tx_q));
+}
+
+// guest memory at a guest physical address, NULL if not mapped
+static inline uint8_t* guest_va(struct vhost_user_q* que, uint64_t gpa,
+                                uint32_t len, struct guest_region** reg)
+{
+    struct guest_region* r;
+    uint32_t i;
+
+    for (i = 0; i < que->dev.nregions; i++) {
+        r = &que->dev.regions[i];
+        if (gpa >= r->gpa && gpa + len <= r->gpa + r->size) {
+            if (reg != NULL) {
+                *reg = r;
+            }
+            return r->va + (gpa - r->gpa);
+        }
+    }
+    return NULL;
+}
+
+// bank of a guest region id, -1 if it is none
+static inline int guest_bank(struct vhost_user_q* que, regionid_t rid)
+{
+    uint32_t b, i;
+
+    for (b = 0; b < VHOST_USER_BANKS; b++) {
+        for (i = 0; i < VHOST_USER_MAX_REGIONS; i++) {
+            if (que->guest_rids[b][i] == rid) {
+                return b;
+            }
+        }
+    }
+    return -1;
+}
+
+// data of a buffer, guest regions only while the device is running
+static inline uint8_t* buf_start(struct vhost_user_q* que, regionid_t rid,
+                                 genoffset_t offset, genoffset_t valid_data)
+{
+    uint32_t i;
+
+    if (guest_bank(que, rid) >= 0) {
+        for (i = 0; i < que->dev.nregions; i++) {
+            if (que->dev.regions[i].rid == rid) {
+                return que->dev.regions[i].va + offset + valid_data;
+            }
+        }
+        return NULL;
+    }
+
+    return region_buf_start(que->regions, rid, offset, valid_data);
+}
+
+/*
+ * Datapath and vhost-user thread
+ *
+ * The datapath marks a side busy and then checks that the device is
+ * running; the vhost-user thread stops the device and then waits until
+ * neither side is busy. Besides when the guest connects and disconnects,
+ * it does so whenever a vring is enabled or disabled: virtio_user and QEMU
+ * disable the vrings around changes of the memory table, which librte_vhost
+ * applies without telling us. The first use of a side after a change picks
+ * up the new vring and, if the memory was remapped, the guest regions.
+ */
+
+static inline void side_call(struct vhost_user_side* s)
+{
+    if (s->call) {
+        rte_vhost_vring_call(s->vid, s->vring_idx);
+        s->call = 0;
+    }
+}
+
+static inline void used_put(struct vhost_user_side* s, uint16_t head,
+                            uint32_t len)
+{
+    struct vring_used_elem* e;
+
+    e = &s->vr.used->ring[s->last_used & (s->vr.size - 1)];
+    e->id = head;
+    e->len = len;
+    s->last_used++;
+    __atomic_store_n(&s->vr.used->idx, s->last_used, __ATOMIC_RELEASE);
+    s->call = 1;
+}
+
+// stands in for a guest region id not used by the memory table, no buffer
+// is within it and it is above any memory the application registers
+static void guest_cap_unused(uint32_t bank, uint32_t i, struct capref* cap)
+{
+    cap->vaddr = NULL;
+    cap->paddr = UINT64_MAX - (bank * VHOST_USER_MAX_REGIONS + i);
+    cap->len = 0;
+}
+
+static void side_attach(struct vhost_user_q* que, struct vhost_user_side* s,
+                        struct cleanq* q, uint32_t seq)
+{
+    struct vhost_user_dev* dev = &que->dev;
+    uint32_t bank = VHOST_USER_BANK(dev->mem_gen);
+    struct guest_region* r;
+    struct capref cap;
+    regionid_t rid;
+    uint32_t i;
+    uint16_t head;
+    // a new connection starts where librte_vhost says, a reload goes on
+    int reset = s->seq == 0 || (int32_t) (s->seq - dev->first_seq) < 0;
+
+    s->vid = dev->vid;
+    s->hdr_len = dev->hdr_len;
+    s->vr = dev->vring[s->vring_idx];
+    if (reset) {
+        s->last_avail = dev->last_avail[s->vring_idx];
+        s->call = 0;
+    }
+    // only we write the used ring
+    s->last_used = s->vr.used->idx;
+    s->seq = seq;
+
+    if (s->mem_gen == dev->mem_gen) {
+        return;
+    }
+
+    // the other bank keeps the mapping before, only bounds are checked
+    for (i = 0; i < VHOST_USER_MAX_REGIONS; i++) {
+        rid = que->guest_rids[bank][i];
+        if (i < dev->nregions) {
+            r = &dev->regions[i];
+            cap.vaddr = r->va;
+            cap.paddr = (uint64_t) (uintptr_t) r->va;
+            cap.len = r->size;
+        } else {
+            guest_cap_unused(bank, i, &cap);
+        }
+        // buffers of a region that could not be added fail validation
+        cleanq_remove_region(q, rid);
+        cleanq_add_region(q, cap, rid);
+    }
+    s->mem_gen = dev->mem_gen;
+
+    if (s != &que->rx) {
+        return;
+    }
+
+    // buffers dequeued in place are gone with the old mapping
+    for (i = que->order_tail; !reset && i != que->order_head; i++) {
+        head = que->order[i % VHOST_USER_MAX_RING_SIZE];
+        if (que->inflight[head].active) {
+            used_put(s, head, 0);
+        }
+    }
+    memset(que->inflight, 0, sizeof(que->inflight));
+    que->order_head = 0;
+    que->order_tail = 0;
+}
+
+static inline int side_enter(struct vhost_user_q* que,
+                             struct vhost_user_side* s, struct cleanq* q)
+{
+    uint32_t seq;
+
+    __atomic_store_n(&s->busy, 1, __ATOMIC_SEQ_CST);
+    seq = __atomic_load_n(&que->running_seq, __ATOMIC_SEQ_CST);
+    if (seq == 0 ||
+        !__atomic_load_n(&que->enabled[s->vring_idx], __ATOMIC_ACQUIRE)) {
+        __atomic_store_n(&s->busy, 0, __ATOMIC_RELEASE);
+        return 0;
+    }
+
+    if (s->seq != seq) {
+        side_attach(que, s, q, seq);
+    }
+    return 1;
+}
+
+static inline void side_leave(struct vhost_user_side* s)
+{
+    __atomic_store_n(&s->busy, 0, __ATOMIC_RELEASE);
+}
+
+// next descriptor chain the guest made available, -1 if none
+static inline int avail_next(struct vhost_user_side* s)
+{
+    uint16_t head;
+
+    if (s->last_avail == __atomic_load_n(&s->vr.avail->idx,
+                                         __ATOMIC_ACQUIRE)) {
+        return -1;
+    }
+
+    head = s->vr.avail->ring[s->last_avail & (s->vr.size - 1)];
+    s->last_avail++;
+    return head;
+}
+
+/*
+ * Receive side, the guest TX vring
+ */
+
+static errval_t rx_next(struct vhost_user_q* que, struct vhost_user_side* s,
+                        regionid_t* rid, genoffset_t* offset,
+                        genoffset_t* length, genoffset_t* valid_data,
+                        genoffset_t* valid_length, uint64_t* flags)
+{
+    struct guest_region* reg = NULL;
+    struct vring_desc* desc;
+    struct cleanq_buf* b;
+    genoffset_t data_off;
+    uint8_t* data;
+    uint32_t len;
+    int head;
+
+    for (;;) {
+        // without zero-copy, packets wait in the vring for a buffer
+        if (!que->zero_copy && fifo_empty(&que->posted)) {
+            return CLEANQ_ERR_QUEUE_EMPTY;
+        }
+
+        head = avail_next(s);
+        if (head < 0) {
+            side_call(s);
+            return CLEANQ_ERR_QUEUE_EMPTY;
+        }
+        if (head >= s->vr.size) {
+            continue;
+        }
+
+        // the header either comes first in the buffer or on its own
+        desc = &s->vr.desc[head];
+        data_off = s->hdr_len;
+        if (desc->len == s->hdr_len && (desc->flags & VRING_DESC_F_NEXT) &&
+            desc->next < s->vr.size) {
+            desc = &s->vr.desc[desc->next];
+            data_off = 0;
+        }
+
+        // packets in more than one buffer are dropped
+        data = guest_va(que, desc->addr, desc->len, &reg);
+        if ((desc->flags & (VRING_DESC_F_NEXT | VRING_DESC_F_INDIRECT)) ||
+            desc->len <= data_off || data == NULL) {
+            DEBUG("dropping descriptor %d\n", head);
+            used_put(s, head, 0);
+            continue;
+        }
+
+        if (fifo_empty(&que->posted)) {
+            que->inflight[head].rid = reg->rid;
+            que->inflight[head].offset = desc->addr - reg->gpa;
+            que->inflight[head].active = 1;
+            que->order[que->order_head++ % VHOST_USER_MAX_RING_SIZE] = head;
+
+            *rid = reg->rid;
+            *offset = desc->addr - reg->gpa;
+            *length = desc->len;
+            *valid_data = data_off;
+            *valid_length = desc->len - data_off;
+            *flags = 0;
+            return CLEANQ_ERR_OK;
+        }
+
+        b = fifo_pop(&que->posted);
+        len = desc->len - data_off;
+        if (len > b->length - b->valid_data) {
+            len = b->length - b->valid_data;
+        }
+
+        memcpy(buf_start(que, b->rid, b->offset, b->valid_data),
+               data + data_off, len);
+        used_put(s, head, 0);
+
+        *rid = b->rid;
+        *offset = b->offset;
+        *length = b->length;
+        *valid_data = b->valid_data;
+        *valid_length = len;
+        *flags = b->flags;
+        return CLEANQ_ERR_OK;
+    }
+}
+
+// gives a buffer dequeued in place back to the guest
+static errval_t rx_return(struct vhost_user_q* que, struct vhost_user_side* s,
+                          regionid_t rid, genoffset_t offset)
+{
+    struct inflight* f;
+    uint32_t i;
+    uint16_t head;
+
+    // of the mapping before, the guest got it back already
+    if (guest_bank(que, rid) != (int) VHOST_USER_BANK(s->mem_gen)) {
+        return CLEANQ_ERR_OK;
+    }
+
+    // skip what was given back out of order already
+    while (que->order_tail != que->order_head &&
+           !que->inflight[que->order[que->order_tail %
+                                     VHOST_USER_MAX_RING_SIZE]].active) {
+        que->order_tail++;
+    }
+
+    for (i = que->order_tail; i != que->order_head; i++) {
+        head = que->order[i % VHOST_USER_MAX_RING_SIZE];
+        f = &que->inflight[head];
+        if (f->active && f->rid == rid && f->offset == offset) {
+            f->active = 0;
+            used_put(s, head, 0);
+            return CLEANQ_ERR_OK;
+        }
+    }
+
+    return CLEANQ_ERR_INVALID_BUFFER_ARGS;
+}
+
+static errval_t vhost_user_rx_enqueue(struct cleanq* q, regionid_t rid,
+                                      genoffset_t offset, genoffset_t length,
+                                      genoffset_t valid_data,
+                                      genoffset_t valid_length, uint64_t flags)
+{
+    struct vhost_user_q* que = vhost_user_from_rx(q);
+    errval_t err;
+
+    if (guest_bank(que, rid) >= 0) {
+        if (!side_enter(que, &que->rx, q)) {
+            cleanq_stats_enq(&que->rx_stats, CLEANQ_ERR_OK, valid_length);
+            return CLEANQ_ERR_OK;
+        }
+        err = rx_return(que, &que->rx, rid, offset);
+        if (flags & CLEANQ_FLAG_LAST) {
+            side_call(&que->rx);
+        }
+        side_leave(&que->rx);
+        cleanq_stats_enq(&que->rx_stats, err, valid_length);
+        return err;
+    }
+
+    if (fifo_full(&que->posted)) {
+        que->rx_stats.full++;
+        return CLEANQ_ERR_QUEUE_FULL;
+    }
+
+    fifo_push(&que->posted, rid, offset, length, valid_data, valid_length,
+              flags);
+    cleanq_stats_enq(&que->rx_stats, CLEANQ_ERR_OK, valid_length);
+    return CLEANQ_ERR_OK;
+}
+
+static errval_t vhost_user_rx_dequeue(struct cleanq* q, regionid_t* rid,
+                                      genoffset_t* offset, genoffset_t* length,
+                                      genoffset_t* valid_data,
+                                      genoffset_t* valid_length,
+                                      uint64_t* flags)
+{
+    struct vhost_user_q* que = vhost_user_from_rx(q);
+    errval_t err;
+
+    if (!side_enter(que, &que->rx, q)) {
+        que->rx_stats.empty++;
+        return CLEANQ_ERR_QUEUE_EMPTY;
+    }
+    err = rx_next(que, &que->rx, rid, offset, length, valid_data,
+                  valid_length, flags);
+    side_leave(&que->rx);
+    cleanq_stats_deq(&que->rx_stats, err,
+                     err == CLEANQ_ERR_OK ? *valid_length : 0);
+    return err;
+}
+
+/*
+ * Send side, the guest RX vring
+ */
+
+// copies a packet into the next buffer the guest posted
+static errval_t tx_copy(struct vhost_user_q* que, struct vhost_user_side* s,
+                        const uint8_t* data, uint32_t len)
+{
+    struct virtio_net_hdr_mrg_rxbuf hdr;
+    const uint8_t* src[2] = { (const uint8_t*) &hdr, data };
+    uint32_t left[2] = { s->hdr_len, len };
+    struct vring_desc* desc;
+    uint32_t written = 0;
+    uint32_t room, n, i;
+    uint16_t idx;
+    uint8_t* dst;
+    int head;
+    int piece = 0;
+
+    head = avail_next(s);
+    if (head < 0) {
+        side_call(s);
+        return CLEANQ_ERR_QUEUE_FULL;
+    }
+    if (head >= s->vr.size) {
+        return CLEANQ_ERR_OK;
+    }
+
+    memset(&hdr, 0, sizeof(hdr));
+    hdr.num_buffers = 1;
+
+    idx = head;
+    for (i = 0; i < s->vr.size && piece < 2; i++) {
+        desc = &s->vr.desc[idx];
+        dst = guest_va(que, desc->addr, desc->len, NULL);
+        if (!(desc->flags & VRING_DESC_F_WRITE) || dst == NULL) {
+            break;
+        }
+
+        room = desc->len;
+        while (room > 0 && piece < 2) {
+            n = left[piece] < room ? left[piece] : room;
+            memcpy(dst, src[piece], n);
+            dst += n;
+            room -= n;
+            src[piece] += n;
+            left[piece] -= n;
+            written += n;
+            if (left[piece] == 0) {
+                piece++;
+            }
+        }
+
+        if (!(desc->flags & VRING_DESC_F_NEXT) || desc->next >= s->vr.size) {
+            break;
+        }
+        idx = desc->next;
+    }
+
+    // does not fit, the guest drops an empty buffer
+    if (piece < 2) {
+        DEBUG("dropping packet of %u bytes\n", len);
+        written = 0;
+    }
+
+    used_put(s, head, written);
+    return CLEANQ_ERR_OK;
+}
+
+static errval_t vhost_user_tx_enqueue(struct cleanq* q, regionid_t rid,
+                                      genoffset_t offset, genoffset_t length,
+                                      genoffset_t valid_data,
+                                      genoffset_t valid_length, uint64_t flags)
+{
+    struct vhost_user_q* que = vhost_user_from_tx(q);
+    uint8_t* data;
+    errval_t err;
+
+    if (fifo_full(&que->sent)) {
+        que->tx_stats.full++;
+        return CLEANQ_ERR_QUEUE_FULL;
+    }
+
+    if (!side_enter(que, &que->tx, q)) {
+        que->tx_stats.full++;
+        return CLEANQ_ERR_QUEUE_FULL;
+    }
+
+    data = buf_start(que, rid, offset, valid_data);
+    if (data == NULL) {
+        side_leave(&que->tx);
+        que->tx_stats.invalid++;
+        return CLEANQ_ERR_INVALID_REGION_ID;
+    }
+
+    err = tx_copy(que, &que->tx, data, valid_length);
+    if (err_is_ok(err)) {
+        fifo_push(&que->sent, rid, offset, length, valid_data, valid_length,
+                  flags);
+        if (flags & CLEANQ_FLAG_LAST) {
+            side_call(&que->tx);
+        }
+    }
+    side_leave(&que->tx);
+    cleanq_stats_enq(&que->tx_stats, err, valid_length);
+    return err;
+}
+
+static errval_t vhost_user_tx_dequeue(struct cleanq* q, regionid_t* rid,
+                                      genoffset_t* offset, genoffset_t* length,
+                                      genoffset_t* valid_data,
+                                      genoffset_t* valid_length,
+                                      uint64_t* flags)
+{
+    struct vhost_user_q* que = vhost_user_from_tx(q);
+    struct cleanq_buf* b;
+
+    if (fifo_empty(&que->sent)) {
+        que->tx_stats.empty++;
+        return CLEANQ_ERR_QUEUE_EMPTY;
+    }
+
+    b = fifo_pop(&que->sent);
+    *rid = b->rid;
+    *offset = b->offset;
+    *length = b->length;
+    *valid_data = b->valid_data;
+    *valid_length = b->valid_length;
+    *flags = b->flags;
+    cleanq_stats_deq(&que->tx_stats, CLEANQ_ERR_OK, b->valid_length);
+    return CLEANQ_ERR_OK;
+}
+
+/*
+ * Both sides
+ */
+
+static errval_t vhost_user_side_notify(struct vhost_user_q* que,
+                                       struct vhost_user_side* s,
+                                       struct cleanq* q)
+{
+    if (side_enter(que, s, q)) {
+        side_call(s);
+        side_leave(s);
+    }
+    return CLEANQ_ERR_OK;
+}
+
+static errval_t vhost_user_rx_notify(struct cleanq* q)
+{
+    return vhost_user_side_notify(vhost_user_from_rx(q),
+                                  &vhost_user_from_rx(q)->rx, q);
+}
+
+static errval_t vhost_user_tx_notify(struct cleanq* q)
+{
+    return vhost_user_side_notify(vhost_user_from_tx(q),
+                                  &vhost_user_from_tx(q)->tx, q);
+}
+
+static errval_t vhost_user_control(struct vhost_user_q* que, uint64_t cmd,
+                                   uint64_t value)
+{
+    if (cmd == CLEANQ_CTRL_SET_REGION_HEADROOM) {
+        return region_set_headroom(que->regions, value);
+    }
+
+    if (cmd == CLEANQ_CTRL_VHOST_USER_ZERO_COPY) {
+        que->zero_copy = value != 0;
+        return CLEANQ_ERR_OK;
+    }
+
+    return queue_pair_control(cmd);
+}
+
+static errval_t vhost_user_rx_register(struct cleanq* q, struct capref cap,
+                                       regionid_t rid)
+{
+    struct vhost_user_q* que = vhost_user_from_rx(q);
+    return region_register(que->regions, &que->tx_q, cap, rid);
+}
+
+static errval_t vhost_user_rx_deregister(struct cleanq* q, regionid_t rid)
+{
+    return region_deregister(vhost_user_from_rx(q)->regions, rid);
+}
+
+static errval_t vhost_user_rx_control(struct cleanq* q, uint64_t cmd,
+                                      uint64_t value, uint64_t* result)
+{
+    if (cmd == CLEANQ_CTRL_GET_STATS) {
+        return cleanq_stats_control(&vhost_user_from_rx(q)->rx_stats, result);
+    }
+    return vhost_user_control(vhost_user_from_rx(q), cmd, value);
+}
+
+static errval_t vhost_user_tx_register(struct cleanq* q, struct capref cap,
+                                       regionid_t rid)
+{
+    struct vhost_user_q* que = vhost_user_from_tx(q);
+    return region_register(que->regions, &que->rx_q, cap, rid);
+}
+
+static errval_t vhost_user_tx_deregister(struct cleanq* q, regionid_t rid)
+{
+    return region_deregister(vhost_user_from_tx(q)->regions, rid);
+}
+
+static errval_t vhost_user_tx_control(struct cleanq* q, uint64_t cmd,
+                                      uint64_t value, uint64_t* result)
+{
+    if (cmd == CLEANQ_CTRL_GET_STATS) {
+        return cleanq_stats_control(&vhost_user_from_tx(q)->tx_stats, result);
+    }
+    return vhost_user_control(vhost_user_from_tx(q), cmd, value);
+}
+
+/*
+ * Callbacks of the vhost-user thread
+ */
+
+static struct vhost_user_q* vhost_user_lookup(int vid)
+{
+    struct vhost_user_q* que = NULL;
+    char path[256];
+    int i;
+
+    if (rte_vhost_get_ifname(vid, path, sizeof(path)) != 0) {
+        return NULL;
+    }
+
+    rte_spinlock_lock(&vhost_user_qs_lock);
+    for (i = 0; i < VHOST_USER_MAX_DEVS; i++) {
+        if (vhost_user_qs[i] != NULL &&
+            strcmp(vhost_user_qs[i]->path, path) == 0) {
+            que = vhost_user_qs[i];
+            break;
+        }
+    }
+    rte_spinlock_unlock(&vhost_user_qs_lock);
+    return que;
+}
+
+// waits until the datapath is out of the guest memory
+static void vhost_user_stop(struct vhost_user_q* que)
+{
+    __atomic_store_n(&que->running_seq, 0, __ATOMIC_SEQ_CST);
+    while (__atomic_load_n(&que->rx.busy, __ATOMIC_SEQ_CST) ||
+           __atomic_load_n(&que->tx.busy, __ATOMIC_SEQ_CST)) {
+        rte_pause();
+    }
+}
+
+static void vhost_user_start(struct vhost_user_q* que, int new_dev)
+{
+    // 0 is not running
+    if (++que->last_seq == 0) {
+        ++que->last_seq;
+    }
+    que->dev.seq = que->last_seq;
+    if (new_dev) {
+        que->dev.first_seq = que->dev.seq;
+    }
+    __atomic_store_n(&que->running_seq, que->dev.seq, __ATOMIC_RELEASE);
+}
+
+// reads the memory table and the vrings of a stopped device
+static int vhost_user_load(struct vhost_user_q* que, int new_dev)
+{
+    struct vhost_user_dev* dev = &que->dev;
+    struct rte_vhost_memory* mem;
+    struct guest_region* r;
+    int changed = new_dev;
+    uint32_t i;
+
+    if (rte_vhost_get_mem_table(dev->vid, &mem) != 0) {
+        return -1;
+    }
+
+    if (mem->nregions > VHOST_USER_MAX_REGIONS) {
+        free(mem);
+        return -1;
+    }
+
+    changed |= mem->nregions != dev->nregions;
+    for (i = 0; i < mem->nregions && !changed; i++) {
+        r = &dev->regions[i];
+        changed = r->gpa != mem->regions[i].guest_phys_addr ||
+                  r->size != mem->regions[i].size ||
+                  r->va != (uint8_t*) (uintptr_t)
+                           mem->regions[i].host_user_addr;
+    }
+
+    if (changed) {
+        // 0 is no regions added
+        if (++que->last_mem_gen == 0) {
+            ++que->last_mem_gen;
+        }
+        dev->mem_gen = que->last_mem_gen;
+        dev->nregions = mem->nregions;
+        for (i = 0; i < mem->nregions; i++) {
+            r = &dev->regions[i];
+            r->gpa = mem->regions[i].guest_phys_addr;
+            r->size = mem->regions[i].size;
+            r->va = (uint8_t*) (uintptr_t) mem->regions[i].host_user_addr;
+            r->rid = que->guest_rids[VHOST_USER_BANK(dev->mem_gen)][i];
+        }
+    }
+    free(mem);
+
+    for (i = 0; i < 2; i++) {
+        if (rte_vhost_get_vhost_vring(dev->vid, i, &dev->vring[i]) != 0) {
+            return -1;
+        }
+        if (dev->vring[i].size > VHOST_USER_MAX_RING_SIZE ||
+            (dev->vring[i].size & (dev->vring[i].size - 1)) != 0) {
+            DEBUG("vring %u has %u entries\n", i, dev->vring[i].size);
+            return -1;
+        }
+    }
+    return 0;
+}
+
+static int vhost_user_new_device(int vid)
+{
+    struct vhost_user_q* que = vhost_user_lookup(vid);
+    struct vhost_user_dev* dev;
+    uint64_t features;
+    uint16_t last_used;
+    uint32_t i;
+
+    if (que == NULL) {
+        return -1;
+    }
+    dev = &que->dev;
+    dev->vid = vid;
+
+    if (rte_vhost_get_negotiated_features(vid, &features) != 0 ||
+        vhost_user_load(que, 1) != 0) {
+        return -1;
+    }
+
+    if (features & ((1ULL << VIRTIO_NET_F_MRG_RXBUF) |
+                    (1ULL << VIRTIO_F_VERSION_1))) {
+        dev->hdr_len = sizeof(struct virtio_net_hdr_mrg_rxbuf);
+    } else {
+        dev->hdr_len = sizeof(struct virtio_net_hdr);
+    }
+
+    for (i = 0; i < 2; i++) {
+        if (rte_vhost_get_vring_base(vid, i, &dev->last_avail[i],
+                                     &last_used) != 0) {
+            return -1;
+        }
+        // we poll
+        rte_vhost_enable_guest_notification(vid, i, 0);
+    }
+
+    // otherwise the guest enables the vrings, see vhost_user_vring_state
+    if (!(features & (1ULL << VHOST_USER_F_PROTOCOL_FEATURES))) {
+        __atomic_store_n(&que->enabled[VHOST_USER_GUEST_RX], 1,
+                         __ATOMIC_RELEASE);
+        __atomic_store_n(&que->enabled[VHOST_USER_GUEST_TX], 1,
+                         __ATOMIC_RELEASE);
+    }
+
+    DEBUG("device %d on %s up, %u regions\n", vid, que->path, dev->nregions);
+    que->up = 1;
+    vhost_user_start(que, 1);
+    return 0;
+}
+
+static void vhost_user_destroy_device(int vid)
+{
+    struct vhost_user_q* que = vhost_user_lookup(vid);
+    struct vhost_user_side* sides[2];
+    struct vhost_user_side* s;
+    int i;
+
+    if (que == NULL || !que->up) {
+        return;
+    }
+
+    vhost_user_stop(que);
+    que->up = 0;
+
+    // where to resume when the guest comes back
+    sides[0] = &que->rx;
+    sides[1] = &que->tx;
+    for (i = 0; i < 2; i++) {
+        s = sides[i];
+        if (s->seq != 0 && (int32_t) (s->seq - que->dev.first_seq) >= 0) {
+            rte_vhost_set_vring_base(vid, s->vring_idx, s->last_avail,
+                                     s->last_used);
+        }
+    }
+    DEBUG("device %d on %s down\n", vid, que->path);
+}
+
+static int vhost_user_vring_state(int vid, uint16_t queue_id, int enable)
+{
+    struct vhost_user_q* que = vhost_user_lookup(vid);
+
+    // only the first queue pair is used
+    if (que == NULL || queue_id >= 2) {
+        return 0;
+    }
+
+    if (!que->up) {
+        __atomic_store_n(&que->enabled[queue_id], enable, __ATOMIC_RELEASE);
+        return 0;
+    }
+
+    // the memory table may have changed since we looked
+    vhost_user_stop(que);
+    __atomic_store_n(&que->enabled[queue_id], enable, __ATOMIC_RELEASE);
+    if (vhost_user_load(que, 0) != 0) {
+        DEBUG("device %d on %s stays stopped\n", vid, que->path);
+        return 0;
+    }
+    vhost_user_start(que, 0);
+    return 0;
+}
+
+static const struct vhost_device_ops vhost_user_ops = {
+    .new_device = vhost_user_new_device,
+    .destroy_device = vhost_user_destroy_device,
+    .vring_state_changed = vhost_user_vring_state,
+};
+
+static int vhost_user_add(struct vhost_user_q* que)
+{
+    int i;
+
+    rte_spinlock_lock(&vhost_user_qs_lock);
+    for (i = 0; i < VHOST_USER_MAX_DEVS; i++) {
+        if (vhost_user_qs[i] == NULL) {
+            vhost_user_qs[i] = que;
+            break;
+        }
+    }
+    rte_spinlock_unlock(&vhost_user_qs_lock);
+    return i < VHOST_USER_MAX_DEVS ? 0 : -1;
+}
+
+static void vhost_user_remove(struct vhost_user_q* que)
+{
+    int i;
+
+    rte_spinlock_lock(&vhost_user_qs_lock);
+    for (i = 0; i < VHOST_USER_MAX_DEVS; i++) {
+        if (vhost_user_qs[i] == que) {
+            vhost_user_qs[i] = NULL;
+        }
+    }
+    rte_spinlock_unlock(&vhost_user_qs_lock);
+}
+
+// takes the ids of the guest regions from the pools, before any other
+static errval_t vhost_user_reserve_rids(struct vhost_user_q* que)
+{
+    struct capref cap;
+    errval_t err;
+    uint32_t b, i;
+
+    for (b = 0; b < VHOST_USER_BANKS; b++) {
+        for (i = 0; i < VHOST_USER_MAX_REGIONS; i++) {
+            guest_cap_unused(b, i, &cap);
+            err = region_pool_add_region(que->rx_q.pool, cap,
+                                         &que->guest_rids[b][i]);
+            if (err_is_fail(err)) {
+                return err;
+            }
+            err = cleanq_add_region(&que->tx_q, cap, que->guest_rids[b][i]);
+            if (err_is_fail(err)) {
+                return err;
+            }
+        }
+    }
+    return CLEANQ_ERR_OK;
+}
+
+static void vhost_user_free(struct vhost_user_q* que)
+{
+    cleanq_free_socket(que->posted.bufs, que->socket_id);
+    cleanq_free_socket(que->sent.bufs, que->socket_id);
+    cleanq_free_socket(que, que->socket_id);
+}
+
+/*
+ * Public functions
+ */
+
+errval_t vhost_user_create(struct vhost_user_q** q, const char* path,
+                           int socket_id)
+{
+    errval_t err;
+    struct vhost_user_q* que;
+    uint64_t features;
+
+    if (strlen(path) >= sizeof(que->path)) {
+        return CLEANQ_ERR_INIT_QUEUE;
+    }
+
+    que = cleanq_malloc_socket(sizeof(struct vhost_user_q), socket_id);
+    if (que == NULL) {
+        return CLEANQ_ERR_MALLOC_FAIL;
+    }
+    memset(que, 0, sizeof(struct vhost_user_q));
+    que->socket_id = socket_id;
+    strcpy(que->path, path);
+    que->rx.vring_idx = VHOST_USER_GUEST_TX;
+    que->tx.vring_idx = VHOST_USER_GUEST_RX;
+
+    err = fifo_init(&que->posted, VHOST_USER_MAX_POSTED, socket_id);
+    if (err_is_ok(err)) {
+        err = fifo_init(&que->sent, VHOST_USER_MAX_SENT, socket_id);
+    }
+    if (err_is_fail(err)) {
+        vhost_user_free(que);
+        return err;
+    }
+
+    err = cleanq_init_socket(&que->rx_q, socket_id);
+    if (err_is_fail(err)) {
+        vhost_user_free(que);
+        return err;
+    }
+
+    err = cleanq_init_socket(&que->tx_q, socket_id);
+    if (err_is_fail(err)) {
+        vhost_user_free(que);
+        return err;
+    }
+
+    que->rx_q.f.reg = vhost_user_rx_register;
+    que->rx_q.f.dereg = vhost_user_rx_deregister;
+    que->rx_q.f.ctrl = vhost_user_rx_control;
+    que->rx_q.f.notify = vhost_user_rx_notify;
+    que->rx_q.f.enq = vhost_user_rx_enqueue;
+    que->rx_q.f.deq = vhost_user_rx_dequeue;
+    que->rx_q.f.destroy = queue_pair_side_destroy;
+
+    que->tx_q.f.reg = vhost_user_tx_register;
+    que->tx_q.f.dereg = vhost_user_tx_deregister;
+    que->tx_q.f.ctrl = vhost_user_tx_control;
+    que->tx_q.f.notify = vhost_user_tx_notify;
+    que->tx_q.f.enq = vhost_user_tx_enqueue;
+    que->tx_q.f.deq = vhost_user_tx_dequeue;
+    que->tx_q.f.destroy = queue_pair_side_destroy;
+
+    err = vhost_user_reserve_rids(que);
+    if (err_is_fail(err)) {
+        goto fail;
+    }
+
+    // the callbacks may run as soon as the socket is started
+    if (vhost_user_add(que) != 0) {
+        err = CLEANQ_ERR_INIT_QUEUE;
+        goto fail;
+    }
+
+    if (rte_vhost_driver_register(path, 0) != 0) {
+        vhost_user_remove(que);
+        err = CLEANQ_ERR_INIT_QUEUE;
+        goto fail;
+    }
+
+    /*
+     * Setting the features would turn off the built-in virtio-net handling,
+     * which rte_vhost_get_vring_base() and rte_vhost_set_vring_base() need
+     */
+    if (rte_vhost_driver_get_features(path, &features) != 0 ||
+        rte_vhost_driver_disable_features(path,
+                                          features & ~VHOST_USER_FEATURES) != 0 ||
+        rte_vhost_driver_callback_register(path, &vhost_user_ops) != 0 ||
+        rte_vhost_driver_start(path) != 0) {
+        DEBUG("cannot start vhost-user socket %s\n", path);
+        rte_vhost_driver_unregister(path);
+        vhost_user_remove(que);
+        err = CLEANQ_ERR_INIT_QUEUE;
+        goto fail;
+    }
+
+    *q = que;
+    return CLEANQ_ERR_OK;
+
+fail:
+    cleanq_destroy(&que->rx_q);
+    cleanq_destroy(&que->tx_q);
+    vhost_user_free(que);
+    return err;
+}
+
+errval_t vhost_user_destroy(struct vhost_user_q* q)
+{
+    // stops the device of a connected guest
+    rte_vhost_driver_unregister(q->path);
+    vhost_user_remove(q);
+
+    cleanq_destroy(&q->rx_q);
+    cleanq_destroy(&q->tx_q);
+    vhost_user_free(q);
+    return CLEANQ_ERR_OK;
+}
+
+struct cleanq* vhost_user_get_rx(struct vhost_user_q* q)
+{
+    return &q->rx_q;
+}
+
+struct cleanq* vhost_user_get_tx(struct vhost_user_q* q)
+{
+    return &q->tx_q;
+}
+
+errval_t vhost_user_get_region(struct vhost_user_q* q, regionid_t rid,
+                               void** va, size_t* len)
+{
+    uint32_t i;
+
+    if (guest_bank(q, rid) < 0 ||
+        __atomic_load_n(&q->running_seq, __ATOMIC_ACQUIRE) == 0) {
+        return CLEANQ_ERR_INVALID_REGION_ID;
+    }
+
+    for (i = 0; i < q->dev.nregions; i++) {
+        if (q->dev.regions[i].rid == rid) {
+            *va = q->dev.regions[i].va;
+            *len = q->dev.regions[i].size;
+            return CLEANQ_ERR_OK;
+        }
+    }
+    return CLEANQ_ERR_INVALID_REGION_ID;
+}
@@ -0,0 +1,328 @@
+/*
+ * Copyright (c) 2017 ETH Zurich.
+ * All rights reserved.
+ *
+ * This file is distributed under the terms in the attached LICENSE file.
+ * If you do not find this file, copies can be found by writing to:
+ * ETH Zurich D-INFK, Universitaetstr. 6, CH-8092 Zurich. Attn: Systems Group.
+ */
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <rte_alarm.h>
+#include <rte_cycles.h>
+#include <rte_metrics.h>
+#include <rte_spinlock.h>
+
+#include <cleanq.h>
+#include <cleanq_lat.h>
+#include <cleanq_metrics.h>
+
+#include "dqi_debug.h"
+
+#define MAX_LAYERS 32
+#define MAX_SOURCES 1024
+
+enum {
+    LAT_COUNT,
+    LAT_P50,
+    LAT_P99,
+    LAT_P999,
+    NB_LAT_METRICS,
+};
+
+// in the order of struct cleanq_stats
+static const char* stats_names[] = {
+    "enq", "deq", "enq_bytes", "deq_bytes", "full", "empty", "invalid",
+    "dropped", "drop_chksum", "drop_wrong_ip", "drop_wrong_proto",
+    "drop_wrong_port", "occupancy", "high_watermark",
+};
+#define NB_STATS_METRICS RTE_DIM(stats_names)
+
+static const char* lat_names[NB_LAT_METRICS] = {
+    "lat_count", "lat_p50_ns", "lat_p99_ns", "lat_p999_ns",
+};
+
+// the metrics of a layer are registered when its first source is added
+struct layer {
+    char name[CLEANQ_METRICS_LAYER_LEN + 1];
+    int stats_key;
+    int lat_key;
+};
+
+// a queue or a histogram
+struct source {
+    struct cleanq* q;
+    const struct cleanq_lat_hist* hist;
+    int port_id;
+    uint16_t layer;
+    // set while the sources of its layer and port are summed up
+    bool done;
+};
+
+static struct layer layers[MAX_LAYERS];
+static uint16_t nb_layers;
+static struct source sources[MAX_SOURCES];
+static uint16_t nb_sources;
+// taken by the control threads, the datapath never sees it
+static rte_spinlock_t lock = RTE_SPINLOCK_INITIALIZER;
+
+static uint64_t period;
+
+static int register_names(const char* layer, const char** names,
+                          unsigned num)
+{
+    char buf[num][RTE_METRICS_MAX_NAME_LEN];
+    const char* list[num];
+
+    for (unsigned i = 0; i < num; i++) {
+        snprintf(buf[i], sizeof(buf[i]), "cleanq_%s_%s", layer, names[i]);
+        list[i] = buf[i];
+    }
+    return rte_metrics_reg_names(list, num);
+}
+
+static errval_t add_source(struct cleanq* q, const struct cleanq_lat_hist* h,
+                           int port_id, const char* layer)
+{
+    struct layer* l = NULL;
+    struct source* s;
+    uint16_t i;
+    int key;
+
+    if (layer == NULL || strlen(layer) == 0 ||
+        strlen(layer) > CLEANQ_METRICS_LAYER_LEN) {
+        return CLEANQ_ERR_INIT_QUEUE;
+    }
+
+    rte_spinlock_lock(&lock);
+    if (nb_sources == MAX_SOURCES) {
+        rte_spinlock_unlock(&lock);
+        return CLEANQ_ERR_MALLOC_FAIL;
+    }
+
+    for (i = 0; i < nb_layers; i++) {
+        if (strcmp(layers[i].name, layer) == 0) {
+            l = &layers[i];
+            break;
+        }
+    }
+    if (l == NULL) {
+        if (nb_layers == MAX_LAYERS) {
+            rte_spinlock_unlock(&lock);
+            return CLEANQ_ERR_MALLOC_FAIL;
+        }
+        l = &layers[nb_layers++];
+        strcpy(l->name, layer);
+        l->stats_key = -1;
+        l->lat_key = -1;
+    }
+
+    // a layer can have queues and histograms
+    if (q != NULL && l->stats_key < 0) {
+        key = register_names(layer, stats_names, NB_STATS_METRICS);
+        if (key < 0) {
+            rte_spinlock_unlock(&lock);
+            return CLEANQ_ERR_INIT_QUEUE;
+        }
+        l->stats_key = key;
+    }
+    if (h != NULL && l->lat_key < 0) {
+        key = register_names(layer, lat_names, NB_LAT_METRICS);
+        if (key < 0) {
+            rte_spinlock_unlock(&lock);
+            return CLEANQ_ERR_INIT_QUEUE;
+        }
+        l->lat_key = key;
+    }
+
+    s = &sources[nb_sources++];
+    s->q = q;
+    s->hist = h;
+    s->port_id = port_id;
+    s->layer = l - layers;
+    rte_spinlock_unlock(&lock);
+    return CLEANQ_ERR_OK;
+}
+
+errval_t cleanq_metrics_add_queue(struct cleanq* q, int port_id,
+                                  const char* layer)
+{
+    struct cleanq_stats stats;
+    errval_t err;
+
+    // it has to have statistics
+    err = cleanq_get_stats(q, &stats);
+    if (err_is_fail(err)) {
+        return err;
+    }
+
+    return add_source(q, NULL, port_id, layer);
+}
+
+errval_t cleanq_metrics_add_latency(const struct cleanq_lat_hist* h,
+                                    int port_id, const char* layer)
+{
+    return add_source(NULL, h, port_id, layer);
+}
+
+void cleanq_metrics_remove(const void* source)
+{
+    rte_spinlock_lock(&lock);
+    for (uint16_t i = 0; i < nb_sources; i++) {
+        if (sources[i].q == source || sources[i].hist == source) {
+            sources[i] = sources[--nb_sources];
+            break;
+        }
+    }
+    rte_spinlock_unlock(&lock);
+}
+
+/*
+ * Sums up the queues of a layer on a port, source first is the first of
+ * them
+ */
+static errval_t update_stats(const struct source* first)
+{
+    uint64_t values[NB_STATS_METRICS] = { 0 };
+    struct cleanq_stats stats;
+    const struct layer* l = &layers[first->layer];
+
+    for (const struct source* s = first; s < &sources[nb_sources]; s++) {
+        if (s->q == NULL || s->layer != first->layer ||
+            s->port_id != first->port_id) {
+            continue;
+        }
+        if (err_is_fail(cleanq_get_stats(s->q, &stats))) {
+            continue;
+        }
+
+        values[0] += stats.enq;
+        values[1] += stats.deq;
+        values[2] += stats.enq_bytes;
+        values[3] += stats.deq_bytes;
+        values[4] += stats.full;
+        values[5] += stats.empty;
+        values[6] += stats.invalid;
+        values[7] += stats.dropped;
+        values[8] += stats.drop_chksum;
+        values[9] += stats.drop_wrong_ip;
+        values[10] += stats.drop_wrong_proto;
+        values[11] += stats.drop_wrong_port;
+        values[12] += stats.occupancy;
+        values[13] = RTE_MAX(values[13], stats.high_watermark);
+    }
+
+    if (rte_metrics_update_values(first->port_id, l->stats_key, values,
+                                  NB_STATS_METRICS) < 0) {
+        return CLEANQ_ERR_INIT_QUEUE;
+    }
+    return CLEANQ_ERR_OK;
+}
+
+static errval_t update_latency(const struct source* first)
+{
+    static struct cleanq_lat_hist sum;
+    uint64_t values[NB_LAT_METRICS];
+    double ns_per_cycle = 1e9 / rte_get_tsc_hz();
+    const struct layer* l = &layers[first->layer];
+
+    memset(&sum, 0, sizeof(sum));
+    for (const struct source* s = first; s < &sources[nb_sources]; s++) {
+        if (s->hist == NULL || s->layer != first->layer ||
+            s->port_id != first->port_id) {
+            continue;
+        }
+        // each bucket is read once, a snapshot of a running histogram
+        for (uint32_t b = 0; b < CLEANQ_LAT_BUCKETS; b++) {
+            sum.count[b] += ((const volatile uint64_t*) s->hist->count)[b];
+        }
+    }
+
+    values[LAT_COUNT] = cleanq_lat_total(&sum);
+    values[LAT_P50] = cleanq_lat_percentile(&sum, 0.5) * ns_per_cycle;
+    values[LAT_P99] = cleanq_lat_percentile(&sum, 0.99) * ns_per_cycle;
+    values[LAT_P999] = cleanq_lat_percentile(&sum, 0.999) * ns_per_cycle;
+
+    if (rte_metrics_update_values(first->port_id, l->lat_key, values,
+                                  NB_LAT_METRICS) < 0) {
+        return CLEANQ_ERR_INIT_QUEUE;
+    }
+    return CLEANQ_ERR_OK;
+}
+
+errval_t cleanq_metrics_update(void)
+{
+    errval_t err = CLEANQ_ERR_OK;
+    errval_t e;
+
+    rte_spinlock_lock(&lock);
+    for (uint16_t i = 0; i < nb_sources; i++) {
+        sources[i].done = false;
+    }
+
+    for (uint16_t i = 0; i < nb_sources; i++) {
+        struct source* first = &sources[i];
+        bool queues = false;
+        bool hists = false;
+
+        if (first->done) {
+            continue;
+        }
+        for (uint16_t j = i; j < nb_sources; j++) {
+            struct source* s = &sources[j];
+            if (s->layer == first->layer && s->port_id == first->port_id) {
+                s->done = true;
+                queues |= s->q != NULL;
+                hists |= s->hist != NULL;
+            }
+        }
+
+        if (queues) {
+            e = update_stats(first);
+            if (err_is_fail(e)) {
+                err = e;
+            }
+        }
+        if (hists) {
+            e = update_latency(first);
+            if (err_is_fail(e)) {
+                err = e;
+            }
+        }
+    }
+    rte_spinlock_unlock(&lock);
+
+    return err;
+}
+
+static void metrics_alarm(void* arg __rte_unused)
+{
+    errval_t err;
+
+    err = cleanq_metrics_update();
+    if (err_is_fail(err)) {
+        DQI_DEBUG("Updating metrics failed err=%d\n", err);
+    }
+    rte_eal_alarm_set(period, metrics_alarm, NULL);
+}
+
+errval_t cleanq_metrics_start(uint64_t period_us)
+{
+    if (period_us == 0) {
+        return CLEANQ_ERR_INVALID_CTRL;
+    }
+
+    cleanq_metrics_stop();
+    period = period_us;
+    if (rte_eal_alarm_set(period, metrics_alarm, NULL) != 0) {
+        return CLEANQ_ERR_INIT_QUEUE;
+    }
+    return CLEANQ_ERR_OK;
+}
+
+void cleanq_metrics_stop(void)
+{
+    rte_eal_alarm_cancel(metrics_alarm, NULL);
+}
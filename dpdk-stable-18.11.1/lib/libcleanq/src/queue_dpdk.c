@@ -7,8 +7,11 @@
  * ETH Zurich D-INFK, Universitaetstr. 6, CH-8092 Zurich. Attn: Systems Group.
  */
 #include <stdbool.h>
+#include <sys/epoll.h>
 #include <sys/queue.h>
 
+#include <rte_ethdev.h>
+#include <rte_interrupts.h>
 #include <rte_mbuf.h>
 
 #include <cleanq.h>
@@ -51,6 +54,7 @@ mempool_to_cap(struct rte_mempool *mp, struct capref *cap)
 errval_t
 cleanq_register_mempool(struct cleanq *q, struct rte_mempool *mp)
 {
+    errval_t err;
     struct capref cap;
     regionid_t region_id;
 
@@ -61,7 +65,19 @@ cleanq_register_mempool(struct cleanq *q, struct rte_mempool *mp)
         cap.len
     );
 
-    return cleanq_register(q, cap, &region_id);
+    err = cleanq_register(q, cap, &region_id);
+    if (err_is_fail(err)) {
+        return err;
+    }
+
+    // buffers are mbufs, valid_data (data_off) is relative to buf_addr
+    err = cleanq_set_region_headroom(q, region_id,
+                                     sizeof(struct rte_mbuf) +
+                                     rte_pktmbuf_priv_size(mp));
+    if (err_is_fail(err)) {
+        cleanq_deregister(q, region_id, &cap);
+    }
+    return err;
 }
 
 errval_t
@@ -81,6 +97,22 @@ cleanq_deregister_mempool(struct cleanq *q, struct rte_mempool *mp)
     return cleanq_deregister(q, region_id, &cap);
 }
 
+errval_t
+cleanq_mempool_region(struct cleanq *q, struct rte_mempool *mp,
+                      regionid_t *rid, uint64_t *base_addr)
+{
+    uint64_t base = mempool_base_addr(mp);
+    errval_t err;
+
+    err = region_pool_find_base_addr(q->pool, base, rid);
+    if (err_is_fail(err)) {
+        return err;
+    }
+
+    *base_addr = base;
+    return CLEANQ_ERR_OK;
+}
+
 inline void
 mbuf_to_cleanq_buf(
     struct cleanq *q,
@@ -111,3 +143,79 @@ cleanq_buf_to_mbuf(
     }
     *mbuf = mb;
 }
+
+// epoll instance of the lcore to clear the RX interrupts of its queues on
+static RTE_DEFINE_PER_LCORE(int, ethdev_intr_epfd) = -1;
+
+/*
+ * Reads the counter of the event fd of a queue that woke up, if there is
+ * one: rte_epoll_wait() does it for the fds the EAL added to an instance.
+ */
+static void
+ethdev_rx_intr_clear(uint16_t port_id, uint16_t queue_id)
+{
+    struct rte_intr_handle *handle = rte_eth_devices[port_id].intr_handle;
+    struct rte_epoll_event ev;
+    unsigned int efd_idx;
+    uint32_t vec;
+    int epfd;
+
+    vec = handle->intr_vec[queue_id];
+    efd_idx = vec >= RTE_INTR_VEC_RXTX_OFFSET ?
+              vec - RTE_INTR_VEC_RXTX_OFFSET : vec;
+
+    // the application waits on it with rte_epoll_wait(), which reads it
+    if (handle->elist[efd_idx].status != RTE_EPOLL_INVALID) {
+        return;
+    }
+
+    epfd = RTE_PER_LCORE(ethdev_intr_epfd);
+    if (epfd < 0) {
+        epfd = epoll_create1(EPOLL_CLOEXEC);
+        if (epfd < 0) {
+            return;
+        }
+        RTE_PER_LCORE(ethdev_intr_epfd) = epfd;
+    }
+
+    if (rte_eth_dev_rx_intr_ctl_q(port_id, queue_id, epfd,
+                                  RTE_INTR_EVENT_ADD, NULL) != 0) {
+        return;
+    }
+    rte_epoll_wait(epfd, &ev, 1, 0);
+    rte_eth_dev_rx_intr_ctl_q(port_id, queue_id, epfd,
+                              RTE_INTR_EVENT_DEL, NULL);
+}
+
+errval_t
+cleanq_ethdev_rx_intr_control(uint16_t port_id, uint16_t queue_id,
+                              uint64_t request, uint64_t *result)
+{
+    int ret;
+
+    switch (request) {
+    case CLEANQ_CTRL_RX_INTR_ENABLE:
+        ret = rte_eth_dev_rx_intr_enable(port_id, queue_id);
+        break;
+    case CLEANQ_CTRL_RX_INTR_DISABLE:
+        ret = rte_eth_dev_rx_intr_disable(port_id, queue_id);
+        if (ret == 0) {
+            // fails if the port has no RX interrupt vectors
+            ret = rte_eth_dev_rx_intr_ctl_q_get_fd(port_id, queue_id);
+            if (ret >= 0) {
+                ethdev_rx_intr_clear(port_id, queue_id);
+            }
+        }
+        break;
+    case CLEANQ_CTRL_RX_INTR_FD:
+        ret = rte_eth_dev_rx_intr_ctl_q_get_fd(port_id, queue_id);
+        if (ret >= 0) {
+            *result = ret;
+        }
+        break;
+    default:
+        return CLEANQ_ERR_INVALID_CTRL;
+    }
+
+    return ret < 0 ? CLEANQ_ERR_INVALID_CTRL : CLEANQ_ERR_OK;
+}
@@ -116,7 +116,7 @@ errval_t cleanq_enqueue(struct cleanq *q,
     errval_t err;
     
     // check if the buffer to enqueue is valid
-    if (!region_pool_buffer_check_bounds(q->pool, region_id, offset,
+    if (!region_pool_buffer_validate(q->pool, false, region_id, offset,
         length, valid_data, valid_length)) {
         return CLEANQ_ERR_INVALID_BUFFER_ARGS;
     }
@@ -180,7 +180,7 @@ errval_t cleanq_dequeue(struct cleanq *q,
     add_bench_entry(&ctl_deq, end - start, "backend_dequeue");
 #endif  
     // check if the dequeue buffer is valid
-    if (!region_pool_buffer_check_bounds(q->pool, *region_id, *offset,
+    if (!region_pool_buffer_validate(q->pool, false, *region_id, *offset,
         *length, *valid_data, *valid_length)) {
         return CLEANQ_ERR_INVALID_BUFFER_ARGS;
     }
@@ -190,6 +190,41 @@ errval_t cleanq_dequeue(struct cleanq *q,
     return CLEANQ_ERR_OK;
 }
 
+/**
+ * @brief check a buffer passed to the datapath of a queue against its
+ *        regions, as cleanq_enqueue/cleanq_dequeue do. Skipped if the
+ *        queue is trusted.
+ *
+ * @returns non-zero if the buffer is valid or does not need a check
+ */
+int cleanq_buffer_valid(struct cleanq* q,
+                        regionid_t region_id,
+                        genoffset_t offset,
+                        genoffset_t length,
+                        genoffset_t valid_data,
+                        genoffset_t valid_length)
+{
+    return region_pool_buffer_validate(q->pool, false, region_id, offset,
+                                       length, valid_data, valid_length);
+}
+
+/**
+ * @brief check a buffer a module passes to (or gets from) a queue it is
+ *        stacked on. Only done if the lower queue does full validation.
+ *
+ * @returns non-zero if the buffer is valid or does not need a check
+ */
+int cleanq_buffer_valid_inner(struct cleanq* q,
+                              regionid_t region_id,
+                              genoffset_t offset,
+                              genoffset_t length,
+                              genoffset_t valid_data,
+                              genoffset_t valid_length)
+{
+    return region_pool_buffer_validate(q->pool, true, region_id, offset,
+                                       length, valid_data, valid_length);
+}
+
 /*
  * ===========================================================================
  * Control Path
@@ -310,6 +345,176 @@ errval_t cleanq_control(struct cleanq *q,
 
 }
 
+/**
+ * @brief Set how buffers on this queue and the queues it is stacked on are
+ *        checked against the registered regions. Debug builds
+ *        (CONFIG_RTE_LIBCLEANQ_DEBUG) check every buffer regardless.
+ *
+ * @param q          The device queue to call the operation on
+ * @param policy     The validation policy, the queues below get the same
+ *
+ * @returns error on failure or SYS_ERR_OK on success
+ *
+ */
+errval_t cleanq_set_validation(struct cleanq *q,
+                               cleanq_validation_t policy)
+{
+    uint64_t result;
+
+    if (policy > CLEANQ_VALIDATE_TRUSTED) {
+        return CLEANQ_ERR_INVALID_CTRL;
+    }
+
+    region_pool_set_validation(q->pool, policy);
+
+    // modules pass the policy on to the queues they are stacked on,
+    // backends without a control function have nothing below them
+    if (q->f.ctrl == NULL) {
+        return CLEANQ_ERR_OK;
+    }
+
+    return q->f.ctrl(q, CLEANQ_CTRL_SET_VALIDATION, policy, &result);
+}
+
+/**
+ * @brief Set the layout of the buffers of a region
+ *
+ * @param q          The device queue to call the operation on
+ * @param region_id  The region the layout is for
+ * @param headroom   Bytes from the start of a buffer to its data area
+ *
+ * @returns error on failure or SYS_ERR_OK on success
+ *
+ */
+errval_t cleanq_set_region_headroom(struct cleanq *q,
+                                    regionid_t region_id,
+                                    genoffset_t headroom)
+{
+    uint64_t result;
+
+    if (headroom > UINT32_MAX) {
+        return CLEANQ_ERR_INVALID_CTRL;
+    }
+
+    // backends do not care where the headers go
+    if (q->f.ctrl == NULL) {
+        return CLEANQ_ERR_OK;
+    }
+
+    return q->f.ctrl(q, CLEANQ_CTRL_SET_REGION_HEADROOM,
+                     CLEANQ_CTRL_REGION_HEADROOM(region_id, headroom),
+                     &result);
+}
+
+/**
+ * @brief Arm the RX interrupt of a receive queue
+ *
+ * @param q          The receive queue
+ *
+ * @returns error on failure or SYS_ERR_OK on success
+ *
+ */
+errval_t cleanq_rx_intr_enable(struct cleanq *q)
+{
+    uint64_t result;
+
+    if (q->f.ctrl == NULL) {
+        return CLEANQ_ERR_INVALID_CTRL;
+    }
+
+    return q->f.ctrl(q, CLEANQ_CTRL_RX_INTR_ENABLE, 0, &result);
+}
+
+/**
+ * @brief Disarm the RX interrupt of a receive queue
+ *
+ * @param q          The receive queue
+ *
+ * @returns error on failure or SYS_ERR_OK on success
+ *
+ */
+errval_t cleanq_rx_intr_disable(struct cleanq *q)
+{
+    uint64_t result;
+
+    if (q->f.ctrl == NULL) {
+        return CLEANQ_ERR_INVALID_CTRL;
+    }
+
+    return q->f.ctrl(q, CLEANQ_CTRL_RX_INTR_DISABLE, 0, &result);
+}
+
+/**
+ * @brief Get the event fd of the RX interrupts of a receive queue
+ *
+ * @param q          The receive queue
+ * @param fd         Return pointer to the fd
+ *
+ * @returns error on failure or SYS_ERR_OK on success
+ *
+ */
+errval_t cleanq_rx_intr_fd(struct cleanq *q, int *fd)
+{
+    errval_t err;
+    uint64_t result;
+
+    if (q->f.ctrl == NULL) {
+        return CLEANQ_ERR_INVALID_CTRL;
+    }
+
+    err = q->f.ctrl(q, CLEANQ_CTRL_RX_INTR_FD, 0, &result);
+    if (err_is_fail(err)) {
+        return err;
+    }
+
+    *fd = (int) result;
+    return CLEANQ_ERR_OK;
+}
+
+/**
+ * @brief Read the statistics of a queue
+ *
+ * @param q          The device queue to call the operation on
+ * @param stats      Return pointer to a snapshot of the counters
+ *
+ * @returns error on failure or SYS_ERR_OK on success
+ *
+ */
+errval_t cleanq_get_stats(struct cleanq *q, struct cleanq_stats *stats)
+{
+    errval_t err;
+    uint64_t result;
+    const volatile struct cleanq_stats* s;
+
+    if (q->f.ctrl == NULL) {
+        return CLEANQ_ERR_INVALID_CTRL;
+    }
+
+    err = q->f.ctrl(q, CLEANQ_CTRL_GET_STATS, 0, &result);
+    if (err_is_fail(err)) {
+        return err;
+    }
+
+    // the datapath updates the counters while they are copied, deq is read
+    // first so that the occupancy does not come out negative
+    s = (const volatile struct cleanq_stats*) (uintptr_t) result;
+    stats->deq = s->deq;
+    stats->enq = s->enq;
+    stats->enq_bytes = s->enq_bytes;
+    stats->deq_bytes = s->deq_bytes;
+    stats->full = s->full;
+    stats->empty = s->empty;
+    stats->invalid = s->invalid;
+    stats->dropped = s->dropped;
+    stats->drop_chksum = s->drop_chksum;
+    stats->drop_wrong_ip = s->drop_wrong_ip;
+    stats->drop_wrong_proto = s->drop_wrong_proto;
+    stats->drop_wrong_port = s->drop_wrong_port;
+    stats->high_watermark = s->high_watermark;
+    stats->occupancy = stats->enq > stats->deq ? stats->enq - stats->deq : 0;
+    return CLEANQ_ERR_OK;
+}
+
  /**
   * @brief destroys the device queue
   *
@@ -321,13 +526,15 @@ errval_t cleanq_control(struct cleanq *q,
 errval_t cleanq_destroy(struct cleanq *q)
 {
     errval_t err;
+    // the backend may free the memory q lives in
+    struct region_pool* pool = q->pool;
 
     err = q->f.destroy(q);
     if (err_is_fail(err)) {
         return err;
     }
 
-    return region_pool_destroy(q->pool);
+    return region_pool_destroy(pool);
 }
 
 
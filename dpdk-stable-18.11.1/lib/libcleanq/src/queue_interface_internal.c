@@ -7,6 +7,10 @@
  * ETH Zurich D-INFK, Universitaetstr. 6, CH-8092 Zurich. Attn: Systems Group.
  */
 #include <stdbool.h>
+#include <stdlib.h>
+
+#include <rte_common.h>
+#include <rte_malloc.h>
 
 #include <cleanq.h>
 #include <cleanq_module.h>
@@ -28,13 +32,43 @@
 
 errval_t cleanq_init(struct cleanq *q)
 {
-    
+    return cleanq_init_socket(q, CLEANQ_SOCKET_ID_ANY);
+}
+
+errval_t cleanq_init_socket(struct cleanq *q, int socket_id)
+{
     errval_t err;
-    err = region_pool_init(&(q->pool));
-    
+    err = region_pool_init_socket(&(q->pool), socket_id);
+
     return err;
 }
 
+void* cleanq_malloc_socket(size_t size, int socket_id)
+{
+    void* ptr;
+
+    // cache line aligned as from the DPDK heap, the per queue statistics
+    // must not share a line with another queue
+    if (socket_id == CLEANQ_SOCKET_ID_ANY) {
+        if (posix_memalign(&ptr, RTE_CACHE_LINE_SIZE, size) != 0) {
+            return NULL;
+        }
+        memset(ptr, 0, size);
+        return ptr;
+    }
+
+    return rte_zmalloc_socket("cleanq", size, RTE_CACHE_LINE_SIZE, socket_id);
+}
+
+void cleanq_free_socket(void* ptr, int socket_id)
+{
+    if (socket_id == CLEANQ_SOCKET_ID_ANY) {
+        free(ptr);
+    } else {
+        rte_free(ptr);
+    }
+}
+
 errval_t cleanq_add_region(struct cleanq* q, struct capref cap,
                          regionid_t rid)
 {
@@ -13,6 +13,7 @@
 #include <time.h>
 
 #include <cleanq_bench.h>
+#include <cleanq_module.h>
 
 #include "slab.h"
 #include "region_pool.h"
@@ -29,10 +30,22 @@ struct region_pool {
 
     // random offset where regions ids start from
     uint64_t region_offset;
+    // bits of the ids handed out, see region_pool_set_id_mask()
+    regionid_t id_mask;
     
     // if we have to serach for a slot, need an offset
     uint16_t last_offset;
 
+    // NUMA socket the pool and its regions are allocated on
+    int socket_id;
+
+    // which buffers of the owning queue are checked
+    cleanq_validation_t validation;
+
+    // region of the last successful check, buffers of a queue mostly
+    // come from the same region
+    struct region* cached;
+
     //region_alloc
     struct slab_allocator region_alloc;
 
@@ -116,31 +129,50 @@ static errval_t region_destroy(struct region* region)
  * @returns error on failure or SYS_ERR_OK on success
  */
 errval_t region_pool_init(struct region_pool** pool)
+{
+    return region_pool_init_socket(pool, CLEANQ_SOCKET_ID_ANY);
+}
+
+/**
+ * @brief initialized a pool of regions whose region table and region
+ *        structs are allocated on a NUMA socket
+ *
+ * @param pool          Return pointer to the region pool
+ * @param socket_id     NUMA socket or CLEANQ_SOCKET_ID_ANY
+ *
+ * @returns error on failure or SYS_ERR_OK on success
+ */
+errval_t region_pool_init_socket(struct region_pool** pool, int socket_id)
 {
     // Allocate pool struct itself including pointers to region
-    (*pool) = (struct region_pool*) calloc(1, sizeof(struct region_pool));
+    (*pool) = (struct region_pool*) cleanq_malloc_socket(sizeof(struct region_pool),
+                                                         socket_id);
     if (*pool == NULL) {
         DQI_DEBUG_REGION("Allocationg inital pool failed \n");
         return CLEANQ_ERR_MALLOC_FAIL;
     }
 
     (*pool)->num_regions = 0;
+    (*pool)->socket_id = socket_id;
 
     srand(time(NULL));
 
     // Initialize region id offset
     (*pool)->region_offset = (rand() >> 12) ;
+    (*pool)->id_mask = UINT32_MAX;
     (*pool)->size = INIT_POOL_SIZE;
 
-    (*pool)->pool = (struct region**) calloc(INIT_POOL_SIZE, sizeof(struct region*));
+    (*pool)->pool = (struct region**) cleanq_malloc_socket(INIT_POOL_SIZE *
+                                                          sizeof(struct region*),
+                                                          socket_id);
     if ((*pool)->pool == NULL) {
-        free(*pool);
+        cleanq_free_socket(*pool, socket_id);
         DQI_DEBUG_REGION("Allocationg inital pool failed \n");
         return CLEANQ_ERR_MALLOC_FAIL;
     }
 
-    slab_init(&(*pool)->region_alloc, sizeof(struct region),
-              slab_default_refill);
+    slab_init_socket(&(*pool)->region_alloc, sizeof(struct region),
+                     slab_default_refill, socket_id);
 
     DQI_DEBUG_REGION("Init region pool size=%d addr=%p\n", INIT_POOL_SIZE, *pool);
     return CLEANQ_ERR_OK;
@@ -160,8 +192,8 @@ errval_t region_pool_destroy(struct region_pool* pool)
     struct capref cap;
     // Check if there are any regions left
     if (pool->num_regions == 0) {
-        free(pool->pool);
-        free(pool);
+        cleanq_free_socket(pool->pool, pool->socket_id);
+        cleanq_free_socket(pool, pool->socket_id);
         return CLEANQ_ERR_OK;
     } else {
         // There are regions left -> remove them
@@ -176,8 +208,8 @@ errval_t region_pool_destroy(struct region_pool* pool)
                 }
             }
         }
-        free(pool->pool);
-        free(pool);
+        cleanq_free_socket(pool->pool, pool->socket_id);
+        cleanq_free_socket(pool, pool->socket_id);
     }
    
     return CLEANQ_ERR_OK;
@@ -198,7 +230,8 @@ static errval_t region_pool_grow(struct region_pool* pool)
 
     uint16_t new_size = (pool->size)*2;
     // Allocate new pool twice the size
-    tmp = (struct region**) calloc(new_size, sizeof(struct region*));
+    tmp = (struct region**) cleanq_malloc_socket(new_size * sizeof(struct region*),
+                                                 pool->socket_id);
     if (tmp == NULL) {
         DQI_DEBUG_REGION("Allocationg larger pool failed \n");
         return CLEANQ_ERR_MALLOC_FAIL;
@@ -216,7 +249,7 @@ static errval_t region_pool_grow(struct region_pool* pool)
         tmp[index] = pool->pool[i];
     }
 
-    free(pool->pool);
+    cleanq_free_socket(pool->pool, pool->socket_id);
 
     pool->pool = tmp;
     pool->size = new_size;
@@ -299,7 +332,8 @@ errval_t region_pool_add_region(struct region_pool* pool,
         return CLEANQ_ERR_MALLOC_FAIL;
     }
 
-    region->id = pool->region_offset + pool->num_regions + offset;
+    region->id = (pool->region_offset + pool->num_regions + offset) &
+                 pool->id_mask;
     region->cap = cap;
     region->base_addr = cap.paddr;
     region->len = cap.len;
@@ -378,6 +412,10 @@ errval_t region_pool_remove_region(struct region_pool* pool,
     }
 
     *cap = region->cap;
+
+    if (pool->cached == region) {
+        pool->cached = NULL;
+    }
   
     slab_free(&pool->region_alloc, region);
     pool->pool[region_id & (pool->size - 1)] = NULL;
@@ -429,10 +467,13 @@ bool region_pool_buffer_check_bounds(struct region_pool* pool,
                                      genoffset_t valid_data,
                                      genoffset_t valid_length)
 {
-    struct region* region;
-    region = pool->pool[region_id & (pool->size - 1)];
-    if (region == NULL) {
-        return false;
+    struct region* region = pool->cached;
+    if (region == NULL || region->id != region_id) {
+        region = pool->pool[region_id & (pool->size - 1)];
+        if (region == NULL || region->id != region_id) {
+            return false;
+        }
+        pool->cached = region;
     }
 
     // check validity of buffer within region
@@ -445,6 +486,56 @@ bool region_pool_buffer_check_bounds(struct region_pool* pool,
     return true;
 }
 
+/**
+ * @brief check a buffer according to the validation policy of the pool
+ *
+ * @param pool          The pool to get the region from
+ * @param inner         The buffer is passed by a module stacked on top of
+ *                      the queue and not through cleanq_enqueue/dequeue
+ * @param region_id     The id of the region
+ * @param offset        offset into the region
+ * @param length        length of the buffer
+ * @param valid_data    offset into the buffer
+ * @param valid_length  length of the valid_data
+ *
+ * @returns true if the buffer is valid or is not checked, otherwise false
+ */
+bool region_pool_buffer_validate(struct region_pool* pool,
+                                 bool inner,
+                                 regionid_t region_id,
+                                 genoffset_t offset,
+                                 genoffset_t length,
+                                 genoffset_t valid_data,
+                                 genoffset_t valid_length)
+{
+#ifndef CLEANQ_DEBUG_VALIDATE
+    if (pool->validation == CLEANQ_VALIDATE_TRUSTED ||
+        (inner && pool->validation != CLEANQ_VALIDATE_FULL)) {
+        return true;
+    }
+#endif
+    return region_pool_buffer_check_bounds(pool, region_id, offset, length,
+                                           valid_data, valid_length);
+}
+
+/**
+ * @brief set the validation policy of the pool
+ *
+ * @param pool          The region pool
+ * @param policy        The validation policy
+ */
+void region_pool_set_validation(struct region_pool* pool,
+                                cleanq_validation_t policy)
+{
+    pool->validation = policy;
+}
+
+void region_pool_set_id_mask(struct region_pool* pool, regionid_t id_mask)
+{
+    // ids of the regions in the pool differ in the bits that index it
+    pool->id_mask = id_mask;
+}
+
 inline
 uint64_t base_addr_of_region(struct region_pool* pool, regionid_t region_id)
 {
@@ -456,15 +547,27 @@ uint64_t base_addr_of_region(struct region_pool* pool, regionid_t region_id)
     return region->base_addr;
 }
 
-inline
-regionid_t region_with_base_addr(struct region_pool* pool, uint64_t base_addr)
+errval_t region_pool_find_base_addr(struct region_pool* pool,
+                                    uint64_t base_addr,
+                                    regionid_t* region_id)
 {
     struct region* region;
     for (uint16_t i = 0; i < pool->size; i++) {
         region = pool->pool[i];
         if (region != NULL && region->base_addr == base_addr) {
-            return region->id;
+            *region_id = region->id;
+            return CLEANQ_ERR_OK;
         }
     }
-    return 0;
+    return CLEANQ_ERR_INVALID_REGION_ID;
+}
+
+inline
+regionid_t region_with_base_addr(struct region_pool* pool, uint64_t base_addr)
+{
+    regionid_t region_id;
+    if (err_is_fail(region_pool_find_base_addr(pool, base_addr, &region_id))) {
+        return 0;
+    }
+    return region_id;
 }
@@ -22,6 +22,17 @@ struct region;
  */
 errval_t region_pool_init(struct region_pool** pool);
 
+/**
+ * @brief initialized a pool of regions whose region table and region
+ *        structs are allocated on a NUMA socket
+ *
+ * @param pool          Return pointer to the region pool
+ * @param socket_id     NUMA socket or CLEANQ_SOCKET_ID_ANY
+ *
+ * @returns error on failure or SYS_ERR_OK on success
+ */
+errval_t region_pool_init_socket(struct region_pool** pool, int socket_id);
+
 
 /**
  * @brief freeing region pool
@@ -91,6 +102,59 @@ bool region_pool_buffer_check_bounds(struct region_pool* pool,
                                      genoffset_t valid_data,
                                      genoffset_t valid_length);
 
+/**
+ * @brief check a buffer according to the validation policy of the pool
+ *
+ * @param pool          The pool to get the region from
+ * @param inner         The buffer is passed by a module stacked on top of
+ *                      the queue and not through cleanq_enqueue/dequeue
+ * @param region_id     The id of the region
+ * @param offset        offset into the region
+ * @param length        length of the buffer
+ * @param valid_data    offset into the buffer
+ * @param valid_length  length of the valid_data
+ *
+ * @returns true if the buffer is valid or is not checked, otherwise false
+ */
+bool region_pool_buffer_validate(struct region_pool* pool,
+                                 bool inner,
+                                 regionid_t region_id,
+                                 genoffset_t offset,
+                                 genoffset_t length,
+                                 genoffset_t valid_data,
+                                 genoffset_t valid_length);
+
+/**
+ * @brief set the validation policy of the pool
+ *
+ * @param pool          The region pool
+ * @param policy        The validation policy
+ */
+void region_pool_set_validation(struct region_pool* pool,
+                                cleanq_validation_t policy);
+
+/**
+ * @brief limits the ids of the regions added from now on to the bits of a
+ *        mask, the ids stay unique as long as it covers the index bits
+ *
+ * @param pool          The region pool
+ * @param id_mask       The bits the ids may have
+ */
+void region_pool_set_id_mask(struct region_pool* pool, regionid_t id_mask);
+
+/**
+ * @brief find the region that starts at a base address
+ *
+ * @param pool          The region pool
+ * @param base_addr     The base address of the region
+ * @param region_id     Return pointer to the id of the region
+ *
+ * @returns CLEANQ_ERR_INVALID_REGION_ID if there is no such region
+ */
+errval_t region_pool_find_base_addr(struct region_pool* pool,
+                                    uint64_t base_addr,
+                                    regionid_t* region_id);
+
 uint64_t base_addr_of_region(struct region_pool* pool, regionid_t region_id);
 
 regionid_t region_with_base_addr(struct region_pool* pool, uint64_t base_addr);
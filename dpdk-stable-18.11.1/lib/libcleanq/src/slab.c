@@ -18,12 +18,12 @@
 #include <stdlib.h>
 #include <stdbool.h>
 
+#include <rte_lcore.h>
+
 #include <cleanq.h>
 #include <cleanq_module.h>
 #include "slab.h"
 
-#define PAGE_SIZE 4096
-
 struct block_head {
     struct block_head *next;///< Pointer to next block in free list
 };
@@ -37,10 +37,102 @@ struct block_head {
  */
 void slab_init(struct slab_allocator *slabs, size_t blocksize,
                slab_refill_func_t refill_func)
+{
+    slab_init_socket(slabs, blocksize, refill_func, CLEANQ_SOCKET_ID_ANY);
+}
+
+/**
+ * \brief Initialise a new slab allocator whose refills are NUMA local
+ *
+ * \param slabs Pointer to slab allocator instance, to be filled-in
+ * \param blocksize Size of blocks to be allocated by this allocator
+ * \param refill_func Pointer to function to call when out of memory (or NULL)
+ * \param socket_id NUMA socket to allocate slabs on (or CLEANQ_SOCKET_ID_ANY)
+ */
+void slab_init_socket(struct slab_allocator *slabs, size_t blocksize,
+                      slab_refill_func_t refill_func, int socket_id)
 {
     slabs->slabs = NULL;
     slabs->blocksize = SLAB_REAL_BLOCKSIZE(blocksize);
     slabs->refill_func = refill_func;
+    slabs->socket_id = socket_id;
+    slabs->refill_bytes = SLAB_DEFAULT_REFILL_SIZE;
+    slabs->mags = NULL;
+    rte_spinlock_init(&slabs->lock);
+}
+
+/**
+ * \brief Set the amount of memory the refill functions add at once
+ *
+ * Larger refills mean fewer calls into the refill function and fewer slabs
+ * to walk on #slab_free. The size is rounded up so that a slab holds
+ * at least one block.
+ *
+ * \param slabs Pointer to slab allocator instance
+ * \param bytes Size of one refill in bytes
+ */
+void slab_set_refill_size(struct slab_allocator *slabs, size_t bytes)
+{
+    size_t min = sizeof(struct slab_head) + slabs->blocksize;
+
+    slabs->refill_bytes = (bytes < min) ? min : bytes;
+}
+
+/**
+ * \brief Enable per-lcore magazines
+ *
+ * With magazines enabled, EAL lcores allocate and free blocks from a private
+ * stash without taking a lock. The shared slab list is only locked when a
+ * magazine runs empty or full. Threads that are not EAL lcores always take
+ * the lock. Has to be called before the allocator is shared between lcores.
+ *
+ * \param slabs Pointer to slab allocator instance
+ *
+ * \returns error on failure or CLEANQ_ERR_OK on success
+ */
+errval_t slab_enable_magazines(struct slab_allocator *slabs)
+{
+    if (slabs->mags != NULL) {
+        return CLEANQ_ERR_OK;
+    }
+
+    slabs->mags = cleanq_malloc_socket(sizeof(struct slab_magazine) *
+                                       RTE_MAX_LCORE, slabs->socket_id);
+    if (slabs->mags == NULL) {
+        return CLEANQ_ERR_MALLOC_FAIL;
+    }
+
+    return CLEANQ_ERR_OK;
+}
+
+static inline struct slab_magazine *slab_get_magazine(struct slab_allocator *slabs)
+{
+    unsigned lcore_id;
+
+    if (slabs->mags == NULL) {
+        return NULL;
+    }
+
+    lcore_id = rte_lcore_id();
+    if (lcore_id >= RTE_MAX_LCORE) {
+        return NULL;
+    }
+
+    return &slabs->mags[lcore_id];
+}
+
+static inline void slab_lock(struct slab_allocator *slabs)
+{
+    if (slabs->mags != NULL) {
+        rte_spinlock_lock(&slabs->lock);
+    }
+}
+
+static inline void slab_unlock(struct slab_allocator *slabs)
+{
+    if (slabs->mags != NULL) {
+        rte_spinlock_unlock(&slabs->lock);
+    }
 }
 
 
@@ -85,60 +177,56 @@ void slab_grow(struct slab_allocator *slabs, void *buf, size_t buflen)
     slabs->slabs = head;
 }
 
-/**
- * \brief Allocate a new block from the slab allocator
- *
- * \param slabs Pointer to slab allocator instance
- *
- * \returns Pointer to block on success, NULL on error (out of memory)
+/*
+ * Takes up to n blocks from the slab list, refilling if needed. The caller
+ * holds the lock if magazines are enabled. Blocks are not cleared.
  */
-void *slab_alloc(struct slab_allocator *slabs)
+static size_t slab_get_blocks(struct slab_allocator *slabs, void **blocks,
+                              size_t n)
 {
     errval_t err;
-    /* find a slab with free blocks */
-    struct slab_head *sh;
-    for (sh = slabs->slabs; sh != NULL && sh->free == 0; sh = sh->next);
+    size_t i = 0;
+    struct slab_head *sh = slabs->slabs;
 
-    if (sh == NULL) {
-        /* out of memory. try refill function if we have one */
-        if (!slabs->refill_func) {
-            return NULL;
-        } else {
+    while (i < n) {
+        /* find a slab with free blocks */
+        for (; sh != NULL && sh->free == 0; sh = sh->next);
+
+        if (sh == NULL) {
+            /* out of memory. try refill function if we have one */
+            if (!slabs->refill_func) {
+                break;
+            }
             err = slabs->refill_func(slabs);
             if (err_is_fail(err)) {
                 printf("slab refill_func failed %d \n", err);
-                return NULL;
+                break;
             }
             for (sh = slabs->slabs; sh != NULL && sh->free == 0; sh = sh->next);
             if (sh == NULL) {
-                return NULL;
+                break;
             }
         }
-    }
-
-    /* dequeue top block from freelist */
-    struct block_head *bh = sh->blocks;
-    assert(bh != NULL);
-    sh->blocks = bh->next;
-    sh->free--;
 
-    memset(bh, 0, slabs->blocksize);
+        /* dequeue top blocks from freelist */
+        while (i < n && sh->free > 0) {
+            struct block_head *bh = sh->blocks;
+            assert(bh != NULL);
+            sh->blocks = bh->next;
+            sh->free--;
+            blocks[i++] = bh;
+        }
+    }
 
-    return bh;
+    return i;
 }
 
-/**
- * \brief Free a block to the slab allocator
- *
- * \param slabs Pointer to slab allocator instance
- * \param block Pointer to block previously returned by #slab_alloc
+/*
+ * Returns a block to the slab it was allocated from. The caller holds the
+ * lock if magazines are enabled.
  */
-void slab_free(struct slab_allocator *slabs, void *block)
+static void slab_put_block(struct slab_allocator *slabs, void *block)
 {
-    if (block == NULL) {
-        return;
-    }
-
     struct block_head *bh = (struct block_head *)block;
 
     /* find matching slab */
@@ -161,6 +249,140 @@ void slab_free(struct slab_allocator *slabs, void *block)
     assert(sh->free <= sh->total);
 }
 
+/**
+ * \brief Allocate a new block from the slab allocator
+ *
+ * \param slabs Pointer to slab allocator instance
+ *
+ * \returns Pointer to block on success, NULL on error (out of memory)
+ */
+void *slab_alloc(struct slab_allocator *slabs)
+{
+    void *block;
+    struct slab_magazine *mag = slab_get_magazine(slabs);
+
+    if (mag != NULL) {
+        if (mag->len == 0) {
+            /* only fill half the magazine so a following free does not
+             * immediately have to flush it again */
+            rte_spinlock_lock(&slabs->lock);
+            mag->len = slab_get_blocks(slabs, mag->objs,
+                                       SLAB_MAGAZINE_SIZE / 2);
+            rte_spinlock_unlock(&slabs->lock);
+            if (mag->len == 0) {
+                return NULL;
+            }
+        }
+        block = mag->objs[--mag->len];
+    } else {
+        slab_lock(slabs);
+        if (slab_get_blocks(slabs, &block, 1) == 0) {
+            block = NULL;
+        }
+        slab_unlock(slabs);
+        if (block == NULL) {
+            return NULL;
+        }
+    }
+
+    memset(block, 0, slabs->blocksize);
+
+    return block;
+}
+
+/**
+ * \brief Free a block to the slab allocator
+ *
+ * \param slabs Pointer to slab allocator instance
+ * \param block Pointer to block previously returned by #slab_alloc
+ */
+void slab_free(struct slab_allocator *slabs, void *block)
+{
+    if (block == NULL) {
+        return;
+    }
+
+    slab_free_bulk(slabs, &block, 1);
+}
+
+/**
+ * \brief Allocate multiple blocks from the slab allocator
+ *
+ * Takes the lock (if any) and walks the slab list only once for the whole
+ * batch instead of once per block.
+ *
+ * \param slabs Pointer to slab allocator instance
+ * \param blocks Array to store the allocated blocks in
+ * \param n Number of blocks to allocate
+ *
+ * \returns Number of blocks allocated, less than n if out of memory
+ */
+size_t slab_alloc_bulk(struct slab_allocator *slabs, void **blocks, size_t n)
+{
+    size_t num = 0;
+    struct slab_magazine *mag = slab_get_magazine(slabs);
+
+    if (mag != NULL) {
+        while (num < n && mag->len > 0) {
+            blocks[num++] = mag->objs[--mag->len];
+        }
+    }
+
+    if (num < n) {
+        slab_lock(slabs);
+        num += slab_get_blocks(slabs, blocks + num, n - num);
+        slab_unlock(slabs);
+    }
+
+    for (size_t i = 0; i < num; i++) {
+        memset(blocks[i], 0, slabs->blocksize);
+    }
+
+    return num;
+}
+
+/**
+ * \brief Free multiple blocks to the slab allocator
+ *
+ * \param slabs Pointer to slab allocator instance
+ * \param blocks Blocks previously returned by #slab_alloc or #slab_alloc_bulk
+ * \param n Number of blocks in the array
+ */
+void slab_free_bulk(struct slab_allocator *slabs, void **blocks, size_t n)
+{
+    size_t i = 0;
+    struct slab_magazine *mag = slab_get_magazine(slabs);
+
+    if (mag != NULL) {
+        for (; i < n; i++) {
+            if (blocks[i] == NULL) {
+                continue;
+            }
+            if (mag->len == SLAB_MAGAZINE_SIZE) {
+                /* flush the older half back to the slabs */
+                rte_spinlock_lock(&slabs->lock);
+                for (uint32_t j = 0; j < SLAB_MAGAZINE_SIZE / 2; j++) {
+                    slab_put_block(slabs, mag->objs[j]);
+                }
+                rte_spinlock_unlock(&slabs->lock);
+                memmove(mag->objs, mag->objs + SLAB_MAGAZINE_SIZE / 2,
+                        sizeof(void *) * (SLAB_MAGAZINE_SIZE / 2));
+                mag->len = SLAB_MAGAZINE_SIZE / 2;
+            }
+            mag->objs[mag->len++] = blocks[i];
+        }
+        return;
+    }
+
+    slab_lock(slabs);
+    for (; i < n; i++) {
+        if (blocks[i] != NULL) {
+            slab_put_block(slabs, blocks[i]);
+        }
+    }
+    slab_unlock(slabs);
+}
+
 /**
  * \brief Returns the count of free blocks in the allocator
  *
@@ -176,6 +398,14 @@ size_t slab_freecount(struct slab_allocator *slabs)
         ret += sh->free;
     }
 
+    /* blocks cached in magazines are free as well, the count is only
+     * a snapshot if other lcores are active */
+    if (slabs->mags != NULL) {
+        for (unsigned i = 0; i < RTE_MAX_LCORE; i++) {
+            ret += slabs->mags[i].len;
+        }
+    }
+
     return ret;
 }
 
@@ -203,7 +433,7 @@ static errval_t slab_refill_pages(struct slab_allocator *slabs, size_t bytes)
         return err LIB_ERR_VSPACE_MAP);
     }
     */
-    void* buf = malloc(bytes);
+    void* buf = cleanq_malloc_socket(bytes, slabs->socket_id);
     if (!buf) {
         return CLEANQ_ERR_MALLOC_FAIL;
     }
@@ -215,12 +445,14 @@ static errval_t slab_refill_pages(struct slab_allocator *slabs, size_t bytes)
 /**
  * \brief General-purpose implementation of a slab allocate/refill function
  *
- * Allocates and maps a single page (FIXME: make configurable) and adds it
- * to the allocator.
+ * Allocates refill_bytes of memory (see #slab_set_refill_size) and adds it
+ * to the allocator. Allocators bound to a NUMA socket refill from the DPDK
+ * heap on that socket, i.e. from pre-faulted hugepages, which requires the
+ * EAL to be initialized. Others refill from the libc heap.
  *
  * \param slabs Pointer to slab allocator instance
  */
 errval_t slab_default_refill(struct slab_allocator *slabs)
 {
-    return slab_refill_pages(slabs, PAGE_SIZE);
+    return slab_refill_pages(slabs, slabs->refill_bytes);
 }
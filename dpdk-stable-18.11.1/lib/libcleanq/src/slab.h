@@ -18,6 +18,8 @@
 #include <stdint.h>
 #include <cleanq.h>
 #include <sys/cdefs.h>
+#include <rte_config.h>
+#include <rte_spinlock.h>
 
 __BEGIN_DECLS
 
@@ -35,20 +37,42 @@ struct slab_head {
 
 struct slot_allocator;
 
+/// Number of blocks an lcore magazine can hold
+#define SLAB_MAGAZINE_SIZE 64
+
+/// Per-lcore stash of free blocks, only ever touched by its owning lcore
+struct slab_magazine {
+    uint32_t len;                       ///< Number of blocks in objs
+    void *objs[SLAB_MAGAZINE_SIZE];     ///< Free blocks, used as a stack
+} __attribute__((aligned(RTE_CACHE_LINE_SIZE)));
+
 struct slab_allocator {
     struct slab_head *slabs;    ///< Pointer to list of slabs
     size_t blocksize;           ///< Size of blocks managed by this allocator
     slab_refill_func_t refill_func;  ///< Refill function
+    int socket_id;              ///< NUMA socket refills are allocated on
+    size_t refill_bytes;        ///< Amount of memory added by one refill
+    struct slab_magazine *mags; ///< Per-lcore magazines (NULL if disabled)
+    rte_spinlock_t lock;        ///< Protects the slab list if mags are used
 };
 
 void slab_init(struct slab_allocator *slabs, size_t blocksize,
                slab_refill_func_t refill_func);
+void slab_init_socket(struct slab_allocator *slabs, size_t blocksize,
+                      slab_refill_func_t refill_func, int socket_id);
+void slab_set_refill_size(struct slab_allocator *slabs, size_t bytes);
+errval_t slab_enable_magazines(struct slab_allocator *slabs);
 void slab_grow(struct slab_allocator *slabs, void *buf, size_t buflen);
 void *slab_alloc(struct slab_allocator *slabs);
 void slab_free(struct slab_allocator *slabs, void *block);
+size_t slab_alloc_bulk(struct slab_allocator *slabs, void **blocks, size_t n);
+void slab_free_bulk(struct slab_allocator *slabs, void **blocks, size_t n);
 size_t slab_freecount(struct slab_allocator *slabs);
 errval_t slab_default_refill(struct slab_allocator *slabs);
 
+/// Refill size used unless changed with #slab_set_refill_size
+#define SLAB_DEFAULT_REFILL_SIZE 4096
+
 // size of block header
 #define SLAB_BLOCK_HDRSIZE (sizeof(void *))
 // should be able to fit the header into the block
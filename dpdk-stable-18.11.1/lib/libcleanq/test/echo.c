@@ -51,7 +51,8 @@ int main(int argc, char *argv[])
         .dereg = ipcq_deregister
     };
 
-    err = ipcq_create(&ipc_queue, (char*) "recv", (char*) "send", true, &func);
+    err = ipcq_create(&ipc_queue, (char*) "recv", (char*) "send", true, &func,
+                      CLEANQ_SOCKET_ID_ANY, IPCQ_DESC_DEFAULT);
     assert(err_is_ok(err));
 
     que = (struct cleanq*) ipc_queue;
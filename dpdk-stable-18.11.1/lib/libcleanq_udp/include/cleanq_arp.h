@@ -0,0 +1,158 @@
+/*
+ * Copyright (c) 2017 ETH Zurich.
+ * All rights reserved.
+ *
+ * This file is distributed under the terms in the attached LICENSE file.
+ * If you do not find this file, copies can be found by writing to:
+ * ETH Zurich D-INFK, Universitaetstr. 6, CH-8092 Zurich. Attn: Systems Group.
+ */
+#ifndef CLEANQ_ARP_H_
+#define CLEANQ_ARP_H_ 1
+
+#include <stdint.h>
+#include <string.h>
+#include <cleanq.h>
+
+/*
+ * ARP queue
+ *
+ * Sits between the NIC queues and the IP (or fused UDP/IP) queues:
+ *
+ *   udp/ip --> arp tx --> NIC tx
+ *   udp/ip <-- arp rx <-- NIC rx
+ *
+ * It answers ARP requests for our address, learns neighbors from the ARP
+ * packets it receives and resolves the next hop of packets that the queues
+ * on top could not address yet. Those are held in a small queue until the
+ * answer arrives, or handed back as send completions if none does.
+ *
+ * The neighbor table can be shared by the ARP queues of several NIC queue
+ * pairs of the same port. Updates take a lock, the datapath reads the
+ * entries without one.
+ *
+ * The modules on top call ARP through its function pointers. With
+ * CONFIG_RTE_LIBCLEANQ_STATIC_IXGBE the direct ixgbe calls see that the
+ * queue below is not ixgbe and fall back to them.
+ */
+
+struct arp_q;
+struct arp_table;
+struct ether_addr;
+
+/*
+ * Control request of the ARP queue: value is an IPv4 destination (network
+ * order), result a pointer to the struct arp_neigh of the next hop towards
+ * it (see arp_neigh_query)
+ */
+#define CLEANQ_CTRL_ARP_GET_NEIGHBOR (CLEANQ_CTRL_BACKEND_BASE | 0x100)
+
+// set on TX by the queues on top when the neighbor of the packet is unknown
+#define NETIF_TXFLAG_RESOLVE (1UL << 26)
+
+/*
+ * Neighbor entry as seen by the datapath. The MAC and whether it is valid
+ * share one 64 bit word, so it can be read with a single load while the
+ * table is updated.
+ */
+struct arp_neigh {
+    uint64_t mac;
+};
+
+union arp_neigh_mac {
+    uint64_t raw;
+    struct {
+        uint8_t addr[6];
+        uint8_t valid;
+        uint8_t pad;
+    } s;
+};
+
+static inline uint64_t arp_neigh_load(const struct arp_neigh* n)
+{
+    return __atomic_load_n(&n->mac, __ATOMIC_ACQUIRE);
+}
+
+static inline int arp_neigh_valid(uint64_t mac)
+{
+    union arp_neigh_mac m = { .raw = mac };
+    return m.s.valid;
+}
+
+static inline void arp_neigh_copy(uint64_t mac, void* dst)
+{
+    union arp_neigh_mac m = { .raw = mac };
+    memcpy(dst, m.s.addr, 6);
+}
+
+/**
+ * @brief Creates a neighbor table
+ *
+ * @param t          return value
+ * @param ip         our IP address (network order)
+ * @param netmask    netmask of our subnet (network order)
+ * @param gateway    next hop for addresses outside the subnet, 0 if
+ *                   every address is reachable directly
+ * @param mac        our MAC address
+ * @param socket_id  NUMA socket to allocate the table on
+ */
+errval_t arp_table_create(struct arp_table** t, uint32_t ip, uint32_t netmask,
+                          uint32_t gateway, struct ether_addr* mac,
+                          int socket_id);
+
+errval_t arp_table_destroy(struct arp_table* t);
+
+/**
+ * @brief Adds a neighbor that does not have to be resolved and is never
+ *        refreshed
+ *
+ * @param t          neighbor table
+ * @param ip         IP address of the neighbor (network order)
+ * @param mac        its MAC address
+ */
+errval_t arp_table_add_static(struct arp_table* t, uint32_t ip,
+                              struct ether_addr* mac);
+
+/**
+ * @brief Creates an ARP queue on top of a pair of NIC queues
+ *
+ * @param q          return value
+ * @param t          neighbor table, can be shared with other ARP queues
+ * @param nic_rx     NIC queue to receive from
+ * @param nic_tx     NIC queue to send on
+ * @param socket_id  NUMA socket to allocate the queue state on
+ */
+errval_t arp_create(struct arp_q** q, struct arp_table* t,
+                    struct cleanq* nic_rx, struct cleanq* nic_tx,
+                    int socket_id);
+
+/**
+ * @brief Destroys an ARP queue. The packets still waiting for their next hop
+ *        are given up on. As long as they or ARP packets of the queue are
+ *        not dequeued as send completions from arp_get_tx(), it fails with
+ *        CLEANQ_ERR_BUFFER_ALREADY_IN_USE and has to be called again. The
+ *        buffers kept to send requests with are enqueued to nic_rx.
+ *
+ * @param q          the ARP queue
+ */
+errval_t arp_destroy(struct arp_q* q);
+
+/*
+ * The receive and send side of the ARP queue, to be passed as nic_rx and
+ * nic_tx to the queues on top
+ */
+struct cleanq* arp_get_rx(struct arp_q* q);
+struct cleanq* arp_get_tx(struct arp_q* q);
+
+/**
+ * @brief Returns the neighbor entry of the next hop towards an address if
+ *        there is an ARP queue below q. The entry stays at the same address
+ *        until the table is destroyed, but it is only valid once resolved.
+ *
+ * @param q          queue to ask, normally the nic_tx of a module
+ * @param dst_ip     destination IP (network order)
+ *
+ * @returns the entry or NULL if there is no ARP queue below q
+ */
+const struct arp_neigh* arp_neigh_query(struct cleanq* q, uint32_t dst_ip);
+
+#endif /* CLEANQ_ARP_H_ */
@@ -0,0 +1,76 @@
+/*
+ * Copyright (c) 2017 ETH Zurich.
+ * All rights reserved.
+ *
+ * This file is distributed under the terms in the attached LICENSE file.
+ * If you do not find this file, copies can be found by writing to:
+ * ETH Zurich D-INFK, Universitaetstr. 6, CH-8092 Zurich. Attn: Systems Group.
+ */
+#ifndef CLEANQ_CHKSUM_H_
+#define CLEANQ_CHKSUM_H_ 1
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Internet checksum (RFC 1071) of a buffer. The result is the folded,
+ * non-inverted 16 bit sum in the byte order of the buffer, the same as
+ * rte_raw_cksum() returns, so it can be added to other partial sums.
+ *
+ * The implementation is picked at startup by what the CPU supports.
+ */
+
+typedef enum {
+    // the lwIP routine the modules used so far, 2 bytes per iteration
+    CLEANQ_CHKSUM_LWIP = 0,
+    // portable, 8 bytes per iteration
+    CLEANQ_CHKSUM_SCALAR = 1,
+    // 16 bytes per iteration (x86 only)
+    CLEANQ_CHKSUM_SSE = 2,
+    // 32 bytes per iteration (x86 with AVX2 only)
+    CLEANQ_CHKSUM_AVX2 = 3,
+    CLEANQ_CHKSUM_MAX
+} cleanq_chksum_impl_t;
+
+/**
+ * @brief Checksum of a buffer
+ *
+ * @param buf       Start of the buffer, no alignment needed
+ * @param len       Length of the buffer in bytes
+ *
+ * @returns the non-inverted 16 bit sum
+ */
+uint16_t cleanq_chksum(const void* buf, size_t len);
+
+/**
+ * @brief Copies a buffer and computes its checksum in the same pass
+ *
+ * @param dst       Where to copy to, must not overlap src
+ * @param src       Where to copy from
+ * @param len       Number of bytes to copy
+ *
+ * @returns the non-inverted 16 bit sum of the copied bytes
+ */
+uint16_t cleanq_chksum_copy(void* dst, const void* src, size_t len);
+
+/**
+ * @brief Selects the implementation used by cleanq_chksum() and
+ *        cleanq_chksum_copy(), mostly for benchmarks and tests.
+ *
+ * @param impl      The implementation to use
+ *
+ * @returns 0 on success, -1 if the CPU or the build does not support it
+ */
+int cleanq_chksum_set_impl(cleanq_chksum_impl_t impl);
+
+/**
+ * @returns the implementation in use
+ */
+cleanq_chksum_impl_t cleanq_chksum_get_impl(void);
+
+/**
+ * @returns the name of an implementation
+ */
+const char* cleanq_chksum_impl_name(cleanq_chksum_impl_t impl);
+
+#endif /* CLEANQ_CHKSUM_H_ */
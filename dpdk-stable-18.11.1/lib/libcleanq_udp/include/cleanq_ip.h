@@ -35,13 +35,50 @@ errval_t ip_destroy(struct ip_q* q);
  *                      the card_name will be initalized
  * @param prot         The protocol that is running on top of IP
  * @param dst_ip       Destination IP
+ * @param dst_mac      Destination MAC, unused (can be NULL) if nic_tx is an
+ *                     ARP queue (see cleanq_arp.h), -EINVAL if it is NULL
+ *                     otherwise
  * @param interrupt    Interrupt handler
  * @param poll         If the queue is polled or should use interrupts             
+ * @param socket_id    NUMA socket to allocate the queue state on, normally the
+ *                     socket of the NIC (CLEANQ_SOCKET_ID_ANY for libc heap)
  *
  */
 errval_t ip_create(struct ip_q** q, struct cleanq* nic_rx, struct cleanq* nic_tx, 
 		   uint8_t prot, uint32_t src_ip , uint32_t dst_ip,
-		   struct ether_addr* src_mac, struct ether_addr* dst_mac);
+		   struct ether_addr* src_mac, struct ether_addr* dst_mac,
+		   int socket_id);
+
+/*
+ * Datapath of the IP queue. Normally called through the function pointers
+ * of the queue, exported so stacks on top can bind them statically
+ * (see cleanq_static.h).
+ *
+ * The IP module itself binds to the NIC at compile time if built with
+ * CLEANQ_IP_NIC_{RX,TX}_{ENQ,DEQ} set to the NIC's CleanQ functions.
+ */
+errval_t ip_enqueue(struct cleanq* q, regionid_t rid,
+                    genoffset_t offset, genoffset_t length,
+                    genoffset_t valid_data, genoffset_t valid_length,
+                    uint64_t flags);
+
+errval_t ip_dequeue(struct cleanq* q, regionid_t* rid, genoffset_t* offset,
+                    genoffset_t* length, genoffset_t* valid_data,
+                    genoffset_t* valid_length, uint64_t* flags);
+
+/*
+ * Dequeue only received packets (ip_dequeue_rx) or only send completions
+ * (ip_dequeue_tx). ip_dequeue() polls both, RX first, which costs a TX
+ * ring read on every empty RX poll; an application that polls RX in a
+ * loop can reap send completions less often with these.
+ */
+errval_t ip_dequeue_rx(struct cleanq* q, regionid_t* rid, genoffset_t* offset,
+                       genoffset_t* length, genoffset_t* valid_data,
+                       genoffset_t* valid_length, uint64_t* flags);
+
+errval_t ip_dequeue_tx(struct cleanq* q, regionid_t* rid, genoffset_t* offset,
+                       genoffset_t* length, genoffset_t* valid_data,
+                       genoffset_t* valid_length, uint64_t* flags);
 
 //struct bench_ctl* ip_get_benchmark_data(struct ip_q* q, uint8_t type);
 #endif /* CLEANQ_IP_H_ */
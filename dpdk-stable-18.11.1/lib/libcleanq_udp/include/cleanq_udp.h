@@ -16,8 +16,13 @@
 #define NETIF_RXFLAG (1UL << 28)
 #define NETIF_TXFLAG (1UL << 29)
 #define NETIF_TXFLAG_LAST (1UL << 30)
+// the payload was written with udp_write_buffer(), which already summed it
+#define NETIF_TXFLAG_PAYLOAD_SUM (1UL << 27)
 #define PORT_BITS 16 // first 16 bits are the port to send to
 
+// Ethernet, IP and UDP header in front of the payload of a UDP packet
+#define UDP_HEADERS_LEN 42
+
 struct udp_q;
 struct bench_ctl;
 
@@ -45,14 +50,22 @@ errval_t udp_destroy(struct udp_q* q);
  * @param src_port     UDP source port
  * @param dst_port     UPD destination port
  * @param dst_ip       Destination IP
+ * @param dst_mac      Destination MAC, unused (can be NULL) if nic_tx is an
+ *                     ARP queue (see cleanq_arp.h), -EINVAL if it is NULL
+ *                     otherwise
+ * @param socket_id    NUMA socket to allocate the queue state on, normally the
+ *                     socket of the NIC (CLEANQ_SOCKET_ID_ANY for libc heap)
  *
  */
 errval_t udp_create(struct udp_q** q, struct cleanq* nic_rx, struct cleanq* nic_tx,
                     uint16_t src_port, uint16_t dst_port,
                     uint32_t src_ip, uint32_t dst_ip,
-                    struct ether_addr* src_mac, struct ether_addr* dst_mac);
+                    struct ether_addr* src_mac, struct ether_addr* dst_mac,
+                    int socket_id);
 /*
- * @brief  Writes into a buffer so that we still have space to add the headers
+ * @brief  Writes into a buffer so that we still have space to add the headers.
+ *         The payload is summed while copied, see udp_set_tx_chksum().
+ *         The buffer has to be enqueued with valid_data 0.
  *
  * @param q           udp queue to which the region was registered to
  * @param rid         The region ID in which the buffer to write to is contained
@@ -64,5 +77,63 @@ errval_t udp_create(struct udp_q** q, struct cleanq* nic_rx, struct cleanq* nic_
 errval_t udp_write_buffer(struct udp_q* q, regionid_t rid, genoffset_t offset,
                           void* data, uint16_t len);
 
+/*
+ * @brief  Turns computing the UDP checksum of sent datagrams on or off
+ *         (off by default, the checksum is then 0). With
+ *         NETIF_TXFLAG_PAYLOAD_SUM the sum of the payload computed by
+ *         udp_write_buffer() is reused, otherwise the payload is summed
+ *         on enqueue.
+ *
+ * @param q           udp queue
+ * @param enable      1 to compute the checksum, 0 to send none
+ */
+void udp_set_tx_chksum(struct udp_q* q, int enable);
+
+/*
+ * @brief  Returns where the payload of a buffer goes, so it can be built in
+ *         place instead of copied with udp_write_buffer(). The buffer is
+ *         then enqueued with valid_length = UDP_HEADERS_LEN + payload length.
+ *         Works for received buffers the same way.
+ *
+ * @param q           udp queue to which the region was registered to
+ * @param rid         The region ID in which the buffer is contained
+ * @param offset      The offset into the region at which the buffer start
+ * @param valid_data  The valid_data of the buffer
+ *
+ * @returns pointer to the payload or NULL if the region is unknown
+ */
+void* udp_get_payload(struct udp_q* q, regionid_t rid, genoffset_t offset,
+                      genoffset_t valid_data);
+
+/*
+ * @brief  Returns the IP queue the UDP queue runs on, e.g. to read its
+ *         statistics (cleanq_get_stats())
+ */
+struct cleanq* udp_get_ip(struct udp_q* q);
+
+/*
+ * Datapath of the UDP queue, exported for static dispatch, e.g.
+ * CLEANQ_STATIC_QUEUE(udp_stack, udp_enqueue, udp_dequeue)
+ */
+errval_t udp_enqueue(struct cleanq* q, regionid_t rid,
+                     genoffset_t offset, genoffset_t length,
+                     genoffset_t valid_data, genoffset_t valid_length,
+                     uint64_t flags);
+
+errval_t udp_dequeue(struct cleanq* q, regionid_t* rid, genoffset_t* offset,
+                     genoffset_t* length, genoffset_t* valid_data,
+                     genoffset_t* valid_length, uint64_t* flags);
+
+/*
+ * RX only and TX completion only dequeue, see ip_dequeue_rx()
+ */
+errval_t udp_dequeue_rx(struct cleanq* q, regionid_t* rid, genoffset_t* offset,
+                        genoffset_t* length, genoffset_t* valid_data,
+                        genoffset_t* valid_length, uint64_t* flags);
+
+errval_t udp_dequeue_tx(struct cleanq* q, regionid_t* rid, genoffset_t* offset,
+                        genoffset_t* length, genoffset_t* valid_data,
+                        genoffset_t* valid_length, uint64_t* flags);
+
 //struct bench_ctl* udp_get_benchmark_data(struct udp_q* q, bench_data_type_t type);
 #endif /* CLEANQ_UDP_H_ */
@@ -0,0 +1,86 @@
+/*
+ * Copyright (c) 2017 ETH Zurich.
+ * All rights reserved.
+ *
+ * This file is distributed under the terms in the attached LICENSE file.
+ * If you do not find this file, copies can be found by writing to:
+ * ETH Zurich D-INFK, Universitaetstr. 6, CH-8092 Zurich. Attn: Systems Group.
+ */
+#ifndef CLEANQ_UDP_IP_H_
+#define CLEANQ_UDP_IP_H_ 1
+
+#include <cleanq.h>
+
+/*
+ * UDP, IP and Ethernet in one module. Behaves like a UDP queue on top of an
+ * IP queue (see cleanq_udp.h) but keeps one header template for the flow and
+ * writes the whole 42 byte header on TX with a few wide stores, without
+ * going through the IP module.
+ */
+
+struct udp_ip_q;
+struct ether_addr;
+
+/**
+ * @brief initalizes a fused UDP/IP queue on top of a pair of NIC queues.
+ *        all packets received that do not match the flow will be dropped.
+ *
+ * @param q            udp/ip queue return value
+ * @param nic_rx       NIC queue to receive on
+ * @param nic_tx       NIC queue to send on
+ * @param src_port     UDP source port
+ * @param dst_port     UDP destination port
+ * @param src_ip       Source IP (network byte order)
+ * @param dst_ip       Destination IP (network byte order)
+ * @param src_mac      Source MAC
+ * @param dst_mac      Destination MAC, unused (can be NULL) if nic_tx is an
+ *                     ARP queue (see cleanq_arp.h), -EINVAL if it is NULL
+ *                     otherwise
+ * @param socket_id    NUMA socket to allocate the queue state on, normally the
+ *                     socket of the NIC (CLEANQ_SOCKET_ID_ANY for libc heap)
+ *
+ * @returns error on failure or CLEANQ_ERR_OK on success
+ */
+errval_t udp_ip_create(struct udp_ip_q** q, struct cleanq* nic_rx,
+                       struct cleanq* nic_tx,
+                       uint16_t src_port, uint16_t dst_port,
+                       uint32_t src_ip, uint32_t dst_ip,
+                       struct ether_addr* src_mac, struct ether_addr* dst_mac,
+                       int socket_id);
+
+/**
+ *  @param q        udp/ip queue to destroy
+ */
+errval_t udp_ip_destroy(struct udp_ip_q* q);
+
+/*
+ * Where the payload of a buffer goes, same as udp_get_payload()
+ */
+void* udp_ip_get_payload(struct udp_ip_q* q, regionid_t rid,
+                         genoffset_t offset, genoffset_t valid_data);
+
+/*
+ * Datapath of the UDP/IP queue, exported for static dispatch, e.g.
+ * CLEANQ_STATIC_QUEUE(udp_stack, udp_ip_enqueue, udp_ip_dequeue)
+ */
+errval_t udp_ip_enqueue(struct cleanq* q, regionid_t rid,
+                        genoffset_t offset, genoffset_t length,
+                        genoffset_t valid_data, genoffset_t valid_length,
+                        uint64_t flags);
+
+errval_t udp_ip_dequeue(struct cleanq* q, regionid_t* rid, genoffset_t* offset,
+                        genoffset_t* length, genoffset_t* valid_data,
+                        genoffset_t* valid_length, uint64_t* flags);
+
+/*
+ * RX only and TX completion only dequeue, see ip_dequeue_rx()
+ */
+errval_t udp_ip_dequeue_rx(struct cleanq* q, regionid_t* rid, genoffset_t* offset,
+                           genoffset_t* length, genoffset_t* valid_data,
+                           genoffset_t* valid_length, uint64_t* flags);
+
+errval_t udp_ip_dequeue_tx(struct cleanq* q, regionid_t* rid, genoffset_t* offset,
+                           genoffset_t* length, genoffset_t* valid_data,
+                           genoffset_t* valid_length, uint64_t* flags);
+
+#endif /* CLEANQ_UDP_IP_H_ */
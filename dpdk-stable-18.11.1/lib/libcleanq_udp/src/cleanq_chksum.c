@@ -0,0 +1,312 @@
+/*
+ * Copyright (c) 2017, ETH Zurich.
+ * All rights reserved.
+ *
+ * This file is distributed under the terms in the attached LICENSE file.
+ * If you do not find this file, copies can be found by writing to:
+ * ETH Zurich D-INFK, Universitätstrasse 4, CH-8092 Zurich. Attn: Systems Group.
+ */
+
+#include <stdint.h>
+#include <string.h>
+
+#include <rte_common.h>
+#include <rte_cpuflags.h>
+#ifdef RTE_ARCH_X86
+#include <emmintrin.h>
+#endif
+
+#include <cleanq_chksum.h>
+#include "cleanq_chksum_impl.h"
+#include "inet_chksum.h"
+
+typedef uint16_t (*chksum_fn_t)(const void* buf, size_t len);
+typedef uint16_t (*chksum_copy_fn_t)(void* dst, const void* src, size_t len);
+
+static cleanq_chksum_impl_t chksum_impl = CLEANQ_CHKSUM_SCALAR;
+static chksum_fn_t chksum_fn = chksum_scalar;
+static chksum_copy_fn_t chksum_copy_fn = chksum_copy_scalar;
+
+static const char* chksum_names[CLEANQ_CHKSUM_MAX] = {
+    [CLEANQ_CHKSUM_LWIP] = "lwip",
+    [CLEANQ_CHKSUM_SCALAR] = "scalar",
+    [CLEANQ_CHKSUM_SSE] = "sse",
+    [CLEANQ_CHKSUM_AVX2] = "avx2",
+};
+
+/*
+ * lwIP
+ */
+
+// lwip_standard_chksum() takes an int and is only correct up to 0x20000 bytes
+#define LWIP_MAX_CHUNK 0x10000
+
+static uint16_t chksum_lwip(const void* buf, size_t len)
+{
+    const uint8_t* p = buf;
+    uint64_t sum = 0;
+
+    while (len > LWIP_MAX_CHUNK) {
+        sum += lwip_standard_chksum(p, LWIP_MAX_CHUNK);
+        p += LWIP_MAX_CHUNK;
+        len -= LWIP_MAX_CHUNK;
+    }
+    sum += lwip_standard_chksum(p, (int) len);
+    return chksum_fold64(sum);
+}
+
+static uint16_t chksum_copy_lwip(void* dst, const void* src, size_t len)
+{
+    memcpy(dst, src, len);
+    return chksum_lwip(dst, len);
+}
+
+/*
+ * Scalar, 32 bit words into a 64 bit sum
+ */
+
+uint16_t chksum_scalar(const void* buf, size_t len)
+{
+    const uint8_t* p = buf;
+    uint64_t sum = 0;
+    uint64_t a, b;
+
+    while (len >= 16) {
+        memcpy(&a, p, 8);
+        memcpy(&b, p + 8, 8);
+        sum += (a & 0xffffffffUL) + (a >> 32);
+        sum += (b & 0xffffffffUL) + (b >> 32);
+        p += 16;
+        len -= 16;
+    }
+
+    if (len >= 8) {
+        memcpy(&a, p, 8);
+        sum += (a & 0xffffffffUL) + (a >> 32);
+        p += 8;
+        len -= 8;
+    }
+
+    return chksum_fold64(chksum_tail(p, len, sum));
+}
+
+uint16_t chksum_copy_scalar(void* dst, const void* src, size_t len)
+{
+    const uint8_t* s = src;
+    uint8_t* d = dst;
+    uint64_t sum = 0;
+    uint64_t a, b;
+
+    while (len >= 16) {
+        memcpy(&a, s, 8);
+        memcpy(&b, s + 8, 8);
+        memcpy(d, &a, 8);
+        memcpy(d + 8, &b, 8);
+        sum += (a & 0xffffffffUL) + (a >> 32);
+        sum += (b & 0xffffffffUL) + (b >> 32);
+        s += 16;
+        d += 16;
+        len -= 16;
+    }
+
+    if (len >= 8) {
+        memcpy(&a, s, 8);
+        memcpy(d, &a, 8);
+        sum += (a & 0xffffffffUL) + (a >> 32);
+        s += 8;
+        d += 8;
+        len -= 8;
+    }
+
+    memcpy(d, s, len);
+    return chksum_fold64(chksum_tail(s, len, sum));
+}
+
+/*
+ * SSE, only needs SSE2 which every x86-64 CPU has
+ */
+
+#ifdef RTE_ARCH_X86
+static inline __m128i chksum_add_sse(__m128i acc, __m128i v)
+{
+    const __m128i zero = _mm_setzero_si128();
+    acc = _mm_add_epi64(acc, _mm_unpacklo_epi32(v, zero));
+    return _mm_add_epi64(acc, _mm_unpackhi_epi32(v, zero));
+}
+
+static inline uint64_t chksum_reduce_sse(__m128i acc)
+{
+    return (uint64_t) _mm_cvtsi128_si64(acc) +
+           (uint64_t) _mm_cvtsi128_si64(_mm_unpackhi_epi64(acc, acc));
+}
+
+uint16_t chksum_sse(const void* buf, size_t len)
+{
+    const uint8_t* p = buf;
+    __m128i acc0 = _mm_setzero_si128();
+    __m128i acc1 = _mm_setzero_si128();
+    uint64_t sum, a;
+
+    while (len >= 64) {
+        acc0 = chksum_add_sse(acc0, _mm_loadu_si128((const __m128i*) p));
+        acc1 = chksum_add_sse(acc1, _mm_loadu_si128((const __m128i*) (p + 16)));
+        acc0 = chksum_add_sse(acc0, _mm_loadu_si128((const __m128i*) (p + 32)));
+        acc1 = chksum_add_sse(acc1, _mm_loadu_si128((const __m128i*) (p + 48)));
+        p += 64;
+        len -= 64;
+    }
+
+    while (len >= 16) {
+        acc0 = chksum_add_sse(acc0, _mm_loadu_si128((const __m128i*) p));
+        p += 16;
+        len -= 16;
+    }
+
+    sum = chksum_reduce_sse(_mm_add_epi64(acc0, acc1));
+
+    if (len >= 8) {
+        memcpy(&a, p, 8);
+        sum += (a & 0xffffffffUL) + (a >> 32);
+        p += 8;
+        len -= 8;
+    }
+
+    return chksum_fold64(chksum_tail(p, len, sum));
+}
+
+uint16_t chksum_copy_sse(void* dst, const void* src, size_t len)
+{
+    const uint8_t* s = src;
+    uint8_t* d = dst;
+    __m128i acc0 = _mm_setzero_si128();
+    __m128i acc1 = _mm_setzero_si128();
+    __m128i v0, v1;
+    uint64_t sum, a;
+
+    while (len >= 32) {
+        v0 = _mm_loadu_si128((const __m128i*) s);
+        v1 = _mm_loadu_si128((const __m128i*) (s + 16));
+        _mm_storeu_si128((__m128i*) d, v0);
+        _mm_storeu_si128((__m128i*) (d + 16), v1);
+        acc0 = chksum_add_sse(acc0, v0);
+        acc1 = chksum_add_sse(acc1, v1);
+        s += 32;
+        d += 32;
+        len -= 32;
+    }
+
+    if (len >= 16) {
+        v0 = _mm_loadu_si128((const __m128i*) s);
+        _mm_storeu_si128((__m128i*) d, v0);
+        acc0 = chksum_add_sse(acc0, v0);
+        s += 16;
+        d += 16;
+        len -= 16;
+    }
+
+    sum = chksum_reduce_sse(_mm_add_epi64(acc0, acc1));
+
+    if (len >= 8) {
+        memcpy(&a, s, 8);
+        memcpy(d, &a, 8);
+        sum += (a & 0xffffffffUL) + (a >> 32);
+        s += 8;
+        d += 8;
+        len -= 8;
+    }
+
+    memcpy(d, s, len);
+    return chksum_fold64(chksum_tail(s, len, sum));
+}
+#endif
+
+/*
+ * Dispatch
+ */
+
+static int chksum_supported(cleanq_chksum_impl_t impl)
+{
+    switch (impl) {
+        case CLEANQ_CHKSUM_LWIP:
+        case CLEANQ_CHKSUM_SCALAR:
+            return 1;
+#ifdef RTE_ARCH_X86
+        case CLEANQ_CHKSUM_SSE:
+            return 1;
+#endif
+#ifdef CLEANQ_CHKSUM_HAVE_AVX2
+        case CLEANQ_CHKSUM_AVX2:
+            return rte_cpu_get_flag_enabled(RTE_CPUFLAG_AVX2) > 0;
+#endif
+        default:
+            return 0;
+    }
+}
+
+int cleanq_chksum_set_impl(cleanq_chksum_impl_t impl)
+{
+    if (!chksum_supported(impl)) {
+        return -1;
+    }
+
+    switch (impl) {
+        case CLEANQ_CHKSUM_LWIP:
+            chksum_fn = chksum_lwip;
+            chksum_copy_fn = chksum_copy_lwip;
+            break;
+#ifdef RTE_ARCH_X86
+        case CLEANQ_CHKSUM_SSE:
+            chksum_fn = chksum_sse;
+            chksum_copy_fn = chksum_copy_sse;
+            break;
+#endif
+#ifdef CLEANQ_CHKSUM_HAVE_AVX2
+        case CLEANQ_CHKSUM_AVX2:
+            chksum_fn = chksum_avx2;
+            chksum_copy_fn = chksum_copy_avx2;
+            break;
+#endif
+        default:
+            chksum_fn = chksum_scalar;
+            chksum_copy_fn = chksum_copy_scalar;
+            break;
+    }
+
+    chksum_impl = impl;
+    return 0;
+}
+
+cleanq_chksum_impl_t cleanq_chksum_get_impl(void)
+{
+    return chksum_impl;
+}
+
+const char* cleanq_chksum_impl_name(cleanq_chksum_impl_t impl)
+{
+    if (impl >= CLEANQ_CHKSUM_MAX) {
+        return "unknown";
+    }
+    return chksum_names[impl];
+}
+
+uint16_t cleanq_chksum(const void* buf, size_t len)
+{
+    return chksum_fn(buf, len);
+}
+
+uint16_t cleanq_chksum_copy(void* dst, const void* src, size_t len)
+{
+    return chksum_copy_fn(dst, src, len);
+}
+
+// pick the widest implementation the CPU supports
+RTE_INIT(cleanq_chksum_init)
+{
+    if (cleanq_chksum_set_impl(CLEANQ_CHKSUM_AVX2) == 0) {
+        return;
+    }
+    if (cleanq_chksum_set_impl(CLEANQ_CHKSUM_SSE) == 0) {
+        return;
+    }
+    cleanq_chksum_set_impl(CLEANQ_CHKSUM_SCALAR);
+}
@@ -0,0 +1,109 @@
+/*
+ * Copyright (c) 2017, ETH Zurich.
+ * All rights reserved.
+ *
+ * This file is distributed under the terms in the attached LICENSE file.
+ * If you do not find this file, copies can be found by writing to:
+ * ETH Zurich D-INFK, Universitätstrasse 4, CH-8092 Zurich. Attn: Systems Group.
+ */
+
+/*
+ * AVX2 checksum kernels, built with -mavx2 and only called if the CPU
+ * supports it (see cleanq_chksum.c)
+ */
+
+#include <stdint.h>
+#include <string.h>
+#include <immintrin.h>
+
+#include <cleanq_chksum.h>
+#include "cleanq_chksum_impl.h"
+
+static inline __m256i chksum_add_avx2(__m256i acc, __m256i v)
+{
+    const __m256i zero = _mm256_setzero_si256();
+    acc = _mm256_add_epi64(acc, _mm256_unpacklo_epi32(v, zero));
+    return _mm256_add_epi64(acc, _mm256_unpackhi_epi32(v, zero));
+}
+
+static inline uint64_t chksum_reduce_avx2(__m256i acc)
+{
+    __m128i v = _mm_add_epi64(_mm256_castsi256_si128(acc),
+                              _mm256_extracti128_si256(acc, 1));
+    return (uint64_t) _mm_cvtsi128_si64(v) +
+           (uint64_t) _mm_cvtsi128_si64(_mm_unpackhi_epi64(v, v));
+}
+
+/* Sums what is left after the 32 byte blocks, less than 32 bytes */
+static inline uint16_t chksum_finish(const uint8_t* p, size_t len, uint64_t sum)
+{
+    uint64_t a;
+
+    while (len >= 8) {
+        memcpy(&a, p, 8);
+        sum += (a & 0xffffffffUL) + (a >> 32);
+        p += 8;
+        len -= 8;
+    }
+
+    return chksum_fold64(chksum_tail(p, len, sum));
+}
+
+uint16_t chksum_avx2(const void* buf, size_t len)
+{
+    const uint8_t* p = buf;
+    __m256i acc0 = _mm256_setzero_si256();
+    __m256i acc1 = _mm256_setzero_si256();
+
+    while (len >= 128) {
+        acc0 = chksum_add_avx2(acc0, _mm256_loadu_si256((const __m256i*) p));
+        acc1 = chksum_add_avx2(acc1, _mm256_loadu_si256((const __m256i*) (p + 32)));
+        acc0 = chksum_add_avx2(acc0, _mm256_loadu_si256((const __m256i*) (p + 64)));
+        acc1 = chksum_add_avx2(acc1, _mm256_loadu_si256((const __m256i*) (p + 96)));
+        p += 128;
+        len -= 128;
+    }
+
+    while (len >= 32) {
+        acc0 = chksum_add_avx2(acc0, _mm256_loadu_si256((const __m256i*) p));
+        p += 32;
+        len -= 32;
+    }
+
+    return chksum_finish(p, len,
+                         chksum_reduce_avx2(_mm256_add_epi64(acc0, acc1)));
+}
+
+uint16_t chksum_copy_avx2(void* dst, const void* src, size_t len)
+{
+    const uint8_t* s = src;
+    uint8_t* d = dst;
+    __m256i acc0 = _mm256_setzero_si256();
+    __m256i acc1 = _mm256_setzero_si256();
+    __m256i v0, v1;
+
+    while (len >= 64) {
+        v0 = _mm256_loadu_si256((const __m256i*) s);
+        v1 = _mm256_loadu_si256((const __m256i*) (s + 32));
+        _mm256_storeu_si256((__m256i*) d, v0);
+        _mm256_storeu_si256((__m256i*) (d + 32), v1);
+        acc0 = chksum_add_avx2(acc0, v0);
+        acc1 = chksum_add_avx2(acc1, v1);
+        s += 64;
+        d += 64;
+        len -= 64;
+    }
+
+    if (len >= 32) {
+        v0 = _mm256_loadu_si256((const __m256i*) s);
+        _mm256_storeu_si256((__m256i*) d, v0);
+        acc0 = chksum_add_avx2(acc0, v0);
+        s += 32;
+        d += 32;
+        len -= 32;
+    }
+
+    memcpy(d, s, len);
+    return chksum_finish(s, len,
+                         chksum_reduce_avx2(_mm256_add_epi64(acc0, acc1)));
+}
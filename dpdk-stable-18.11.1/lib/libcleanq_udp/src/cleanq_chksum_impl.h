@@ -0,0 +1,69 @@
+/*
+ * Copyright (c) 2017 ETH Zurich.
+ * All rights reserved.
+ *
+ * This file is distributed under the terms in the attached LICENSE file.
+ * If you do not find this file, copies can be found by writing to:
+ * ETH Zurich D-INFK, Universitaetstr. 6, CH-8092 Zurich. Attn: Systems Group.
+ */
+#ifndef CLEANQ_CHKSUM_IMPL_H_
+#define CLEANQ_CHKSUM_IMPL_H_ 1
+
+#include <stdint.h>
+#include <string.h>
+
+/*
+ * The vector kernels sum the buffer as 32 bit words into 64 bit
+ * accumulators. Since 2^16 = 1 mod 0xffff that is the same as summing
+ * 16 bit words, the 64 bit sum only has to be folded down at the end.
+ */
+static inline uint16_t chksum_fold64(uint64_t sum)
+{
+    sum = (sum & 0xffffffffUL) + (sum >> 32);
+    sum = (sum & 0xffffffffUL) + (sum >> 32);
+    sum = (sum & 0xffff) + (sum >> 16);
+    sum = (sum & 0xffff) + (sum >> 16);
+    return (uint16_t) sum;
+}
+
+/* Sums the last bytes (less than 8) that do not fill a vector */
+static inline uint64_t chksum_tail(const uint8_t* buf, size_t len, uint64_t sum)
+{
+    uint16_t w;
+    uint32_t d;
+
+    if (len >= 4) {
+        memcpy(&d, buf, 4);
+        sum += d;
+        buf += 4;
+        len -= 4;
+    }
+    if (len >= 2) {
+        memcpy(&w, buf, 2);
+        sum += w;
+        buf += 2;
+        len -= 2;
+    }
+    if (len > 0) {
+        // the odd byte is the first byte of a 16 bit word in memory order
+        w = 0;
+        *(uint8_t*) &w = *buf;
+        sum += w;
+    }
+    return sum;
+}
+
+uint16_t chksum_scalar(const void* buf, size_t len);
+uint16_t chksum_copy_scalar(void* dst, const void* src, size_t len);
+
+#ifdef RTE_ARCH_X86
+uint16_t chksum_sse(const void* buf, size_t len);
+uint16_t chksum_copy_sse(void* dst, const void* src, size_t len);
+#endif
+
+#ifdef CLEANQ_CHKSUM_HAVE_AVX2
+uint16_t chksum_avx2(const void* buf, size_t len);
+uint16_t chksum_copy_avx2(void* dst, const void* src, size_t len);
+#endif
+
+#endif /* CLEANQ_CHKSUM_IMPL_H_ */
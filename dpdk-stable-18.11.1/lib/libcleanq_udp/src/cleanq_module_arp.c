@@ -0,0 +1,989 @@
+/*
+ * Copyright (c) 2017, ETH Zurich.
+ * All rights reserved.
+ *
+ * This file is distributed under the terms in the attached LICENSE file.
+ * If you do not find this file, copies can be found by writing to:
+ * ETH Zurich D-INFK, Universitätstrasse 4, CH-8092 Zurich. Attn: Systems Group.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stddef.h>
+#include <cleanq.h>
+#include <cleanq_module.h>
+#include <cleanq_pkt_headers.h>
+#include <cleanq_arp.h>
+
+#include <arpa/inet.h>
+#include <rte_arp.h>
+#include <rte_cycles.h>
+#include <rte_spinlock.h>
+
+#define MAX_NUM_REGIONS 64
+
+// neighbors per table
+#define ARP_TABLE_BITS 8
+#define ARP_TABLE_SIZE (1 << ARP_TABLE_BITS)
+// RX buffers kept back to send requests with
+#define ARP_NUM_SPARE 4
+// requests and replies on the NIC TX queue
+#define ARP_MAX_INFLIGHT 16
+// packets waiting for their next hop to be resolved
+#define ARP_MAX_PENDING 32
+
+// how often the table and the held packets are looked at
+#define ARP_CHECK_MS 100
+// time between requests to a neighbor that does not answer
+#define ARP_RETRY_MS 1000
+// requests without an answer before a neighbor is given up
+#define ARP_MAX_TRIES 3
+// a resolved neighbor is asked again after this long
+#define ARP_REFRESH_MS 30000
+
+// Ethernet and ARP header, sent padded to the minimum frame size
+#define ARP_PKT_LEN (sizeof(struct ether_hdr) + sizeof(struct arp_hdr))
+#define ARP_FRAME_LEN 60
+
+//#define DEBUG_ENABLED
+
+#if defined(DEBUG_ENABLED)
+#define DEBUG(x...) do { printf("ARP_QUEUE: %s:%d: ", \
+                 __func__, __LINE__); \
+                printf(x);\
+        } while (0)
+
+#else
+#define DEBUG(x...) ((void)0)
+#endif
+
+enum arp_state {
+    ARP_INCOMPLETE = 0,
+    ARP_REACHABLE,
+    ARP_FAILED,
+    ARP_STATIC,
+};
+
+/*
+ * Entries are never freed, so the pointers handed out with
+ * CLEANQ_CTRL_ARP_GET_NEIGHBOR stay valid. Only the MAC word is read
+ * without the table lock.
+ */
+struct arp_entry {
+    struct arp_neigh neigh;
+    uint32_t ip;            // 0 for a free slot
+    uint32_t state;
+    uint32_t tries;         // requests sent since the last answer
+    uint64_t next_request;  // TSC of the next request (or refresh)
+} __rte_cache_aligned;
+
+struct arp_table {
+    struct arp_entry entries[ARP_TABLE_SIZE];
+    rte_spinlock_t lock;
+    uint32_t ip;
+    uint32_t netmask;
+    uint32_t gateway;
+    struct ether_addr mac;
+    uint64_t retry_cycles;
+    uint64_t refresh_cycles;
+    int socket_id;
+};
+
+struct region_vaddr {
+    void* va;
+    regionid_t rid;
+    genoffset_t headroom; // see cleanq_set_region_headroom()
+};
+
+struct arp_pending {
+    struct arp_entry* e;
+    struct cleanq_buf buf;
+};
+
+struct arp_q {
+    struct cleanq rx_q;
+    struct cleanq tx_q;
+    struct cleanq* rx;
+    struct cleanq* tx;
+    struct arp_table* table;
+    uint64_t next_check;
+    uint64_t check_cycles;
+
+    struct cleanq_buf spare[ARP_NUM_SPARE];
+    uint32_t num_spare;
+    struct cleanq_buf inflight[ARP_MAX_INFLIGHT];
+    uint32_t num_inflight;
+    struct arp_pending pending[ARP_MAX_PENDING];
+    uint32_t num_pending;
+    // held packets that could not be resolved, returned as send completions
+    struct cleanq_buf dropped[ARP_MAX_PENDING];
+    uint32_t num_dropped;
+
+    struct region_vaddr regions[MAX_NUM_REGIONS];
+    int socket_id;
+
+    // ARP frames and the spare buffers are not counted, drops are the
+    // packets for neighbors that did not answer
+    struct cleanq_stats rx_stats;
+    struct cleanq_stats tx_stats;
+};
+
+static inline struct arp_q* arp_from_rx(struct cleanq* q)
+{
+    return (struct arp_q*) q;
+}
+
+static inline struct arp_q* arp_from_tx(struct cleanq* q)
+{
+    return (struct arp_q*) ((uint8_t*) q - offsetof(struct arp_q, tx_q));
+}
+
+static inline uint8_t* arp_buf_start(struct arp_q* que, regionid_t rid,
+                                     genoffset_t offset, genoffset_t valid_data)
+{
+    struct region_vaddr* reg = &que->regions[rid % MAX_NUM_REGIONS];
+    return (uint8_t*) reg->va + offset + reg->headroom + valid_data;
+}
+
+/*
+ * Neighbor table
+ */
+
+static inline uint32_t arp_hash(uint32_t ip)
+{
+    return (ip * 2654435761U) >> (32 - ARP_TABLE_BITS);
+}
+
+static struct arp_entry* arp_lookup(struct arp_table* t, uint32_t ip)
+{
+    uint32_t h = arp_hash(ip);
+
+    for (uint32_t i = 0; i < ARP_TABLE_SIZE; i++) {
+        struct arp_entry* e = &t->entries[(h + i) & (ARP_TABLE_SIZE - 1)];
+        uint32_t eip = __atomic_load_n(&e->ip, __ATOMIC_ACQUIRE);
+        if (eip == ip) {
+            return e;
+        }
+        if (eip == 0) {
+            return NULL;
+        }
+    }
+    return NULL;
+}
+
+// table lock held
+static struct arp_entry* arp_insert(struct arp_table* t, uint32_t ip)
+{
+    uint32_t h = arp_hash(ip);
+
+    for (uint32_t i = 0; i < ARP_TABLE_SIZE; i++) {
+        struct arp_entry* e = &t->entries[(h + i) & (ARP_TABLE_SIZE - 1)];
+        if (e->ip == ip) {
+            return e;
+        }
+        if (e->ip == 0) {
+            e->neigh.mac = 0;
+            e->state = ARP_INCOMPLETE;
+            e->tries = 0;
+            e->next_request = 0;
+            // publish the slot last, lookups do not take the lock
+            __atomic_store_n(&e->ip, ip, __ATOMIC_RELEASE);
+            return e;
+        }
+    }
+    return NULL;
+}
+
+static struct arp_entry* arp_get(struct arp_table* t, uint32_t ip)
+{
+    struct arp_entry* e = arp_lookup(t, ip);
+    if (e != NULL) {
+        return e;
+    }
+
+    rte_spinlock_lock(&t->lock);
+    e = arp_insert(t, ip);
+    rte_spinlock_unlock(&t->lock);
+    return e;
+}
+
+static inline void arp_set_mac(struct arp_entry* e, const struct ether_addr* mac)
+{
+    union arp_neigh_mac m = { .raw = 0 };
+    memcpy(m.s.addr, mac, ETHER_ADDR_LEN);
+    m.s.valid = 1;
+    __atomic_store_n(&e->neigh.mac, m.raw, __ATOMIC_RELEASE);
+}
+
+static inline uint32_t arp_next_hop(struct arp_table* t, uint32_t dst_ip)
+{
+    if (t->gateway != 0 && ((dst_ip ^ t->ip) & t->netmask) != 0) {
+        return t->gateway;
+    }
+    return dst_ip;
+}
+
+/*
+ * Own buffers
+ */
+
+// keeps the buffer to send requests with, or gives it back to the NIC
+static void arp_recycle(struct arp_q* que, struct cleanq_buf* buf)
+{
+    if (que->num_spare < ARP_NUM_SPARE) {
+        que->spare[que->num_spare++] = *buf;
+        return;
+    }
+    que->rx->f.enq(que->rx, buf->rid, buf->offset, buf->length,
+                   buf->valid_data, buf->valid_length, NETIF_RXFLAG);
+}
+
+static errval_t arp_send(struct arp_q* que, struct cleanq_buf* buf)
+{
+    errval_t err;
+
+    if (que->num_inflight == ARP_MAX_INFLIGHT) {
+        return CLEANQ_ERR_QUEUE_FULL;
+    }
+
+    buf->valid_length = ARP_FRAME_LEN;
+    buf->flags = NETIF_TXFLAG;
+    err = que->tx->f.enq(que->tx, buf->rid, buf->offset, buf->length,
+                         buf->valid_data, buf->valid_length, buf->flags);
+    if (err_is_ok(err)) {
+        que->inflight[que->num_inflight++] = *buf;
+    }
+    return err;
+}
+
+// returns 1 if a send completion was one of our own packets
+static int arp_reclaim(struct arp_q* que, regionid_t rid, genoffset_t offset)
+{
+    for (uint32_t i = 0; i < que->num_inflight; i++) {
+        if (que->inflight[i].rid == rid && que->inflight[i].offset == offset) {
+            struct cleanq_buf buf = que->inflight[i];
+            que->inflight[i] = que->inflight[--que->num_inflight];
+            arp_recycle(que, &buf);
+            return 1;
+        }
+    }
+    return 0;
+}
+
+static void arp_write(struct arp_table* t, uint8_t* frame, uint16_t op,
+                      const struct ether_addr* dst, const struct ether_addr* tha,
+                      uint32_t tip)
+{
+    struct ether_hdr* eth = (struct ether_hdr*) frame;
+    struct arp_hdr* arp = (struct arp_hdr*) (eth + 1);
+
+    ether_addr_copy(dst, &eth->d_addr);
+    ether_addr_copy(&t->mac, &eth->s_addr);
+    eth->ether_type = htons(ETHER_TYPE_ARP);
+
+    arp->arp_hrd = htons(ARP_HRD_ETHER);
+    arp->arp_pro = htons(ETHER_TYPE_IPv4);
+    arp->arp_hln = ETHER_ADDR_LEN;
+    arp->arp_pln = sizeof(uint32_t);
+    arp->arp_op = htons(op);
+    ether_addr_copy(&t->mac, &arp->arp_data.arp_sha);
+    arp->arp_data.arp_sip = t->ip;
+    ether_addr_copy(tha, &arp->arp_data.arp_tha);
+    arp->arp_data.arp_tip = tip;
+
+    memset(frame + ARP_PKT_LEN, 0, ARP_FRAME_LEN - ARP_PKT_LEN);
+}
+
+// table lock held
+static errval_t arp_request(struct arp_q* que, struct arp_entry* e, uint64_t now)
+{
+    static const struct ether_addr bcast = {
+        .addr_bytes = {0xff, 0xff, 0xff, 0xff, 0xff, 0xff}
+    };
+    static const struct ether_addr zero = { .addr_bytes = {0} };
+    struct cleanq_buf buf;
+    errval_t err;
+
+    // no buffer, tried again at the next check
+    if (que->num_spare == 0) {
+        return CLEANQ_ERR_QUEUE_EMPTY;
+    }
+
+    buf = que->spare[--que->num_spare];
+    arp_write(que->table, arp_buf_start(que, buf.rid, buf.offset, buf.valid_data),
+              ARP_OP_REQUEST, &bcast, &zero, e->ip);
+
+    err = arp_send(que, &buf);
+    if (err_is_fail(err)) {
+        que->spare[que->num_spare++] = buf;
+        return err;
+    }
+
+    DEBUG("request for %x try %d \n", e->ip, e->tries);
+    e->tries++;
+    e->next_request = now + que->table->retry_cycles;
+    return CLEANQ_ERR_OK;
+}
+
+/*
+ * Sends the held packets whose neighbor got resolved and gives the ones
+ * that failed back as send completions.
+ */
+static void arp_flush(struct arp_q* que)
+{
+    uint32_t n = 0;
+
+    for (uint32_t i = 0; i < que->num_pending; i++) {
+        struct arp_pending* p = &que->pending[i];
+        uint64_t mac = arp_neigh_load(&p->e->neigh);
+
+        if (arp_neigh_valid(mac)) {
+            arp_neigh_copy(mac, arp_buf_start(que, p->buf.rid, p->buf.offset,
+                                              p->buf.valid_data));
+            if (err_is_ok(que->tx->f.enq(que->tx, p->buf.rid, p->buf.offset,
+                                         p->buf.length, p->buf.valid_data,
+                                         p->buf.valid_length, p->buf.flags))) {
+                continue;
+            }
+        } else if (p->e->state == ARP_FAILED) {
+            que->dropped[que->num_dropped++] = p->buf;
+            cleanq_stats_drop(&que->tx_stats);
+            continue;
+        }
+
+        // keep it, in order
+        que->pending[n++] = *p;
+    }
+
+    que->num_pending = n;
+}
+
+// table lock held
+static void arp_age(struct arp_q* que, uint64_t now)
+{
+    struct arp_table* t = que->table;
+
+    for (uint32_t i = 0; i < ARP_TABLE_SIZE; i++) {
+        struct arp_entry* e = &t->entries[i];
+
+        if (e->ip == 0 || now < e->next_request) {
+            continue;
+        }
+
+        switch (e->state) {
+            case ARP_INCOMPLETE:
+                // only neighbors something was sent to are asked for
+                if (e->tries == 0) {
+                    break;
+                }
+                /* fall through */
+            case ARP_REACHABLE:
+                if (e->tries >= ARP_MAX_TRIES) {
+                    DEBUG("giving up on %x \n", e->ip);
+                    __atomic_store_n(&e->neigh.mac, 0, __ATOMIC_RELEASE);
+                    e->state = ARP_FAILED;
+                    break;
+                }
+                arp_request(que, e, now);
+                break;
+            default:
+                break;
+        }
+    }
+}
+
+// called on empty RX polls
+static inline void arp_check(struct arp_q* que)
+{
+    uint64_t now = rte_rdtsc();
+
+    if (likely(now < que->next_check)) {
+        return;
+    }
+    que->next_check = now + que->check_cycles;
+
+    // another queue on the same table is at it
+    if (rte_spinlock_trylock(&que->table->lock)) {
+        arp_age(que, now);
+        rte_spinlock_unlock(&que->table->lock);
+    }
+
+    if (que->num_pending > 0) {
+        arp_flush(que);
+    }
+}
+
+/*
+ * Handles a received ARP packet, the buffer is either sent back as reply
+ * or recycled.
+ */
+static void arp_input(struct arp_q* que, struct cleanq_buf* buf)
+{
+    struct arp_table* t = que->table;
+    uint8_t* frame = arp_buf_start(que, buf->rid, buf->offset, buf->valid_data);
+    struct arp_hdr* arp = (struct arp_hdr*) (frame + sizeof(struct ether_hdr));
+    struct arp_entry* e;
+    struct ether_addr sha;
+    uint32_t sip, tip;
+    int resolved = 0;
+
+    if (buf->valid_length < ARP_PKT_LEN ||
+        arp->arp_hrd != htons(ARP_HRD_ETHER) ||
+        arp->arp_pro != htons(ETHER_TYPE_IPv4) ||
+        arp->arp_hln != ETHER_ADDR_LEN || arp->arp_pln != sizeof(uint32_t)) {
+        arp_recycle(que, buf);
+        return;
+    }
+
+    ether_addr_copy(&arp->arp_data.arp_sha, &sha);
+    sip = arp->arp_data.arp_sip;
+    tip = arp->arp_data.arp_tip;
+
+    DEBUG("op %d from %x for %x \n", ntohs(arp->arp_op), sip, tip);
+
+    // update the sender if we know it (or it asks us, we will answer it)
+    if (sip != 0) {
+        rte_spinlock_lock(&t->lock);
+        e = (tip == t->ip) ? arp_insert(t, sip) : arp_lookup(t, sip);
+        if (e != NULL && e->state != ARP_STATIC) {
+            arp_set_mac(e, &sha);
+            e->state = ARP_REACHABLE;
+            e->tries = 0;
+            e->next_request = rte_rdtsc() + t->refresh_cycles;
+            resolved = 1;
+        }
+        rte_spinlock_unlock(&t->lock);
+    }
+
+    if (tip == t->ip && arp->arp_op == htons(ARP_OP_REQUEST)) {
+        // answer in place
+        arp_write(t, frame, ARP_OP_REPLY, &sha, &sha, sip);
+        if (err_is_fail(arp_send(que, buf))) {
+            arp_recycle(que, buf);
+        }
+    } else {
+        arp_recycle(que, buf);
+    }
+
+    if (resolved && que->num_pending > 0) {
+        arp_flush(que);
+    }
+}
+
+/*
+ * Holds a packet whose next hop was not resolved when it was built
+ */
+static errval_t arp_resolve(struct arp_q* que, regionid_t rid,
+                            genoffset_t offset, genoffset_t length,
+                            genoffset_t valid_data, genoffset_t valid_length,
+                            uint64_t flags)
+{
+    struct arp_table* t = que->table;
+    uint8_t* frame = arp_buf_start(que, rid, offset, valid_data);
+    struct ip_hdr* ip = (struct ip_hdr*) (frame + ETH_HLEN);
+    struct arp_entry* e;
+    struct arp_pending* p;
+    uint64_t mac, now;
+
+    if (valid_length < ETH_HLEN + IP_HLEN) {
+        return CLEANQ_ERR_INVALID_BUFFER_ARGS;
+    }
+
+    e = arp_get(t, arp_next_hop(t, ip->dest));
+    if (e == NULL) {
+        return CLEANQ_ERR_QUEUE_FULL;
+    }
+
+    flags &= ~NETIF_TXFLAG_RESOLVE;
+
+    // resolved in the meantime
+    mac = arp_neigh_load(&e->neigh);
+    if (arp_neigh_valid(mac)) {
+        arp_neigh_copy(mac, frame);
+        return que->tx->f.enq(que->tx, rid, offset, length, valid_data,
+                              valid_length, flags);
+    }
+
+    // the dropped ones share the limit until they are dequeued
+    if (que->num_pending + que->num_dropped == ARP_MAX_PENDING) {
+        return CLEANQ_ERR_QUEUE_FULL;
+    }
+
+    p = &que->pending[que->num_pending++];
+    p->e = e;
+    p->buf.rid = rid;
+    p->buf.offset = offset;
+    p->buf.length = length;
+    p->buf.valid_data = valid_data;
+    p->buf.valid_length = valid_length;
+    p->buf.flags = flags;
+
+    now = rte_rdtsc();
+    rte_spinlock_lock(&t->lock);
+    if (e->state == ARP_FAILED) {
+        // try again, someone still wants to talk to it
+        e->state = ARP_INCOMPLETE;
+        e->tries = 0;
+        e->next_request = 0;
+    }
+    if (e->state == ARP_INCOMPLETE && now >= e->next_request) {
+        arp_request(que, e, now);
+    }
+    rte_spinlock_unlock(&t->lock);
+
+    return CLEANQ_ERR_OK;
+}
+
+/*
+ * Queue functions, shared by both sides
+ */
+
+static errval_t arp_register(struct arp_q* que, struct cleanq* nic,
+                             struct capref cap, regionid_t rid)
+{
+    que->regions[rid % MAX_NUM_REGIONS].va = cap.vaddr;
+    que->regions[rid % MAX_NUM_REGIONS].rid = rid;
+    que->regions[rid % MAX_NUM_REGIONS].headroom = 0;
+
+    // let the NIC queues know the region so they can validate buffers of it
+    cleanq_add_region(que->tx, cap, rid);
+    if (que->rx != que->tx) {
+        cleanq_add_region(que->rx, cap, rid);
+    }
+
+    return nic->f.reg(nic, cap, rid);
+}
+
+static errval_t arp_deregister(struct arp_q* que, struct cleanq* nic,
+                               regionid_t rid)
+{
+    errval_t err;
+
+    que->regions[rid % MAX_NUM_REGIONS].va = NULL;
+    que->regions[rid % MAX_NUM_REGIONS].rid = 0;
+    err = nic->f.dereg(nic, rid);
+    if (err_is_fail(err)) {
+        return err;
+    }
+    if (que->rx != que->tx) {
+        cleanq_remove_region(nic == que->tx ? que->rx : que->tx, rid);
+    }
+    return cleanq_remove_region(nic, rid);
+}
+
+static errval_t arp_control(struct arp_q* que, struct cleanq* nic,
+                            uint64_t cmd, uint64_t value, uint64_t* result)
+{
+    if (cmd == CLEANQ_CTRL_ARP_GET_NEIGHBOR) {
+        struct arp_entry* e = arp_get(que->table,
+                                      arp_next_hop(que->table, (uint32_t) value));
+        if (e == NULL) {
+            return CLEANQ_ERR_QUEUE_FULL;
+        }
+        *result = (uint64_t) (uintptr_t) &e->neigh;
+        return CLEANQ_ERR_OK;
+    }
+
+    if (cmd == CLEANQ_CTRL_SET_VALIDATION) {
+        return cleanq_set_validation(nic, (cleanq_validation_t) value);
+    }
+
+    if (cmd == CLEANQ_CTRL_SET_REGION_HEADROOM) {
+        regionid_t rid = CLEANQ_CTRL_REGION_HEADROOM_RID(value);
+        struct region_vaddr* reg = &que->regions[rid % MAX_NUM_REGIONS];
+        if (reg->va == NULL || reg->rid != rid) {
+            return CLEANQ_ERR_INVALID_REGION_ID;
+        }
+        reg->headroom = CLEANQ_CTRL_REGION_HEADROOM_LEN(value);
+        return cleanq_set_region_headroom(nic, rid,
+                                          CLEANQ_CTRL_REGION_HEADROOM_LEN(value));
+    }
+
+    if (nic->f.ctrl == NULL) {
+        return CLEANQ_ERR_INVALID_CTRL;
+    }
+    return nic->f.ctrl(nic, cmd, value, result);
+}
+
+static errval_t arp_enqueue(struct arp_q* que, regionid_t rid,
+                            genoffset_t offset, genoffset_t length,
+                            genoffset_t valid_data, genoffset_t valid_length,
+                            uint64_t flags)
+{
+    if (flags & NETIF_TXFLAG) {
+        if (!cleanq_buffer_valid_inner(que->tx, rid, offset, length,
+                                       valid_data, valid_length)) {
+            return CLEANQ_ERR_INVALID_BUFFER_ARGS;
+        }
+
+        if (likely(!(flags & NETIF_TXFLAG_RESOLVE))) {
+            return que->tx->f.enq(que->tx, rid, offset, length, valid_data,
+                                  valid_length, flags);
+        }
+        return arp_resolve(que, rid, offset, length, valid_data, valid_length,
+                           flags);
+    }
+
+    if (flags & NETIF_RXFLAG) {
+        if (!cleanq_buffer_valid_inner(que->rx, rid, offset, length,
+                                       valid_data, valid_length)) {
+            return CLEANQ_ERR_INVALID_BUFFER_ARGS;
+        }
+
+        // keep a few buffers to send requests with
+        if (unlikely(que->num_spare < ARP_NUM_SPARE) &&
+            length >= que->regions[rid % MAX_NUM_REGIONS].headroom +
+                      valid_data + ARP_FRAME_LEN) {
+            struct cleanq_buf* buf = &que->spare[que->num_spare++];
+            buf->rid = rid;
+            buf->offset = offset;
+            buf->length = length;
+            buf->valid_data = valid_data;
+            buf->valid_length = valid_length;
+            buf->flags = flags;
+            return CLEANQ_ERR_OK;
+        }
+
+        return que->rx->f.enq(que->rx, rid, offset, length, valid_data,
+                              valid_length, flags);
+    }
+
+    return CLEANQ_ERR_UNKNOWN_FLAG;
+}
+
+/*
+ * Receive side
+ */
+
+static errval_t arp_rx_register(struct cleanq* q, struct capref cap,
+                                regionid_t rid)
+{
+    struct arp_q* que = arp_from_rx(q);
+    return arp_register(que, que->rx, cap, rid);
+}
+
+static errval_t arp_rx_deregister(struct cleanq* q, regionid_t rid)
+{
+    struct arp_q* que = arp_from_rx(q);
+    return arp_deregister(que, que->rx, rid);
+}
+
+static errval_t arp_rx_control(struct cleanq* q, uint64_t cmd, uint64_t value,
+                               uint64_t* result)
+{
+    struct arp_q* que = arp_from_rx(q);
+    if (cmd == CLEANQ_CTRL_GET_STATS) {
+        return cleanq_stats_control(&que->rx_stats, result);
+    }
+    return arp_control(que, que->rx, cmd, value, result);
+}
+
+static errval_t arp_rx_notify(struct cleanq* q)
+{
+    struct arp_q* que = arp_from_rx(q);
+    return que->rx->f.notify(que->rx);
+}
+
+static errval_t arp_rx_enqueue(struct cleanq* q, regionid_t rid,
+                               genoffset_t offset, genoffset_t length,
+                               genoffset_t valid_data, genoffset_t valid_length,
+                               uint64_t flags)
+{
+    errval_t err;
+    struct arp_q* que = arp_from_rx(q);
+
+    err = arp_enqueue(que, rid, offset, length, valid_data, valid_length,
+                      flags);
+    cleanq_stats_enq(&que->rx_stats, err, valid_length);
+    return err;
+}
+
+static errval_t arp_rx_dequeue(struct cleanq* q, regionid_t* rid,
+                               genoffset_t* offset, genoffset_t* length,
+                               genoffset_t* valid_data,
+                               genoffset_t* valid_length, uint64_t* flags)
+{
+    errval_t err;
+    struct arp_q* que = arp_from_rx(q);
+
+    for (;;) {
+        err = que->rx->f.deq(que->rx, rid, offset, length, valid_data,
+                             valid_length, flags);
+        if (err == CLEANQ_ERR_QUEUE_EMPTY) {
+            que->rx_stats.empty++;
+            arp_check(que);
+            return err;
+        }
+        if (err_is_fail(err)) {
+            return err;
+        }
+
+        if (!cleanq_buffer_valid_inner(que->rx, *rid, *offset, *length,
+                                       *valid_data, *valid_length)) {
+            que->rx_stats.invalid++;
+            return CLEANQ_ERR_INVALID_BUFFER_ARGS;
+        }
+
+        // runts are passed up, the IP, UDP and UDP/IP queues on top
+        // check the length before parsing and drop them
+        struct ether_hdr* eth = (struct ether_hdr*)
+                                arp_buf_start(que, *rid, *offset, *valid_data);
+        if (unlikely(*valid_length < sizeof(struct ether_hdr)) ||
+            likely(eth->ether_type != htons(ETHER_TYPE_ARP))) {
+            cleanq_stats_deq(&que->rx_stats, CLEANQ_ERR_OK, *valid_length);
+            return CLEANQ_ERR_OK;
+        }
+
+        struct cleanq_buf buf = {
+            .offset = *offset,
+            .length = *length,
+            .valid_data = *valid_data,
+            .valid_length = *valid_length,
+            .flags = *flags,
+            .rid = *rid,
+        };
+        arp_input(que, &buf);
+    }
+}
+
+/*
+ * Send side
+ */
+
+static errval_t arp_tx_register(struct cleanq* q, struct capref cap,
+                                regionid_t rid)
+{
+    struct arp_q* que = arp_from_tx(q);
+    return arp_register(que, que->tx, cap, rid);
+}
+
+static errval_t arp_tx_deregister(struct cleanq* q, regionid_t rid)
+{
+    struct arp_q* que = arp_from_tx(q);
+    return arp_deregister(que, que->tx, rid);
+}
+
+static errval_t arp_tx_control(struct cleanq* q, uint64_t cmd, uint64_t value,
+                               uint64_t* result)
+{
+    struct arp_q* que = arp_from_tx(q);
+    if (cmd == CLEANQ_CTRL_GET_STATS) {
+        return cleanq_stats_control(&que->tx_stats, result);
+    }
+    return arp_control(que, que->tx, cmd, value, result);
+}
+
+static errval_t arp_tx_notify(struct cleanq* q)
+{
+    struct arp_q* que = arp_from_tx(q);
+    return que->tx->f.notify(que->tx);
+}
+
+static errval_t arp_tx_enqueue(struct cleanq* q, regionid_t rid,
+                               genoffset_t offset, genoffset_t length,
+                               genoffset_t valid_data, genoffset_t valid_length,
+                               uint64_t flags)
+{
+    errval_t err;
+    struct arp_q* que = arp_from_tx(q);
+
+    err = arp_enqueue(que, rid, offset, length, valid_data, valid_length,
+                      flags);
+    cleanq_stats_enq(&que->tx_stats, err, valid_length);
+    return err;
+}
+
+static errval_t arp_tx_dequeue(struct cleanq* q, regionid_t* rid,
+                               genoffset_t* offset, genoffset_t* length,
+                               genoffset_t* valid_data,
+                               genoffset_t* valid_length, uint64_t* flags)
+{
+    errval_t err;
+    struct arp_q* que = arp_from_tx(q);
+
+    if (unlikely(que->num_dropped > 0)) {
+        struct cleanq_buf* buf = &que->dropped[--que->num_dropped];
+        *rid = buf->rid;
+        *offset = buf->offset;
+        *length = buf->length;
+        *valid_data = buf->valid_data;
+        *valid_length = buf->valid_length;
+        *flags = buf->flags;
+        cleanq_stats_deq(&que->tx_stats, CLEANQ_ERR_OK, buf->valid_length);
+        return CLEANQ_ERR_OK;
+    }
+
+    for (;;) {
+        err = que->tx->f.deq(que->tx, rid, offset, length, valid_data,
+                             valid_length, flags);
+        if (err_is_fail(err)) {
+            if (err == CLEANQ_ERR_QUEUE_EMPTY) {
+                que->tx_stats.empty++;
+            }
+            return err;
+        }
+
+        if (!cleanq_buffer_valid_inner(que->tx, *rid, *offset, *length,
+                                       *valid_data, *valid_length)) {
+            que->tx_stats.invalid++;
+            return CLEANQ_ERR_INVALID_BUFFER_ARGS;
+        }
+
+        if (likely(que->num_inflight == 0) ||
+            !arp_reclaim(que, *rid, *offset)) {
+            cleanq_stats_deq(&que->tx_stats, CLEANQ_ERR_OK, *valid_length);
+            return CLEANQ_ERR_OK;
+        }
+    }
+}
+
+/*
+ * Public functions
+ *
+ */
+
+errval_t arp_table_create(struct arp_table** t, uint32_t ip, uint32_t netmask,
+                          uint32_t gateway, struct ether_addr* mac,
+                          int socket_id)
+{
+    struct arp_table* table;
+
+    table = cleanq_malloc_socket(sizeof(struct arp_table), socket_id);
+    if (table == NULL) {
+        return CLEANQ_ERR_MALLOC_FAIL;
+    }
+
+    rte_spinlock_init(&table->lock);
+    table->ip = ip;
+    table->netmask = netmask;
+    table->gateway = gateway;
+    ether_addr_copy(mac, &table->mac);
+    table->retry_cycles = rte_get_tsc_hz() * ARP_RETRY_MS / 1000;
+    table->refresh_cycles = rte_get_tsc_hz() * ARP_REFRESH_MS / 1000;
+    table->socket_id = socket_id;
+
+    *t = table;
+    return CLEANQ_ERR_OK;
+}
+
+errval_t arp_table_destroy(struct arp_table* t)
+{
+    cleanq_free_socket(t, t->socket_id);
+    return CLEANQ_ERR_OK;
+}
+
+errval_t arp_table_add_static(struct arp_table* t, uint32_t ip,
+                              struct ether_addr* mac)
+{
+    struct arp_entry* e;
+
+    rte_spinlock_lock(&t->lock);
+    e = arp_insert(t, ip);
+    if (e != NULL) {
+        arp_set_mac(e, mac);
+        e->state = ARP_STATIC;
+    }
+    rte_spinlock_unlock(&t->lock);
+
+    return (e == NULL) ? CLEANQ_ERR_QUEUE_FULL : CLEANQ_ERR_OK;
+}
+
+errval_t arp_create(struct arp_q** q, struct arp_table* t,
+                    struct cleanq* nic_rx, struct cleanq* nic_tx,
+                    int socket_id)
+{
+    errval_t err;
+    struct arp_q* que;
+
+    que = cleanq_malloc_socket(sizeof(struct arp_q), socket_id);
+    if (que == NULL) {
+        return CLEANQ_ERR_MALLOC_FAIL;
+    }
+
+    que->socket_id = socket_id;
+
+    err = cleanq_init_socket(&que->rx_q, socket_id);
+    if (err_is_fail(err)) {
+        cleanq_free_socket(que, socket_id);
+        return err;
+    }
+
+    err = cleanq_init_socket(&que->tx_q, socket_id);
+    if (err_is_fail(err)) {
+        cleanq_free_socket(que, socket_id);
+        return err;
+    }
+
+    que->rx = nic_rx;
+    que->tx = nic_tx;
+    que->table = t;
+    que->check_cycles = rte_get_tsc_hz() * ARP_CHECK_MS / 1000;
+
+    que->rx_q.f.reg = arp_rx_register;
+    que->rx_q.f.dereg = arp_rx_deregister;
+    que->rx_q.f.ctrl = arp_rx_control;
+    que->rx_q.f.notify = arp_rx_notify;
+    que->rx_q.f.enq = arp_rx_enqueue;
+    que->rx_q.f.deq = arp_rx_dequeue;
+
+    que->tx_q.f.reg = arp_tx_register;
+    que->tx_q.f.dereg = arp_tx_deregister;
+    que->tx_q.f.ctrl = arp_tx_control;
+    que->tx_q.f.notify = arp_tx_notify;
+    que->tx_q.f.enq = arp_tx_enqueue;
+    que->tx_q.f.deq = arp_tx_dequeue;
+
+    *q = que;
+    return CLEANQ_ERR_OK;
+}
+
+errval_t arp_destroy(struct arp_q* q)
+{
+    // the held packets are given up on and handed back as send completions
+    for (uint32_t i = 0; i < q->num_pending; i++) {
+        q->dropped[q->num_dropped++] = q->pending[i].buf;
+        cleanq_stats_drop(&q->tx_stats);
+    }
+    q->num_pending = 0;
+
+    if (q->num_dropped > 0 || q->num_inflight > 0) {
+        return CLEANQ_ERR_BUFFER_ALREADY_IN_USE;
+    }
+
+    // the spare buffers go back to the NIC to receive into
+    for (uint32_t i = 0; i < q->num_spare; i++) {
+        struct cleanq_buf* buf = &q->spare[i];
+        q->rx->f.enq(q->rx, buf->rid, buf->offset, buf->length,
+                     buf->valid_data, buf->valid_length, NETIF_RXFLAG);
+    }
+    q->num_spare = 0;
+
+    cleanq_free_socket(q, q->socket_id);
+    return CLEANQ_ERR_OK;
+}
+
+struct cleanq* arp_get_rx(struct arp_q* q)
+{
+    return &q->rx_q;
+}
+
+struct cleanq* arp_get_tx(struct arp_q* q)
+{
+    return &q->tx_q;
+}
+
+const struct arp_neigh* arp_neigh_query(struct cleanq* q, uint32_t dst_ip)
+{
+    uint64_t result = 0;
+
+    // NIC queues have no control function
+    if (q->f.ctrl == NULL) {
+        return NULL;
+    }
+
+    if (err_is_fail(q->f.ctrl(q, CLEANQ_CTRL_ARP_GET_NEIGHBOR, dst_ip,
+                              &result)) || result == 0) {
+        return NULL;
+    }
+    return (const struct arp_neigh*) (uintptr_t) result;
+}
@@ -12,13 +12,16 @@
 #include <stdbool.h>
 #include <cleanq.h>
 #include <cleanq_module.h>
+#include <cleanq_static.h>
 #include <cleanq_bench.h>
 #include <cleanq_ip.h>
 #include <cleanq_pkt_headers.h>
+#include <cleanq_arp.h>
 
 #include <arpa/inet.h>
 #include <rte_ip.h>
 #include "inet_chksum.h"
+#include "cleanq_nic_static.h"
 
 #define MAX_NUM_REGIONS 64
 
@@ -37,6 +40,7 @@
 struct region_vaddr {
     void* va;
     regionid_t rid;
+    genoffset_t headroom; // see cleanq_set_region_headroom()
 };
 
 struct pkt_ip_headers {
@@ -53,8 +57,14 @@ struct ip_q {
     uint16_t hdr_len;
     uint8_t proto;
     uint64_t pkt_id;	
+    int socket_id;
+    // next hop if there is an ARP queue below, and its MAC in the header
+    const struct arp_neigh* neigh;
+    uint64_t neigh_mac;
 
     const char* name;
+    // both directions, drops are the checksum, address and protocol checks
+    struct cleanq_stats stats;
 #ifdef BENCH
     bench_ctl_t en_rx;
     bench_ctl_t en_tx;
@@ -90,9 +100,17 @@ static errval_t ip_register(struct cleanq* q, struct capref cap,
     // dont have to map it, just store va
     que->regions[rid % MAX_NUM_REGIONS].va = cap.vaddr;
     que->regions[rid % MAX_NUM_REGIONS].rid = rid;
+    que->regions[rid % MAX_NUM_REGIONS].headroom = 0;
     DEBUG("id-%d va-%p \n", que->regions[rid % MAX_NUM_REGIONS].rid, 
           que->regions[rid % MAX_NUM_REGIONS].va);
 	
+    // let the NIC queues know the region so they can validate buffers of it,
+    // fails if they already use the id for the same memory which is fine
+    cleanq_add_region(que->tx, cap, rid);
+    if (que->rx != que->tx) {
+        cleanq_add_region(que->rx, cap, rid);
+    }
+
     err = que->tx->f.reg(que->tx, cap, rid);
     if (err_is_fail(err)) {
 	printf("IP register TX adding region failed \n");
@@ -119,6 +137,9 @@ static errval_t ip_deregister(struct cleanq* q, regionid_t rid)
     if (err_is_fail(err)) {
         return err;
     }
+    if (que->rx != que->tx) {
+        cleanq_remove_region(que->tx, rid);
+    }
     err = cleanq_remove_region(que->rx, rid);
     return err;
 }
@@ -127,7 +148,37 @@ static errval_t ip_deregister(struct cleanq* q, regionid_t rid)
 static errval_t ip_control(struct cleanq* q, uint64_t cmd, uint64_t value,
                            uint64_t* result)
 {
+    errval_t err;
     struct ip_q* que = (struct ip_q*) q;
+
+    if (cmd == CLEANQ_CTRL_GET_STATS) {
+        return cleanq_stats_control(&que->stats, result);
+    }
+
+    if (cmd == CLEANQ_CTRL_SET_VALIDATION) {
+        err = cleanq_set_validation(que->rx, (cleanq_validation_t) value);
+        if (err_is_fail(err)) {
+            return err;
+        }
+        return cleanq_set_validation(que->tx, (cleanq_validation_t) value);
+    }
+
+    if (cmd == CLEANQ_CTRL_SET_REGION_HEADROOM) {
+        regionid_t rid = CLEANQ_CTRL_REGION_HEADROOM_RID(value);
+        struct region_vaddr* reg = &que->regions[rid % MAX_NUM_REGIONS];
+        if (reg->va == NULL || reg->rid != rid) {
+            return CLEANQ_ERR_INVALID_REGION_ID;
+        }
+        reg->headroom = CLEANQ_CTRL_REGION_HEADROOM_LEN(value);
+        err = cleanq_set_region_headroom(que->tx, rid,
+                                         CLEANQ_CTRL_REGION_HEADROOM_LEN(value));
+        if (err_is_fail(err) || que->rx == que->tx) {
+            return err;
+        }
+        return cleanq_set_region_headroom(que->rx, rid,
+                                          CLEANQ_CTRL_REGION_HEADROOM_LEN(value));
+    }
+
     return que->rx->f.ctrl(que->rx, cmd, value, result);
 }
 
@@ -138,7 +189,7 @@ static errval_t ip_notify(struct cleanq* q)
     return que->rx->f.notify(que->rx);
 }
 
-static errval_t ip_enqueue(struct cleanq* q, regionid_t rid, 
+errval_t ip_enqueue(struct cleanq* q, regionid_t rid, 
                            genoffset_t offset, genoffset_t length,
                            genoffset_t valid_data, genoffset_t valid_length,
                            uint64_t flags)
@@ -147,10 +198,20 @@ static errval_t ip_enqueue(struct cleanq* q, regionid_t rid,
     // for now limit length
     //  TODO fragmentation
     struct ip_q* que = (struct ip_q*) q;
+    errval_t err;
+
     if (flags & NETIF_TXFLAG) {
         
         DEBUG("TX rid: %d offset %ld length %ld valid_length %ld valid_ata %ld \n", 
               rid, offset, length, valid_length, valid_data);
+
+        // before the header is updated and written to the buffer
+        if (!cleanq_buffer_valid_inner(que->tx, rid, offset, length,
+                                       valid_data, valid_length)) {
+            que->stats.invalid++;
+            return CLEANQ_ERR_INVALID_BUFFER_ARGS;
+        }
+
         //que->header.ip._len = htons(valid_length + IP_HLEN);   
         que->header.ip._len = htons(valid_length - ETH_HLEN);   
     	que->pkt_id++;
@@ -158,17 +219,27 @@ static errval_t ip_enqueue(struct cleanq* q, regionid_t rid,
         que->header.ip._chksum = 0;
         que->header.ip._chksum = rte_ipv4_cksum((struct ipv4_hdr*) &que->header.ip);
 
+        if (que->neigh != NULL) {
+            uint64_t mac = arp_neigh_load(que->neigh);
+            if (unlikely(mac != que->neigh_mac)) {
+                arp_neigh_copy(mac, &que->header.eth.dest);
+                que->neigh_mac = mac;
+            }
+            if (unlikely(!arp_neigh_valid(mac))) {
+                flags |= NETIF_TXFLAG_RESOLVE;
+            }
+        }
 
         assert(que->regions[rid % MAX_NUM_REGIONS].va != NULL);
 
-        uint8_t* start = (uint8_t*) que->regions[rid % MAX_NUM_REGIONS].va + 
-                         offset + valid_data + 128;   
+        struct region_vaddr* reg = &que->regions[rid % MAX_NUM_REGIONS];
+        uint8_t* start = (uint8_t*) reg->va + offset + reg->headroom +
+                         valid_data;
 
         memcpy(start, &que->header, sizeof(que->header));   
 
 #ifdef BENCH
         uint64_t b_start, b_end;
-        errval_t err;
             
         b_start = rdtscp();
         err = que->tx->f.enq(que->q, rid, offset, length, valid_data, 
@@ -178,42 +249,49 @@ static errval_t ip_enqueue(struct cleanq* q, regionid_t rid,
             uint64_t res = b_end - b_start;
             bench_ctl_add_run(&que->en_tx, &res);
         }
-        return err;
 #else
-        return que->tx->f.enq(que->tx, rid, offset, length, valid_data, 
-                             valid_length, flags);
+        err = NIC_TX_ENQ(que->tx, rid, offset, length, valid_data, 
+                         valid_length, flags);
 #endif
+        cleanq_stats_enq(&que->stats, err, valid_length);
+        return err;
     } 
 
     if (flags & NETIF_RXFLAG) {
         assert(valid_length <= 2048);    
         DEBUG("RX rid: %d offset %ld length %ld valid_length %ld \n", rid, offset, 
               length, valid_length);
+        if (!cleanq_buffer_valid_inner(que->rx, rid, offset, length,
+                                       valid_data, valid_length)) {
+            que->stats.invalid++;
+            return CLEANQ_ERR_INVALID_BUFFER_ARGS;
+        }
 #ifdef BENCH
         uint64_t start, end;
-        errval_t err;
             
         start = rdtscp();
-        err = que->rx->f.enq(que->rx, rid, offset, length, valid_data, 
+        err = NIC_RX_ENQ(que->rx, rid, offset, length, valid_data, 
                              valid_length, flags);
         end = rdtscp();
         if (err_is_ok(err)) {
             uint64_t res = end - start;
             bench_ctl_add_run(&que->en_rx, &res);
         }
-        return err;
 #else
-        return que->rx->f.enq(que->rx, rid, offset, length, valid_data, 
-                             valid_length, flags);
+        err = NIC_RX_ENQ(que->rx, rid, offset, length, valid_data, 
+                         valid_length, flags);
 #endif
+        cleanq_stats_enq(&que->stats, err, valid_length);
+        return err;
     } 
 
+    que->stats.invalid++;
     return CLEANQ_ERR_UNKNOWN_FLAG;
 }
 
-static errval_t ip_dequeue(struct cleanq* q, regionid_t* rid, genoffset_t* offset,
-                           genoffset_t* length, genoffset_t* valid_data,
-                           genoffset_t* valid_length, uint64_t* flags)
+errval_t ip_dequeue_rx(struct cleanq* q, regionid_t* rid, genoffset_t* offset,
+                       genoffset_t* length, genoffset_t* valid_data,
+                       genoffset_t* valid_length, uint64_t* flags)
 {
     errval_t err;
     struct ip_q* que = (struct ip_q*) q;
@@ -221,96 +299,144 @@ static errval_t ip_dequeue(struct cleanq* q, regionid_t* rid, genoffset_t* offse
 #ifdef BENCH
     uint64_t start, end;
     start = rdtscp();
-    err = que->rx->f.deq(que->rx, rid, offset, length, valid_data, valid_length, flags);
+#endif
+    err = NIC_RX_DEQ(que->rx, rid, offset, length, valid_data, valid_length, flags);
+#ifdef BENCH
     end = rdtscp();
+#endif
     if (err_is_fail(err)) {  
-    	start = rdtscp();
-    	err = que->tx->f.deq(que->tx, rid, offset, length, valid_data, valid_length, flags);
-    	end = rdtscp();
-	if (err_is_fail(err)) {
-	   return err;
-	}
+        if (err == CLEANQ_ERR_QUEUE_EMPTY) {
+            que->stats.empty++;
+        }
         return err;
     }
-#else
-    err = que->rx->f.deq(que->rx, rid, offset, length, valid_data, valid_length, flags);
-    if (err_is_fail(err)) {  
-    	err = que->tx->f.deq(que->tx, rid, offset, length, valid_data, valid_length, flags);
-	if (err_is_fail(err)) {
-	   return err;
-	}
-    	*flags |= NETIF_TXFLAG;
-    } else {
-    	*flags |= NETIF_RXFLAG;
+    *flags |= NETIF_RXFLAG;
+
+    if (!cleanq_buffer_valid_inner(que->rx, *rid, *offset, *length,
+                                   *valid_data, *valid_length)) {
+        que->stats.invalid++;
+        return CLEANQ_ERR_INVALID_BUFFER_ARGS;
     }
-#endif
 
-    if (*flags & NETIF_RXFLAG) {
-        DEBUG("RX rid: %d offset %ld valid_data %ld length %ld va %p \n", *rid, 
-              *offset, *valid_data, 
-              *valid_length, ((uint8_t*)que->regions[*rid % MAX_NUM_REGIONS].va) + *offset + *valid_data);
+    DEBUG("RX rid: %d offset %ld valid_data %ld length %ld va %p \n", *rid, 
+          *offset, *valid_data, 
+          *valid_length, ((uint8_t*)que->regions[*rid % MAX_NUM_REGIONS].va) + *offset + *valid_data);
+
+    if (*valid_length < ETH_HLEN + IP_HLEN) {
+        DEBUG("IP queue: dropping runt of %ld bytes\n", *valid_length);
+        err = NIC_RX_ENQ(que->rx, *rid, *offset, *length, *valid_data,
+                         *valid_length, NETIF_RXFLAG);
+        cleanq_stats_drop(&que->stats);
+        return CLEANQ_ERR_INVALID_BUFFER_ARGS;
+    }
 
-        struct pkt_ip_headers* header = (struct pkt_ip_headers*) 
-                                        (((uint8_t*) que->regions[*rid % MAX_NUM_REGIONS].va) +
-                                         *offset + *valid_data + 128);
+    struct region_vaddr* reg = &que->regions[*rid % MAX_NUM_REGIONS];
+    struct pkt_ip_headers* header = (struct pkt_ip_headers*) 
+                                    ((uint8_t*) reg->va + *offset + reg->headroom +
+                                     *valid_data);
  
-        // IP checksum
-	uint16_t chksum = header->ip._chksum;
-	header->ip._chksum = 0;
-	header->ip._chksum = rte_ipv4_cksum((const struct ipv4_hdr *) &header->ip);
-	//uint16_t chksum = inet_chksum(&(header->ip), IP_HLEN);
-        if (header->ip._chksum != chksum) {
-            DEBUG("IP queue: dropping packet wrong checksum is %x should be %x\n",
-	          header->ip._chksum, chksum);
-            err = que->rx->f.enq(que->rx, *rid, *offset, *length, *valid_data, *valid_length, 
-                                 NETIF_RXFLAG);
-            return CLEANQ_ERR_IP_CHKSUM;
-        }
+    // IP checksum
+    uint16_t chksum = header->ip._chksum;
+    header->ip._chksum = 0;
+    header->ip._chksum = rte_ipv4_cksum((const struct ipv4_hdr *) &header->ip);
+    //uint16_t chksum = inet_chksum(&(header->ip), IP_HLEN);
+    if (header->ip._chksum != chksum) {
+        DEBUG("IP queue: dropping packet wrong checksum is %x should be %x\n",
+              header->ip._chksum, chksum);
+        err = NIC_RX_ENQ(que->rx, *rid, *offset, *length, *valid_data, *valid_length, 
+                         NETIF_RXFLAG);
+        cleanq_stats_drop_err(&que->stats, CLEANQ_ERR_IP_CHKSUM);
+        return CLEANQ_ERR_IP_CHKSUM;
+    }
 
-        // Correct ip for this queue?
-        if (header->ip.src != que->header.ip.dest) {
-            DEBUG("IP queue: dropping packet, wrong IP is %d should be %d\n",
-                  header->ip.src, que->header.ip.dest);
-            err = que->rx->f.enq(que->rx, *rid, *offset, *length, *valid_data, 
-			    	 *valid_length, NETIF_RXFLAG);
-            return CLEANQ_ERR_IP_WRONG_IP;
-        }
+    // Correct ip for this queue?
+    if (header->ip.src != que->header.ip.dest) {
+        DEBUG("IP queue: dropping packet, wrong IP is %d should be %d\n",
+              header->ip.src, que->header.ip.dest);
+        err = NIC_RX_ENQ(que->rx, *rid, *offset, *length, *valid_data, 
+                         *valid_length, NETIF_RXFLAG);
+        cleanq_stats_drop_err(&que->stats, CLEANQ_ERR_IP_WRONG_IP);
+        return CLEANQ_ERR_IP_WRONG_IP;
+    }
         
-	if (header->ip._proto != que->proto) {
-            DEBUG("IP queue: dropping packet wrong protocol is %d should be %d \n", 
-                  header->ip._proto, que->proto);
-	  
-            err = que->rx->f.enq(que->rx, *rid, *offset, *length, *valid_data, 
-			    	 *valid_length, NETIF_RXFLAG);
-            return CLEANQ_ERR_IP_WRONG_PROTO;
-	}
+    if (header->ip._proto != que->proto) {
+        DEBUG("IP queue: dropping packet wrong protocol is %d should be %d \n", 
+              header->ip._proto, que->proto);
+        err = NIC_RX_ENQ(que->rx, *rid, *offset, *length, *valid_data, 
+                         *valid_length, NETIF_RXFLAG);
+        cleanq_stats_drop_err(&que->stats, CLEANQ_ERR_IP_WRONG_PROTO);
+        return CLEANQ_ERR_IP_WRONG_PROTO;
+    }
 #ifdef DEBUG_ENABLED
-        print_buffer(que, que->regions[*rid % MAX_NUM_REGIONS].va + *offset, *valid_length);
+    print_buffer(que, que->regions[*rid % MAX_NUM_REGIONS].va + *offset, *valid_length);
 #endif
 
-        //*valid_data += IP_HLEN + ETH_HLEN + 128;
-        //*valid_length = ntohs(header->ip._len) - IP_HLEN;
-        //print_buffer(que, que->regions[*rid % MAX_NUM_REGIONS].va + *offset+ *valid_data, *valid_length);
-        //
+    //*valid_data += IP_HLEN + ETH_HLEN;
+    //*valid_length = ntohs(header->ip._len) - IP_HLEN;
+
+#ifdef BENCH
+    uint64_t res = end - start;
+    bench_ctl_add_run(&que->deq_rx, &res);
+#endif
+    cleanq_stats_deq(&que->stats, CLEANQ_ERR_OK, *valid_length);
+    return CLEANQ_ERR_OK;
+}
+
+errval_t ip_dequeue_tx(struct cleanq* q, regionid_t* rid, genoffset_t* offset,
+                       genoffset_t* length, genoffset_t* valid_data,
+                       genoffset_t* valid_length, uint64_t* flags)
+{
+    errval_t err;
+    struct ip_q* que = (struct ip_q*) q;
 
 #ifdef BENCH
-        uint64_t res = end - start;
-        bench_ctl_add_run(&que->deq_rx, &res);
+    uint64_t start, end;
+    start = rdtscp();
+#endif
+    err = NIC_TX_DEQ(que->tx, rid, offset, length, valid_data, valid_length, flags);
+#ifdef BENCH
+    end = rdtscp();
 #endif
-        return CLEANQ_ERR_OK;
+    if (err_is_fail(err)) {
+        if (err == CLEANQ_ERR_QUEUE_EMPTY) {
+            que->stats.empty++;
+        }
+        return err;
+    }
+    *flags |= NETIF_TXFLAG;
+
+    if (!cleanq_buffer_valid_inner(que->tx, *rid, *offset, *length,
+                                   *valid_data, *valid_length)) {
+        que->stats.invalid++;
+        return CLEANQ_ERR_INVALID_BUFFER_ARGS;
     }
 
     DEBUG("TX rid: %d offset %ld length %ld \n", *rid, *offset, 
           *valid_length);
 
 #ifdef BENCH
-        uint64_t res = end - start;
-        bench_ctl_add_run(&que->deq_tx, &res);
+    uint64_t res = end - start;
+    bench_ctl_add_run(&que->deq_tx, &res);
 #endif
-
+    cleanq_stats_deq(&que->stats, CLEANQ_ERR_OK, *valid_length);
     return CLEANQ_ERR_OK;
 }
 
+errval_t ip_dequeue(struct cleanq* q, regionid_t* rid, genoffset_t* offset,
+                           genoffset_t* length, genoffset_t* valid_data,
+                           genoffset_t* valid_length, uint64_t* flags)
+{
+    errval_t err;
+
+    // received packets first, send completions only if there are none
+    err = ip_dequeue_rx(q, rid, offset, length, valid_data, valid_length, flags);
+    if (err != CLEANQ_ERR_QUEUE_EMPTY) {
+        return err;
+    }
+
+    return ip_dequeue_tx(q, rid, offset, length, valid_data, valid_length, flags);
+}
+
 /*
  * Public functions
  *
@@ -318,29 +444,56 @@ static errval_t ip_dequeue(struct cleanq* q, regionid_t* rid, genoffset_t* offse
 
 errval_t ip_create(struct ip_q** q, struct cleanq* nic_rx, struct cleanq* nic_tx, 
                    uint8_t prot, uint32_t src_ip , uint32_t dst_ip,
-                   struct ether_addr* src_mac, struct ether_addr* dst_mac)
+                   struct ether_addr* src_mac, struct ether_addr* dst_mac,
+                   int socket_id)
 {
     errval_t err;
     struct ip_q* que;
-    que = calloc(1, sizeof(struct ip_q));
+    const struct arp_neigh* neigh;
+
+    // the destination MAC comes from ARP if there is an ARP queue
+    neigh = arp_neigh_query(nic_tx, dst_ip);
+    if (neigh == NULL && dst_mac == NULL) {
+        return CLEANQ_ERR_INIT_QUEUE;
+    }
+
+    que = cleanq_malloc_socket(sizeof(struct ip_q), socket_id);
     assert(que);
 
-    // TODO init cleanq from dpdk
+    que->socket_id = socket_id;
+
+    switch(prot) {
+        case UDP_PROT:
+            que->hdr_len = IP_HLEN + sizeof(struct udp_hdr);
+	    que->proto = IP_PROTO_UDP;
+	    que->header.ip._proto = IP_PROTO_UDP;
+            break;
+        case TCP_PROT:
+            // TODO
+            break;
+        default:
+            printf("Unknown protocl used when initalizing ip queue \n");
+            cleanq_free_socket(que, socket_id);
+            return CLEANQ_ERR_INIT_QUEUE;
+    }
 
-    err = cleanq_init(&que->my_q);
+    err = cleanq_init_socket(&que->my_q, socket_id);
     if (err_is_fail(err)) {
-        // TODO net queue destroy
+        cleanq_free_socket(que, socket_id);
         return err;
     }   
 
     // fill in header that is reused for each packet
     // Ethernet
-    memcpy(&(que->header.eth.dest), dst_mac, ETH_HWADDR_LEN);
+    que->rx = nic_rx;
+    que->tx = nic_tx;
+    que->neigh = neigh;
+    if (que->neigh == NULL) {
+        memcpy(&(que->header.eth.dest), dst_mac, ETH_HWADDR_LEN);
+    }
     memcpy(&(que->header.eth.src), src_mac, ETH_HWADDR_LEN);
 
     que->header.eth.type = htons(ETHTYPE_IP);
-    que->rx = nic_rx;
-    que->tx = nic_tx;
 
     // IP
     que->header.ip._v_hl = 69;
@@ -358,21 +511,6 @@ errval_t ip_create(struct ip_q** q, struct cleanq* nic_rx, struct cleanq* nic_tx
     que->my_q.f.notify = ip_notify;
     que->my_q.f.enq = ip_enqueue;
     que->my_q.f.deq = ip_dequeue;
-    *q = que;
-	
-    switch(prot) {
-        case UDP_PROT:
-            que->hdr_len = IP_HLEN + sizeof(struct udp_hdr);
-	    que->proto = IP_PROTO_UDP;
-	    que->header.ip._proto = IP_PROTO_UDP;
-            break;
-        case TCP_PROT:
-            // TODO
-            break;
-        default:
-            printf("Unknown protocl used when initalizing ip queue \n");
-            return CLEANQ_ERR_INIT_QUEUE;
-    }
 
 #ifdef BENCH
     bench_init();
@@ -402,13 +540,14 @@ errval_t ip_create(struct ip_q** q, struct cleanq* nic_rx, struct cleanq* nic_tx
                        sizeof(*que->deq_tx.data));
 #endif
 
+    *q = que;
     return CLEANQ_ERR_OK;
 }
 
 errval_t ip_destroy(struct ip_q* q)
 {
     // TODO destroy q->q;
-    free(q);    
+    cleanq_free_socket(q, q->socket_id);
 
     return CLEANQ_ERR_OK;
 }
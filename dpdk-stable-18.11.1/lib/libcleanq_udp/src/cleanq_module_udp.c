@@ -11,10 +11,12 @@
 #include <stdio.h>
 #include <stdbool.h>
 #include <cleanq_module.h>
+#include <cleanq_static.h>
 #include <cleanq.h>
 #include <cleanq_bench.h>
 #include <cleanq_pkt_headers.h>
 #include <cleanq_udp.h>
+#include <cleanq_chksum.h>
 
 #include <arpa/inet.h>
 #include "inet_chksum.h"
@@ -36,15 +38,24 @@
 struct region_vaddr {
     void* va;
     regionid_t rid;
+    genoffset_t headroom; // see cleanq_set_region_headroom()
 };
 
 struct udp_q {
     struct cleanq my_q;
     struct cleanq* q;
+    // the same queue, created in udp_create(), for the split dequeue
+    struct ip_q* ip;
     struct udp_hdr header; // can fill in this header and reuse it by copying
     uint16_t dst_port;
     uint16_t src_port;
+    int tx_chksum;
+    // partial checksum over source IP, destination IP and protocol
+    uint32_t pseudo_sum;
+    int socket_id;
     struct region_vaddr regions[MAX_NUM_REGIONS];
+    // drops are packets for other ports
+    struct cleanq_stats stats;
 };
 
 
@@ -72,6 +83,10 @@ static errval_t udp_register(struct cleanq* q, struct capref cap,
 
     que->regions[rid % MAX_NUM_REGIONS].va = cap.vaddr;
     que->regions[rid % MAX_NUM_REGIONS].rid = rid;
+    que->regions[rid % MAX_NUM_REGIONS].headroom = 0;
+
+    // the IP queue needs the region to validate buffers of it
+    cleanq_add_region(que->q, cap, rid);
 
     return que->q->f.reg(que->q, cap, rid);
 }
@@ -82,6 +97,7 @@ static errval_t udp_deregister(struct cleanq* q, regionid_t rid)
     struct udp_q* que = (struct udp_q*) q;
     que->regions[rid % MAX_NUM_REGIONS].va = NULL;
     que->regions[rid % MAX_NUM_REGIONS].rid = 0;
+    cleanq_remove_region(que->q, rid);
     return que->q->f.dereg(que->q, rid);
 }
 
@@ -90,6 +106,27 @@ static errval_t udp_control(struct cleanq* q, uint64_t cmd, uint64_t value,
                            uint64_t* result)
 {
     struct udp_q* que = (struct udp_q*) q;
+
+    if (cmd == CLEANQ_CTRL_GET_STATS) {
+        return cleanq_stats_control(&que->stats, result);
+    }
+
+    if (cmd == CLEANQ_CTRL_SET_VALIDATION) {
+        return cleanq_set_validation(que->q, (cleanq_validation_t) value);
+    }
+
+    if (cmd == CLEANQ_CTRL_SET_REGION_HEADROOM) {
+        regionid_t rid = CLEANQ_CTRL_REGION_HEADROOM_RID(value);
+        struct region_vaddr* reg = &que->regions[rid % MAX_NUM_REGIONS];
+        // an empty slot has rid 0 as well
+        if (reg->va == NULL || reg->rid != rid) {
+            return CLEANQ_ERR_INVALID_REGION_ID;
+        }
+        reg->headroom = CLEANQ_CTRL_REGION_HEADROOM_LEN(value);
+        return cleanq_set_region_headroom(que->q, rid,
+                                          CLEANQ_CTRL_REGION_HEADROOM_LEN(value));
+    }
+
     return que->q->f.ctrl(que->q, cmd, value, result);
 }
 
@@ -100,7 +137,36 @@ static errval_t udp_notify(struct cleanq* q)
     return que->q->f.notify(que->q);
 }
 
-static errval_t udp_enqueue(struct cleanq* q, regionid_t rid, 
+/*
+ * Fills in the UDP checksum of the header for a datagram of udp_len bytes
+ * starting at udp. If has_sum is set the checksum field of the buffer holds
+ * the sum of the payload from udp_write_buffer(), otherwise the payload is
+ * summed here.
+ */
+static inline void udp_tx_chksum(struct udp_q* que, uint8_t* udp,
+                                 uint16_t udp_len, uint64_t has_sum)
+{
+    uint64_t sum;
+    uint16_t chksum;
+
+    if (has_sum) {
+        sum = ((struct udp_hdr*) udp)->chksum;
+    } else {
+        sum = cleanq_chksum(udp + UDP_HLEN, udp_len - UDP_HLEN);
+    }
+
+    // pseudo header and UDP header, the length is in both
+    sum += que->pseudo_sum + 2 * (uint32_t) que->header.len +
+           que->header.src + que->header.dest;
+    sum = (sum & 0xffff) + (sum >> 16);
+    sum = (sum & 0xffff) + (sum >> 16);
+    chksum = (uint16_t) ~sum;
+
+    // 0 means no checksum for UDP
+    que->header.chksum = (chksum == 0) ? 0xffff : chksum;
+}
+
+errval_t udp_enqueue(struct cleanq* q, regionid_t rid, 
                            genoffset_t offset, genoffset_t length,
                            genoffset_t valid_data, genoffset_t valid_length,
                            uint64_t flags)
@@ -110,86 +176,168 @@ static errval_t udp_enqueue(struct cleanq* q, regionid_t rid,
     //  TODO fragmentation
 
     struct udp_q* que = (struct udp_q*) q;
+    errval_t err;
+
     if (flags & NETIF_TXFLAG) {
         
         DEBUG("TX rid: %d offset %ld length %ld valid_length %ld valid_data %ld \n", rid, offset, 
               length, valid_length, valid_data);
+
+        // before anything is written to the buffer, the headers have to
+        // fit into the valid data
+        if (valid_length < UDP_HEADERS_LEN ||
+            !cleanq_buffer_valid_inner(que->q, rid, offset, length,
+                                       valid_data, valid_length)) {
+            que->stats.invalid++;
+            return CLEANQ_ERR_INVALID_BUFFER_ARGS;
+        }
+
         //que->header.len = htons(valid_length + UDP_HLEN);
         que->header.len = htons(valid_length - IP_HLEN - ETH_HLEN);
     	que->header.dest = flags & 0xFFFF;
 
         assert(que->regions[rid % MAX_NUM_REGIONS].va != NULL);
 
-        uint8_t* start = ((uint8_t*) que->regions[rid % MAX_NUM_REGIONS].va) + 
-                         offset + valid_data + ETH_HLEN + IP_HLEN + 128;   
+        struct region_vaddr* reg = &que->regions[rid % MAX_NUM_REGIONS];
+        uint8_t* start = (uint8_t*) reg->va + offset + reg->headroom +
+                         valid_data + ETH_HLEN + IP_HLEN;
+
+        if (que->tx_chksum) {
+            udp_tx_chksum(que, start, valid_length - IP_HLEN - ETH_HLEN,
+                          flags & NETIF_TXFLAG_PAYLOAD_SUM);
+        }
 
         memcpy(start, &que->header, sizeof(que->header));   
 
-        return que->q->f.enq(que->q, rid, offset, length, valid_data, 
-                             valid_length, flags);
+        err = CLEANQ_STATIC_ENQ(ip_enqueue, que->q, rid, offset, length, valid_data, 
+                                valid_length, flags);
+        cleanq_stats_enq(&que->stats, err, valid_length);
+        return err;
     } 
 
     if (flags & NETIF_RXFLAG) {
         assert(valid_length <= 2048);    
         DEBUG("RX rid: %d offset %ld length %ld valid_length %ld \n", rid, offset, 
               length, valid_length);
-        return que->q->f.enq(que->q, rid, offset, length, valid_data, 
-                             valid_length, flags);
+        if (!cleanq_buffer_valid_inner(que->q, rid, offset, length,
+                                       valid_data, valid_length)) {
+            que->stats.invalid++;
+            return CLEANQ_ERR_INVALID_BUFFER_ARGS;
+        }
+        err = CLEANQ_STATIC_ENQ(ip_enqueue, que->q, rid, offset, length, valid_data, 
+                                valid_length, flags);
+        cleanq_stats_enq(&que->stats, err, valid_length);
+        return err;
     } 
 
-    return -1;
+    que->stats.invalid++;
+    return CLEANQ_ERR_UNKNOWN_FLAG;
 }
 
-static errval_t udp_dequeue(struct cleanq* q, regionid_t* rid, genoffset_t* offset,
-                           genoffset_t* length, genoffset_t* valid_data,
-                           genoffset_t* valid_length, uint64_t* flags)
+errval_t udp_dequeue_rx(struct cleanq* q, regionid_t* rid, genoffset_t* offset,
+                        genoffset_t* length, genoffset_t* valid_data,
+                        genoffset_t* valid_length, uint64_t* flags)
 {
     errval_t err;
     struct udp_q* que = (struct udp_q*) q;
 
-    err = que->q->f.deq(que->q, rid, offset, length, valid_data, valid_length, flags);
+    err = ip_dequeue_rx((struct cleanq*) que->ip, rid, offset, length, valid_data, valid_length, flags);
     if (err_is_fail(err)) {    
+        // packets the IP queue dropped are counted there
+        if (err == CLEANQ_ERR_QUEUE_EMPTY) {
+            que->stats.empty++;
+        }
         return err;
     }
 
-    if (*flags & NETIF_RXFLAG) {
-        DEBUG("RX rid: %d offset %ld valid_data %ld length %ld va %p \n", *rid, 
-              *offset, *valid_data, 
-              *valid_length, ((uint8_t*) que->regions[*rid % MAX_NUM_REGIONS].va + 
-              *offset) + *valid_data);
+    if (!cleanq_buffer_valid_inner(que->q, *rid, *offset, *length,
+                                   *valid_data, *valid_length)) {
+        que->stats.invalid++;
+        return CLEANQ_ERR_INVALID_BUFFER_ARGS;
+    }
 
-        struct udp_hdr* header = (struct udp_hdr*) 
-                                 ((uint8_t*)(que->regions[*rid % MAX_NUM_REGIONS].va) +
-                                 *offset + *valid_data + IP_HLEN + ETH_HLEN + 128);
+    DEBUG("RX rid: %d offset %ld valid_data %ld length %ld va %p \n", *rid, 
+          *offset, *valid_data, 
+          *valid_length, ((uint8_t*) que->regions[*rid % MAX_NUM_REGIONS].va + 
+          *offset) + *valid_data);
+
+    // the IP queue below only checks for its own header
+    if (*valid_length < UDP_HEADERS_LEN) {
+        DEBUG("UDP queue: dropping runt of %ld bytes\n", *valid_length);
+        err = CLEANQ_STATIC_ENQ(ip_enqueue, que->q, *rid, *offset, *length,
+                                *valid_data, *valid_length, NETIF_RXFLAG);
+        cleanq_stats_drop(&que->stats);
+        return CLEANQ_ERR_INVALID_BUFFER_ARGS;
+    }
+
+    struct region_vaddr* reg = &que->regions[*rid % MAX_NUM_REGIONS];
+    struct udp_hdr* header = (struct udp_hdr*) 
+                             ((uint8_t*) reg->va + *offset + reg->headroom +
+                              *valid_data + IP_HLEN + ETH_HLEN);
  
-        // Correct port for this queue?
-        if (header->dest != htons(que->dst_port)) {
-            printf("UDP queue: dropping packet, wrong port %d %d \n",
-                   header->dest, que->dst_port);
-            err = que->q->f.enq(que->q, *rid, *offset, *length, *valid_data, 
-			    	*valid_length, NETIF_RXFLAG);
-            return CLEANQ_ERR_UDP_WRONG_PORT;
-        }
+    // Correct port for this queue?
+    if (header->dest != htons(que->dst_port)) {
+        DEBUG("UDP queue: dropping packet, wrong port %d %d \n",
+              header->dest, que->dst_port);
+        err = CLEANQ_STATIC_ENQ(ip_enqueue, que->q, *rid, *offset, *length, *valid_data, 
+                                *valid_length, NETIF_RXFLAG);
+        cleanq_stats_drop_err(&que->stats, CLEANQ_ERR_UDP_WRONG_PORT);
+        return CLEANQ_ERR_UDP_WRONG_PORT;
+    }
         
 #ifdef DEBUG_ENABLED
-        print_buffer((uint8_t*) que->regions[*rid % MAX_NUM_REGIONS].va + *offset, *valid_length);
+    print_buffer((uint8_t*) que->regions[*rid % MAX_NUM_REGIONS].va + *offset, *valid_length);
 #endif
 
-	*flags |= header->src;
-        //*valid_length = ntohs(header->len) - UDP_HLEN;
-        //*valid_data += UDP_HLEN;
-        //print_buffer(que, que->regions[*rid % MAX_NUM_REGIONS].va + *offset+ *valid_data, *valid_length);
-        return CLEANQ_ERR_OK;
+    *flags |= header->src;
+    //*valid_length = ntohs(header->len) - UDP_HLEN;
+    //*valid_data += UDP_HLEN;
+    cleanq_stats_deq(&que->stats, CLEANQ_ERR_OK, *valid_length);
+    return CLEANQ_ERR_OK;
+}
+
+errval_t udp_dequeue_tx(struct cleanq* q, regionid_t* rid, genoffset_t* offset,
+                        genoffset_t* length, genoffset_t* valid_data,
+                        genoffset_t* valid_length, uint64_t* flags)
+{
+    errval_t err;
+    struct udp_q* que = (struct udp_q*) q;
+
+    err = ip_dequeue_tx((struct cleanq*) que->ip, rid, offset, length, valid_data, valid_length, flags);
+    if (err_is_fail(err)) {    
+        if (err == CLEANQ_ERR_QUEUE_EMPTY) {
+            que->stats.empty++;
+        }
+        return err;
+    }
+
+    if (!cleanq_buffer_valid_inner(que->q, *rid, *offset, *length,
+                                   *valid_data, *valid_length)) {
+        que->stats.invalid++;
+        return CLEANQ_ERR_INVALID_BUFFER_ARGS;
     }
 
-#ifdef DEBUG_ENABLED
     DEBUG("TX rid: %d offset %ld length %ld \n", *rid, *offset, 
           *valid_length);
-#endif
-
+    cleanq_stats_deq(&que->stats, CLEANQ_ERR_OK, *valid_length);
     return CLEANQ_ERR_OK;
 }
 
+errval_t udp_dequeue(struct cleanq* q, regionid_t* rid, genoffset_t* offset,
+                           genoffset_t* length, genoffset_t* valid_data,
+                           genoffset_t* valid_length, uint64_t* flags)
+{
+    errval_t err;
+
+    // received packets first, send completions only if there are none
+    err = udp_dequeue_rx(q, rid, offset, length, valid_data, valid_length, flags);
+    if (err != CLEANQ_ERR_QUEUE_EMPTY) {
+        return err;
+    }
+
+    return udp_dequeue_tx(q, rid, offset, length, valid_data, valid_length, flags);
+}
+
 /*
  * Public functions
  *
@@ -197,22 +345,27 @@ static errval_t udp_dequeue(struct cleanq* q, regionid_t* rid, genoffset_t* offs
 errval_t udp_create(struct udp_q** q, struct cleanq* nic_rx, struct cleanq* nic_tx,
                     uint16_t src_port, uint16_t dst_port,
                     uint32_t src_ip, uint32_t dst_ip,
-		    struct ether_addr* src_mac, struct ether_addr* dst_mac)
+		    struct ether_addr* src_mac, struct ether_addr* dst_mac,
+                    int socket_id)
 {
     errval_t err;
     struct udp_q* que;
-    que = calloc(1, sizeof(struct udp_q));
+    que = cleanq_malloc_socket(sizeof(struct udp_q), socket_id);
     assert(que);
 
+    que->socket_id = socket_id;
+
     // init other queue
-    err = ip_create((struct ip_q**) &que->q, nic_rx, nic_tx, 
+    err = ip_create(&que->ip, nic_rx, nic_tx, 
 		     UDP_PROT, src_ip, dst_ip, src_mac, 
-		     dst_mac);
+		     dst_mac, socket_id);
     if (err_is_fail(err)) {
+        cleanq_free_socket(que, socket_id);
         return err;
     }
+    que->q = (struct cleanq*) que->ip;
 
-    err = cleanq_init(&que->my_q);
+    err = cleanq_init_socket(&que->my_q, socket_id);
     if (err_is_fail(err)) {
         return err;
     }   
@@ -223,6 +376,10 @@ errval_t udp_create(struct udp_q** q, struct cleanq* nic_rx, struct cleanq* nic_
     que->src_port = src_port;
     que->dst_port = dst_port;
     que->header.chksum = 0x0;
+    que->tx_chksum = 0;
+    que->pseudo_sum = (src_ip & 0xffff) + (src_ip >> 16) +
+                      (dst_ip & 0xffff) + (dst_ip >> 16) +
+                      htons(IP_PROTO_UDP);
 
     que->my_q.f.reg = udp_register;
     que->my_q.f.dereg = udp_deregister;
@@ -238,27 +395,53 @@ errval_t udp_create(struct udp_q** q, struct cleanq* nic_rx, struct cleanq* nic_
 errval_t udp_destroy(struct udp_q* q)
 {
     // TODO destroy q->q;
-    free(q);    
+    cleanq_free_socket(q, q->socket_id);
 
     return CLEANQ_ERR_OK;
 }
 
+void* udp_get_payload(struct udp_q* q, regionid_t rid, genoffset_t offset,
+                      genoffset_t valid_data)
+{
+    struct region_vaddr* reg = &q->regions[rid % MAX_NUM_REGIONS];
+    if (reg->va == NULL || reg->rid != rid) {
+        return NULL;
+    }
+
+    return (uint8_t*) reg->va + offset + reg->headroom + valid_data +
+           UDP_HEADERS_LEN;
+}
+
+struct cleanq* udp_get_ip(struct udp_q* q)
+{
+    return q->q;
+}
+
 errval_t udp_write_buffer(struct udp_q* q, regionid_t rid, genoffset_t offset,
                           void* data, uint16_t len) 
 {
     assert(len <= 1500);
-    if (q->regions[rid % MAX_NUM_REGIONS].va != NULL) {
-        uint8_t* start = ((uint8_t*) q->regions[rid % MAX_NUM_REGIONS].va) + offset 
-                         + sizeof (struct udp_hdr) 
-                         + sizeof (struct ip_hdr)
-                         + sizeof (struct eth_hdr);
-        memcpy(start, data, len);
+    uint8_t* start = udp_get_payload(q, rid, offset, 0);
+    if (start != NULL) {
+        // copy and sum in one pass, the sum is kept in the checksum field
+        // until the header is written (see NETIF_TXFLAG_PAYLOAD_SUM)
+        uint16_t sum = cleanq_chksum_copy(start, data, len);
+        struct udp_hdr* header = (struct udp_hdr*) (start - UDP_HLEN);
+        header->chksum = sum;
         return CLEANQ_ERR_OK;
     } else {
         return CLEANQ_ERR_INVALID_REGION_ARGS;
     }
 }
 
+void udp_set_tx_chksum(struct udp_q* q, int enable)
+{
+    q->tx_chksum = enable;
+    if (!enable) {
+        q->header.chksum = 0x0;
+    }
+}
+
 /*
 struct bench_ctl* udp_get_benchmark_data(struct udp_q* q, uint32_t type)
 {
@@ -0,0 +1,480 @@
+/*
+ * Copyright (c) 2017, ETH Zurich.
+ * All rights reserved.
+ *
+ * This file is distributed under the terms in the attached LICENSE file.
+ * If you do not find this file, copies can be found by writing to:
+ * ETH Zurich D-INFK, Universitätstrasse 4, CH-8092 Zurich. Attn: Systems Group.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdbool.h>
+#include <cleanq.h>
+#include <cleanq_module.h>
+#include <cleanq_static.h>
+#include <cleanq_pkt_headers.h>
+#include <cleanq_udp.h>
+#include <cleanq_udp_ip.h>
+#include <cleanq_arp.h>
+
+#include <arpa/inet.h>
+#include <rte_ip.h>
+#include <rte_memcpy.h>
+#include "cleanq_nic_static.h"
+
+#define MAX_NUM_REGIONS 64
+
+//#define DEBUG_ENABLED
+
+#if defined(DEBUG_ENABLED)
+#define DEBUG(x...) do { printf("UDP_IP_QUEUE:%s:%d: ", \
+            __func__, __LINE__); \
+                printf(x);\
+        } while (0)
+
+#else
+#define DEBUG(x...) ((void)0)
+#endif
+
+struct region_vaddr {
+    void* va;
+    regionid_t rid;
+    genoffset_t headroom; // see cleanq_set_region_headroom()
+};
+
+/* Ethernet, IP and UDP header as they are on the wire, 42 bytes */
+struct pkt_udp_ip_headers {
+    struct eth_hdr eth;
+    struct ip_hdr ip;
+    struct udp_hdr udp;
+} __attribute__ ((packed));
+
+#define UDP_IP_HDR_LEN (ETH_HLEN + IP_HLEN + UDP_HLEN)
+
+_Static_assert(UDP_IP_HDR_LEN == UDP_HEADERS_LEN, "UDP header length mismatch");
+
+/*
+ * The template is written with one 32 byte and one overlapping 16 byte
+ * store, so it has to be at least 32 bytes.
+ */
+_Static_assert(sizeof(struct pkt_udp_ip_headers) == UDP_IP_HDR_LEN,
+               "UDP/IP header template has the wrong size");
+_Static_assert(UDP_IP_HDR_LEN >= 32 && UDP_IP_HDR_LEN <= 48,
+               "UDP/IP header template does not fit the stores");
+
+struct udp_ip_q {
+    struct cleanq my_q;
+    struct cleanq* rx;
+    struct cleanq* tx;
+    // per flow header, only length, id, checksum and port change per packet
+    union {
+        struct pkt_udp_ip_headers header;
+        uint8_t raw[48];
+    } tmpl __rte_cache_aligned;
+    // partial IP checksum over the fields that do not change per packet
+    uint32_t ip_chksum_base;
+    uint16_t pkt_id;
+    uint16_t src_port;
+    uint16_t dst_port;
+    int socket_id;
+    // next hop if there is an ARP queue below, and its MAC in the template
+    const struct arp_neigh* neigh;
+    uint64_t neigh_mac;
+    struct region_vaddr regions[MAX_NUM_REGIONS];
+    struct cleanq_stats stats;
+};
+
+static errval_t udp_ip_register(struct cleanq* q, struct capref cap,
+                                regionid_t rid)
+{
+    struct udp_ip_q* que = (struct udp_ip_q*) q;
+
+    que->regions[rid % MAX_NUM_REGIONS].va = cap.vaddr;
+    que->regions[rid % MAX_NUM_REGIONS].rid = rid;
+    que->regions[rid % MAX_NUM_REGIONS].headroom = 0;
+
+    // let the NIC queues know the region so they can validate buffers of it
+    cleanq_add_region(que->tx, cap, rid);
+    if (que->rx != que->tx) {
+        cleanq_add_region(que->rx, cap, rid);
+    }
+
+    return que->tx->f.reg(que->tx, cap, rid);
+}
+
+static errval_t udp_ip_deregister(struct cleanq* q, regionid_t rid)
+{
+    errval_t err;
+    struct udp_ip_q* que = (struct udp_ip_q*) q;
+    que->regions[rid % MAX_NUM_REGIONS].va = NULL;
+    que->regions[rid % MAX_NUM_REGIONS].rid = 0;
+    err = que->tx->f.dereg(que->tx, rid);
+    if (err_is_fail(err)) {
+        return err;
+    }
+    if (que->rx != que->tx) {
+        cleanq_remove_region(que->tx, rid);
+    }
+    return cleanq_remove_region(que->rx, rid);
+}
+
+static errval_t udp_ip_control(struct cleanq* q, uint64_t cmd, uint64_t value,
+                               uint64_t* result)
+{
+    errval_t err;
+    struct udp_ip_q* que = (struct udp_ip_q*) q;
+
+    if (cmd == CLEANQ_CTRL_GET_STATS) {
+        return cleanq_stats_control(&que->stats, result);
+    }
+
+    if (cmd == CLEANQ_CTRL_SET_VALIDATION) {
+        err = cleanq_set_validation(que->rx, (cleanq_validation_t) value);
+        if (err_is_fail(err)) {
+            return err;
+        }
+        return cleanq_set_validation(que->tx, (cleanq_validation_t) value);
+    }
+
+    if (cmd == CLEANQ_CTRL_SET_REGION_HEADROOM) {
+        regionid_t rid = CLEANQ_CTRL_REGION_HEADROOM_RID(value);
+        struct region_vaddr* reg = &que->regions[rid % MAX_NUM_REGIONS];
+        if (reg->va == NULL || reg->rid != rid) {
+            return CLEANQ_ERR_INVALID_REGION_ID;
+        }
+        reg->headroom = CLEANQ_CTRL_REGION_HEADROOM_LEN(value);
+        err = cleanq_set_region_headroom(que->tx, rid,
+                                         CLEANQ_CTRL_REGION_HEADROOM_LEN(value));
+        if (err_is_fail(err) || que->rx == que->tx) {
+            return err;
+        }
+        return cleanq_set_region_headroom(que->rx, rid,
+                                          CLEANQ_CTRL_REGION_HEADROOM_LEN(value));
+    }
+
+    return que->rx->f.ctrl(que->rx, cmd, value, result);
+}
+
+static errval_t udp_ip_notify(struct cleanq* q)
+{
+    struct udp_ip_q* que = (struct udp_ip_q*) q;
+    return que->rx->f.notify(que->rx);
+}
+
+/*
+ * Fills in the per packet fields of the template and writes the whole header
+ * to dst with two stores.
+ */
+static inline void udp_ip_write_header(struct udp_ip_q* que, uint8_t* dst,
+                                       uint16_t ip_len, uint16_t dst_port)
+{
+    struct pkt_udp_ip_headers* hdr = &que->tmpl.header;
+    uint32_t sum;
+    uint16_t chksum;
+
+    que->pkt_id++;
+    hdr->ip._len = htons(ip_len);
+    hdr->ip._id = htons(que->pkt_id);
+    hdr->udp.len = htons(ip_len - IP_HLEN);
+    hdr->udp.dest = dst_port;
+
+    // only length and id differ from the precomputed sum
+    sum = que->ip_chksum_base + hdr->ip._len + hdr->ip._id;
+    chksum = __rte_raw_cksum_reduce(sum);
+    hdr->ip._chksum = (chksum == 0xffff) ? chksum : (uint16_t) ~chksum;
+
+    rte_mov32(dst, que->tmpl.raw);
+    rte_mov16(dst + UDP_IP_HDR_LEN - 16, que->tmpl.raw + UDP_IP_HDR_LEN - 16);
+}
+
+errval_t udp_ip_enqueue(struct cleanq* q, regionid_t rid,
+                        genoffset_t offset, genoffset_t length,
+                        genoffset_t valid_data, genoffset_t valid_length,
+                        uint64_t flags)
+{
+    struct udp_ip_q* que = (struct udp_ip_q*) q;
+    errval_t err;
+
+    if (flags & NETIF_TXFLAG) {
+        DEBUG("TX rid: %d offset %ld length %ld valid_length %ld valid_data %ld \n",
+              rid, offset, length, valid_length, valid_data);
+
+        // the headers have to fit into the valid data
+        if (valid_length < UDP_IP_HDR_LEN ||
+            !cleanq_buffer_valid_inner(que->tx, rid, offset, length,
+                                       valid_data, valid_length)) {
+            que->stats.invalid++;
+            return CLEANQ_ERR_INVALID_BUFFER_ARGS;
+        }
+
+        assert(que->regions[rid % MAX_NUM_REGIONS].va != NULL);
+
+        struct region_vaddr* reg = &que->regions[rid % MAX_NUM_REGIONS];
+        uint8_t* start = (uint8_t*) reg->va + offset + reg->headroom +
+                         valid_data;
+
+        if (que->neigh != NULL) {
+            uint64_t mac = arp_neigh_load(que->neigh);
+            if (unlikely(mac != que->neigh_mac)) {
+                arp_neigh_copy(mac, &que->tmpl.header.eth.dest);
+                que->neigh_mac = mac;
+            }
+            if (unlikely(!arp_neigh_valid(mac))) {
+                flags |= NETIF_TXFLAG_RESOLVE;
+            }
+        }
+
+        udp_ip_write_header(que, start, valid_length - ETH_HLEN,
+                            flags & 0xFFFF);
+
+        err = NIC_TX_ENQ(que->tx, rid, offset, length, valid_data,
+                         valid_length, flags);
+        cleanq_stats_enq(&que->stats, err, valid_length);
+        return err;
+    }
+
+    if (flags & NETIF_RXFLAG) {
+        assert(valid_length <= 2048);
+        DEBUG("RX rid: %d offset %ld length %ld valid_length %ld \n", rid, offset,
+              length, valid_length);
+        if (!cleanq_buffer_valid_inner(que->rx, rid, offset, length,
+                                       valid_data, valid_length)) {
+            que->stats.invalid++;
+            return CLEANQ_ERR_INVALID_BUFFER_ARGS;
+        }
+        err = NIC_RX_ENQ(que->rx, rid, offset, length, valid_data,
+                         valid_length, flags);
+        cleanq_stats_enq(&que->stats, err, valid_length);
+        return err;
+    }
+
+    que->stats.invalid++;
+    return CLEANQ_ERR_UNKNOWN_FLAG;
+}
+
+errval_t udp_ip_dequeue_rx(struct cleanq* q, regionid_t* rid, genoffset_t* offset,
+                           genoffset_t* length, genoffset_t* valid_data,
+                           genoffset_t* valid_length, uint64_t* flags)
+{
+    errval_t err;
+    struct udp_ip_q* que = (struct udp_ip_q*) q;
+
+    err = NIC_RX_DEQ(que->rx, rid, offset, length, valid_data, valid_length, flags);
+    if (err_is_fail(err)) {
+        if (err == CLEANQ_ERR_QUEUE_EMPTY) {
+            que->stats.empty++;
+        }
+        return err;
+    }
+
+    if (!cleanq_buffer_valid_inner(que->rx, *rid, *offset, *length,
+                                   *valid_data, *valid_length)) {
+        que->stats.invalid++;
+        return CLEANQ_ERR_INVALID_BUFFER_ARGS;
+    }
+
+    *flags |= NETIF_RXFLAG;
+
+    if (*valid_length < UDP_IP_HDR_LEN) {
+        DEBUG("UDP/IP queue: dropping runt of %ld bytes\n", *valid_length);
+        NIC_RX_ENQ(que->rx, *rid, *offset, *length, *valid_data, *valid_length,
+                   NETIF_RXFLAG);
+        cleanq_stats_drop(&que->stats);
+        return CLEANQ_ERR_INVALID_BUFFER_ARGS;
+    }
+
+    struct region_vaddr* reg = &que->regions[*rid % MAX_NUM_REGIONS];
+    struct pkt_udp_ip_headers* header = (struct pkt_udp_ip_headers*)
+                                        ((uint8_t*) reg->va + *offset +
+                                         reg->headroom + *valid_data);
+
+    // a header with a valid checksum sums up to 0xffff
+    if (rte_raw_cksum(&header->ip, IP_HLEN) != 0xffff) {
+        DEBUG("UDP/IP queue: dropping packet wrong checksum\n");
+        NIC_RX_ENQ(que->rx, *rid, *offset, *length, *valid_data, *valid_length,
+                   NETIF_RXFLAG);
+        cleanq_stats_drop_err(&que->stats, CLEANQ_ERR_IP_CHKSUM);
+        return CLEANQ_ERR_IP_CHKSUM;
+    }
+
+    if (header->ip.src != que->tmpl.header.ip.dest) {
+        DEBUG("UDP/IP queue: dropping packet, wrong IP is %d should be %d\n",
+              header->ip.src, que->tmpl.header.ip.dest);
+        NIC_RX_ENQ(que->rx, *rid, *offset, *length, *valid_data, *valid_length,
+                   NETIF_RXFLAG);
+        cleanq_stats_drop_err(&que->stats, CLEANQ_ERR_IP_WRONG_IP);
+        return CLEANQ_ERR_IP_WRONG_IP;
+    }
+
+    if (header->ip._proto != IP_PROTO_UDP) {
+        DEBUG("UDP/IP queue: dropping packet wrong protocol is %d \n",
+              header->ip._proto);
+        NIC_RX_ENQ(que->rx, *rid, *offset, *length, *valid_data, *valid_length,
+                   NETIF_RXFLAG);
+        cleanq_stats_drop_err(&que->stats, CLEANQ_ERR_IP_WRONG_PROTO);
+        return CLEANQ_ERR_IP_WRONG_PROTO;
+    }
+
+    if (header->udp.dest != htons(que->dst_port)) {
+        DEBUG("UDP/IP queue: dropping packet, wrong port %d %d \n",
+              header->udp.dest, que->dst_port);
+        NIC_RX_ENQ(que->rx, *rid, *offset, *length, *valid_data, *valid_length,
+                   NETIF_RXFLAG);
+        cleanq_stats_drop_err(&que->stats, CLEANQ_ERR_UDP_WRONG_PORT);
+        return CLEANQ_ERR_UDP_WRONG_PORT;
+    }
+
+    *flags |= header->udp.src;
+    cleanq_stats_deq(&que->stats, CLEANQ_ERR_OK, *valid_length);
+    return CLEANQ_ERR_OK;
+}
+
+errval_t udp_ip_dequeue_tx(struct cleanq* q, regionid_t* rid, genoffset_t* offset,
+                           genoffset_t* length, genoffset_t* valid_data,
+                           genoffset_t* valid_length, uint64_t* flags)
+{
+    errval_t err;
+    struct udp_ip_q* que = (struct udp_ip_q*) q;
+
+    err = NIC_TX_DEQ(que->tx, rid, offset, length, valid_data, valid_length, flags);
+    if (err_is_fail(err)) {
+        if (err == CLEANQ_ERR_QUEUE_EMPTY) {
+            que->stats.empty++;
+        }
+        return err;
+    }
+
+    if (!cleanq_buffer_valid_inner(que->tx, *rid, *offset, *length,
+                                   *valid_data, *valid_length)) {
+        que->stats.invalid++;
+        return CLEANQ_ERR_INVALID_BUFFER_ARGS;
+    }
+
+    *flags |= NETIF_TXFLAG;
+    DEBUG("TX rid: %d offset %ld length %ld \n", *rid, *offset,
+          *valid_length);
+    cleanq_stats_deq(&que->stats, CLEANQ_ERR_OK, *valid_length);
+    return CLEANQ_ERR_OK;
+}
+
+errval_t udp_ip_dequeue(struct cleanq* q, regionid_t* rid, genoffset_t* offset,
+                        genoffset_t* length, genoffset_t* valid_data,
+                        genoffset_t* valid_length, uint64_t* flags)
+{
+    errval_t err;
+
+    // received packets first, send completions only if there are none
+    err = udp_ip_dequeue_rx(q, rid, offset, length, valid_data, valid_length,
+                            flags);
+    if (err != CLEANQ_ERR_QUEUE_EMPTY) {
+        return err;
+    }
+
+    return udp_ip_dequeue_tx(q, rid, offset, length, valid_data, valid_length,
+                             flags);
+}
+
+static errval_t udp_ip_destroy_queue(struct cleanq* q)
+{
+    return udp_ip_destroy((struct udp_ip_q*) q);
+}
+
+/*
+ * Public functions
+ *
+ */
+errval_t udp_ip_create(struct udp_ip_q** q, struct cleanq* nic_rx,
+                       struct cleanq* nic_tx,
+                       uint16_t src_port, uint16_t dst_port,
+                       uint32_t src_ip, uint32_t dst_ip,
+                       struct ether_addr* src_mac, struct ether_addr* dst_mac,
+                       int socket_id)
+{
+    errval_t err;
+    struct udp_ip_q* que;
+    struct pkt_udp_ip_headers* hdr;
+    const struct arp_neigh* neigh;
+
+    // the destination MAC comes from ARP if there is an ARP queue
+    neigh = arp_neigh_query(nic_tx, dst_ip);
+    if (neigh == NULL && dst_mac == NULL) {
+        return CLEANQ_ERR_INIT_QUEUE;
+    }
+
+    que = cleanq_malloc_socket(sizeof(struct udp_ip_q), socket_id);
+    assert(que);
+
+    que->socket_id = socket_id;
+
+    err = cleanq_init_socket(&que->my_q, socket_id);
+    if (err_is_fail(err)) {
+        cleanq_free_socket(que, socket_id);
+        return err;
+    }
+
+    que->rx = nic_rx;
+    que->tx = nic_tx;
+    que->src_port = src_port;
+    que->dst_port = dst_port;
+    que->pkt_id = 3;
+
+    hdr = &que->tmpl.header;
+
+    // Ethernet
+    que->neigh = neigh;
+    if (que->neigh == NULL) {
+        memcpy(&hdr->eth.dest, dst_mac, ETH_HWADDR_LEN);
+    }
+    memcpy(&hdr->eth.src, src_mac, ETH_HWADDR_LEN);
+    hdr->eth.type = htons(ETHTYPE_IP);
+
+    // IP, length, id and checksum are filled in per packet
+    hdr->ip._v_hl = 69;
+    IPH_TOS_SET(&hdr->ip, 0x0);
+    hdr->ip._len = 0;
+    hdr->ip._id = 0;
+    hdr->ip._offset = htons(IP_DF);
+    hdr->ip._ttl = 0x40; // 64
+    hdr->ip._proto = IP_PROTO_UDP;
+    hdr->ip._chksum = 0;
+    hdr->ip.src = src_ip;
+    hdr->ip.dest = dst_ip;
+    que->ip_chksum_base = __rte_raw_cksum(&hdr->ip, IP_HLEN, 0);
+
+    // UDP, length and destination port are filled in per packet
+    hdr->udp.src = htons(src_port);
+    hdr->udp.dest = htons(dst_port);
+    hdr->udp.len = 0;
+    hdr->udp.chksum = 0x0;
+
+    que->my_q.f.reg = udp_ip_register;
+    que->my_q.f.dereg = udp_ip_deregister;
+    que->my_q.f.ctrl = udp_ip_control;
+    que->my_q.f.notify = udp_ip_notify;
+    que->my_q.f.enq = udp_ip_enqueue;
+    que->my_q.f.deq = udp_ip_dequeue;
+    que->my_q.f.destroy = udp_ip_destroy_queue;
+    *q = que;
+
+    return CLEANQ_ERR_OK;
+}
+
+void* udp_ip_get_payload(struct udp_ip_q* q, regionid_t rid,
+                         genoffset_t offset, genoffset_t valid_data)
+{
+    struct region_vaddr* reg = &q->regions[rid % MAX_NUM_REGIONS];
+    if (reg->va == NULL || reg->rid != rid) {
+        return NULL;
+    }
+
+    return (uint8_t*) reg->va + offset + reg->headroom + valid_data +
+           UDP_IP_HDR_LEN;
+}
+
+errval_t udp_ip_destroy(struct udp_ip_q* q)
+{
+    cleanq_free_socket(q, q->socket_id);
+
+    return CLEANQ_ERR_OK;
+}
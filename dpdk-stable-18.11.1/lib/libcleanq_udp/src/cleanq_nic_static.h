@@ -0,0 +1,46 @@
+/*
+ * Copyright (c) 2017 ETH Zurich.
+ * All rights reserved.
+ *
+ * This file is distributed under the terms in the attached LICENSE file.
+ * If you do not find this file, copies can be found by writing to:
+ * ETH Zurich D-INFK, Universitaetstr. 6, CH-8092 Zurich. Attn: Systems Group.
+ */
+#ifndef CLEANQ_NIC_STATIC_H_
+#define CLEANQ_NIC_STATIC_H_ 1
+
+#include <cleanq_static.h>
+
+/*
+ * Calls into the NIC queues. Bound at compile time if the NIC functions are
+ * given (see cleanq_ip.h), otherwise through the queue's function pointers.
+ */
+#ifdef CLEANQ_IP_NIC_RX_ENQ
+CLEANQ_STATIC_DECLARE_ENQ(CLEANQ_IP_NIC_RX_ENQ);
+#define NIC_RX_ENQ(q, ...) CLEANQ_STATIC_ENQ(CLEANQ_IP_NIC_RX_ENQ, q, __VA_ARGS__)
+#else
+#define NIC_RX_ENQ(q, ...) (q)->f.enq((q), __VA_ARGS__)
+#endif
+
+#ifdef CLEANQ_IP_NIC_RX_DEQ
+CLEANQ_STATIC_DECLARE_DEQ(CLEANQ_IP_NIC_RX_DEQ);
+#define NIC_RX_DEQ(q, ...) CLEANQ_STATIC_DEQ(CLEANQ_IP_NIC_RX_DEQ, q, __VA_ARGS__)
+#else
+#define NIC_RX_DEQ(q, ...) (q)->f.deq((q), __VA_ARGS__)
+#endif
+
+#ifdef CLEANQ_IP_NIC_TX_ENQ
+CLEANQ_STATIC_DECLARE_ENQ(CLEANQ_IP_NIC_TX_ENQ);
+#define NIC_TX_ENQ(q, ...) CLEANQ_STATIC_ENQ(CLEANQ_IP_NIC_TX_ENQ, q, __VA_ARGS__)
+#else
+#define NIC_TX_ENQ(q, ...) (q)->f.enq((q), __VA_ARGS__)
+#endif
+
+#ifdef CLEANQ_IP_NIC_TX_DEQ
+CLEANQ_STATIC_DECLARE_DEQ(CLEANQ_IP_NIC_TX_DEQ);
+#define NIC_TX_DEQ(q, ...) CLEANQ_STATIC_DEQ(CLEANQ_IP_NIC_TX_DEQ, q, __VA_ARGS__)
+#else
+#define NIC_TX_DEQ(q, ...) (q)->f.deq((q), __VA_ARGS__)
+#endif
+
+#endif /* CLEANQ_NIC_STATIC_H_ */
@@ -52,6 +52,7 @@ typedef uint32_t ip_addr_t;
 #endif
 
 uint16_t inet_chksum(const void *dataptr, uint16_t len);
+uint16_t lwip_standard_chksum(const void *dataptr, int len);
 
 #endif /* LWIP_HDR_INET_H */
 
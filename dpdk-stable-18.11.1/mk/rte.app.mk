@@ -95,9 +95,6 @@ _LDLIBS-$(CONFIG_RTE_LIBRTE_CMDLINE)        += -lrte_cmdline
 _LDLIBS-$(CONFIG_RTE_LIBRTE_REORDER)        += -lrte_reorder
 _LDLIBS-$(CONFIG_RTE_LIBRTE_SCHED)          += -lrte_sched
 
-_LDLIBS-$(CONFIG_RTE_LIBCLEANQ)             += -lcleanq
-_LDLIBS-$(CONFIG_RTE_LIBCLEANQ)             += -lcleanq_udp
-
 ifeq ($(CONFIG_RTE_EXEC_ENV_LINUXAPP),y)
 _LDLIBS-$(CONFIG_RTE_LIBRTE_KNI)            += -lrte_kni
 endif
@@ -188,6 +185,7 @@ _LDLIBS-$(CONFIG_RTE_LIBRTE_PMD_NULL)       += -lrte_pmd_null
 _LDLIBS-$(CONFIG_RTE_LIBRTE_PMD_PCAP)       += -lrte_pmd_pcap -lpcap
 _LDLIBS-$(CONFIG_RTE_LIBRTE_QEDE_PMD)       += -lrte_pmd_qede
 _LDLIBS-$(CONFIG_RTE_LIBRTE_PMD_RING)       += -lrte_pmd_ring
+_LDLIBS-$(CONFIG_RTE_LIBCLEANQ)             += -lrte_pmd_cleanq
 ifeq ($(CONFIG_RTE_LIBRTE_SCHED),y)
 _LDLIBS-$(CONFIG_RTE_LIBRTE_PMD_SOFTNIC)      += -lrte_pmd_softnic
 endif
@@ -299,6 +297,13 @@ endif # !CONFIG_RTE_BUILD_SHARED_LIBS
 
 _LDLIBS-y += --no-whole-archive
 
+# after the PMDs built on libcleanq, librte_metrics is the only library it
+# uses that is not linked as a whole
+_LDLIBS-$(CONFIG_RTE_LIBCLEANQ)             += -lcleanq_udp -lcleanq
+ifeq ($(CONFIG_RTE_LIBRTE_METRICS),y)
+_LDLIBS-$(CONFIG_RTE_LIBCLEANQ)             += -lrte_metrics
+endif
+
 ifeq ($(CONFIG_RTE_BUILD_SHARED_LIB),n)
 # The static libraries do not know their dependencies.
 # So linking with static library requires explicit dependencies.
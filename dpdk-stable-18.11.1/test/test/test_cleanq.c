@@ -0,0 +1,2258 @@
+/* SPDX-License-Identifier: BSD-3-Clause
+ * Copyright(c) 2017 ETH Zurich
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+
+#include <rte_arp.h>
+#include <rte_bus_vdev.h>
+#include <rte_cycles.h>
+#include <rte_ethdev.h>
+#include <rte_ether.h>
+#include <rte_ip.h>
+#include <rte_udp.h>
+#include <rte_launch.h>
+#include <rte_lcore.h>
+#include <rte_malloc.h>
+#include <rte_mbuf.h>
+#include <rte_eth_cleanq.h>
+#ifdef RTE_LIBRTE_PMD_RING
+#include <rte_eth_ring.h>
+#endif
+
+#include <cleanq.h>
+#include <cleanq_module.h>
+#include <cleanq_poll.h>
+#include <cleanq_dpdk.h>
+#include <backends/loopback_devif.h>
+#include <backends/debug.h>
+#include <backends/ipcq.h>
+#include <backends/reflector.h>
+#include <backends/af_packet.h>
+#include <backends/ethdev.h>
+#include <slab.h>
+#ifdef RTE_LIBRTE_VHOST
+#include <backends/vhost_user.h>
+#endif
+#include <cleanq_udp.h>
+#include <cleanq_udp_ip.h>
+#include <cleanq_arp.h>
+#ifdef RTE_LIBRTE_METRICS
+#include <rte_metrics.h>
+#include <cleanq_lat.h>
+#include <cleanq_metrics.h>
+#endif
+
+#include "test.h"
+
+/*
+ * CleanQ queues
+ * =============
+ *
+ * Checks the backends that pass buffers through unchanged (loopback, debug
+ * on loopback, ipcq in both descriptor formats):
+ *  * Buffers come back in order with all their fields
+ *  * Full and empty queues are reported, nothing is lost at the limits
+ *  * Buffers outside of a region and of unknown regions are rejected
+ *  * Deregistered regions cannot be used any more
+ * and the compact ipcq once its sequence numbers wrap, the regions of an
+ * ipcq connection over a socket, the buffer ownership
+ * checks of the debug queue, the packets of the reflector, the validation
+ * policies, the ARP queue, the ethdev on top of a queue, the queues on
+ * top of a net_ring port, AF_PACKET on lo (skipped without the permission), vhost-user with a virtio_user port
+ * (skipped if the port cannot be set up), the statistics of a stack of two
+ * queues and their export through librte_metrics.
+ */
+
+#define BUF_SIZE 2048
+#define NUM_BUFS 512
+#define MEM_SIZE (BUF_SIZE * NUM_BUFS)
+
+struct test_q {
+	const char *name;
+	struct cleanq *tx;	/* buffers are enqueued here */
+	struct cleanq *rx;	/* and dequeued here */
+	struct cleanq *peer;	/* polled for control messages, or NULL */
+	struct cleanq *lower;
+};
+
+/* the region the other side registered last, as mapped on this side */
+static struct capref ipcq_reg_cap;
+
+static errval_t
+ipcq_reg_cb(struct ipcq *q, struct capref cap, regionid_t rid)
+{
+	RTE_SET_USED(q);
+	RTE_SET_USED(rid);
+	ipcq_reg_cap = cap;
+	return CLEANQ_ERR_OK;
+}
+
+static errval_t
+ipcq_dereg_cb(struct ipcq *q, regionid_t rid)
+{
+	RTE_SET_USED(q);
+	RTE_SET_USED(rid);
+	return CLEANQ_ERR_OK;
+}
+
+static struct ipcq_func_pointer ipcq_funcs = {
+	.reg = ipcq_reg_cb,
+	.dereg = ipcq_dereg_cb,
+};
+
+static int
+loopback_init(struct test_q *tq)
+{
+	struct loopback_queue *lq;
+
+	TEST_ASSERT_SUCCESS(loopback_queue_create(&lq, rte_socket_id()),
+			"cannot create loopback queue");
+	tq->tx = tq->rx = (struct cleanq *) lq;
+	return 0;
+}
+
+static int
+debug_init(struct test_q *tq)
+{
+	struct loopback_queue *lq;
+	struct debug_q *dq;
+
+	TEST_ASSERT_SUCCESS(loopback_queue_create(&lq, rte_socket_id()),
+			"cannot create loopback queue");
+	tq->lower = (struct cleanq *) lq;
+	TEST_ASSERT_SUCCESS(debug_create(&dq, tq->lower, rte_socket_id()),
+			"cannot create debug queue");
+	tq->tx = tq->rx = (struct cleanq *) dq;
+	return 0;
+}
+
+static int
+ipcq_init_format(struct test_q *tq, ipcq_desc_format_t format)
+{
+	char name_a[32], name_b[32];
+	struct ipcq *a, *b;
+	errval_t err_a, err_b, mismatch;
+
+	snprintf(name_a, sizeof(name_a), "cleanq_test_%d_%u_a", getpid(),
+			format);
+	snprintf(name_b, sizeof(name_b), "cleanq_test_%d_%u_b", getpid(),
+			format);
+
+	err_a = ipcq_create(&a, name_a, name_b, true, &ipcq_funcs,
+			rte_socket_id(), format);
+	/* both ends have to ask for the same format */
+	mismatch = ipcq_create(&b, name_b, name_a, false, &ipcq_funcs,
+			rte_socket_id(), format == IPCQ_DESC_DEFAULT ?
+			IPCQ_DESC_COMPACT : IPCQ_DESC_DEFAULT);
+	err_b = ipcq_create(&b, name_b, name_a, false, &ipcq_funcs,
+			rte_socket_id(), format);
+	shm_unlink(name_a);
+	shm_unlink(name_b);
+
+	TEST_ASSERT_SUCCESS(err_a, "cannot create ipcq");
+	TEST_ASSERT_FAIL(mismatch, "descriptor format mismatch not detected");
+	TEST_ASSERT_SUCCESS(err_b, "cannot create ipcq");
+	TEST_ASSERT_EQUAL(ipcq_get_desc_format(b), format,
+			"descriptor format %u not used", (unsigned) format);
+
+	tq->tx = (struct cleanq *) a;
+	tq->rx = tq->peer = (struct cleanq *) b;
+	return 0;
+}
+
+static int
+ipcq_init(struct test_q *tq)
+{
+	return ipcq_init_format(tq, IPCQ_DESC_DEFAULT);
+}
+
+static int
+ipcq_compact_init(struct test_q *tq)
+{
+	return ipcq_init_format(tq, IPCQ_DESC_COMPACT);
+}
+
+static void
+test_q_free(struct test_q *tq)
+{
+	if (tq->peer != NULL)
+		cleanq_destroy(tq->peer);
+	if (tq->tx != NULL)
+		cleanq_destroy(tq->tx);
+	if (tq->lower != NULL)
+		cleanq_destroy(tq->lower);
+}
+
+/* the peer of an ipcq learns about regions when it is polled */
+static int
+poll_peer(struct test_q *tq)
+{
+	regionid_t rid;
+	genoffset_t offset, length, valid_data, valid_length;
+	uint64_t flags;
+
+	if (tq->peer == NULL)
+		return 0;
+
+	TEST_ASSERT_EQUAL(cleanq_dequeue(tq->peer, &rid, &offset, &length,
+			&valid_data, &valid_length, &flags),
+			CLEANQ_ERR_QUEUE_EMPTY, "%s: unexpected buffer", tq->name);
+	return 0;
+}
+
+static int
+register_mem(struct test_q *tq, void *mem, regionid_t *rid)
+{
+	struct capref cap;
+
+	cap.vaddr = mem;
+	cap.paddr = rte_malloc_virt2iova(mem);
+	cap.len = MEM_SIZE;
+	TEST_ASSERT_SUCCESS(cleanq_register(tq->tx, cap, rid),
+			"%s: cannot register region", tq->name);
+	return poll_peer(tq);
+}
+
+/* every field of every buffer has to come back as it was */
+static int
+test_roundtrip(struct test_q *tq, regionid_t rid)
+{
+	struct cleanq_buf b;
+	unsigned i, n;
+
+	for (n = 1; n <= 32; n *= 2) {
+		for (i = 0; i < n; i++) {
+			TEST_ASSERT_SUCCESS(cleanq_enqueue(tq->tx, rid,
+					i * BUF_SIZE, BUF_SIZE, i, 64 + i,
+					(i == n - 1) ? CLEANQ_FLAG_LAST : i),
+					"%s: enqueue %u of %u failed", tq->name,
+					i, n);
+		}
+		for (i = 0; i < n; i++) {
+			TEST_ASSERT_SUCCESS(cleanq_dequeue(tq->rx, &b.rid,
+					&b.offset, &b.length, &b.valid_data,
+					&b.valid_length, &b.flags),
+					"%s: dequeue %u of %u failed", tq->name,
+					i, n);
+			TEST_ASSERT(b.rid == rid && b.offset == i * BUF_SIZE &&
+					b.length == BUF_SIZE &&
+					b.valid_data == i &&
+					b.valid_length == 64 + i &&
+					b.flags == ((i == n - 1) ?
+						CLEANQ_FLAG_LAST : i),
+					"%s: buffer %u of %u changed", tq->name,
+					i, n);
+		}
+		TEST_ASSERT_EQUAL(cleanq_dequeue(tq->rx, &b.rid, &b.offset,
+				&b.length, &b.valid_data, &b.valid_length,
+				&b.flags), CLEANQ_ERR_QUEUE_EMPTY,
+				"%s: queue not empty", tq->name);
+	}
+	return 0;
+}
+
+/* fills the queue until it is full, then gets everything back */
+static int
+test_full_empty(struct test_q *tq, regionid_t rid)
+{
+	struct cleanq_buf b;
+	unsigned i, num;
+	errval_t err;
+
+	for (num = 0; num < NUM_BUFS; num++) {
+		err = cleanq_enqueue(tq->tx, rid, num * BUF_SIZE, BUF_SIZE, 0,
+				BUF_SIZE, 0);
+		if (err == CLEANQ_ERR_QUEUE_FULL)
+			break;
+		TEST_ASSERT_SUCCESS(err, "%s: enqueue %u failed", tq->name, num);
+	}
+	TEST_ASSERT(num > 0 && num < NUM_BUFS,
+			"%s: queue full after %u buffers", tq->name, num);
+
+	for (i = 0; i < num; i++) {
+		TEST_ASSERT_SUCCESS(cleanq_dequeue(tq->rx, &b.rid, &b.offset,
+				&b.length, &b.valid_data, &b.valid_length,
+				&b.flags), "%s: dequeue %u of %u failed",
+				tq->name, i, num);
+		TEST_ASSERT_EQUAL(b.offset, (genoffset_t) i * BUF_SIZE,
+				"%s: buffer %u out of order", tq->name, i);
+	}
+	TEST_ASSERT_EQUAL(cleanq_dequeue(tq->rx, &b.rid, &b.offset, &b.length,
+			&b.valid_data, &b.valid_length, &b.flags),
+			CLEANQ_ERR_QUEUE_EMPTY, "%s: queue not empty", tq->name);
+
+	/* there is space again */
+	TEST_ASSERT_SUCCESS(cleanq_enqueue(tq->tx, rid, 0, BUF_SIZE, 0,
+			BUF_SIZE, 0), "%s: enqueue after full failed", tq->name);
+	TEST_ASSERT_SUCCESS(cleanq_dequeue(tq->rx, &b.rid, &b.offset,
+			&b.length, &b.valid_data, &b.valid_length, &b.flags),
+			"%s: dequeue after full failed", tq->name);
+	return 0;
+}
+
+static int
+test_invalid_buffers(struct test_q *tq, regionid_t rid)
+{
+	TEST_ASSERT_EQUAL(cleanq_enqueue(tq->tx, rid, MEM_SIZE, BUF_SIZE, 0,
+			0, 0), CLEANQ_ERR_INVALID_BUFFER_ARGS,
+			"%s: buffer after the region accepted", tq->name);
+	TEST_ASSERT_EQUAL(cleanq_enqueue(tq->tx, rid, MEM_SIZE - BUF_SIZE / 2,
+			BUF_SIZE, 0, 0, 0), CLEANQ_ERR_INVALID_BUFFER_ARGS,
+			"%s: buffer across the end of the region accepted",
+			tq->name);
+	TEST_ASSERT_EQUAL(cleanq_enqueue(tq->tx, rid, 0, BUF_SIZE, BUF_SIZE,
+			1, 0), CLEANQ_ERR_INVALID_BUFFER_ARGS,
+			"%s: valid data after the buffer accepted", tq->name);
+	TEST_ASSERT_EQUAL(cleanq_enqueue(tq->tx, rid + 1, 0, BUF_SIZE, 0, 0,
+			0), CLEANQ_ERR_INVALID_BUFFER_ARGS,
+			"%s: buffer of unknown region accepted", tq->name);
+	return 0;
+}
+
+static int
+test_deregister(struct test_q *tq, void *mem, regionid_t rid)
+{
+	struct capref cap;
+
+	TEST_ASSERT_SUCCESS(cleanq_deregister(tq->tx, rid, &cap),
+			"%s: cannot deregister region", tq->name);
+	TEST_ASSERT(cap.vaddr == mem && cap.len == MEM_SIZE,
+			"%s: wrong region returned", tq->name);
+	TEST_ASSERT_FAIL(cleanq_deregister(tq->tx, rid, &cap),
+			"%s: region deregistered twice", tq->name);
+	TEST_ASSERT_EQUAL(cleanq_enqueue(tq->tx, rid, 0, BUF_SIZE, 0, 0, 0),
+			CLEANQ_ERR_INVALID_BUFFER_ARGS,
+			"%s: buffer of deregistered region accepted", tq->name);
+	return poll_peer(tq);
+}
+
+/*
+ * None of the software queues has a device that could interrupt, they must
+ * not hand out an fd
+ */
+static int
+test_no_rx_intr(struct test_q *tq)
+{
+	int fd = -1;
+
+	TEST_ASSERT(err_is_fail(cleanq_rx_intr_enable(tq->rx)),
+			"%s: RX interrupt armed", tq->name);
+	TEST_ASSERT(err_is_fail(cleanq_rx_intr_fd(tq->rx, &fd)) && fd == -1,
+			"%s: RX interrupt fd %d", tq->name, fd);
+	return 0;
+}
+
+static int
+test_backend(const char *name, int (*init)(struct test_q *tq), void *mem)
+{
+	struct test_q tq;
+	regionid_t rid;
+	int ret = -1;
+
+	memset(&tq, 0, sizeof(tq));
+	tq.name = name;
+	if (init(&tq) != 0)
+		goto out;
+
+	if (register_mem(&tq, mem, &rid) != 0 ||
+			test_roundtrip(&tq, rid) != 0 ||
+			test_full_empty(&tq, rid) != 0 ||
+			test_invalid_buffers(&tq, rid) != 0 ||
+			test_no_rx_intr(&tq) != 0 ||
+			test_deregister(&tq, mem, rid) != 0)
+		goto out;
+
+	/* the same memory can be registered again */
+	if (register_mem(&tq, mem, &rid) != 0 ||
+			test_roundtrip(&tq, rid) != 0 ||
+			test_deregister(&tq, mem, rid) != 0)
+		goto out;
+
+	printf("%s: OK\n", name);
+	ret = 0;
+out:
+	test_q_free(&tq);
+	return ret;
+}
+
+#define IPCQ_WRAP_BUFS (3 << 14)
+#define IPCQ_WRAP_BURST 100
+
+/*
+ * The compact descriptors carry 14 sequence bits, buffers still have to
+ * come through in order once the sequence numbers wrap, and the socket
+ * setup must not hand out a compact ring with more slots than that
+ */
+static int
+test_ipcq_compact_wrap(void *mem)
+{
+	struct ipcq_conn_params limits = {
+		.num_queues = 1,
+		.ring_size = IPCQ_MAX_RING_SIZE,
+		.format = IPCQ_DESC_COMPACT,
+	};
+	struct ipcq_listener *l;
+	struct test_q tq;
+	struct cleanq_buf b;
+	char path[32];
+	regionid_t rid;
+	unsigned i, n;
+	int ret = -1;
+
+	snprintf(path, sizeof(path), "@cleanq_test_%d", getpid());
+	TEST_ASSERT_FAIL(ipcq_listen(&l, path, &limits),
+			"ipcq_wrap: compact ring of %u bytes accepted",
+			limits.ring_size);
+	limits.ring_size = IPCQ_COMPACT_MAX_RING_SIZE;
+	TEST_ASSERT_SUCCESS(ipcq_listen(&l, path, &limits),
+			"ipcq_wrap: cannot listen on %s", path);
+	ipcq_listener_destroy(l);
+
+	memset(&tq, 0, sizeof(tq));
+	tq.name = "ipcq_wrap";
+	if (ipcq_compact_init(&tq) != 0 || register_mem(&tq, mem, &rid) != 0)
+		goto out;
+	if (rid > UINT16_MAX) {
+		printf("ipcq_wrap: region id %u does not fit\n", rid);
+		goto out;
+	}
+
+	for (n = 0; n < IPCQ_WRAP_BUFS; n += IPCQ_WRAP_BURST) {
+		for (i = n; i < n + IPCQ_WRAP_BURST; i++) {
+			if (cleanq_enqueue(tq.tx, rid,
+					(i % NUM_BUFS) * BUF_SIZE, BUF_SIZE,
+					0, i % BUF_SIZE, 0) != CLEANQ_ERR_OK) {
+				printf("ipcq_wrap: enqueue %u failed\n", i);
+				goto out;
+			}
+		}
+		for (i = n; i < n + IPCQ_WRAP_BURST; i++) {
+			if (cleanq_dequeue(tq.rx, &b.rid, &b.offset, &b.length,
+					&b.valid_data, &b.valid_length,
+					&b.flags) != CLEANQ_ERR_OK ||
+					b.offset != (i % NUM_BUFS) * BUF_SIZE ||
+					b.valid_length != i % BUF_SIZE) {
+				printf("ipcq_wrap: buffer %u lost\n", i);
+				goto out;
+			}
+		}
+	}
+	if (cleanq_dequeue(tq.rx, &b.rid, &b.offset, &b.length, &b.valid_data,
+			&b.valid_length, &b.flags) != CLEANQ_ERR_QUEUE_EMPTY) {
+		printf("ipcq_wrap: queue not empty\n");
+		goto out;
+	}
+
+	printf("ipcq_wrap: OK\n");
+	ret = 0;
+out:
+	test_q_free(&tq);
+	return ret;
+}
+
+struct ipcq_accept_arg {
+	struct ipcq_listener *l;
+	struct ipcq_conn *c;
+	errval_t err;
+};
+
+static void *
+ipcq_accept_thread(void *arg)
+{
+	struct ipcq_accept_arg *a = arg;
+
+	a->err = ipcq_accept(a->l, &a->c, &ipcq_funcs, rte_socket_id());
+	return NULL;
+}
+
+/* one buffer of a region of the connecting side, read by the listener */
+static int
+ipcq_socket_round(struct ipcq_conn *cli, struct cleanq *cq, struct cleanq *sq,
+		uint8_t fill)
+{
+	struct capref cap;
+	struct cleanq_buf b;
+	regionid_t rid;
+	unsigned i;
+	errval_t err = CLEANQ_ERR_QUEUE_EMPTY;
+
+	TEST_ASSERT_SUCCESS(ipcq_conn_alloc_region(cli, BUF_SIZE, 0, &cap),
+			"ipcq_socket: cannot allocate region");
+	memset(cap.vaddr, fill, BUF_SIZE);
+	TEST_ASSERT_SUCCESS(cleanq_register(cq, cap, &rid),
+			"ipcq_socket: cannot register region");
+	TEST_ASSERT_SUCCESS(cleanq_enqueue(cq, rid, 0, BUF_SIZE, 0, 64, 0),
+			"ipcq_socket: cannot send");
+	/* the registration comes first */
+	for (i = 0; i < 2 && err == CLEANQ_ERR_QUEUE_EMPTY; i++)
+		err = cleanq_dequeue(sq, &b.rid, &b.offset, &b.length,
+				&b.valid_data, &b.valid_length, &b.flags);
+	TEST_ASSERT_SUCCESS(err, "ipcq_socket: nothing received");
+	TEST_ASSERT(((uint8_t *) ipcq_reg_cap.vaddr)[b.offset] == fill,
+			"ipcq_socket: other memory mapped for region %u", rid);
+
+	TEST_ASSERT_SUCCESS(cleanq_enqueue(sq, b.rid, b.offset, b.length,
+			b.valid_data, b.valid_length, b.flags),
+			"ipcq_socket: cannot return buffer");
+	TEST_ASSERT_SUCCESS(cleanq_dequeue(cq, &b.rid, &b.offset, &b.length,
+			&b.valid_data, &b.valid_length, &b.flags),
+			"ipcq_socket: buffer not returned");
+	TEST_ASSERT_SUCCESS(cleanq_deregister(cq, rid, &cap),
+			"ipcq_socket: cannot deregister region");
+	/* lets the listener see the deregistration */
+	cleanq_dequeue(sq, &b.rid, &b.offset, &b.length, &b.valid_data,
+			&b.valid_length, &b.flags);
+	TEST_ASSERT_SUCCESS(ipcq_conn_free_region(cli, &cap),
+			"ipcq_socket: cannot free region");
+	return 0;
+}
+
+/*
+ * A region freed by the connecting side is unmapped by the listener, a
+ * region allocated afterwards at the same address is mapped anew
+ */
+static int
+test_ipcq_socket(void)
+{
+	struct ipcq_conn_params params = {
+		.num_queues = 1,
+		.ring_size = IPCQ_MEM_SIZE,
+		.format = IPCQ_DESC_DEFAULT,
+	};
+	struct ipcq_accept_arg a;
+	struct ipcq_conn *cli;
+	struct cleanq *cq, *sq;
+	pthread_t t;
+	char path[32];
+	int ret = -1;
+
+	snprintf(path, sizeof(path), "@cleanq_test_sock_%d", getpid());
+	TEST_ASSERT_SUCCESS(ipcq_listen(&a.l, path, &params),
+			"ipcq_socket: cannot listen on %s", path);
+	a.c = NULL;
+	if (pthread_create(&t, NULL, ipcq_accept_thread, &a) != 0) {
+		ipcq_listener_destroy(a.l);
+		return -1;
+	}
+	if (ipcq_connect(&cli, path, &params, &ipcq_funcs,
+			rte_socket_id()) != CLEANQ_ERR_OK) {
+		cli = NULL;
+		/* wakes up the accept if the connect did not get that far */
+		shutdown(ipcq_listener_get_fd(a.l), SHUT_RDWR);
+	}
+	pthread_join(t, NULL);
+	ipcq_listener_destroy(a.l);
+	if (cli == NULL || err_is_fail(a.err)) {
+		printf("ipcq_socket: cannot connect\n");
+		goto out;
+	}
+
+	cq = (struct cleanq *) ipcq_conn_get_queue(cli, 0);
+	sq = (struct cleanq *) ipcq_conn_get_queue(a.c, 0);
+	if (ipcq_socket_round(cli, cq, sq, 1) != 0 ||
+			ipcq_socket_round(cli, cq, sq, 2) != 0)
+		goto out;
+
+	printf("ipcq_socket: OK\n");
+	ret = 0;
+out:
+	if (cli != NULL)
+		ipcq_conn_destroy(cli);
+	if (a.c != NULL)
+		ipcq_conn_destroy(a.c);
+	return ret;
+}
+
+/* a buffer has to be dequeued before it can be enqueued again */
+static int
+test_debug_ownership(void *mem)
+{
+	struct test_q tq;
+	struct cleanq_buf b;
+	regionid_t rid;
+	int ret = -1;
+
+	memset(&tq, 0, sizeof(tq));
+	tq.name = "debug";
+	if (debug_init(&tq) != 0 || register_mem(&tq, mem, &rid) != 0)
+		goto out;
+
+	if (cleanq_enqueue(tq.tx, rid, 0, BUF_SIZE, 0, 64, 0) !=
+			CLEANQ_ERR_OK) {
+		printf("debug: enqueue failed\n");
+		goto out;
+	}
+	if (err_is_ok(cleanq_enqueue(tq.tx, rid, 0, BUF_SIZE, 0, 64, 0)) ||
+			err_is_ok(cleanq_enqueue(tq.tx, rid, BUF_SIZE / 2,
+				BUF_SIZE, 0, 64, 0))) {
+		printf("debug: buffer in use enqueued again\n");
+		goto out;
+	}
+	if (cleanq_dequeue(tq.rx, &b.rid, &b.offset, &b.length,
+			&b.valid_data, &b.valid_length, &b.flags) !=
+			CLEANQ_ERR_OK ||
+			cleanq_enqueue(tq.tx, rid, 0, BUF_SIZE, 0, 64, 0) !=
+			CLEANQ_ERR_OK ||
+			cleanq_dequeue(tq.rx, &b.rid, &b.offset, &b.length,
+				&b.valid_data, &b.valid_length, &b.flags) !=
+			CLEANQ_ERR_OK) {
+		printf("debug: dequeued buffer cannot be enqueued again\n");
+		goto out;
+	}
+	if (test_deregister(&tq, mem, rid) != 0)
+		goto out;
+
+	printf("debug ownership: OK\n");
+	ret = 0;
+out:
+	test_q_free(&tq);
+	return ret;
+}
+
+static void
+build_udp_frame(uint8_t *pkt, uint16_t len)
+{
+	struct ether_hdr *eth = (struct ether_hdr *) pkt;
+	struct ipv4_hdr *ip = (struct ipv4_hdr *) (eth + 1);
+	struct udp_hdr *udp = (struct udp_hdr *) (ip + 1);
+	static const struct ether_addr src = {{ 0x02, 0, 0, 0, 0, 0x01 }};
+	static const struct ether_addr dst = {{ 0x02, 0, 0, 0, 0, 0x02 }};
+
+	memset(pkt, 0, len);
+	ether_addr_copy(&src, &eth->s_addr);
+	ether_addr_copy(&dst, &eth->d_addr);
+	eth->ether_type = rte_cpu_to_be_16(ETHER_TYPE_IPv4);
+	ip->version_ihl = 0x45;
+	ip->total_length = rte_cpu_to_be_16(len - sizeof(*eth));
+	ip->time_to_live = 64;
+	ip->next_proto_id = IPPROTO_UDP;
+	ip->src_addr = rte_cpu_to_be_32(IPv4(10, 0, 0, 1));
+	ip->dst_addr = rte_cpu_to_be_32(IPv4(10, 0, 0, 2));
+	ip->hdr_checksum = rte_ipv4_cksum(ip);
+	udp->src_port = rte_cpu_to_be_16(1234);
+	udp->dst_port = rte_cpu_to_be_16(7);
+	udp->dgram_len = rte_cpu_to_be_16(len - sizeof(*eth) - sizeof(*ip));
+}
+
+/*
+ * The frame sent comes back in the posted buffer, addressed to the sender,
+ * without a posted buffer it is dropped
+ */
+static int
+test_reflector(uint8_t *mem)
+{
+	static const struct ether_addr src = {{ 0x02, 0, 0, 0, 0, 0x01 }};
+	struct reflector_q *refl;
+	struct cleanq *rx, *tx;
+	struct capref cap;
+	struct cleanq_buf b;
+	struct ether_hdr *eth;
+	struct ipv4_hdr *ip;
+	struct udp_hdr *udp;
+	uint64_t reflected, dropped;
+	const uint16_t len = 128;
+	regionid_t rid;
+
+	TEST_ASSERT_SUCCESS(reflector_create(&refl, rte_socket_id()),
+			"cannot create reflector");
+	rx = reflector_get_rx(refl);
+	tx = reflector_get_tx(refl);
+
+	cap.vaddr = mem;
+	cap.paddr = rte_malloc_virt2iova(mem);
+	cap.len = MEM_SIZE;
+	TEST_ASSERT_SUCCESS(cleanq_register(tx, cap, &rid),
+			"reflector: cannot register region");
+
+	build_udp_frame(mem, len);
+	TEST_ASSERT_SUCCESS(cleanq_enqueue(rx, rid, BUF_SIZE, BUF_SIZE, 64, 0,
+			42), "reflector: cannot post buffer");
+	TEST_ASSERT_SUCCESS(cleanq_enqueue(tx, rid, 0, BUF_SIZE, 0, len, 0),
+			"reflector: cannot send");
+
+	TEST_ASSERT_SUCCESS(cleanq_dequeue(rx, &b.rid, &b.offset, &b.length,
+			&b.valid_data, &b.valid_length, &b.flags),
+			"reflector: nothing received");
+	TEST_ASSERT(b.offset == BUF_SIZE && b.valid_data == 64 &&
+			b.valid_length == len && b.flags == 42,
+			"reflector: wrong receive buffer");
+
+	eth = (struct ether_hdr *) (mem + BUF_SIZE + 64);
+	ip = (struct ipv4_hdr *) (eth + 1);
+	udp = (struct udp_hdr *) (ip + 1);
+	TEST_ASSERT(is_same_ether_addr(&eth->d_addr, &src) &&
+			ip->dst_addr == rte_cpu_to_be_32(IPv4(10, 0, 0, 1)) &&
+			udp->dst_port == rte_cpu_to_be_16(1234) &&
+			ip->hdr_checksum == ((struct ipv4_hdr *) (mem +
+				sizeof(*eth)))->hdr_checksum,
+			"reflector: frame not reflected");
+
+	TEST_ASSERT_SUCCESS(cleanq_dequeue(tx, &b.rid, &b.offset, &b.length,
+			&b.valid_data, &b.valid_length, &b.flags),
+			"reflector: sent buffer not returned");
+	TEST_ASSERT_EQUAL(b.offset, 0, "reflector: wrong sent buffer");
+
+	/* nothing posted */
+	TEST_ASSERT_SUCCESS(cleanq_enqueue(tx, rid, 0, BUF_SIZE, 0, len, 0),
+			"reflector: cannot send");
+	TEST_ASSERT_EQUAL(cleanq_dequeue(rx, &b.rid, &b.offset, &b.length,
+			&b.valid_data, &b.valid_length, &b.flags),
+			CLEANQ_ERR_QUEUE_EMPTY, "reflector: received unposted");
+	TEST_ASSERT_SUCCESS(cleanq_dequeue(tx, &b.rid, &b.offset, &b.length,
+			&b.valid_data, &b.valid_length, &b.flags),
+			"reflector: dropped buffer not returned");
+	reflector_get_stats(refl, &reflected, &dropped);
+	TEST_ASSERT(reflected == 1 && dropped == 1,
+			"reflector: %"PRIu64" reflected, %"PRIu64" dropped",
+			reflected, dropped);
+
+	/* and again after the region came back */
+	TEST_ASSERT_SUCCESS(cleanq_deregister(tx, rid, &cap),
+			"reflector: cannot deregister region");
+	TEST_ASSERT_SUCCESS(cleanq_register(tx, cap, &rid),
+			"reflector: cannot register region again");
+	TEST_ASSERT_SUCCESS(cleanq_enqueue(rx, rid, BUF_SIZE, BUF_SIZE, 0, 0,
+			0), "reflector: cannot post buffer again");
+	TEST_ASSERT_SUCCESS(cleanq_deregister(tx, rid, &cap),
+			"reflector: cannot deregister region");
+	/* an empty slot has rid 0 */
+	TEST_ASSERT_FAIL(cleanq_set_region_headroom(tx, rid, 64),
+			"reflector: headroom of a deregistered region set");
+	TEST_ASSERT_FAIL(cleanq_set_region_headroom(tx, 0, 64),
+			"reflector: headroom of an unknown region set");
+
+	reflector_destroy(refl);
+	printf("reflector: OK\n");
+	return 0;
+}
+
+static int
+mem_untouched(const uint8_t *mem, size_t len)
+{
+	size_t i;
+
+	for (i = 0; i < len; i++)
+		if (mem[i] != 0)
+			return 0;
+	return 1;
+}
+
+/*
+ * The policy set on the top of a stack applies to the queues below. Only
+ * the half of the memory is registered, the buffer after it is invalid.
+ */
+static int
+test_validation(uint8_t *mem)
+{
+	static struct ether_addr mac = {{ 0x02, 0, 0, 0, 0, 0x01 }};
+	const genoffset_t bad = MEM_SIZE / 2;
+	struct reflector_q *refl;
+	struct udp_q *udp;
+	struct cleanq *uq;
+	struct cleanq_stats st;
+	struct test_q tq;
+	struct capref cap;
+	struct cleanq_buf b;
+	regionid_t rid;
+	int ret = -1;
+
+	cap.vaddr = mem;
+	cap.paddr = rte_malloc_virt2iova(mem);
+	cap.len = MEM_SIZE / 2;
+	memset(mem + bad, 0, BUF_SIZE);
+
+	/* loopback is only checked where the buffer enters the stack */
+	memset(&tq, 0, sizeof(tq));
+	tq.name = "validation";
+	if (debug_init(&tq) != 0)
+		goto out;
+	TEST_ASSERT_SUCCESS(cleanq_register(tq.tx, cap, &rid),
+			"validation: cannot register region");
+	if (cleanq_enqueue(tq.lower, rid, bad, BUF_SIZE, 0, 64, 0) !=
+			CLEANQ_ERR_INVALID_BUFFER_ARGS) {
+		printf("validation: invalid buffer accepted by default\n");
+		goto out;
+	}
+#ifndef RTE_LIBCLEANQ_DEBUG
+	if (cleanq_set_validation(tq.tx, CLEANQ_VALIDATE_TRUSTED) !=
+			CLEANQ_ERR_OK ||
+			cleanq_enqueue(tq.lower, rid, bad, BUF_SIZE, 0, 64, 0) !=
+			CLEANQ_ERR_OK ||
+			cleanq_dequeue(tq.lower, &b.rid, &b.offset, &b.length,
+				&b.valid_data, &b.valid_length, &b.flags) !=
+			CLEANQ_ERR_OK || b.offset != bad) {
+		printf("validation: trusted policy not passed down\n");
+		goto out;
+	}
+#endif
+	test_q_free(&tq);
+	memset(&tq, 0, sizeof(tq));
+
+	/* a module checks before it writes its header into the buffer */
+	TEST_ASSERT_SUCCESS(reflector_create(&refl, rte_socket_id()),
+			"validation: cannot create reflector");
+	TEST_ASSERT_SUCCESS(udp_create(&udp, reflector_get_rx(refl),
+			reflector_get_tx(refl), 1234, 7, IPv4(10, 0, 0, 1),
+			IPv4(10, 0, 0, 2), &mac, &mac, rte_socket_id()),
+			"validation: cannot create UDP queue");
+	uq = (struct cleanq *) udp;
+	if (cleanq_register(uq, cap, &rid) != CLEANQ_ERR_OK ||
+			cleanq_set_validation(uq, CLEANQ_VALIDATE_TRUSTED) !=
+			CLEANQ_ERR_OK ||
+			cleanq_set_validation(udp_get_ip(udp),
+				CLEANQ_VALIDATE_FULL) != CLEANQ_ERR_OK) {
+		printf("validation: cannot set up UDP queue\n");
+		goto udp_out;
+	}
+	if (cleanq_enqueue(uq, rid, bad, BUF_SIZE, 0, 128, NETIF_TXFLAG | 7) !=
+			CLEANQ_ERR_INVALID_BUFFER_ARGS ||
+			!mem_untouched(mem + bad, BUF_SIZE) ||
+			cleanq_get_stats(uq, &st) != CLEANQ_ERR_OK ||
+			st.invalid != 1) {
+		printf("validation: invalid buffer written or passed down\n");
+		goto udp_out;
+	}
+	/* a runt has no room for the headers, unknown flags are rejected */
+	memset(mem + BUF_SIZE, 0, BUF_SIZE);
+	if (cleanq_enqueue(uq, rid, BUF_SIZE, BUF_SIZE, 0, 20,
+				NETIF_TXFLAG | 7) != CLEANQ_ERR_INVALID_BUFFER_ARGS ||
+			!mem_untouched(mem + BUF_SIZE, BUF_SIZE) ||
+			cleanq_enqueue(uq, rid, BUF_SIZE, BUF_SIZE, 0, 128, 0) !=
+			CLEANQ_ERR_UNKNOWN_FLAG ||
+			cleanq_get_stats(uq, &st) != CLEANQ_ERR_OK ||
+			st.invalid != 3) {
+		printf("validation: runt or unknown flags accepted\n");
+		goto udp_out;
+	}
+	if (cleanq_enqueue(uq, rid, 0, BUF_SIZE, 0, 128, NETIF_TXFLAG | 7) !=
+			CLEANQ_ERR_OK ||
+			cleanq_dequeue(uq, &b.rid, &b.offset, &b.length,
+				&b.valid_data, &b.valid_length, &b.flags) !=
+			CLEANQ_ERR_OK || b.offset != 0) {
+		printf("validation: valid buffer not sent\n");
+		goto udp_out;
+	}
+
+	printf("validation: OK\n");
+	ret = 0;
+udp_out:
+	udp_destroy(udp);
+	reflector_destroy(refl);
+out:
+	test_q_free(&tq);
+	return ret;
+}
+
+#define ARP_IP(x) rte_cpu_to_be_32(IPv4(10, 0, 0, (x)))
+
+static void
+build_arp_frame(uint8_t *pkt, uint16_t op, const struct ether_addr *sha,
+		uint32_t sip, uint32_t tip)
+{
+	struct ether_hdr *eth = (struct ether_hdr *) pkt;
+	struct arp_hdr *arp = (struct arp_hdr *) (eth + 1);
+
+	memset(pkt, 0, 64);
+	memset(&eth->d_addr, 0xff, ETHER_ADDR_LEN);
+	ether_addr_copy(sha, &eth->s_addr);
+	eth->ether_type = rte_cpu_to_be_16(ETHER_TYPE_ARP);
+	arp->arp_hrd = rte_cpu_to_be_16(ARP_HRD_ETHER);
+	arp->arp_pro = rte_cpu_to_be_16(ETHER_TYPE_IPv4);
+	arp->arp_hln = ETHER_ADDR_LEN;
+	arp->arp_pln = sizeof(uint32_t);
+	arp->arp_op = rte_cpu_to_be_16(op);
+	ether_addr_copy(sha, &arp->arp_data.arp_sha);
+	arp->arp_data.arp_sip = sip;
+	arp->arp_data.arp_tip = tip;
+}
+
+/* a UDP frame to 10.0.0.x in buffer i, sent to be resolved */
+static errval_t
+arp_send_to(struct cleanq *atx, uint8_t *mem, regionid_t rid, unsigned i,
+		uint8_t x)
+{
+	uint8_t *pkt = mem + i * BUF_SIZE;
+	struct ether_hdr *eth = (struct ether_hdr *) pkt;
+
+	build_udp_frame(pkt, 128);
+	memset(&eth->d_addr, 0, ETHER_ADDR_LEN);
+	((struct ipv4_hdr *) (eth + 1))->dst_addr = ARP_IP(x);
+	return cleanq_enqueue(atx, rid, i * BUF_SIZE, BUF_SIZE, 0, 128,
+			NETIF_TXFLAG | NETIF_TXFLAG_RESOLVE);
+}
+
+static int
+arp_neigh_is(const struct arp_neigh *n, const struct ether_addr *mac)
+{
+	struct ether_addr m;
+	uint64_t v;
+
+	if (n == NULL)
+		return 0;
+	v = arp_neigh_load(n);
+	if (!arp_neigh_valid(v))
+		return 0;
+	arp_neigh_copy(v, &m);
+	return is_same_ether_addr(&m, mac);
+}
+
+/*
+ * The ARP queue on two loopback queues standing in for the NIC: what is
+ * enqueued to the receive loopback comes from the wire, the send loopback
+ * hands back what was sent. At most 3 receive buffers are posted, the ARP
+ * queue keeps up to 4 to send with, so it never gives one back to the
+ * receive loopback. Aging takes ARP_MAX_TRIES seconds.
+ */
+static int
+test_arp(uint8_t *mem)
+{
+	static struct ether_addr us = {{ 0x02, 0, 0, 0, 0, 0x01 }};
+	static const struct ether_addr peer = {{ 0x02, 0, 0, 0, 0, 0x02 }};
+	static const struct ether_addr other = {{ 0x02, 0, 0, 0, 0, 0x03 }};
+	struct loopback_queue *lrx, *ltx;
+	struct cleanq *nrx, *ntx, *arx, *atx;
+	struct arp_table *t;
+	struct arp_q *arp = NULL;
+	const struct arp_neigh *n;
+	struct udp_ip_q *uiq;
+	struct udp_q *udp;
+	struct cleanq_stats st;
+	struct capref cap;
+	struct cleanq_buf b;
+	struct ether_hdr *eth;
+	struct arp_hdr *ah;
+	uint64_t start;
+	regionid_t rid;
+	unsigned i;
+	int ret = -1;
+
+	TEST_ASSERT_SUCCESS(loopback_queue_create(&lrx, rte_socket_id()),
+			"arp: cannot create loopback queue");
+	TEST_ASSERT_SUCCESS(loopback_queue_create(&ltx, rte_socket_id()),
+			"arp: cannot create loopback queue");
+	nrx = (struct cleanq *) lrx;
+	ntx = (struct cleanq *) ltx;
+
+	/* without ARP below the destination MAC is needed */
+	if (udp_create(&udp, nrx, ntx, 1234, 7, ARP_IP(1), ARP_IP(2), &us,
+			NULL, rte_socket_id()) != CLEANQ_ERR_INIT_QUEUE ||
+			udp_ip_create(&uiq, nrx, ntx, 1234, 7, ARP_IP(1),
+				ARP_IP(2), &us, NULL, rte_socket_id()) !=
+			CLEANQ_ERR_INIT_QUEUE) {
+		printf("arp: missing destination MAC accepted\n");
+		goto out;
+	}
+
+	if (arp_table_create(&t, ARP_IP(1), rte_cpu_to_be_32(0xffffff00), 0,
+			&us, rte_socket_id()) != CLEANQ_ERR_OK) {
+		printf("arp: cannot create table\n");
+		goto out;
+	}
+	if (arp_create(&arp, t, nrx, ntx, rte_socket_id()) != CLEANQ_ERR_OK) {
+		printf("arp: cannot create queue\n");
+		goto table_out;
+	}
+	arx = arp_get_rx(arp);
+	atx = arp_get_tx(arp);
+
+	/* both sides hand out the same entry, the NIC has none */
+	n = arp_neigh_query(atx, ARP_IP(2));
+	if (n == NULL || arp_neigh_valid(arp_neigh_load(n)) ||
+			arp_neigh_query(arx, ARP_IP(2)) != n ||
+			arp_neigh_query(ntx, ARP_IP(2)) != NULL) {
+		printf("arp: wrong neighbor entry\n");
+		goto arp_out;
+	}
+	if (udp_ip_create(&uiq, arx, atx, 1234, 7, ARP_IP(1), ARP_IP(2), &us,
+			NULL, rte_socket_id()) != CLEANQ_ERR_OK) {
+		printf("arp: destination MAC needed with ARP\n");
+		goto arp_out;
+	}
+	if (cleanq_destroy((struct cleanq *) uiq) != CLEANQ_ERR_OK) {
+		printf("arp: cannot destroy UDP/IP queue\n");
+		goto arp_out;
+	}
+
+	cap.vaddr = mem;
+	cap.paddr = rte_malloc_virt2iova(mem);
+	cap.len = MEM_SIZE;
+	if (cleanq_register(atx, cap, &rid) != CLEANQ_ERR_OK ||
+			cleanq_add_region(arx, cap, rid) != CLEANQ_ERR_OK) {
+		printf("arp: cannot register region\n");
+		goto arp_out;
+	}
+	for (i = 1; i <= 2; i++) {
+		if (cleanq_enqueue(arx, rid, i * BUF_SIZE, BUF_SIZE, 0, 0,
+				NETIF_RXFLAG) != CLEANQ_ERR_OK) {
+			printf("arp: cannot post buffer\n");
+			goto arp_out;
+		}
+	}
+
+	/* a miss is held and asked for with one of the posted buffers */
+	eth = (struct ether_hdr *) (mem + 2 * BUF_SIZE);
+	ah = (struct arp_hdr *) (eth + 1);
+	if (arp_send_to(atx, mem, rid, 0, 2) != CLEANQ_ERR_OK ||
+			cleanq_dequeue(atx, &b.rid, &b.offset, &b.length,
+				&b.valid_data, &b.valid_length, &b.flags) !=
+			CLEANQ_ERR_QUEUE_EMPTY ||
+			!is_broadcast_ether_addr(&eth->d_addr) ||
+			eth->ether_type != rte_cpu_to_be_16(ETHER_TYPE_ARP) ||
+			ah->arp_op != rte_cpu_to_be_16(ARP_OP_REQUEST) ||
+			ah->arp_data.arp_tip != ARP_IP(2)) {
+		printf("arp: no request for a miss\n");
+		goto arp_out;
+	}
+
+	/* the reply resolves it and sends the held packet */
+	build_arp_frame(mem + 3 * BUF_SIZE, ARP_OP_REPLY, &peer, ARP_IP(2),
+			ARP_IP(1));
+	eth = (struct ether_hdr *) mem;
+	if (cleanq_enqueue(nrx, rid, 3 * BUF_SIZE, BUF_SIZE, 0, 42, 0) !=
+			CLEANQ_ERR_OK ||
+			cleanq_dequeue(arx, &b.rid, &b.offset, &b.length,
+				&b.valid_data, &b.valid_length, &b.flags) !=
+			CLEANQ_ERR_QUEUE_EMPTY || !arp_neigh_is(n, &peer) ||
+			cleanq_dequeue(atx, &b.rid, &b.offset, &b.length,
+				&b.valid_data, &b.valid_length, &b.flags) !=
+			CLEANQ_ERR_OK || b.offset != 0 ||
+			!is_same_ether_addr(&eth->d_addr, &peer)) {
+		printf("arp: held packet not sent on reply\n");
+		goto arp_out;
+	}
+
+	/* a runt is not looked at */
+	build_arp_frame(mem + 4 * BUF_SIZE, ARP_OP_REPLY, &peer, ARP_IP(2),
+			ARP_IP(1));
+	if (cleanq_enqueue(nrx, rid, 4 * BUF_SIZE, BUF_SIZE, 0, 10, 0) !=
+			CLEANQ_ERR_OK ||
+			cleanq_dequeue(arx, &b.rid, &b.offset, &b.length,
+				&b.valid_data, &b.valid_length, &b.flags) !=
+			CLEANQ_ERR_OK || b.offset != 4 * BUF_SIZE ||
+			b.valid_length != 10) {
+		printf("arp: runt not passed up\n");
+		goto arp_out;
+	}
+
+	/* a request for us is answered in its buffer, the sender learned */
+	build_arp_frame(mem + 5 * BUF_SIZE, ARP_OP_REQUEST, &other, ARP_IP(3),
+			ARP_IP(1));
+	eth = (struct ether_hdr *) (mem + 5 * BUF_SIZE);
+	ah = (struct arp_hdr *) (eth + 1);
+	if (cleanq_enqueue(nrx, rid, 5 * BUF_SIZE, BUF_SIZE, 0, 42, 0) !=
+			CLEANQ_ERR_OK ||
+			cleanq_dequeue(arx, &b.rid, &b.offset, &b.length,
+				&b.valid_data, &b.valid_length, &b.flags) !=
+			CLEANQ_ERR_QUEUE_EMPTY ||
+			!is_same_ether_addr(&eth->d_addr, &other) ||
+			!is_same_ether_addr(&eth->s_addr, &us) ||
+			ah->arp_op != rte_cpu_to_be_16(ARP_OP_REPLY) ||
+			!is_same_ether_addr(&ah->arp_data.arp_sha, &us) ||
+			ah->arp_data.arp_sip != ARP_IP(1) ||
+			!is_same_ether_addr(&ah->arp_data.arp_tha, &other) ||
+			ah->arp_data.arp_tip != ARP_IP(3) ||
+			cleanq_dequeue(atx, &b.rid, &b.offset, &b.length,
+				&b.valid_data, &b.valid_length, &b.flags) !=
+			CLEANQ_ERR_QUEUE_EMPTY ||
+			!arp_neigh_is(arp_neigh_query(atx, ARP_IP(3)), &other)) {
+		printf("arp: request not answered\n");
+		goto arp_out;
+	}
+
+	/* without an answer the packet comes back as dropped */
+	if (arp_send_to(atx, mem, rid, 6, 4) != CLEANQ_ERR_OK) {
+		printf("arp: cannot send\n");
+		goto arp_out;
+	}
+	start = rte_get_timer_cycles();
+	for (;;) {
+		cleanq_dequeue(arx, &b.rid, &b.offset, &b.length,
+				&b.valid_data, &b.valid_length, &b.flags);
+		if (cleanq_dequeue(atx, &b.rid, &b.offset, &b.length,
+				&b.valid_data, &b.valid_length, &b.flags) ==
+				CLEANQ_ERR_OK)
+			break;
+		if (rte_get_timer_cycles() - start > 5 * rte_get_timer_hz()) {
+			printf("arp: unanswered packet not given back\n");
+			goto arp_out;
+		}
+		rte_delay_ms(10);
+	}
+	if (b.offset != 6 * BUF_SIZE ||
+			cleanq_get_stats(atx, &st) != CLEANQ_ERR_OK ||
+			st.dropped != 1) {
+		printf("arp: wrong packet dropped\n");
+		goto arp_out;
+	}
+
+	/* destroying it hands back the held, sent and kept buffers */
+	if (arp_send_to(atx, mem, rid, 7, 5) != CLEANQ_ERR_OK ||
+			arp_destroy(arp) != CLEANQ_ERR_BUFFER_ALREADY_IN_USE ||
+			cleanq_dequeue(atx, &b.rid, &b.offset, &b.length,
+				&b.valid_data, &b.valid_length, &b.flags) !=
+			CLEANQ_ERR_OK || b.offset != 7 * BUF_SIZE ||
+			cleanq_dequeue(atx, &b.rid, &b.offset, &b.length,
+				&b.valid_data, &b.valid_length, &b.flags) !=
+			CLEANQ_ERR_QUEUE_EMPTY ||
+			arp_destroy(arp) != CLEANQ_ERR_OK) {
+		printf("arp: cannot destroy with buffers held\n");
+		goto arp_out;
+	}
+	arp = NULL;
+	for (i = 0; cleanq_dequeue(nrx, &b.rid, &b.offset, &b.length,
+			&b.valid_data, &b.valid_length, &b.flags) ==
+			CLEANQ_ERR_OK; i++)
+		;
+	if (i != 4) {
+		printf("arp: %u of 4 kept buffers given back\n", i);
+		goto table_out;
+	}
+
+	printf("arp: OK\n");
+	ret = 0;
+arp_out:
+	if (arp != NULL)
+		arp_destroy(arp);
+table_out:
+	arp_table_destroy(t);
+out:
+	cleanq_destroy(nrx);
+	cleanq_destroy(ntx);
+	return ret;
+}
+
+#define ETHDEV_NB_MBUFS 511
+#define ETHDEV_BURST 8
+
+/*
+ * A port made from a loopback queue with rte_eth_from_cleanq(), the packets
+ * sent come back as the received ones and every mbuf is back in its pool
+ * once the port is gone
+ */
+static int
+test_ethdev(void)
+{
+	const struct rte_eth_cleanq_conf conf = { .loopback = 1 };
+	struct rte_eth_conf port_conf;
+	struct rte_eth_stats stats;
+	struct rte_mbuf *tx[ETHDEV_BURST], *rx[ETHDEV_BURST];
+	struct loopback_queue *lq;
+	struct rte_mempool *mp;
+	struct cleanq *q;
+	uint16_t nb_rx = 0;
+	unsigned i;
+	int port;
+	int ret = -1;
+
+	mp = rte_pktmbuf_pool_create("cleanq_test_pool", ETHDEV_NB_MBUFS, 0, 0,
+			RTE_MBUF_DEFAULT_BUF_SIZE, rte_socket_id());
+	if (mp == NULL) {
+		printf("ethdev: cannot create mempool\n");
+		return -1;
+	}
+	if (loopback_queue_create(&lq, rte_socket_id()) != CLEANQ_ERR_OK) {
+		printf("ethdev: cannot create loopback queue\n");
+		goto pool_out;
+	}
+	q = (struct cleanq *) lq;
+
+	port = rte_eth_from_cleanq("test", &q, 1, &q, 1, rte_socket_id(),
+			&conf);
+	if (port < 0) {
+		printf("ethdev: cannot create port\n");
+		goto q_out;
+	}
+
+	memset(&port_conf, 0, sizeof(port_conf));
+	if (rte_eth_dev_configure(port, 1, 1, &port_conf) != 0 ||
+			rte_eth_rx_queue_setup(port, 0, 64, rte_socket_id(),
+				NULL, mp) != 0 ||
+			rte_eth_tx_queue_setup(port, 0, 64, rte_socket_id(),
+				NULL) != 0 ||
+			rte_eth_dev_start(port) != 0) {
+		printf("ethdev: cannot set up port\n");
+		goto port_out;
+	}
+
+	if (rte_pktmbuf_alloc_bulk(mp, tx, ETHDEV_BURST) != 0) {
+		printf("ethdev: cannot allocate mbufs\n");
+		goto port_out;
+	}
+	for (i = 0; i < ETHDEV_BURST; i++)
+		memset(rte_pktmbuf_append(tx[i], 64 + i), i, 64 + i);
+
+	if (rte_eth_tx_burst(port, 0, tx, ETHDEV_BURST) != ETHDEV_BURST) {
+		printf("ethdev: burst not sent\n");
+		goto port_out;
+	}
+	nb_rx = rte_eth_rx_burst(port, 0, rx, ETHDEV_BURST);
+	if (nb_rx != ETHDEV_BURST) {
+		printf("ethdev: %u of %u packets received\n", nb_rx,
+				ETHDEV_BURST);
+		goto port_out;
+	}
+	for (i = 0; i < ETHDEV_BURST; i++) {
+		if (rx[i] != tx[i] || rx[i]->pkt_len != 64 + i ||
+				rx[i]->port != port ||
+				*rte_pktmbuf_mtod_offset(rx[i], uint8_t *,
+					63 + i) != i) {
+			printf("ethdev: wrong packet %u received\n", i);
+			goto port_out;
+		}
+	}
+	if (rte_eth_stats_get(port, &stats) != 0 ||
+			stats.opackets != ETHDEV_BURST ||
+			stats.ipackets != ETHDEV_BURST) {
+		printf("ethdev: wrong statistics\n");
+		goto port_out;
+	}
+	ret = 0;
+
+port_out:
+	for (i = 0; i < nb_rx; i++)
+		rte_pktmbuf_free(rx[i]);
+	rte_vdev_uninit("net_cleanq_test");
+	if (ret == 0 && rte_mempool_avail_count(mp) != ETHDEV_NB_MBUFS) {
+		printf("ethdev: %u of %u mbufs back\n",
+				rte_mempool_avail_count(mp), ETHDEV_NB_MBUFS);
+		ret = -1;
+	}
+q_out:
+	cleanq_destroy(q);
+pool_out:
+	rte_mempool_free(mp);
+	if (ret == 0)
+		printf("ethdev: OK\n");
+	return ret;
+}
+
+#ifdef RTE_LIBRTE_PMD_RING
+#define ETHDEV_Q_RING "cleanq_test_ring"
+
+/*
+ * The queues of a net_ring port sending into its own receive ring. The
+ * packets are received into the buffers posted on the receive side, in
+ * order, and a sent buffer comes back once the ring gave its packet to the
+ * receive side.
+ */
+static int
+test_ethdev_q(void)
+{
+	struct rte_mbuf *tx[ETHDEV_BURST], *posted[ETHDEV_BURST];
+	struct rte_eth_conf port_conf;
+	struct ethdev_q *eq = NULL;
+	struct rte_mempool *mp;
+	struct rte_ring *ring;
+	struct cleanq *rxq, *txq;
+	struct cleanq_buf b, p;
+	unsigned i;
+	int port;
+	int ret = -1;
+
+	mp = rte_pktmbuf_pool_create("cleanq_test_pool", ETHDEV_NB_MBUFS, 0, 0,
+			RTE_MBUF_DEFAULT_BUF_SIZE, rte_socket_id());
+	if (mp == NULL) {
+		printf("ethdev_q: cannot create mempool\n");
+		return -1;
+	}
+	ring = rte_ring_create(ETHDEV_Q_RING, 64, rte_socket_id(),
+			RING_F_SP_ENQ | RING_F_SC_DEQ);
+	if (ring == NULL) {
+		printf("ethdev_q: cannot create ring\n");
+		goto pool_out;
+	}
+	port = rte_eth_from_ring(ring);
+	if (port < 0) {
+		printf("ethdev_q: cannot create port\n");
+		goto ring_out;
+	}
+
+	memset(&port_conf, 0, sizeof(port_conf));
+	if (rte_eth_dev_configure(port, 1, 1, &port_conf) != 0 ||
+			rte_eth_rx_queue_setup(port, 0, 64, rte_socket_id(),
+				NULL, mp) != 0 ||
+			rte_eth_tx_queue_setup(port, 0, 64, rte_socket_id(),
+				NULL) != 0 ||
+			rte_eth_dev_start(port) != 0 ||
+			ethdev_q_create(&eq, port, 0, rte_socket_id()) !=
+				CLEANQ_ERR_OK) {
+		printf("ethdev_q: cannot set up port\n");
+		goto port_out;
+	}
+	rxq = ethdev_q_get_rx(eq);
+	txq = ethdev_q_get_tx(eq);
+
+	/* registered with one side, known to both */
+	if (cleanq_register_mempool(txq, mp) != CLEANQ_ERR_OK ||
+			rte_pktmbuf_alloc_bulk(mp, tx, ETHDEV_BURST) != 0) {
+		printf("ethdev_q: cannot register mbufs\n");
+		goto port_out;
+	}
+	if (rte_pktmbuf_alloc_bulk(mp, posted, ETHDEV_BURST) != 0) {
+		printf("ethdev_q: cannot allocate mbufs\n");
+		goto port_out;
+	}
+
+	for (i = 0; i < ETHDEV_BURST; i++) {
+		memset(rte_pktmbuf_append(tx[i], 64 + i), i, 64 + i);
+		mbuf_to_cleanq_buf(txq, tx[i], &b);
+		if (cleanq_enqueue(txq, b.rid, b.offset, b.length,
+				b.valid_data, b.valid_length,
+				i == ETHDEV_BURST - 1 ? CLEANQ_FLAG_LAST : 0) !=
+				CLEANQ_ERR_OK) {
+			printf("ethdev_q: buffer %u not sent\n", i);
+			goto bufs_out;
+		}
+	}
+
+	/* nothing to receive into, the packets stay in the ring */
+	if (cleanq_dequeue(rxq, &b.rid, &b.offset, &b.length, &b.valid_data,
+			&b.valid_length, &b.flags) != CLEANQ_ERR_QUEUE_EMPTY ||
+			cleanq_dequeue(txq, &b.rid, &b.offset, &b.length,
+			&b.valid_data, &b.valid_length, &b.flags) !=
+			CLEANQ_ERR_QUEUE_EMPTY) {
+		printf("ethdev_q: buffer returned before it was done\n");
+		goto bufs_out;
+	}
+
+	for (i = 0; i < ETHDEV_BURST; i++) {
+		mbuf_to_cleanq_buf(rxq, posted[i], &p);
+		if (cleanq_enqueue(rxq, p.rid, p.offset, p.length,
+				p.valid_data, 0, i) != CLEANQ_ERR_OK) {
+			printf("ethdev_q: buffer %u not posted\n", i);
+			goto bufs_out;
+		}
+	}
+
+	for (i = 0; i < ETHDEV_BURST; i++) {
+		mbuf_to_cleanq_buf(rxq, posted[i], &p);
+		if (cleanq_dequeue(rxq, &b.rid, &b.offset, &b.length,
+				&b.valid_data, &b.valid_length, &b.flags) !=
+				CLEANQ_ERR_OK || b.rid != p.rid ||
+				b.offset != p.offset || b.flags != i ||
+				b.valid_length != 64 + i ||
+				posted[i]->pkt_len != 64 + i ||
+				*rte_pktmbuf_mtod_offset(posted[i], uint8_t *,
+					63 + i) != i) {
+			printf("ethdev_q: packet %u not in its buffer\n", i);
+			goto bufs_out;
+		}
+	}
+
+	for (i = 0; i < ETHDEV_BURST; i++) {
+		mbuf_to_cleanq_buf(txq, tx[i], &p);
+		if (cleanq_dequeue(txq, &b.rid, &b.offset, &b.length,
+				&b.valid_data, &b.valid_length, &b.flags) !=
+				CLEANQ_ERR_OK || b.rid != p.rid ||
+				b.offset != p.offset ||
+				b.valid_length != 64 + i) {
+			printf("ethdev_q: sent buffer %u not back\n", i);
+			goto bufs_out;
+		}
+	}
+	ret = 0;
+
+bufs_out:
+	/* those not dequeued are freed by the queues */
+	for (i = 0; ret == 0 && i < ETHDEV_BURST; i++) {
+		rte_pktmbuf_free(tx[i]);
+		rte_pktmbuf_free(posted[i]);
+	}
+port_out:
+	rte_eth_dev_stop(port);
+	if (eq != NULL)
+		ethdev_q_destroy(eq);
+	rte_vdev_uninit("net_ring_" ETHDEV_Q_RING);
+	if (ret == 0 && rte_mempool_avail_count(mp) != ETHDEV_NB_MBUFS) {
+		printf("ethdev_q: %u of %u mbufs back\n",
+				rte_mempool_avail_count(mp), ETHDEV_NB_MBUFS);
+		ret = -1;
+	}
+ring_out:
+	rte_ring_free(ring);
+pool_out:
+	rte_mempool_free(mp);
+	if (ret == 0)
+		printf("ethdev_q: OK\n");
+	return ret;
+}
+#endif
+
+#define AF_PACKET_ETHERTYPE 0x88b5	/* local experimental */
+#define AF_PACKET_LEN 100
+#define AF_PACKET_TRIES 1000
+#define AF_PACKET_NB_MBUFS 511
+
+static void
+build_local_frame(uint8_t *pkt, uint8_t tag)
+{
+	struct ether_hdr *eth = (struct ether_hdr *) pkt;
+
+	memset(eth, 0, sizeof(*eth));
+	eth->ether_type = rte_cpu_to_be_16(AF_PACKET_ETHERTYPE);
+	memset(pkt + sizeof(*eth), tag, AF_PACKET_LEN - sizeof(*eth));
+}
+
+static int
+is_local_frame(const uint8_t *pkt, genoffset_t len, uint8_t tag)
+{
+	const struct ether_hdr *eth = (const struct ether_hdr *) pkt;
+
+	return len == AF_PACKET_LEN &&
+		eth->ether_type == rte_cpu_to_be_16(AF_PACKET_ETHERTYPE) &&
+		pkt[AF_PACKET_LEN - 1] == tag;
+}
+
+/*
+ * Dequeues from the AF_PACKET queue until the frame tagged tag arrives,
+ * whatever else shows up on lo is given back
+ */
+static int
+af_packet_wait(struct cleanq *rx, struct cleanq_buf *b, regionid_t rid,
+		uint8_t *mem, regionid_t ring_rid, uint8_t *ring, uint8_t tag)
+{
+	const uint8_t *pkt;
+	unsigned i;
+	errval_t err;
+
+	for (i = 0; i < AF_PACKET_TRIES; i++) {
+		err = cleanq_dequeue(rx, &b->rid, &b->offset, &b->length,
+				&b->valid_data, &b->valid_length, &b->flags);
+		if (err == CLEANQ_ERR_QUEUE_EMPTY) {
+			usleep(1000);
+			continue;
+		}
+		TEST_ASSERT_SUCCESS(err, "af_packet: dequeue failed");
+		TEST_ASSERT(b->rid == rid || b->rid == ring_rid,
+				"af_packet: buffer of unknown region %u", b->rid);
+
+		pkt = (b->rid == rid ? mem : ring) + b->offset + b->valid_data;
+		if (is_local_frame(pkt, b->valid_length, tag))
+			return 0;
+
+		TEST_ASSERT_SUCCESS(cleanq_enqueue(rx, b->rid, b->offset,
+				b->length, b->valid_data, 0, b->flags),
+				"af_packet: cannot give back a buffer");
+	}
+	printf("af_packet: frame %u not received\n", tag);
+	return -1;
+}
+
+static int
+af_packet_send(struct cleanq *tx, regionid_t rid, uint8_t *mem, uint8_t tag)
+{
+	struct cleanq_buf b;
+
+	build_local_frame(mem, tag);
+	TEST_ASSERT_SUCCESS(cleanq_enqueue(tx, rid, 0, BUF_SIZE, 0,
+			AF_PACKET_LEN, CLEANQ_FLAG_LAST),
+			"af_packet: cannot send frame %u", tag);
+	/* copied, the buffer is back right away */
+	TEST_ASSERT_SUCCESS(cleanq_dequeue(tx, &b.rid, &b.offset, &b.length,
+			&b.valid_data, &b.valid_length, &b.flags),
+			"af_packet: frame %u not completed", tag);
+	return 0;
+}
+
+/*
+ * Frames sent on lo come back copied into a posted buffer, or in place in
+ * the ring once it is registered and zero-copy is on
+ */
+static int
+test_af_packet_queue(struct af_packet_q *ap, uint8_t *mem)
+{
+	struct cleanq *rx = af_packet_get_rx(ap);
+	struct cleanq *tx = af_packet_get_tx(ap);
+	struct capref cap, ring;
+	struct cleanq_buf b;
+	regionid_t rid, ring_rid;
+
+	cap.vaddr = mem;
+	cap.paddr = rte_malloc_virt2iova(mem);
+	cap.len = MEM_SIZE;
+	/* the receive side knows it then as well */
+	TEST_ASSERT_SUCCESS(cleanq_register(tx, cap, &rid),
+			"af_packet: cannot register region");
+
+	TEST_ASSERT_EQUAL(cleanq_enqueue(tx, rid, 0, BUF_SIZE, 0,
+			sizeof(struct ether_hdr) - 1, CLEANQ_FLAG_LAST),
+			CLEANQ_ERR_INVALID_BUFFER_ARGS,
+			"af_packet: runt not rejected");
+
+	TEST_ASSERT_SUCCESS(cleanq_enqueue(rx, rid, BUF_SIZE, BUF_SIZE, 0, 0,
+			0), "af_packet: cannot post buffer");
+	if (af_packet_send(tx, rid, mem, 1) != 0 ||
+			af_packet_wait(rx, &b, rid, mem, rid, NULL, 1) != 0)
+		return -1;
+	TEST_ASSERT(b.rid == rid && b.offset == BUF_SIZE,
+			"af_packet: frame not copied into the posted buffer");
+
+	/* the ring gets an id of the pool like any other region */
+	af_packet_get_rx_ring(ap, &ring);
+	TEST_ASSERT_SUCCESS(cleanq_register(rx, ring, &ring_rid),
+			"af_packet: cannot register the ring");
+	TEST_ASSERT(ring_rid != rid, "af_packet: ring has the id of the memory");
+	TEST_ASSERT_SUCCESS(cleanq_control(rx, CLEANQ_CTRL_AF_PACKET_ZERO_COPY,
+			1, NULL), "af_packet: cannot turn on zero-copy");
+
+	if (af_packet_send(tx, rid, mem, 2) != 0 ||
+			af_packet_wait(rx, &b, rid, mem, ring_rid, ring.vaddr,
+				2) != 0)
+		return -1;
+	TEST_ASSERT_EQUAL(b.rid, ring_rid, "af_packet: frame not in place");
+	TEST_ASSERT_SUCCESS(cleanq_enqueue(rx, b.rid, b.offset, b.length,
+			b.valid_data, 0, 0), "af_packet: cannot give back frame");
+
+	TEST_ASSERT_SUCCESS(cleanq_deregister(rx, ring_rid, &ring),
+			"af_packet: cannot deregister the ring");
+	return 0;
+}
+
+/* the same through a net_cleanq port with zero_copy=1 */
+static int
+test_af_packet_ethdev(void)
+{
+	struct rte_eth_conf port_conf;
+	struct rte_mbuf *m, *rx[ETHDEV_BURST];
+	struct rte_mempool *mp;
+	uint16_t port, nb_rx;
+	unsigned i, j;
+	uint8_t tag;
+	int ret = -1;
+
+	mp = rte_pktmbuf_pool_create("cleanq_zc_pool", AF_PACKET_NB_MBUFS, 0,
+			0, RTE_MBUF_DEFAULT_BUF_SIZE, rte_socket_id());
+	if (mp == NULL) {
+		printf("af_packet: cannot create mempool\n");
+		return -1;
+	}
+	if (rte_vdev_init("net_cleanq_zc",
+			"backend=af_packet,iface=lo,zero_copy=1") != 0) {
+		printf("af_packet: cannot create port\n");
+		goto pool_out;
+	}
+	if (rte_eth_dev_get_port_by_name("net_cleanq_zc", &port) != 0) {
+		printf("af_packet: port not found\n");
+		goto port_out;
+	}
+
+	memset(&port_conf, 0, sizeof(port_conf));
+	if (rte_eth_dev_configure(port, 1, 1, &port_conf) != 0 ||
+			rte_eth_rx_queue_setup(port, 0, 64, rte_socket_id(),
+				NULL, mp) != 0 ||
+			rte_eth_tx_queue_setup(port, 0, 64, rte_socket_id(),
+				NULL) != 0 ||
+			rte_eth_dev_start(port) != 0) {
+		printf("af_packet: cannot set up port\n");
+		goto port_out;
+	}
+
+	/* the second round needs the frames freed in the first one back */
+	for (tag = 1; tag <= 2; tag++) {
+		m = rte_pktmbuf_alloc(mp);
+		if (m == NULL) {
+			printf("af_packet: cannot allocate mbuf\n");
+			goto port_out;
+		}
+		build_local_frame((uint8_t *) rte_pktmbuf_append(m,
+				AF_PACKET_LEN), tag);
+		if (rte_eth_tx_burst(port, 0, &m, 1) != 1) {
+			rte_pktmbuf_free(m);
+			printf("af_packet: frame %u not sent\n", tag);
+			goto port_out;
+		}
+
+		for (i = 0; i < AF_PACKET_TRIES; i++) {
+			nb_rx = rte_eth_rx_burst(port, 0, rx, ETHDEV_BURST);
+			for (j = 0; j < nb_rx; j++) {
+				if (RTE_MBUF_HAS_EXTBUF(rx[j]) &&
+						is_local_frame(
+							rte_pktmbuf_mtod(rx[j],
+								uint8_t *),
+							rx[j]->pkt_len, tag))
+					i = AF_PACKET_TRIES;
+				rte_pktmbuf_free(rx[j]);
+			}
+			if (nb_rx == 0)
+				usleep(1000);
+		}
+		if (i == AF_PACKET_TRIES) {
+			printf("af_packet: frame %u not received in place\n",
+					tag);
+			goto port_out;
+		}
+	}
+	ret = 0;
+
+port_out:
+	rte_vdev_uninit("net_cleanq_zc");
+	if (ret == 0 && rte_mempool_avail_count(mp) != AF_PACKET_NB_MBUFS) {
+		printf("af_packet: %u of %u mbufs back\n",
+				rte_mempool_avail_count(mp), AF_PACKET_NB_MBUFS);
+		ret = -1;
+	}
+pool_out:
+	rte_mempool_free(mp);
+	return ret;
+}
+
+static int
+test_af_packet(uint8_t *mem)
+{
+	struct af_packet_q *ap;
+	int ret;
+
+	if (af_packet_create(&ap, "lo", rte_socket_id()) != CLEANQ_ERR_OK) {
+		printf("af_packet: cannot open lo, skipped\n");
+		return 0;
+	}
+	ret = test_af_packet_queue(ap, mem);
+	af_packet_destroy(ap);
+
+	if (ret == 0)
+		ret = test_af_packet_ethdev();
+	if (ret == 0)
+		printf("af_packet: OK\n");
+	return ret;
+}
+
+#ifdef RTE_LIBRTE_VHOST
+#define VHOST_USER_PATH "/tmp/cleanq_test_vhost.sock"
+#define VHOST_USER_PORT "net_virtio_user_cq"
+#define VHOST_USER_NB_MBUFS 1023
+
+/* waits for the frame tagged tag from the virtio port, in place */
+static int
+vhost_user_wait(struct vhost_user_q *vq, struct cleanq_buf *b, uint8_t tag)
+{
+	struct cleanq *rx = vhost_user_get_rx(vq);
+	uint8_t *va;
+	size_t len;
+	unsigned i;
+	errval_t err;
+
+	for (i = 0; i < AF_PACKET_TRIES; i++) {
+		err = cleanq_dequeue(rx, &b->rid, &b->offset, &b->length,
+				&b->valid_data, &b->valid_length, &b->flags);
+		if (err == CLEANQ_ERR_QUEUE_EMPTY) {
+			usleep(1000);
+			continue;
+		}
+		TEST_ASSERT_SUCCESS(err, "vhost_user: dequeue failed");
+		TEST_ASSERT_SUCCESS(vhost_user_get_region(vq, b->rid,
+				(void **) &va, &len),
+				"vhost_user: buffer of unknown region %u",
+				b->rid);
+		TEST_ASSERT(b->offset + b->length <= len,
+				"vhost_user: buffer outside of its region");
+		if (is_local_frame(va + b->offset + b->valid_data,
+				b->valid_length, tag))
+			return 0;
+
+		TEST_ASSERT_SUCCESS(cleanq_enqueue(rx, b->rid, b->offset,
+				b->length, b->valid_data, 0, b->flags),
+				"vhost_user: cannot give back a buffer");
+	}
+	printf("vhost_user: frame %u not received\n", tag);
+	return -1;
+}
+
+/*
+ * Frames of the guest come in place with an id of the pool that differs
+ * from the registered memory, those of the queue are copied to the guest
+ */
+static int
+test_vhost_user_port(struct vhost_user_q *vq, uint16_t port, uint8_t *mem,
+		struct rte_mempool *mp)
+{
+	struct cleanq *rx = vhost_user_get_rx(vq);
+	struct cleanq *tx = vhost_user_get_tx(vq);
+	struct rte_mbuf *m, *pkts[ETHDEV_BURST];
+	struct capref cap;
+	struct cleanq_buf b;
+	regionid_t rid;
+	uint16_t nb_rx, j;
+	unsigned i;
+	int found = 0;
+
+	cap.vaddr = mem;
+	cap.paddr = rte_malloc_virt2iova(mem);
+	cap.len = MEM_SIZE;
+	TEST_ASSERT_SUCCESS(cleanq_register(tx, cap, &rid),
+			"vhost_user: cannot register region");
+	TEST_ASSERT_SUCCESS(cleanq_control(rx,
+			CLEANQ_CTRL_VHOST_USER_ZERO_COPY, 1, NULL),
+			"vhost_user: cannot turn on zero-copy");
+
+	m = rte_pktmbuf_alloc(mp);
+	TEST_ASSERT_NOT_NULL(m, "vhost_user: cannot allocate mbuf");
+	build_local_frame((uint8_t *) rte_pktmbuf_append(m, AF_PACKET_LEN), 1);
+	if (rte_eth_tx_burst(port, 0, &m, 1) != 1) {
+		rte_pktmbuf_free(m);
+		printf("vhost_user: frame not sent\n");
+		return -1;
+	}
+	if (vhost_user_wait(vq, &b, 1) != 0)
+		return -1;
+	/* the slots of the region table are rid % 64 */
+	TEST_ASSERT(b.rid != rid && b.rid % 64 != rid % 64,
+			"vhost_user: guest region %u clashes with region %u",
+			b.rid, rid);
+	TEST_ASSERT_SUCCESS(cleanq_enqueue(rx, b.rid, b.offset, b.length,
+			b.valid_data, 0, b.flags),
+			"vhost_user: cannot give back the frame");
+
+	build_local_frame(mem, 2);
+	for (i = 0; i < AF_PACKET_TRIES; i++) {
+		if (err_is_ok(cleanq_enqueue(tx, rid, 0, BUF_SIZE, 0,
+				AF_PACKET_LEN, CLEANQ_FLAG_LAST)))
+			break;
+		usleep(1000);
+	}
+	TEST_ASSERT(i < AF_PACKET_TRIES, "vhost_user: cannot send frame");
+	TEST_ASSERT_SUCCESS(cleanq_dequeue(tx, &b.rid, &b.offset, &b.length,
+			&b.valid_data, &b.valid_length, &b.flags),
+			"vhost_user: frame not completed");
+
+	for (i = 0; i < AF_PACKET_TRIES && !found; i++) {
+		nb_rx = rte_eth_rx_burst(port, 0, pkts, ETHDEV_BURST);
+		for (j = 0; j < nb_rx; j++) {
+			found |= is_local_frame(rte_pktmbuf_mtod(pkts[j],
+					uint8_t *), pkts[j]->pkt_len, 2);
+			rte_pktmbuf_free(pkts[j]);
+		}
+		if (nb_rx == 0)
+			usleep(1000);
+	}
+	TEST_ASSERT(found, "vhost_user: frame not received by the guest");
+	return 0;
+}
+
+static int
+test_vhost_user(uint8_t *mem)
+{
+	struct rte_eth_conf port_conf;
+	struct rte_mempool *mp;
+	struct vhost_user_q *vq;
+	uint16_t port;
+	int ret = 0;
+
+	unlink(VHOST_USER_PATH);
+	if (vhost_user_create(&vq, VHOST_USER_PATH, rte_socket_id()) !=
+			CLEANQ_ERR_OK) {
+		printf("vhost_user: cannot create socket\n");
+		return -1;
+	}
+	mp = rte_pktmbuf_pool_create("cleanq_vhost_pool", VHOST_USER_NB_MBUFS,
+			0, 0, RTE_MBUF_DEFAULT_BUF_SIZE, rte_socket_id());
+	if (mp == NULL) {
+		printf("vhost_user: cannot create mempool\n");
+		vhost_user_destroy(vq);
+		return -1;
+	}
+
+	memset(&port_conf, 0, sizeof(port_conf));
+	if (rte_vdev_init(VHOST_USER_PORT, "path=" VHOST_USER_PATH
+			",queues=1,queue_size=256") != 0) {
+		printf("vhost_user: cannot create virtio_user port, skipped\n");
+		goto pool_out;
+	}
+	if (rte_eth_dev_get_port_by_name(VHOST_USER_PORT, &port) != 0 ||
+			rte_eth_dev_configure(port, 1, 1, &port_conf) != 0 ||
+			rte_eth_rx_queue_setup(port, 0, 256, rte_socket_id(),
+				NULL, mp) != 0 ||
+			rte_eth_tx_queue_setup(port, 0, 256, rte_socket_id(),
+				NULL) != 0 ||
+			rte_eth_dev_start(port) != 0) {
+		printf("vhost_user: cannot set up virtio_user port, "
+				"skipped\n");
+		goto port_out;
+	}
+
+	ret = test_vhost_user_port(vq, port, mem, mp);
+	rte_eth_dev_stop(port);
+	if (ret == 0)
+		printf("vhost_user: OK\n");
+port_out:
+	rte_vdev_uninit(VHOST_USER_PORT);
+pool_out:
+	vhost_user_destroy(vq);
+	rte_mempool_free(mp);
+	unlink(VHOST_USER_PATH);
+	return ret;
+}
+#endif
+
+/*
+ * The counters of a loopback queue and of the debug queue stacked on it,
+ * each layer only counts what it sees itself
+ */
+static int
+test_stats(void *mem)
+{
+	struct test_q tq;
+	struct cleanq_stats st, lst;
+	struct cleanq_buf b;
+	regionid_t rid;
+	unsigned i;
+	int ret = -1;
+
+	memset(&tq, 0, sizeof(tq));
+	tq.name = "stats";
+	if (debug_init(&tq) != 0 || register_mem(&tq, mem, &rid) != 0)
+		goto out;
+
+	for (i = 0; i < 3; i++)
+		if (cleanq_enqueue(tq.tx, rid, i * BUF_SIZE, BUF_SIZE, 0, 64,
+				0) != CLEANQ_ERR_OK)
+			goto fail;
+	if (cleanq_dequeue(tq.rx, &b.rid, &b.offset, &b.length,
+			&b.valid_data, &b.valid_length, &b.flags) !=
+			CLEANQ_ERR_OK)
+		goto fail;
+	if (cleanq_get_stats(tq.rx, &st) != CLEANQ_ERR_OK ||
+			st.enq != 3 || st.deq != 1 || st.enq_bytes != 192 ||
+			st.deq_bytes != 64 || st.occupancy != 2 ||
+			st.high_watermark != 3) {
+		printf("stats: enq %"PRIu64" deq %"PRIu64" occupancy %"PRIu64
+				" high watermark %"PRIu64"\n", st.enq, st.deq,
+				st.occupancy, st.high_watermark);
+		goto out;
+	}
+
+	/* the buffer is still queued, only the debug queue rejects it */
+	if (err_is_ok(cleanq_enqueue(tq.tx, rid, BUF_SIZE, BUF_SIZE, 0, 64,
+			0)))
+		goto fail;
+	for (i = 0; i < 3; i++)
+		cleanq_dequeue(tq.rx, &b.rid, &b.offset, &b.length,
+				&b.valid_data, &b.valid_length, &b.flags);
+	if (cleanq_get_stats(tq.rx, &st) != CLEANQ_ERR_OK ||
+			cleanq_get_stats(tq.lower, &lst) != CLEANQ_ERR_OK)
+		goto fail;
+	if (st.invalid != 1 || st.empty != 1 || st.deq != 3 ||
+			st.occupancy != 0 || st.high_watermark != 3 ||
+			lst.invalid != 0 || lst.empty != 1 || lst.enq != 3) {
+		printf("stats: debug invalid %"PRIu64" empty %"PRIu64
+				", loopback invalid %"PRIu64" empty %"PRIu64"\n",
+				st.invalid, st.empty, lst.invalid, lst.empty);
+		goto out;
+	}
+
+	/* the loopback queue is full, the debug queue passes that on */
+	for (i = 0; i < NUM_BUFS; i++)
+		if (cleanq_enqueue(tq.tx, rid, i * BUF_SIZE, BUF_SIZE, 0, 0,
+				0) != CLEANQ_ERR_OK)
+			break;
+	if (cleanq_get_stats(tq.rx, &st) != CLEANQ_ERR_OK ||
+			cleanq_get_stats(tq.lower, &lst) != CLEANQ_ERR_OK)
+		goto fail;
+	if (st.full != 1 || lst.full != 1 || lst.high_watermark != i ||
+			st.occupancy != i) {
+		printf("stats: full %"PRIu64"/%"PRIu64" after %u\n",
+				st.full, lst.full, i);
+		goto out;
+	}
+
+	printf("stats: OK\n");
+	ret = 0;
+	goto out;
+fail:
+	printf("stats: queue operation failed\n");
+out:
+	test_q_free(&tq);
+	return ret;
+}
+
+#ifdef RTE_LIBRTE_METRICS
+static uint64_t
+metric_value(const char *name)
+{
+	struct rte_metric_name *names;
+	struct rte_metric_value *values;
+	uint64_t value = UINT64_MAX;
+	int nb_names, nb_values;
+	int i, j;
+
+	nb_names = rte_metrics_get_names(NULL, 0);
+	nb_values = rte_metrics_get_values(RTE_METRICS_GLOBAL, NULL, 0);
+	if (nb_names <= 0 || nb_values <= 0)
+		return value;
+	names = calloc(nb_names, sizeof(*names));
+	values = calloc(nb_values, sizeof(*values));
+	if (names == NULL || values == NULL)
+		goto out;
+
+	rte_metrics_get_names(names, nb_names);
+	rte_metrics_get_values(RTE_METRICS_GLOBAL, values, nb_values);
+	for (i = 0; i < nb_names; i++) {
+		if (strcmp(names[i].name, name) != 0)
+			continue;
+		for (j = 0; j < nb_values; j++)
+			if (values[j].key == i)
+				value = values[j].value;
+	}
+out:
+	free(names);
+	free(values);
+	return value;
+}
+
+/*
+ * Frames with a bad checksum and for another address reflected into a UDP
+ * stack are counted by the reason the IP queue drops them for
+ */
+static int
+metrics_drops(uint8_t *mem)
+{
+	static struct ether_addr mac = {{ 0x02, 0, 0, 0, 0, 0x01 }};
+	static const errval_t reasons[] = {
+		CLEANQ_ERR_IP_CHKSUM, CLEANQ_ERR_IP_WRONG_IP,
+	};
+	struct ipv4_hdr *ip = (struct ipv4_hdr *) (mem + sizeof(struct ether_hdr));
+	struct reflector_q *refl;
+	struct udp_q *udp;
+	struct cleanq *uq, *tx;
+	struct cleanq_buf b;
+	struct capref cap;
+	regionid_t rid;
+	unsigned i;
+	int ret = -1;
+
+	if (reflector_create(&refl, rte_socket_id()) != CLEANQ_ERR_OK)
+		return -1;
+	tx = reflector_get_tx(refl);
+	if (udp_create(&udp, reflector_get_rx(refl), tx, 1234, 7,
+			IPv4(10, 0, 0, 1), IPv4(10, 0, 0, 2), &mac, &mac,
+			rte_socket_id()) != CLEANQ_ERR_OK) {
+		reflector_destroy(refl);
+		return -1;
+	}
+	uq = (struct cleanq *) udp;
+
+	cap.vaddr = mem;
+	cap.paddr = rte_malloc_virt2iova(mem);
+	cap.len = MEM_SIZE;
+	if (cleanq_register(uq, cap, &rid) != CLEANQ_ERR_OK ||
+			cleanq_metrics_add_queue(udp_get_ip(udp),
+				RTE_METRICS_GLOBAL, "test_ip") != CLEANQ_ERR_OK ||
+			cleanq_enqueue(uq, rid, BUF_SIZE, BUF_SIZE, 0, 0,
+				NETIF_RXFLAG) != CLEANQ_ERR_OK) {
+		printf("metrics: cannot set up UDP queue\n");
+		goto out;
+	}
+
+	/* the dropped buffer is posted again by the IP queue */
+	for (i = 0; i < RTE_DIM(reasons); i++) {
+		build_udp_frame(mem, 128);
+		if (reasons[i] == CLEANQ_ERR_IP_CHKSUM) {
+			ip->hdr_checksum = ~ip->hdr_checksum;
+		} else {
+			ip->dst_addr = rte_cpu_to_be_32(IPv4(10, 0, 0, 3));
+			ip->hdr_checksum = 0;
+			ip->hdr_checksum = rte_ipv4_cksum(ip);
+		}
+		if (cleanq_enqueue(tx, rid, 0, BUF_SIZE, 0, 128, 0) !=
+				CLEANQ_ERR_OK ||
+				cleanq_dequeue(tx, &b.rid, &b.offset, &b.length,
+					&b.valid_data, &b.valid_length,
+					&b.flags) != CLEANQ_ERR_OK ||
+				cleanq_dequeue(uq, &b.rid, &b.offset, &b.length,
+					&b.valid_data, &b.valid_length,
+					&b.flags) != reasons[i]) {
+			printf("metrics: frame %u not dropped\n", i);
+			goto remove;
+		}
+	}
+
+	if (cleanq_metrics_update() != CLEANQ_ERR_OK ||
+			metric_value("cleanq_test_ip_dropped") != 2 ||
+			metric_value("cleanq_test_ip_drop_chksum") != 1 ||
+			metric_value("cleanq_test_ip_drop_wrong_ip") != 1 ||
+			metric_value("cleanq_test_ip_drop_wrong_proto") != 0) {
+		printf("metrics: dropped %"PRIu64" chksum %"PRIu64
+				" wrong_ip %"PRIu64"\n",
+				metric_value("cleanq_test_ip_dropped"),
+				metric_value("cleanq_test_ip_drop_chksum"),
+				metric_value("cleanq_test_ip_drop_wrong_ip"));
+		goto remove;
+	}
+	ret = 0;
+remove:
+	cleanq_metrics_remove(udp_get_ip(udp));
+out:
+	udp_destroy(udp);
+	reflector_destroy(refl);
+	return ret;
+}
+
+/*
+ * Two queues of a layer are summed up, the histogram has its count, the
+ * drops are split up by reason
+ */
+static int
+test_metrics(void *mem)
+{
+	static struct cleanq_lat_hist hist;
+	struct test_q tq;
+	regionid_t rid;
+	unsigned i;
+	int ret = -1;
+
+	memset(&tq, 0, sizeof(tq));
+	tq.name = "metrics";
+	if (debug_init(&tq) != 0 || register_mem(&tq, mem, &rid) != 0)
+		goto out;
+
+	rte_metrics_init(rte_socket_id());
+	if (cleanq_metrics_add_queue(tq.tx, RTE_METRICS_GLOBAL,
+			"test_stack") != CLEANQ_ERR_OK ||
+			cleanq_metrics_add_queue(tq.lower, RTE_METRICS_GLOBAL,
+				"test_stack") != CLEANQ_ERR_OK ||
+			cleanq_metrics_add_latency(&hist, RTE_METRICS_GLOBAL,
+				"test_stack") != CLEANQ_ERR_OK) {
+		printf("metrics: cannot add sources\n");
+		goto out;
+	}
+
+	for (i = 0; i < 3; i++)
+		cleanq_enqueue(tq.tx, rid, i * BUF_SIZE, BUF_SIZE, 0, 64, 0);
+	for (i = 0; i < 100; i++)
+		cleanq_lat_add(&hist, 1000);
+	if (cleanq_metrics_update() != CLEANQ_ERR_OK ||
+			metric_value("cleanq_test_stack_enq") != 6 ||
+			metric_value("cleanq_test_stack_occupancy") != 6 ||
+			metric_value("cleanq_test_stack_lat_count") != 100) {
+		printf("metrics: enq %"PRIu64" lat_count %"PRIu64"\n",
+				metric_value("cleanq_test_stack_enq"),
+				metric_value("cleanq_test_stack_lat_count"));
+		goto remove;
+	}
+	if (metrics_drops(mem) != 0)
+		goto remove;
+
+	printf("metrics: OK\n");
+	ret = 0;
+remove:
+	cleanq_metrics_remove(tq.tx);
+	cleanq_metrics_remove(tq.lower);
+	cleanq_metrics_remove(&hist);
+out:
+	test_q_free(&tq);
+	return ret;
+}
+#endif
+
+#define SLAB_TEST_BLOCKS 100
+#define SLAB_TEST_ROUNDS 10000
+
+/* free blocks once everything is returned, in the slabs and the magazines */
+static size_t
+slab_capacity(struct slab_allocator *slabs)
+{
+	struct slab_head *sh;
+	size_t total = 0;
+
+	for (sh = slabs->slabs; sh != NULL; sh = sh->next)
+		total += sh->total;
+	return total;
+}
+
+static int
+slab_worker(void *arg)
+{
+	struct slab_allocator *slabs = arg;
+	void *blocks[SLAB_MAGAZINE_SIZE];
+	unsigned i, j;
+	size_t n;
+
+	for (i = 0; i < SLAB_TEST_ROUNDS; i++) {
+		n = slab_alloc_bulk(slabs, blocks, (i % SLAB_MAGAZINE_SIZE) + 1);
+		if (n != (i % SLAB_MAGAZINE_SIZE) + 1)
+			return -1;
+		for (j = 0; j < n; j++)
+			*(unsigned *)blocks[j] = rte_lcore_id();
+		for (j = 0; j < n; j++) {
+			if (*(unsigned *)blocks[j] != rte_lcore_id())
+				return -1;
+		}
+		slab_free_bulk(slabs, blocks, n);
+	}
+	return 0;
+}
+
+/*
+ * Bulk allocations hand out distinct, cleared blocks. With magazines the
+ * lcores share one allocator and all blocks come back in the end.
+ */
+static int
+test_slab(void)
+{
+	struct slab_allocator slabs;
+	struct slab_head *sh;
+	void *blocks[SLAB_TEST_BLOCKS];
+	unsigned lcore_id;
+	size_t i, j;
+	int ret;
+
+	slab_init(&slabs, 48, slab_default_refill);
+
+	TEST_ASSERT_EQUAL(slab_alloc_bulk(&slabs, blocks, SLAB_TEST_BLOCKS),
+			SLAB_TEST_BLOCKS, "slab: bulk alloc short");
+	for (i = 0; i < SLAB_TEST_BLOCKS; i++) {
+		for (j = 0; j < 48; j++)
+			TEST_ASSERT(((uint8_t *)blocks[i])[j] == 0,
+					"slab: block not cleared");
+		for (j = 0; j < i; j++)
+			TEST_ASSERT(blocks[i] != blocks[j],
+					"slab: block handed out twice");
+		memset(blocks[i], 0xff, 48);
+	}
+	slab_free_bulk(&slabs, blocks, SLAB_TEST_BLOCKS);
+	TEST_ASSERT_EQUAL(slab_freecount(&slabs), slab_capacity(&slabs),
+			"slab: bulk free lost blocks");
+
+	TEST_ASSERT_SUCCESS(slab_enable_magazines(&slabs),
+			"slab: cannot enable magazines");
+	TEST_ASSERT_EQUAL(slab_alloc_bulk(&slabs, blocks, SLAB_TEST_BLOCKS),
+			SLAB_TEST_BLOCKS, "slab: magazine alloc short");
+	TEST_ASSERT(((uint8_t *)blocks[0])[0] == 0,
+			"slab: magazine block not cleared");
+	/* overflows the magazine, the older half is flushed */
+	slab_free_bulk(&slabs, blocks, SLAB_TEST_BLOCKS);
+	blocks[0] = slab_alloc(&slabs);
+	TEST_ASSERT(blocks[0] != NULL, "slab: magazine alloc failed");
+	slab_free(&slabs, blocks[0]);
+
+	RTE_LCORE_FOREACH_SLAVE(lcore_id)
+		rte_eal_remote_launch(slab_worker, &slabs, lcore_id);
+	ret = slab_worker(&slabs);
+	RTE_LCORE_FOREACH_SLAVE(lcore_id) {
+		if (rte_eal_wait_lcore(lcore_id) != 0)
+			ret = -1;
+	}
+	TEST_ASSERT_SUCCESS(ret, "slab: lcore run failed");
+	TEST_ASSERT_EQUAL(slab_freecount(&slabs), slab_capacity(&slabs),
+			"slab: magazines lost blocks");
+
+	/* refills without a socket come from the libc heap */
+	while (slabs.slabs != NULL) {
+		sh = slabs.slabs;
+		slabs.slabs = sh->next;
+		free(sh);
+	}
+	cleanq_free_socket(slabs.mags, CLEANQ_SOCKET_ID_ANY);
+
+	printf("slab: OK\n");
+	return 0;
+}
+
+/*
+ * The adaptive burst grows with full polls up to the maximum, shrinks with
+ * mostly empty ones and empty polls back off up to sleeping
+ */
+static int
+test_poll(void)
+{
+	struct cleanq_poll p;
+	unsigned i;
+
+	cleanq_poll_init(&p, 1, 64);
+	TEST_ASSERT_EQUAL(cleanq_poll_burst(&p), 1, "poll: wrong first burst");
+
+	for (i = 0; i < 10; i++)
+		cleanq_poll_update(&p, cleanq_poll_burst(&p));
+	TEST_ASSERT_EQUAL(cleanq_poll_burst(&p), 64, "poll: burst not grown");
+
+	for (i = 0; i < CLEANQ_POLL_SHRINK_POLLS; i++)
+		cleanq_poll_update(&p, 1);
+	TEST_ASSERT_EQUAL(cleanq_poll_burst(&p), 32, "poll: burst not shrunk");
+	cleanq_poll_update(&p, 16);
+	TEST_ASSERT_EQUAL(cleanq_poll_burst(&p), 32, "poll: burst changed");
+
+	/* an empty poll halves the burst, the idle ones take it down to 1 */
+	TEST_ASSERT_EQUAL(cleanq_poll_update(&p, 0), CLEANQ_POLL_BUSY,
+			"poll: backing off too early");
+	TEST_ASSERT_EQUAL(cleanq_poll_burst(&p), 16, "poll: burst not halved");
+	for (i = 1; i < CLEANQ_POLL_IDLE_POLLS; i++)
+		TEST_ASSERT_EQUAL(cleanq_poll_update(&p, 0), CLEANQ_POLL_BUSY,
+				"poll: backing off too early");
+	TEST_ASSERT_EQUAL(cleanq_poll_burst(&p), 1, "poll: idle burst not 1");
+	TEST_ASSERT_EQUAL(cleanq_poll_update(&p, 0), CLEANQ_POLL_IDLE,
+			"poll: not backing off");
+
+	for (i = 0; i < 32 && cleanq_poll_update(&p, 0) != CLEANQ_POLL_SLEEP;
+			i++)
+		;
+	TEST_ASSERT(p.pause == CLEANQ_POLL_MAX_PAUSE, "poll: not sleeping");
+
+	TEST_ASSERT_EQUAL(cleanq_poll_update(&p, 1), CLEANQ_POLL_BUSY,
+			"poll: not woken up");
+	TEST_ASSERT_EQUAL(p.pause, 0, "poll: back off not reset");
+
+	printf("poll: OK\n");
+	return 0;
+}
+
+static const struct {
+	const char *name;
+	int (*init)(struct test_q *tq);
+} backends[] = {
+	{ "loopback", loopback_init },
+	{ "debug", debug_init },
+	{ "ipcq", ipcq_init },
+	{ "ipcq_compact", ipcq_compact_init },
+};
+
+static int
+test_cleanq(void)
+{
+	uint8_t *mem;
+	unsigned i;
+	int ret = -1;
+
+	mem = rte_zmalloc(NULL, MEM_SIZE, BUF_SIZE);
+	if (mem == NULL)
+		return -1;
+
+	for (i = 0; i < RTE_DIM(backends); i++) {
+		if (test_backend(backends[i].name, backends[i].init, mem) != 0)
+			goto out;
+	}
+
+	if (test_ipcq_compact_wrap(mem) != 0 || test_ipcq_socket() != 0 ||
+			test_debug_ownership(mem) != 0 ||
+			test_reflector(mem) != 0 ||
+			test_validation(mem) != 0 || test_arp(mem) != 0 ||
+			test_ethdev() != 0 || test_af_packet(mem) != 0 ||
+			test_stats(mem) != 0 ||
+			test_poll() != 0 || test_slab() != 0)
+		goto out;
+#ifdef RTE_LIBRTE_PMD_RING
+	if (test_ethdev_q() != 0)
+		goto out;
+#endif
+#ifdef RTE_LIBRTE_VHOST
+	if (test_vhost_user(mem) != 0)
+		goto out;
+#endif
+#ifdef RTE_LIBRTE_METRICS
+	if (test_metrics(mem) != 0)
+		goto out;
+#endif
+	ret = 0;
+out:
+	rte_free(mem);
+	return ret;
+}
+
+REGISTER_TEST_COMMAND(cleanq_autotest, test_cleanq);
@@ -0,0 +1,171 @@
+/* SPDX-License-Identifier: BSD-3-Clause
+ * Copyright(c) 2017 ETH Zurich
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <inttypes.h>
+
+#include <rte_cycles.h>
+#include <rte_ip.h>
+#include <rte_malloc.h>
+#include <rte_random.h>
+
+#include <cleanq_chksum.h>
+
+#include "test.h"
+
+/*
+ * CleanQ checksum
+ * ===============
+ *
+ * Measures the checksum kernels of libcleanq_udp against rte_raw_cksum()
+ * using rdtsc, for buffer sizes from a minimal frame to a jumbo frame:
+ *  * Checksum of a buffer (lwip, scalar, sse, avx2, rte_raw_cksum)
+ *  * Checksum while copying against memcpy() followed by rte_raw_cksum()
+ *
+ * Before measuring, every kernel is checked against rte_raw_cksum() on
+ * random lengths and alignments.
+ */
+
+#define ITERATIONS 10000
+#define MAX_LEN 9216
+#define CHECK_ROUNDS 2000
+
+/* marked volatile so they won't be seen as compile-time constants */
+static const volatile unsigned sizes[] = {
+	64, 128, 256, 512, 1024, 1500, 2048, 4096, 9000
+};
+
+static volatile uint16_t sink;
+
+static int
+check_impl(cleanq_chksum_impl_t impl, uint8_t *src, uint8_t *dst)
+{
+	unsigned i;
+
+	for (i = 0; i < CHECK_ROUNDS; i++) {
+		unsigned off = rte_rand() % 64;
+		unsigned len = rte_rand() % (MAX_LEN - 64);
+		uint16_t ref = rte_raw_cksum(src + off, len);
+
+		if (cleanq_chksum(src + off, len) != ref) {
+			printf("%s: wrong checksum len %u offset %u\n",
+				cleanq_chksum_impl_name(impl), len, off);
+			return -1;
+		}
+
+		memset(dst, 0, MAX_LEN + 64);
+		if (cleanq_chksum_copy(dst + (off ^ 1), src + off, len) != ref ||
+				memcmp(dst + (off ^ 1), src + off, len) != 0) {
+			printf("%s: wrong copy len %u offset %u\n",
+				cleanq_chksum_impl_name(impl), len, off);
+			return -1;
+		}
+	}
+
+	return 0;
+}
+
+static void
+test_chksum(const char *name, uint8_t *src, uint8_t *dst)
+{
+	unsigned i, j;
+
+	printf("\n### %s ###\n", name);
+	for (i = 0; i < RTE_DIM(sizes); i++) {
+		const unsigned len = sizes[i];
+		uint64_t start, end;
+
+		start = rte_rdtsc();
+		for (j = 0; j < ITERATIONS; j++)
+			sink = cleanq_chksum(src, len);
+		end = rte_rdtsc();
+		printf("%5u bytes: sum %8.1f cycles (%5.2f bytes/cycle)",
+			len, (double)(end - start) / ITERATIONS,
+			(double)len * ITERATIONS / (end - start));
+
+		start = rte_rdtsc();
+		for (j = 0; j < ITERATIONS; j++)
+			sink = cleanq_chksum_copy(dst, src, len);
+		end = rte_rdtsc();
+		printf(", copy+sum %8.1f cycles\n",
+			(double)(end - start) / ITERATIONS);
+	}
+}
+
+static void
+test_rte_raw_cksum(uint8_t *src, uint8_t *dst)
+{
+	unsigned i, j;
+
+	printf("\n### rte_raw_cksum ###\n");
+	for (i = 0; i < RTE_DIM(sizes); i++) {
+		const unsigned len = sizes[i];
+		uint64_t start, end;
+
+		start = rte_rdtsc();
+		for (j = 0; j < ITERATIONS; j++)
+			sink = rte_raw_cksum(src, len);
+		end = rte_rdtsc();
+		printf("%5u bytes: sum %8.1f cycles (%5.2f bytes/cycle)",
+			len, (double)(end - start) / ITERATIONS,
+			(double)len * ITERATIONS / (end - start));
+
+		start = rte_rdtsc();
+		for (j = 0; j < ITERATIONS; j++) {
+			memcpy(dst, src, len);
+			sink = rte_raw_cksum(dst, len);
+		}
+		end = rte_rdtsc();
+		printf(", memcpy+sum %8.1f cycles\n",
+			(double)(end - start) / ITERATIONS);
+	}
+}
+
+static int
+test_cleanq_chksum_perf(void)
+{
+	cleanq_chksum_impl_t def = cleanq_chksum_get_impl();
+	cleanq_chksum_impl_t impl;
+	uint8_t *src, *dst;
+	unsigned i;
+	int ret = 0;
+
+	src = rte_malloc(NULL, MAX_LEN + 64, RTE_CACHE_LINE_SIZE);
+	dst = rte_malloc(NULL, MAX_LEN + 64, RTE_CACHE_LINE_SIZE);
+	if (src == NULL || dst == NULL) {
+		printf("cannot allocate buffers\n");
+		ret = -1;
+		goto out;
+	}
+
+	for (i = 0; i < MAX_LEN + 64; i++)
+		src[i] = rte_rand();
+
+	printf("default implementation: %s\n", cleanq_chksum_impl_name(def));
+
+	for (impl = CLEANQ_CHKSUM_LWIP; impl < CLEANQ_CHKSUM_MAX; impl++) {
+		if (cleanq_chksum_set_impl(impl) != 0) {
+			printf("\n### %s not supported ###\n",
+				cleanq_chksum_impl_name(impl));
+			continue;
+		}
+		if (check_impl(impl, src, dst) != 0) {
+			ret = -1;
+			break;
+		}
+		test_chksum(cleanq_chksum_impl_name(impl), src, dst);
+	}
+
+	if (ret == 0)
+		test_rte_raw_cksum(src, dst);
+
+	cleanq_chksum_set_impl(def);
+out:
+	rte_free(src);
+	rte_free(dst);
+	return ret;
+}
+
+REGISTER_TEST_COMMAND(cleanq_chksum_perf_autotest, test_cleanq_chksum_perf);
@@ -0,0 +1,951 @@
+/* SPDX-License-Identifier: BSD-3-Clause
+ * Copyright(c) 2017 ETH Zurich
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <inttypes.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#include <rte_cycles.h>
+#include <rte_launch.h>
+#include <rte_lcore.h>
+#include <rte_malloc.h>
+#include <rte_mbuf.h>
+#include <rte_random.h>
+#ifdef RTE_LIBRTE_PMD_RING
+#include <rte_ethdev.h>
+#include <rte_bus_vdev.h>
+#include <rte_eth_ring.h>
+#endif
+
+#include <cleanq.h>
+#include <cleanq_dpdk.h>
+#include <backends/loopback_devif.h>
+#include <backends/debug.h>
+#include <backends/ipcq.h>
+#include <backends/reflector.h>
+#include <backends/ethdev.h>
+
+#include "test.h"
+
+/*
+ * CleanQ queues
+ * =============
+ *
+ * Measures the datapath and the control path of the CleanQ backends using
+ * rdtsc, in cycles per buffer or per region:
+ *  * Enqueue/dequeue of single buffers and of bursts on one lcore, on the
+ *    loopback, debug (on loopback), ipcq (both descriptor formats) and
+ *    reflector queues and, with the ring PMD, the ethdev backend on a
+ *    net_ring port
+ *  * Register/deregister of 1 to 128 regions, in order and at random
+ *  * Round trips over ipcq between two lcores, on two hyperthreads, two
+ *    cores and two sockets if the lcores allow it
+ *
+ * The functional tests of the same backends are in cleanq_autotest.
+ */
+
+#define BUF_SIZE 2048
+#define MAX_BURST 32
+#define NUM_REGIONS 128
+#define REGION_SIZE 4096
+/* control messages the ipcq peer gets between two polls, fits both rings */
+#define REG_CHUNK 16
+
+static const unsigned iter_shift = 20;
+static const unsigned reg_rounds = 1000;
+static const unsigned handoff_shift = 16;
+
+/* marked volatile so they won't be seen as compile-time constants */
+static const volatile unsigned burst_sizes[] = { 8, 32 };
+static const volatile unsigned region_counts[] = { 1, 16, 128 };
+
+struct perf_q;
+
+/*
+ * send() hands a buffer to the queue, recv() takes the oldest one back and
+ * leaves the queue as it was before it was sent
+ */
+typedef errval_t (*perf_send_t)(struct perf_q *pq, struct cleanq_buf *b,
+		uint64_t flags);
+typedef errval_t (*perf_recv_t)(struct perf_q *pq);
+
+struct perf_q {
+	const char *name;
+	struct cleanq *tx;	/* buffers are enqueued here */
+	struct cleanq *rx;	/* and dequeued here */
+	struct cleanq *peer;	/* polled for control messages, or NULL */
+	perf_send_t send;
+	perf_recv_t recv;
+	void (*destroy)(struct perf_q *pq);
+	void *mem;
+	regionid_t rid;
+	struct cleanq_buf bufs[MAX_BURST];
+
+	/* backend state */
+	struct cleanq *lower;
+	struct reflector_q *refl;
+	struct ethdev_q *eth_q;
+	struct rte_mempool *mp;
+	struct rte_mbuf *mbufs[MAX_BURST];
+	struct rte_ring *ring;
+	uint16_t port;
+};
+
+static struct capref regions[NUM_REGIONS];
+
+struct lcore_pair {
+	unsigned c1, c2;
+};
+
+static inline errval_t
+enq(struct cleanq *q, struct cleanq_buf *b, uint64_t flags)
+{
+	return cleanq_enqueue(q, b->rid, b->offset, b->length,
+			b->valid_data, b->valid_length, flags);
+}
+
+static inline errval_t
+deq(struct cleanq *q, struct cleanq_buf *b)
+{
+	return cleanq_dequeue(q, &b->rid, &b->offset, &b->length,
+			&b->valid_data, &b->valid_length, &b->flags);
+}
+
+/* processes the reg/dereg messages waiting for the peer of an ipcq */
+static errval_t
+drain_peer(struct perf_q *pq)
+{
+	struct cleanq_buf b;
+	errval_t err;
+
+	if (pq->peer == NULL)
+		return CLEANQ_ERR_OK;
+
+	do {
+		err = deq(pq->peer, &b);
+	} while (err_is_ok(err));
+
+	return err == CLEANQ_ERR_QUEUE_EMPTY ? CLEANQ_ERR_OK : err;
+}
+
+/**** Datapath of the backends ****/
+
+static errval_t
+direct_send(struct perf_q *pq, struct cleanq_buf *b, uint64_t flags)
+{
+	return enq(pq->tx, b, flags);
+}
+
+static errval_t
+direct_recv(struct perf_q *pq)
+{
+	struct cleanq_buf b;
+
+	return deq(pq->rx, &b);
+}
+
+/* the reflection goes to a buffer in the second half of the memory */
+static errval_t
+reflector_send(struct perf_q *pq, struct cleanq_buf *b, uint64_t flags)
+{
+	errval_t err;
+
+	err = cleanq_enqueue(pq->rx, b->rid, b->offset + MAX_BURST * BUF_SIZE,
+			b->length, 0, 0, 0);
+	if (err_is_fail(err))
+		return err;
+
+	return enq(pq->tx, b, flags);
+}
+
+static errval_t
+reflector_recv(struct perf_q *pq)
+{
+	struct cleanq_buf b;
+	errval_t err;
+
+	err = deq(pq->rx, &b);
+	if (err_is_fail(err))
+		return err;
+
+	return deq(pq->tx, &b);
+}
+
+#ifdef RTE_LIBRTE_PMD_RING
+/*
+ * The packet is copied into a posted mbuf, which is posted again. The ring
+ * gave the sent mbuf back to the queue, the send is complete.
+ */
+static errval_t
+ethdev_recv(struct perf_q *pq)
+{
+	struct cleanq_buf b;
+	errval_t err;
+
+	err = deq(pq->rx, &b);
+	if (err_is_fail(err))
+		return err;
+
+	err = enq(pq->rx, &b, 0);
+	if (err_is_fail(err))
+		return err;
+
+	return deq(pq->tx, &b);
+}
+#endif
+
+/**** Setup of the backends ****/
+
+static errval_t
+ipcq_reg_cb(struct ipcq *q, struct capref cap, regionid_t rid)
+{
+	RTE_SET_USED(q);
+	RTE_SET_USED(cap);
+	RTE_SET_USED(rid);
+	return CLEANQ_ERR_OK;
+}
+
+static errval_t
+ipcq_dereg_cb(struct ipcq *q, regionid_t rid)
+{
+	RTE_SET_USED(q);
+	RTE_SET_USED(rid);
+	return CLEANQ_ERR_OK;
+}
+
+static struct ipcq_func_pointer ipcq_funcs = {
+	.reg = ipcq_reg_cb,
+	.dereg = ipcq_dereg_cb,
+};
+
+static void
+default_destroy(struct perf_q *pq)
+{
+	if (pq->peer != NULL)
+		cleanq_destroy(pq->peer);
+	cleanq_destroy(pq->tx);
+	if (pq->lower != NULL)
+		cleanq_destroy(pq->lower);
+}
+
+static int
+loopback_init(struct perf_q *pq)
+{
+	struct loopback_queue *lq;
+
+	if (err_is_fail(loopback_queue_create(&lq, rte_socket_id())))
+		return -1;
+
+	pq->tx = pq->rx = (struct cleanq *) lq;
+	return 0;
+}
+
+static int
+debug_init(struct perf_q *pq)
+{
+	struct loopback_queue *lq;
+	struct debug_q *dq;
+
+	if (err_is_fail(loopback_queue_create(&lq, rte_socket_id())))
+		return -1;
+
+	pq->lower = (struct cleanq *) lq;
+	if (err_is_fail(debug_create(&dq, pq->lower, rte_socket_id()))) {
+		cleanq_destroy(pq->lower);
+		return -1;
+	}
+
+	pq->tx = pq->rx = (struct cleanq *) dq;
+	return 0;
+}
+
+/* both ends in this process, buffers go from a to b */
+static int
+ipcq_init_format(struct perf_q *pq, ipcq_desc_format_t format)
+{
+	char name_a[32], name_b[32];
+	struct ipcq *a, *b;
+	int ret = -1;
+
+	snprintf(name_a, sizeof(name_a), "cleanq_perf_%d_%u_a", getpid(),
+			format);
+	snprintf(name_b, sizeof(name_b), "cleanq_perf_%d_%u_b", getpid(),
+			format);
+
+	if (err_is_fail(ipcq_create(&a, name_a, name_b, true, &ipcq_funcs,
+			rte_socket_id(), format)))
+		goto out;
+
+	if (err_is_fail(ipcq_create(&b, name_b, name_a, false, &ipcq_funcs,
+			rte_socket_id(), format))) {
+		ipcq_destroy(a);
+		goto out;
+	}
+
+	pq->tx = (struct cleanq *) a;
+	pq->rx = pq->peer = (struct cleanq *) b;
+	ret = 0;
+out:
+	/* the mappings stay */
+	shm_unlink(name_a);
+	shm_unlink(name_b);
+	return ret;
+}
+
+static int
+ipcq_init(struct perf_q *pq)
+{
+	return ipcq_init_format(pq, IPCQ_DESC_DEFAULT);
+}
+
+static int
+ipcq_compact_init(struct perf_q *pq)
+{
+	return ipcq_init_format(pq, IPCQ_DESC_COMPACT);
+}
+
+static void
+reflector_destroy_pq(struct perf_q *pq)
+{
+	reflector_destroy(pq->refl);
+}
+
+static int
+reflector_init(struct perf_q *pq)
+{
+	if (err_is_fail(reflector_create(&pq->refl, rte_socket_id())))
+		return -1;
+
+	pq->tx = reflector_get_tx(pq->refl);
+	pq->rx = reflector_get_rx(pq->refl);
+	pq->send = reflector_send;
+	pq->recv = reflector_recv;
+	pq->destroy = reflector_destroy_pq;
+	return 0;
+}
+
+#ifdef RTE_LIBRTE_PMD_RING
+#define RING_PORT_NAME "cleanq_perf"
+#define RING_PORT_SIZE 1024
+#define RING_PORT_MBUFS 2047
+
+static void
+ethdev_destroy_pq(struct perf_q *pq)
+{
+	unsigned i;
+
+	rte_eth_dev_stop(pq->port);
+	/* frees the posted mbufs */
+	ethdev_q_destroy(pq->eth_q);
+	rte_vdev_uninit("net_ring_" RING_PORT_NAME);
+	rte_ring_free(pq->ring);
+	for (i = 0; i < MAX_BURST; i++)
+		rte_pktmbuf_free(pq->mbufs[i]);
+	rte_mempool_free(pq->mp);
+}
+
+/* a net_ring port sending into its own receive ring */
+static int
+ethdev_init(struct perf_q *pq)
+{
+	struct rte_mbuf *posted[MAX_BURST];
+	struct rte_eth_conf conf;
+	struct cleanq_buf b;
+	int socket = rte_socket_id();
+	unsigned i;
+	int port;
+
+	pq->mp = rte_pktmbuf_pool_create(RING_PORT_NAME, RING_PORT_MBUFS, 0,
+			0, RTE_MBUF_DEFAULT_BUF_SIZE, socket);
+	if (pq->mp == NULL)
+		return -1;
+
+	pq->ring = rte_ring_create(RING_PORT_NAME, RING_PORT_SIZE, socket,
+			RING_F_SP_ENQ | RING_F_SC_DEQ);
+	if (pq->ring == NULL)
+		goto fail_ring;
+
+	port = rte_eth_from_ring(pq->ring);
+	if (port < 0)
+		goto fail_port;
+	pq->port = port;
+
+	memset(&conf, 0, sizeof(conf));
+	if (rte_eth_dev_configure(port, 1, 1, &conf) < 0 ||
+			rte_eth_rx_queue_setup(port, 0, RING_PORT_SIZE, socket,
+				NULL, pq->mp) < 0 ||
+			rte_eth_tx_queue_setup(port, 0, RING_PORT_SIZE, socket,
+				NULL) < 0 ||
+			rte_eth_dev_start(port) < 0)
+		goto fail_eth_q;
+
+	if (err_is_fail(ethdev_q_create(&pq->eth_q, port, 0, socket)))
+		goto fail_eth_q;
+
+	pq->tx = ethdev_q_get_tx(pq->eth_q);
+	pq->rx = ethdev_q_get_rx(pq->eth_q);
+	/* known to both sides */
+	if (err_is_fail(cleanq_register_mempool(pq->tx, pq->mp)))
+		goto fail_reg;
+
+	if (rte_pktmbuf_alloc_bulk(pq->mp, pq->mbufs, MAX_BURST) != 0)
+		goto fail_reg;
+
+	/* a burst is received into these */
+	if (rte_pktmbuf_alloc_bulk(pq->mp, posted, MAX_BURST) != 0)
+		goto fail_posted;
+
+	for (i = 0; i < MAX_BURST; i++) {
+		mbuf_to_cleanq_buf(pq->rx, posted[i], &b);
+		if (err_is_fail(enq(pq->rx, &b, 0)))
+			break;
+	}
+	if (i < MAX_BURST) {
+		/* the queue frees those posted already */
+		for (; i < MAX_BURST; i++)
+			rte_pktmbuf_free(posted[i]);
+		goto fail_posted;
+	}
+
+	for (i = 0; i < MAX_BURST; i++) {
+		pq->mbufs[i]->data_len = 64;
+		mbuf_to_cleanq_buf(pq->tx, pq->mbufs[i], &pq->bufs[i]);
+	}
+
+	pq->recv = ethdev_recv;
+	pq->destroy = ethdev_destroy_pq;
+	return 0;
+
+fail_posted:
+	for (i = 0; i < MAX_BURST; i++)
+		rte_pktmbuf_free(pq->mbufs[i]);
+fail_reg:
+	/* nothing was sent yet */
+	ethdev_q_destroy(pq->eth_q);
+fail_eth_q:
+	rte_eth_dev_stop(port);
+	rte_vdev_uninit("net_ring_" RING_PORT_NAME);
+fail_port:
+	rte_ring_free(pq->ring);
+fail_ring:
+	rte_mempool_free(pq->mp);
+	return -1;
+}
+#endif
+
+static const struct {
+	const char *name;
+	int (*init)(struct perf_q *pq);
+} backends[] = {
+	{ "loopback", loopback_init },
+	{ "debug", debug_init },
+	{ "ipcq", ipcq_init },
+	{ "ipcq_compact", ipcq_compact_init },
+	{ "reflector", reflector_init },
+#ifdef RTE_LIBRTE_PMD_RING
+	{ "ethdev_ring", ethdev_init },
+#endif
+};
+
+/* the backend has its buffers already if they are mbufs */
+static int
+perf_q_create(struct perf_q *pq, unsigned i)
+{
+	struct capref cap;
+	unsigned j;
+
+	memset(pq, 0, sizeof(*pq));
+	pq->name = backends[i].name;
+	pq->send = direct_send;
+	pq->recv = direct_recv;
+	pq->destroy = default_destroy;
+	if (backends[i].init(pq) != 0) {
+		printf("%s: cannot create queue\n", pq->name);
+		return -1;
+	}
+	if (pq->mp != NULL)
+		return 0;
+
+	pq->mem = rte_zmalloc(NULL, 2 * MAX_BURST * BUF_SIZE, BUF_SIZE);
+	if (pq->mem == NULL)
+		goto fail;
+
+	cap.vaddr = pq->mem;
+	cap.paddr = rte_malloc_virt2iova(pq->mem);
+	cap.len = 2 * MAX_BURST * BUF_SIZE;
+	if (err_is_fail(cleanq_register(pq->tx, cap, &pq->rid)) ||
+			err_is_fail(drain_peer(pq)))
+		goto fail;
+
+	for (j = 0; j < MAX_BURST; j++) {
+		pq->bufs[j].rid = pq->rid;
+		pq->bufs[j].offset = j * BUF_SIZE;
+		pq->bufs[j].length = BUF_SIZE;
+		pq->bufs[j].valid_data = 0;
+		pq->bufs[j].valid_length = 64;
+		pq->bufs[j].flags = 0;
+	}
+	return 0;
+
+fail:
+	printf("%s: cannot register buffers\n", pq->name);
+	pq->destroy(pq);
+	rte_free(pq->mem);
+	return -1;
+}
+
+static void
+perf_q_free(struct perf_q *pq)
+{
+	struct capref cap;
+
+	if (pq->mem != NULL) {
+		cleanq_deregister(pq->tx, pq->rid, &cap);
+		drain_peer(pq);
+	}
+	pq->destroy(pq);
+	rte_free(pq->mem);
+}
+
+/**** Datapath on a single lcore ****/
+
+static int
+test_single_enqueue_dequeue(struct perf_q *pq)
+{
+	const unsigned iterations = 1 << iter_shift;
+	uint64_t start, end;
+	unsigned i;
+
+	start = rte_rdtsc();
+	for (i = 0; i < iterations; i++) {
+		if (err_is_fail(pq->send(pq, &pq->bufs[0], CLEANQ_FLAG_LAST)) ||
+				err_is_fail(pq->recv(pq))) {
+			printf("%s: single enqueue/dequeue failed\n", pq->name);
+			return -1;
+		}
+	}
+	end = rte_rdtsc();
+
+	printf("%-14s single enq/dequeue: %"PRIu64"\n", pq->name,
+			(end - start) >> iter_shift);
+	return 0;
+}
+
+static int
+test_burst_enqueue_dequeue(struct perf_q *pq)
+{
+	uint64_t start, mid, end;
+	uint64_t enq_cycles, deq_cycles;
+	unsigned i, j, k, iterations;
+
+	for (i = 0; i < RTE_DIM(burst_sizes); i++) {
+		const unsigned size = burst_sizes[i];
+
+		iterations = (1 << iter_shift) / size;
+		enq_cycles = deq_cycles = 0;
+		for (j = 0; j < iterations; j++) {
+			start = rte_rdtsc();
+			for (k = 0; k < size; k++) {
+				if (err_is_fail(pq->send(pq, &pq->bufs[k],
+						k == size - 1 ? CLEANQ_FLAG_LAST : 0)))
+					goto fail;
+			}
+			mid = rte_rdtsc();
+			for (k = 0; k < size; k++) {
+				if (err_is_fail(pq->recv(pq)))
+					goto fail;
+			}
+			end = rte_rdtsc();
+			enq_cycles += mid - start;
+			deq_cycles += end - mid;
+		}
+
+		printf("%-14s burst enq (size: %2u): %.2F\n", pq->name, size,
+				(double) enq_cycles / (iterations * size));
+		printf("%-14s burst deq (size: %2u): %.2F\n", pq->name, size,
+				(double) deq_cycles / (iterations * size));
+	}
+	return 0;
+
+fail:
+	printf("%s: burst enqueue/dequeue failed\n", pq->name);
+	return -1;
+}
+
+/**** Control path ****/
+
+/* the peer of an ipcq is polled every REG_CHUNK regions, not timed */
+static int
+test_register_sequential(struct perf_q *pq, unsigned num)
+{
+	regionid_t rids[NUM_REGIONS];
+	struct capref cap;
+	uint64_t reg_cycles = 0, dereg_cycles = 0;
+	uint64_t start;
+	unsigned i, j, r, n;
+
+	for (r = 0; r < reg_rounds; r++) {
+		for (i = 0; i < num; i += n) {
+			n = RTE_MIN(num - i, (unsigned) REG_CHUNK);
+			start = rte_rdtsc();
+			for (j = i; j < i + n; j++) {
+				if (err_is_fail(cleanq_register(pq->tx,
+						regions[j], &rids[j])))
+					goto fail;
+			}
+			reg_cycles += rte_rdtsc() - start;
+			if (err_is_fail(drain_peer(pq)))
+				goto fail;
+		}
+
+		for (i = 0; i < num; i += n) {
+			n = RTE_MIN(num - i, (unsigned) REG_CHUNK);
+			start = rte_rdtsc();
+			for (j = i; j < i + n; j++) {
+				if (err_is_fail(cleanq_deregister(pq->tx,
+						rids[j], &cap)))
+					goto fail;
+			}
+			dereg_cycles += rte_rdtsc() - start;
+			if (err_is_fail(drain_peer(pq)))
+				goto fail;
+		}
+	}
+
+	printf("%-14s register (regions: %3u): %.2F\n", pq->name, num,
+			(double) reg_cycles / (reg_rounds * num));
+	printf("%-14s deregister (regions: %3u): %.2F\n", pq->name, num,
+			(double) dereg_cycles / (reg_rounds * num));
+	return 0;
+
+fail:
+	printf("%s: register/deregister failed\n", pq->name);
+	return -1;
+}
+
+/*
+ * Registers or deregisters a random one of num regions, so regions come
+ * and go in any order. Timed per operation.
+ */
+static int
+test_register_random(struct perf_q *pq, unsigned num)
+{
+	regionid_t rids[NUM_REGIONS];
+	bool is_reg[NUM_REGIONS] = { false };
+	struct capref cap;
+	uint64_t cycles[2] = { 0, 0 };
+	uint64_t ops[2] = { 0, 0 };
+	uint64_t start, end;
+	unsigned i, idx;
+	errval_t err;
+
+	for (i = 0; i < reg_rounds * num; i++) {
+		idx = rte_rand() % num;
+		if (!is_reg[idx]) {
+			start = rte_rdtsc();
+			err = cleanq_register(pq->tx, regions[idx], &rids[idx]);
+			end = rte_rdtsc();
+		} else {
+			start = rte_rdtsc();
+			err = cleanq_deregister(pq->tx, rids[idx], &cap);
+			end = rte_rdtsc();
+		}
+		if (err_is_fail(err))
+			goto fail;
+
+		cycles[is_reg[idx]] += end - start;
+		ops[is_reg[idx]]++;
+		is_reg[idx] = !is_reg[idx];
+		if (i % REG_CHUNK == REG_CHUNK - 1 &&
+				err_is_fail(drain_peer(pq)))
+			goto fail;
+	}
+
+	for (idx = 0; idx < num; idx++) {
+		if (is_reg[idx] &&
+				(err_is_fail(cleanq_deregister(pq->tx, rids[idx],
+					&cap)) ||
+				err_is_fail(drain_peer(pq))))
+			goto fail;
+	}
+
+	printf("%-14s random register (regions: %3u): %.2F\n", pq->name, num,
+			ops[0] ? (double) cycles[0] / ops[0] : 0.0);
+	printf("%-14s random deregister (regions: %3u): %.2F\n", pq->name, num,
+			ops[1] ? (double) cycles[1] / ops[1] : 0.0);
+	return 0;
+
+fail:
+	printf("%s: random register/deregister failed\n", pq->name);
+	return -1;
+}
+
+static int
+test_register_deregister(struct perf_q *pq)
+{
+	unsigned i;
+
+	for (i = 0; i < RTE_DIM(region_counts); i++) {
+		if (test_register_sequential(pq, region_counts[i]) != 0 ||
+				test_register_random(pq, region_counts[i]) != 0)
+			return -1;
+	}
+	return 0;
+}
+
+/**** ipcq between two lcores ****/
+
+/* copied from test_ring_perf.c */
+static int
+get_two_hyperthreads(struct lcore_pair *lcp)
+{
+	unsigned id1, id2;
+	unsigned c1, c2, s1, s2;
+	RTE_LCORE_FOREACH(id1) {
+		RTE_LCORE_FOREACH(id2) {
+			if (id1 == id2)
+				continue;
+			c1 = lcore_config[id1].core_id;
+			c2 = lcore_config[id2].core_id;
+			s1 = lcore_config[id1].socket_id;
+			s2 = lcore_config[id2].socket_id;
+			if ((c1 == c2) && (s1 == s2)) {
+				lcp->c1 = id1;
+				lcp->c2 = id2;
+				return 0;
+			}
+		}
+	}
+	return 1;
+}
+
+static int
+get_two_cores(struct lcore_pair *lcp)
+{
+	unsigned id1, id2;
+	unsigned c1, c2, s1, s2;
+	RTE_LCORE_FOREACH(id1) {
+		RTE_LCORE_FOREACH(id2) {
+			if (id1 == id2)
+				continue;
+			c1 = lcore_config[id1].core_id;
+			c2 = lcore_config[id2].core_id;
+			s1 = lcore_config[id1].socket_id;
+			s2 = lcore_config[id2].socket_id;
+			if ((c1 != c2) && (s1 == s2)) {
+				lcp->c1 = id1;
+				lcp->c2 = id2;
+				return 0;
+			}
+		}
+	}
+	return 1;
+}
+
+static int
+get_two_sockets(struct lcore_pair *lcp)
+{
+	unsigned id1, id2;
+	unsigned s1, s2;
+	RTE_LCORE_FOREACH(id1) {
+		RTE_LCORE_FOREACH(id2) {
+			if (id1 == id2)
+				continue;
+			s1 = lcore_config[id1].socket_id;
+			s2 = lcore_config[id2].socket_id;
+			if (s1 != s2) {
+				lcp->c1 = id1;
+				lcp->c2 = id2;
+				return 0;
+			}
+		}
+	}
+	return 1;
+}
+
+struct handoff_params {
+	struct perf_q *pq;
+	unsigned size;
+	double cycles;
+	int ret;
+};
+
+static volatile unsigned handoff_stop;
+
+/* sends every buffer that comes in back */
+static int
+handoff_echo(void *arg)
+{
+	struct handoff_params *p = arg;
+	struct cleanq_buf b;
+	errval_t err;
+
+	while (!handoff_stop) {
+		if (deq(p->pq->rx, &b) != CLEANQ_ERR_OK)
+			continue;
+		do {
+			err = enq(p->pq->rx, &b, b.flags);
+		} while (err == CLEANQ_ERR_QUEUE_FULL);
+	}
+	return 0;
+}
+
+/* round trips of a burst to the echo */
+static int
+handoff_send(void *arg)
+{
+	struct handoff_params *p = arg;
+	struct perf_q *pq = p->pq;
+	const unsigned iterations = 1 << handoff_shift;
+	struct cleanq_buf b;
+	uint64_t start = 0;
+	unsigned i, k, n;
+	errval_t err;
+
+	/* the first round trip waits for the echo to start */
+	for (i = 0; i <= iterations; i++) {
+		if (i == 1)
+			start = rte_rdtsc();
+		for (k = 0; k < p->size; k++) {
+			if (err_is_fail(enq(pq->tx, &pq->bufs[k], 0)))
+				goto fail;
+		}
+		for (n = 0; n < p->size; ) {
+			err = deq(pq->tx, &b);
+			if (err == CLEANQ_ERR_OK)
+				n++;
+			else if (err != CLEANQ_ERR_QUEUE_EMPTY)
+				goto fail;
+		}
+	}
+	p->cycles = (double) (rte_rdtsc() - start) / (iterations * p->size);
+	p->ret = 0;
+	handoff_stop = 1;
+	return 0;
+
+fail:
+	p->ret = -1;
+	handoff_stop = 1;
+	return -1;
+}
+
+static int
+run_on_core_pair(struct lcore_pair *cores, struct perf_q *pq)
+{
+	struct handoff_params param1, param2;
+	unsigned sizes[RTE_DIM(burst_sizes) + 1];
+	unsigned i;
+
+	sizes[0] = 1;
+	for (i = 0; i < RTE_DIM(burst_sizes); i++)
+		sizes[i + 1] = burst_sizes[i];
+
+	for (i = 0; i < RTE_DIM(sizes); i++) {
+		memset(&param1, 0, sizeof(param1));
+		param1.pq = param2.pq = pq;
+		param1.size = param2.size = sizes[i];
+		handoff_stop = 0;
+		if (cores->c1 == rte_get_master_lcore()) {
+			rte_eal_remote_launch(handoff_echo, &param2, cores->c2);
+			handoff_send(&param1);
+			rte_eal_wait_lcore(cores->c2);
+		} else if (cores->c2 == rte_get_master_lcore()) {
+			rte_eal_remote_launch(handoff_echo, &param2, cores->c1);
+			handoff_send(&param1);
+			rte_eal_wait_lcore(cores->c1);
+		} else {
+			rte_eal_remote_launch(handoff_send, &param1, cores->c1);
+			rte_eal_remote_launch(handoff_echo, &param2, cores->c2);
+			rte_eal_wait_lcore(cores->c1);
+			rte_eal_wait_lcore(cores->c2);
+		}
+		if (param1.ret != 0) {
+			printf("%s: round trip failed\n", pq->name);
+			return -1;
+		}
+		printf("%-14s round trip (size: %2u): %.2F\n", pq->name,
+				sizes[i], param1.cycles);
+	}
+	return 0;
+}
+
+static int
+test_handoff(struct perf_q *pq)
+{
+	struct lcore_pair cores;
+
+	if (get_two_hyperthreads(&cores) == 0) {
+		printf("\n### %s using two hyperthreads ###\n", pq->name);
+		if (run_on_core_pair(&cores, pq) != 0)
+			return -1;
+	}
+	if (get_two_cores(&cores) == 0) {
+		printf("\n### %s using two physical cores ###\n", pq->name);
+		if (run_on_core_pair(&cores, pq) != 0)
+			return -1;
+	}
+	if (get_two_sockets(&cores) == 0) {
+		printf("\n### %s using two NUMA nodes ###\n", pq->name);
+		if (run_on_core_pair(&cores, pq) != 0)
+			return -1;
+	}
+	return 0;
+}
+
+static int
+test_cleanq_perf(void)
+{
+	struct perf_q queues[RTE_DIM(backends)];
+	uint8_t *region_mem;
+	unsigned i, num = 0;
+	int ret = -1;
+
+	region_mem = rte_zmalloc(NULL, NUM_REGIONS * REGION_SIZE, REGION_SIZE);
+	if (region_mem == NULL)
+		return -1;
+	for (i = 0; i < NUM_REGIONS; i++) {
+		regions[i].vaddr = region_mem + i * REGION_SIZE;
+		regions[i].paddr = rte_mem_virt2iova(regions[i].vaddr);
+		regions[i].len = REGION_SIZE;
+	}
+
+	for (num = 0; num < RTE_DIM(backends); num++) {
+		if (perf_q_create(&queues[num], num) != 0)
+			goto out;
+	}
+
+	printf("### Testing single buffer enq/deq ###\n");
+	for (i = 0; i < num; i++) {
+		if (test_single_enqueue_dequeue(&queues[i]) != 0)
+			goto out;
+	}
+
+	printf("\n### Testing burst enq/deq ###\n");
+	for (i = 0; i < num; i++) {
+		if (test_burst_enqueue_dequeue(&queues[i]) != 0)
+			goto out;
+	}
+
+	printf("\n### Testing register/deregister ###\n");
+	for (i = 0; i < num; i++) {
+		if (test_register_deregister(&queues[i]) != 0)
+			goto out;
+	}
+
+	for (i = 0; i < num; i++) {
+		if (queues[i].peer != NULL && test_handoff(&queues[i]) != 0)
+			goto out;
+	}
+	ret = 0;
+
+out:
+	while (num > 0)
+		perf_q_free(&queues[--num]);
+	rte_free(region_mem);
+	return ret;
+}
+
+REGISTER_TEST_COMMAND(cleanq_perf_autotest, test_cleanq_perf);
@@ -24,18 +24,9 @@
 #include <assert.h>
 #include <pthread.h>
 #include <errno.h>
+#include <time.h>
 
-#define	timersub(a, b, result)						      \
-  do {									      \
-    (result)->tv_sec = (a)->tv_sec - (b)->tv_sec;			      \
-    (result)->tv_usec = (a)->tv_usec - (b)->tv_usec;			      \
-    if ((result)->tv_usec < 0) {					      \
-      --(result)->tv_sec;						      \
-      (result)->tv_usec += 1000000;					      \
-    }									      \
-  } while (0)
-
-struct timeval st;
+#include "udp_bench.h"
 
 static pthread_t* threads; // all threads
 static double* pkts_per_s; // total pkts per thread
@@ -48,6 +39,25 @@ static int buf_size;
 static char* ip;
 static uint32_t max_pkts_in_flight = 1;
 static uint32_t rounds;
+static int latency_mode; // -l
+static uint32_t batch = 1; // -b, packets per sendmmsg/recvmmsg
+static uint32_t num_ports = 1; // -p, source ports (sockets) per thread
+
+#define MAX_BATCH 1024 // UIO_MAXIOV
+#define MAX_PORTS 256
+
+/*
+ * Latency mode: requests carry the sequence number in payload[0] and the
+ * TSC send time in payload[1], the RTTs go into a histogram per thread (see
+ * udp_bench.h)
+ */
+
+// replies missing this long are given up, the window is refilled
+#define LAT_LOSS_TIMEOUT_NS 100000000ULL
+// waiting for the replies still in flight at the end of a round
+#define LAT_DRAIN_NS 100000000ULL
+
+static struct lat_stats* lat_stats; // per thread
 
 // data of machine we send to
 //static struct sockaddr_in clientaddr;
@@ -78,81 +88,194 @@ static int setup_socket()
     return sockfd;
 }
 
+/*
+ * A thread sends on num_ports sockets, each with its own source port, so
+ * the server sees as many flows and RSS spreads them over its queues. A
+ * reply is answered with a new request on the same socket.
+ */
+struct client {
+    int sockfd[MAX_PORTS];
+    uint64_t next_seq[MAX_PORTS];   // reordering only counts within a flow
+    struct sockaddr_in addr;        // of the server
+    char* tx_bufs;                  // batch buffers of buf_size
+    char* rx_bufs;
+    struct iovec tx_iov[MAX_BATCH];
+    struct iovec rx_iov[MAX_BATCH];
+    struct mmsghdr tx_msgs[MAX_BATCH];
+    struct mmsghdr rx_msgs[MAX_BATCH];
+    uint64_t num_pkt_send;
+};
+
+static void client_init(struct client* c)
+{
+    memset(c, 0, sizeof(*c));
+    c->addr.sin_family = AF_INET;
+    c->addr.sin_addr.s_addr = inet_addr(ip);
+    if(c->addr.sin_addr.s_addr == INADDR_NONE) {
+      printf("Error on inet_addr()\n");
+      exit(1);
+    }
+    c->addr.sin_port = htons((unsigned short)portno);
+
+    c->tx_bufs = (char*) calloc(batch, buf_size);
+    c->rx_bufs = (char*) calloc(batch, buf_size);
+    assert(c->tx_bufs != NULL && c->rx_bufs != NULL);
+
+    for (uint32_t i = 0; i < batch; i++) {
+        c->tx_iov[i].iov_base = c->tx_bufs + i * buf_size;
+        c->tx_iov[i].iov_len = buf_size;
+        c->tx_msgs[i].msg_hdr.msg_iov = &c->tx_iov[i];
+        c->tx_msgs[i].msg_hdr.msg_iovlen = 1;
+        c->tx_msgs[i].msg_hdr.msg_name = &c->addr;
+        c->tx_msgs[i].msg_hdr.msg_namelen = sizeof(c->addr);
+
+        c->rx_iov[i].iov_base = c->rx_bufs + i * buf_size;
+        c->rx_iov[i].iov_len = buf_size;
+        c->rx_msgs[i].msg_hdr.msg_iov = &c->rx_iov[i];
+        c->rx_msgs[i].msg_hdr.msg_iovlen = 1;
+    }
+
+    // setup sockets including binding to interface
+    for (uint32_t i = 0; i < num_ports; i++) {
+        c->sockfd[i] = setup_socket();
+    }
+}
+
+static void client_destroy(struct client* c)
+{
+    for (uint32_t i = 0; i < num_ports; i++) {
+        close(c->sockfd[i]);
+    }
+    free(c->tx_bufs);
+    free(c->rx_bufs);
+}
+
+// sends n requests on socket port, returns how many went out
+static uint32_t send_batch(struct client* c, uint32_t port, uint32_t n)
+{
+    int sent;
+
+    for (uint32_t i = 0; i < n; i++) {
+        uint64_t* payload = (uint64_t*) c->tx_iov[i].iov_base;
+        payload[0] = c->num_pkt_send + i;
+        if (latency_mode) {
+            payload[1] = tsc_read();
+        }
+    }
+
+    sent = sendmmsg(c->sockfd[port], c->tx_msgs, n, 0);
+    if (sent < 0) {
+        printf("ERROR in sendmmsg");
+        return 0;
+    }
+    c->num_pkt_send += sent;
+    return sent;
+}
+
+/*
+ * receives up to batch replies on socket port and records their RTT,
+ * returns the number of replies, -1 on error
+ */
+static int recv_batch(struct client* c, uint32_t port, struct lat_stats* lat)
+{
+    int n;
+    int replies = 0;
+    uint64_t now;
+
+    n = recvmmsg(c->sockfd[port], c->rx_msgs, batch, MSG_DONTWAIT, NULL);
+    if (n < 0) {
+        if (errno == EWOULDBLOCK || errno == EAGAIN) {
+            return 0;
+        }
+        printf("ERROR in recvmmsg");
+        return -1;
+    }
+
+    now = tsc_read();
+    lat->next_seq = c->next_seq[port];
+    for (int i = 0; i < n; i++) {
+        if (c->rx_msgs[i].msg_len != (unsigned int) buf_size) {
+            continue;
+        }
+        replies++;
+        if (latency_mode) {
+            uint64_t* payload = (uint64_t*) c->rx_iov[i].iov_base;
+            lat_record(lat, payload[0],
+                       now > payload[1] ? tsc_to_ns(now - payload[1]) : 0);
+        }
+    }
+    c->next_seq[port] = lat->next_seq;
+
+    return replies;
+}
+
 static void *client_func(void *arg)
 {
-    char buf[buf_size]; /* message buf */
-    uint64_t* payload = (uint64_t*) &buf;
     uint64_t total_pkts = 0;
-    uint64_t num_pkt_send = 0;
     uint64_t t_id = (uint64_t) arg;
-    int sockfd;
-    struct timeval diff;
-    struct timeval end;
     int n;
     double time_s = 0;
     uint32_t pkts_in_flight = 0;
+    uint32_t port = 0;
+    struct lat_stats* lat = &lat_stats[t_id];
+    uint64_t start = tsc_read();
+    uint64_t end = start + ns_to_tsc(bench_run_time * 1e9);
+    uint64_t now = start;
+    uint64_t last_rx = start;
+    uint64_t loss_timeout = ns_to_tsc(LAT_LOSS_TIMEOUT_NS);
+    struct client* c = (struct client*) malloc(sizeof(struct client));
+
+    assert(c != NULL);
+    client_init(c);
  
-    struct sockaddr_in clientaddr;
-    socklen_t clientlen;
-
-    clientlen = sizeof(clientaddr);
+    while (now < end) {
 
-    bzero((char *) &clientaddr, sizeof(clientaddr));
-    clientaddr.sin_family = AF_INET;
-    clientaddr.sin_addr.s_addr = inet_addr(ip);
-    if(clientaddr.sin_addr.s_addr == INADDR_NONE) {
-      printf("Error on inet_addr()\n");
-      exit(1);
-    }
-    clientaddr.sin_port = htons((unsigned short)portno);
-
-    // setup socket including binding to interface
-    sockfd = setup_socket();
- 
-    //printf("Thread %lu started using sockfd %d \n", t_id, sockfd);  
-    //timersub(tstamp, &oldstamp, &diff);
-    while (time_s < bench_run_time) {   
-
-        // slowly start up with sending packets
+        // slowly start up with sending packets, the flows take turns
         if (pkts_in_flight < max_pkts_in_flight) {
-            payload[0] = num_pkt_send;
-            n = sendto(sockfd, buf, buf_size, 0, (struct sockaddr *) &clientaddr, 
-                   clientlen);
-            if (n < 0) {
-                printf("ERROR in sendto");
+            uint32_t num = max_pkts_in_flight - pkts_in_flight;
+            if (num > batch) {
+                num = batch;
             }
-            pkts_in_flight++;
-            num_pkt_send++;
+            pkts_in_flight += send_batch(c, port, num);
+            port = (port + 1) % num_ports;
         }
 
-        n = recvfrom(sockfd, buf, buf_size, MSG_DONTWAIT, NULL, NULL);
-        if (n < 0) {
-	    if (errno == EWOULDBLOCK || errno == EAGAIN) {
-	    	
-	    } else {
-            	printf("ERROR in recvfrom");
-            	pkts_in_flight--;
-	    }
-        }
-
-        if (n == buf_size) {
-            total_pkts++;
-            // was a valid buffer, resend
-            payload[0] = num_pkt_send;
-            n = sendto(sockfd, buf, buf_size, 0, (struct sockaddr *) &clientaddr, 
-                       clientlen);
+        for (uint32_t p = 0; p < num_ports; p++) {
+            n = recv_batch(c, p, lat);
             if (n < 0) {
-                printf("ERROR in sendto");
+                if (pkts_in_flight > 0) {
+                    pkts_in_flight--;
+                }
+            } else if (n > 0) {
+                total_pkts += n;
+                last_rx = tsc_read();
+                // were valid buffers, resend on the same flow
+                pkts_in_flight -= n - send_batch(c, p, n);
             }
-            num_pkt_send++;
         }
 
-        gettimeofday(&end, NULL);
-        timersub(&end, &st, &diff);
-        time_s = ((double)diff.tv_sec * 1000000 + (double)diff.tv_usec)/1000000;
+        now = tsc_read();
+        if (latency_mode && pkts_in_flight > 0 && now - last_rx > loss_timeout) {
+            // the replies are lost, do not stall on them
+            pkts_in_flight = 0;
+            last_rx = now;
+        }
+    }
+    time_s = tsc_to_ns(now - start) / 1e9;
+
+    if (latency_mode) {
+        // whatever is still missing after the drain counts as lost
+        uint64_t drain_end = tsc_read() + ns_to_tsc(LAT_DRAIN_NS);
+        while (lat->received < c->num_pkt_send && tsc_read() < drain_end) {
+            for (uint32_t p = 0; p < num_ports; p++) {
+                recv_batch(c, p, lat);
+            }
+        }
+        lat->sent = c->num_pkt_send;
     }
 
-    close(sockfd);
+    client_destroy(c);
+    free(c);
     run_times[t_id] = time_s; 
     pkts_per_s[t_id] = total_pkts/time_s;
     //printf("Thread %lu exit pkts recvd %lu \n", t_id, total_pkts);  
@@ -161,13 +284,38 @@ static void *client_func(void *arg)
 
 int main(int argc, char **argv) 
 {
+    int opt;
+
+    while ((opt = getopt(argc, argv, "lb:p:")) != -1) {
+        switch (opt) {
+        case 'l':
+            latency_mode = 1;
+            break;
+        case 'b':
+            batch = atoi(optarg);
+            break;
+        case 'p':
+            num_ports = atoi(optarg);
+            break;
+        default:
+            argc = 0;
+            break;
+        }
+    }
+    argv[optind - 1] = argv[0];
+    argc -= optind - 1;
+    argv += optind - 1;
+
     /* 
     * check command line arguments 
     */
     if (argc < 10) {
-        fprintf(stderr, "usage: %s <num clients> <interface> <port> <server IP>" 
+        fprintf(stderr, "usage: %s [-l] [-b <batch>] [-p <ports>] <num clients> <interface> <port> <server IP>" 
                         "<mesure time (in seconds)> <max packets in flight>"
-                        "<buffer size> <number of rounds> <ouput file name>\n",
+                        "<buffer size> <number of rounds> <ouput file name>\n"
+                        "  -l  latency mode, RTT percentiles, loss and reordering\n"
+                        "  -b  packets per sendmmsg/recvmmsg call (default 1)\n"
+                        "  -p  source ports (flows) per client (default 1)\n",
                          argv[0]);
         exit(1);
     }
@@ -186,6 +334,7 @@ int main(int argc, char **argv)
         pkts_per_s = (double*) calloc(num_clients, sizeof(double));
         run_times = (double*) calloc(num_clients, sizeof(double));
         threads = (pthread_t*) calloc(num_clients, sizeof(pthread_t));
+        lat_stats = (struct lat_stats*) calloc(num_clients, sizeof(struct lat_stats));
     } else {
         fprintf(stderr, "Invalid client value. Should be 1 <= client value <= 100 \n");
         exit(1);
@@ -197,7 +346,23 @@ int main(int argc, char **argv)
         exit(1);
     }
 
-    gettimeofday(&st, NULL);
+    if (latency_mode && buf_size < (int) (2 * sizeof(uint64_t))) {
+        fprintf(stderr, "Invalid buffer size. Should be >= 16 in latency mode \n");
+        exit(1);
+    }
+
+    if (buf_size < (int) sizeof(uint64_t)) {
+        fprintf(stderr, "Invalid buffer size. Should be >= 8 \n");
+        exit(1);
+    }
+
+    if (batch < 1 || batch > MAX_BATCH || num_ports < 1 || num_ports > MAX_PORTS) {
+        fprintf(stderr, "Invalid batch or ports. Should be 1 <= batch <= %d, "
+                        "1 <= ports <= %d \n", MAX_BATCH, MAX_PORTS);
+        exit(1);
+    }
+
+    tsc_init();
     uint32_t num_cores = sysconf(_SC_NPROCESSORS_ONLN);
 
     double tot_pkts_per_s = 0;
@@ -210,14 +375,18 @@ int main(int argc, char **argv)
                   "#################### \n");
     fprintf(file, "#Config: num_clients %d, if_name %s, portno %d, ip %s, \n" 
                   "#        bench_run_time %.2f (s), max_pkts_in_flight %d, buf_size %d,\n" 
-                  "#        rounds %d, outfile %s \n",
+                  "#        rounds %d, outfile %s, latency %d, batch %u, ports %u \n",
             num_clients, if_name, portno, ip, bench_run_time, max_pkts_in_flight, 
-            buf_size, rounds, out_file_name);
-    fprintf(file, "Round \t | Pkts/s \t\t\t| Mbit/s incl. header \t\t| Mbit/s payload\n");
+            buf_size, rounds, out_file_name, latency_mode, batch, num_ports);
+    fprintf(file, "Round \t | Pkts/s \t\t\t| Mbit/s incl. header \t\t| Mbit/s payload");
+    if (latency_mode) {
+        fprintf(file, "\t| p50 us \t| p99 us \t| p99.9 us \t| p99.99 us \t| lost \t| reordered");
+    }
+    fprintf(file, "\n");
     for(uint32_t rnd = 0; rnd < rounds; rnd++) {
 
         memset(threads, 0, num_clients*sizeof(pthread_t));
-        gettimeofday(&st, NULL);
+        memset(lat_stats, 0, num_clients*sizeof(struct lat_stats));
         
         for (uint64_t i = 0; i < (uint32_t) num_clients; i++) { 
 
@@ -233,8 +402,6 @@ int main(int argc, char **argv)
             assert(ret == 0);
 
         }
-        
-        gettimeofday(&st, NULL);
 
         for (int i = 0; i < num_clients; i++) {
             pthread_join(threads[i], NULL);
@@ -248,11 +415,33 @@ int main(int argc, char **argv)
         printf("Mbit/s %f including header \n", ((tot_pkts_per_s)*(buf_size+42)*8)/(1000*1000));
         printf("Mbit/s %f only payload \n", ((tot_pkts_per_s)*buf_size*8)/(1000*1000));
         printf("Pkts/s %f \n", tot_pkts_per_s);
-        fprintf(file, "%d \t\t | %.2f \t\t| %.2f \t\t\t\t\t| %.2f\n", rnd, 
+        fprintf(file, "%d \t\t | %.2f \t\t| %.2f \t\t\t\t\t| %.2f", rnd, 
                 tot_pkts_per_s,
                 ((tot_pkts_per_s)*(buf_size+42)*8)/(1000*1000), 
                 ((tot_pkts_per_s)*buf_size*8)/(1000*1000));
 
+        if (latency_mode) {
+            // merge the histograms of the threads into the first one
+            struct lat_stats* tot = &lat_stats[0];
+            for (int i = 1; i < num_clients; i++) {
+                lat_merge(tot, &lat_stats[i]);
+            }
+
+            double p50 = lat_percentile(tot, 0.5);
+            double p99 = lat_percentile(tot, 0.99);
+            double p999 = lat_percentile(tot, 0.999);
+            double p9999 = lat_percentile(tot, 0.9999);
+            uint64_t lost = lat_lost(tot);
+
+            printf("RTT us p50 %.2f p99 %.2f p99.9 %.2f p99.99 %.2f \n",
+                   p50, p99, p999, p9999);
+            printf("Lost %" PRIu64 " reordered %" PRIu64 " of %" PRIu64 " \n",
+                   lost, tot->reordered, tot->sent);
+            fprintf(file, "\t| %.2f \t| %.2f \t| %.2f \t| %.2f \t| %" PRIu64
+                    " \t| %" PRIu64, p50, p99, p999, p9999, lost, tot->reordered);
+        }
+        fprintf(file, "\n");
+
         sleep(5);
     }
 
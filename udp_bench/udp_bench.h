@@ -0,0 +1,167 @@
+/*
+ * Copyright (c) 2019, ETH Zürich
+ * All rights reserved.
+ *
+ * This file is distributed under the terms in the attached LICENSE file.
+ * If you do not find this file, copies can be found by writing to:
+ * ETH Zurich D-INFK, Universitaetstr. 6, CH-8092 Zurich.
+ * Attn: Systems Group.
+ */
+
+#ifndef UDP_BENCH_H_
+#define UDP_BENCH_H_
+
+#include <stdint.h>
+#include <time.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+/*
+ * Time
+ */
+
+static inline uint64_t now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/*
+ * The TSC, calibrated against CLOCK_MONOTONIC by tsc_init(). It has to be
+ * invariant and the same on all cores, which it is on current x86. Other
+ * architectures fall back to CLOCK_MONOTONIC.
+ */
+static double tsc_per_ns = 1.0;
+
+static inline uint64_t tsc_read(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#else
+    return now_ns();
+#endif
+}
+
+static inline void tsc_pause(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+    _mm_pause();
+#endif
+}
+
+static inline void tsc_init(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+    struct timespec wait = { 0, 50 * 1000 * 1000 };
+    uint64_t t0 = now_ns();
+    uint64_t c0 = tsc_read();
+
+    nanosleep(&wait, NULL);
+    tsc_per_ns = (double) (tsc_read() - c0) / (now_ns() - t0);
+#endif
+}
+
+static inline uint64_t ns_to_tsc(double ns)
+{
+    return (uint64_t) (ns * tsc_per_ns);
+}
+
+static inline double tsc_to_ns(uint64_t cycles)
+{
+    return cycles / tsc_per_ns;
+}
+
+/*
+ * RTT histogram. Values below LAT_SUB ns have a bucket each, above that
+ * every power of two is split into LAT_SUB buckets, so a bucket is at most
+ * 1/LAT_SUB of its values wide.
+ */
+#define LAT_SUB_BITS 5
+#define LAT_SUB (1 << LAT_SUB_BITS)
+#define LAT_BUCKETS ((64 - LAT_SUB_BITS + 1) * LAT_SUB)
+
+struct lat_stats {
+    uint64_t hist[LAT_BUCKETS];
+    uint64_t sent;
+    uint64_t received;
+    uint64_t reordered;     // received after a higher sequence number
+    uint64_t next_seq;      // highest sequence number received + 1
+};
+
+static inline uint32_t lat_bucket(uint64_t ns)
+{
+    if (ns < LAT_SUB) {
+        return ns;
+    }
+    uint32_t shift = 63 - __builtin_clzll(ns) - LAT_SUB_BITS;
+    return ((shift + 1) << LAT_SUB_BITS) + ((ns >> shift) & (LAT_SUB - 1));
+}
+
+// middle of the values of a bucket
+static inline double lat_bucket_ns(uint32_t b)
+{
+    if (b < LAT_SUB) {
+        return b;
+    }
+    uint32_t shift = (b >> LAT_SUB_BITS) - 1;
+    uint64_t low = ((uint64_t) (LAT_SUB + (b & (LAT_SUB - 1)))) << shift;
+    return low + (double) (1ULL << shift) / 2;
+}
+
+static inline void lat_record(struct lat_stats* st, uint64_t seq,
+                              uint64_t rtt_ns)
+{
+    st->received++;
+    if (seq >= st->next_seq) {
+        st->next_seq = seq + 1;
+    } else {
+        st->reordered++;
+    }
+    st->hist[lat_bucket(rtt_ns)]++;
+}
+
+static inline void lat_merge(struct lat_stats* dst, const struct lat_stats* src)
+{
+    for (uint32_t b = 0; b < LAT_BUCKETS; b++) {
+        dst->hist[b] += src->hist[b];
+    }
+    dst->sent += src->sent;
+    dst->received += src->received;
+    dst->reordered += src->reordered;
+}
+
+static inline uint64_t lat_lost(const struct lat_stats* st)
+{
+    return st->sent > st->received ? st->sent - st->received : 0;
+}
+
+// percentile p (0..1) in us
+static inline double lat_percentile(const struct lat_stats* st, double p)
+{
+    uint64_t total = 0;
+    uint64_t target;
+    uint64_t sum = 0;
+
+    for (uint32_t b = 0; b < LAT_BUCKETS; b++) {
+        total += st->hist[b];
+    }
+    if (total == 0) {
+        return 0;
+    }
+
+    target = (uint64_t) (p * total);
+    if (target < 1) {
+        target = 1;
+    }
+    for (uint32_t b = 0; b < LAT_BUCKETS; b++) {
+        sum += st->hist[b];
+        if (sum >= target) {
+            return lat_bucket_ns(b) / 1000;
+        }
+    }
+    return 0;
+}
+
+#endif // UDP_BENCH_H_
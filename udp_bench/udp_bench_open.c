@@ -24,36 +24,65 @@
 #include <assert.h>
 #include <pthread.h>
 #include <errno.h>
+#include <math.h>
+#include <time.h>
 
-#define	timersub(a, b, result)						      \
-  do {									      \
-    (result)->tv_sec = (a)->tv_sec - (b)->tv_sec;			      \
-    (result)->tv_usec = (a)->tv_usec - (b)->tv_usec;			      \
-    if ((result)->tv_usec < 0) {					      \
-      --(result)->tv_sec;						      \
-      (result)->tv_usec += 1000000;					      \
-    }									      \
-  } while (0)
+#include "udp_bench.h"
 
-struct timeval st;
+/*
+ * Open loop: every socket has a sender thread that sends at a fixed rate,
+ * regardless of the replies, and a receiver thread. Requests carry the
+ * sequence number in payload[0] and the TSC time the request was scheduled
+ * for in payload[1]. A request sent late counts its delay in the RTT, so
+ * a slow server cannot hide its queueing (coordinated omission).
+ */
+
+// the sender sleeps while the next request is further away than this
+#define PACE_SPIN_NS 50000
+// waiting for the replies still in flight at the end of a step
+#define DRAIN_NS 100000000ULL
+// threads start together this long after they are created
+#define START_DELAY_NS 20000000ULL
+
+/*
+ * Rate sweep (-s): the rate grows by SWEEP_FACTOR per step until the knee
+ * is passed, which is then narrowed down by SWEEP_BISECT bisections. The
+ * knee is passed when less than KNEE_DELIVERED of the offered load comes
+ * back or the p99 exceeds KNEE_P99_FACTOR times the p99 of the first step.
+ */
+#define SWEEP_FACTOR 1.5
+#define SWEEP_BISECT 3
+#define KNEE_DELIVERED 0.95
+#define KNEE_P99_FACTOR 5.0
 
 static pthread_t* rcv_threads; // all threads
 static pthread_t* snd_threads; // all threads
-static double* pkts_per_s; // total pkts per thread
-static double* pkts_send_per_s; // total pkts per thread
-static double* run_times; // all the end times of the threads
 static int num_clients;
 static char* if_name;
 static int portno;
 static double bench_run_time;
 static int buf_size;
 static char* ip;
-static uint32_t max_pkts_in_flight = 1;
 static int* sock_fds;
-
-// data of machine we send to
-//static struct sockaddr_in clientaddr;
-//static socklen_t clientlen;
+static int poisson; // -e
+
+// of the current step
+static double thread_rate; // pkts/s of one sender
+static uint64_t start_tsc;
+static uint64_t end_tsc;
+static struct lat_stats* lat_stats; // per socket, sent is set by the sender
+
+struct step_result {
+    double offered;     // pkts/s
+    double sent;        // pkts/s
+    double received;    // pkts/s
+    double p50;         // us
+    double p99;
+    double p999;
+    double p9999;
+    uint64_t lost;
+    uint64_t reordered;
+};
 
 static int setup_socket(uint64_t tid)
 {
@@ -79,22 +108,42 @@ static int setup_socket(uint64_t tid)
     return sock_fds[tid];
 }
 
+// sleeps most of the time until the TSC reaches t, spins for the rest
+static void wait_until(uint64_t t)
+{
+    uint64_t now = tsc_read();
+    uint64_t spin = ns_to_tsc(PACE_SPIN_NS);
+
+    if (now + spin < t) {
+        double ns = tsc_to_ns(t - now - spin);
+        struct timespec ts;
+        ts.tv_sec = (time_t) (ns / 1e9);
+        ts.tv_nsec = (long) (ns - ts.tv_sec * 1e9);
+        nanosleep(&ts, NULL);
+    }
+
+    while (tsc_read() < t) {
+        tsc_pause();
+    }
+}
+
 static void *sender_func(void *arg)
 {
     char buf[buf_size]; /* message buf */
     uint64_t* payload = (uint64_t*) &buf;
     uint64_t num_pkt_send = 0;
     uint64_t t_id = (uint64_t) arg;
-    struct timeval diff;
-    struct timeval end;
     int n;
-    double time_s = 0;
+    double gap = ns_to_tsc(1e9 / thread_rate);
+    double next = start_tsc;
+    unsigned short xsubi[3] = { (unsigned short) t_id, 0x1234, 0x330e };
  
     struct sockaddr_in clientaddr;
     socklen_t clientlen;
 
     clientlen = sizeof(clientaddr);
 
+    memset(buf, 0, buf_size);
     bzero((char *) &clientaddr, sizeof(clientaddr));
     clientaddr.sin_family = AF_INET;
     clientaddr.sin_addr.s_addr = inet_addr(ip);
@@ -104,9 +153,14 @@ static void *sender_func(void *arg)
     }
     clientaddr.sin_port = htons((unsigned short)portno);
 
-    while (time_s < bench_run_time) {   
+    // the senders are spread over the gap so they do not send in lockstep
+    next += gap * t_id / num_clients;
+
+    while (next < end_tsc) {
+        wait_until((uint64_t) next);
 
         payload[0] = num_pkt_send;
+        payload[1] = (uint64_t) next;
         n = sendto(sock_fds[t_id], buf, buf_size, 0, (struct sockaddr *) &clientaddr, 
                clientlen);
         if (n < 0) {
@@ -114,29 +168,31 @@ static void *sender_func(void *arg)
         } else {
             num_pkt_send++;
         }
-        gettimeofday(&end, NULL);
-        timersub(&end, &st, &diff);
-        time_s = ((double)diff.tv_sec * 1000000 + (double)diff.tv_usec)/1000000;
+
+        if (poisson) {
+            next += -log(1.0 - erand48(xsubi)) * gap;
+        } else {
+            next += gap;
+        }
     }
 
-    pkts_send_per_s[t_id] = num_pkt_send/time_s;
+    lat_stats[t_id].sent = num_pkt_send;
     return NULL;
 }
 
 static void *receiver_func(void *arg)
 {
     char buf[buf_size]; /* message buf */
-    uint64_t total_pkts = 0;
+    uint64_t* payload = (uint64_t*) &buf;
     uint64_t t_id = (uint64_t) arg;
-    struct timeval diff;
-    struct timeval end;
+    struct lat_stats* lat = &lat_stats[t_id];
+    uint64_t stop = end_tsc + ns_to_tsc(DRAIN_NS);
+    uint64_t now;
     int n;
-    double time_s = 0;
  
-    printf("Thread %lu started using sockfd %d \n", t_id, sock_fds[t_id]);  
-    //timersub(tstamp, &oldstamp, &diff);
-    while (time_s < bench_run_time) {   
+    do {
         n = recvfrom(sock_fds[t_id], buf, buf_size, MSG_DONTWAIT, NULL, NULL);
+        now = tsc_read();
         if (n < 0) {
             if (errno == EWOULDBLOCK || errno == EAGAIN) {
                 
@@ -146,97 +202,264 @@ static void *receiver_func(void *arg)
         }
 
         if (n == buf_size) {
-            total_pkts++;
-            // was a valid buffer, resend
+            lat_record(lat, payload[0],
+                       now > payload[1] ? tsc_to_ns(now - payload[1]) : 0);
+        }
+    } while (now < stop);
+
+    return NULL;
+}
+
+// offers rate pkts/s in total for one run time
+static void run_step(double rate, struct step_result* res)
+{
+    char buf[buf_size];
+    uint32_t num_cores = sysconf(_SC_NPROCESSORS_ONLN);
+
+    memset(lat_stats, 0, num_clients * sizeof(struct lat_stats));
+    for (int i = 0; i < num_clients; i++) {
+        // late replies of the last step
+        while (recvfrom(sock_fds[i], buf, buf_size, MSG_DONTWAIT, NULL, NULL) > 0) {
         }
+    }
+
+    thread_rate = rate / num_clients;
+    start_tsc = tsc_read() + ns_to_tsc(START_DELAY_NS);
+    end_tsc = start_tsc + ns_to_tsc(bench_run_time * 1e9);
+
+    // both threads of a socket poll, they get a core each
+    for (uint64_t i = 0; i < (uint32_t) num_clients; i++) { 
+        cpu_set_t cpuset;
+        pthread_attr_t attr;
+        pthread_attr_init(&attr);
+
+        CPU_ZERO(&cpuset);
+        CPU_SET((2 * i) % num_cores, &cpuset);
+        pthread_attr_setaffinity_np(&attr, sizeof(cpu_set_t), &cpuset);
+        int ret = pthread_create(&rcv_threads[i], &attr, receiver_func, (void*) i);
+        assert(ret == 0);
+
+        CPU_ZERO(&cpuset);
+        CPU_SET((2 * i + 1) % num_cores, &cpuset);
+        pthread_attr_setaffinity_np(&attr, sizeof(cpu_set_t), &cpuset);
+        ret = pthread_create(&snd_threads[i], &attr, sender_func, (void*) i);
+        assert(ret == 0);
 
-        gettimeofday(&end, NULL);
-        timersub(&end, &st, &diff);
-        time_s = ((double)diff.tv_sec * 1000000 + (double)diff.tv_usec)/1000000;
+        pthread_attr_destroy(&attr);
     }
 
-    run_times[t_id] = time_s; 
-    pkts_per_s[t_id] = total_pkts/time_s;
-    printf("Thread %lu exit pkts recvd %lu \n", t_id,
- 	   total_pkts);  
-    return NULL;
+    for (int i = 0; i < num_clients; i++) {
+        pthread_join(snd_threads[i], NULL);
+    }
+
+    for (int i = 0; i < num_clients; i++) {
+        pthread_join(rcv_threads[i], NULL);
+    }
+
+    struct lat_stats* tot = &lat_stats[0];
+    for (int i = 1; i < num_clients; i++) {
+        lat_merge(tot, &lat_stats[i]);
+    }
+
+    res->offered = rate;
+    res->sent = tot->sent / bench_run_time;
+    res->received = tot->received / bench_run_time;
+    res->p50 = lat_percentile(tot, 0.5);
+    res->p99 = lat_percentile(tot, 0.99);
+    res->p999 = lat_percentile(tot, 0.999);
+    res->p9999 = lat_percentile(tot, 0.9999);
+    res->lost = lat_lost(tot);
+    res->reordered = tot->reordered;
+}
+
+static void print_step(FILE* file, const struct step_result* res)
+{
+    printf("Offered %.0f pkts/s sent %.0f received %.0f, RTT us p50 %.2f "
+           "p99 %.2f p99.9 %.2f p99.99 %.2f, lost %" PRIu64
+           " reordered %" PRIu64 " \n", res->offered, res->sent,
+           res->received, res->p50, res->p99, res->p999, res->p9999,
+           res->lost, res->reordered);
+
+    if (file != NULL) {
+        fprintf(file, "%.0f \t| %.0f \t| %.0f \t| %.2f \t| %.2f \t| %.2f "
+                "\t| %.2f \t| %" PRIu64 " \t| %" PRIu64 "\n", res->offered,
+                res->sent, res->received, res->p50, res->p99, res->p999,
+                res->p9999, res->lost, res->reordered);
+    }
+}
+
+static int knee_passed(const struct step_result* res, double base_p99)
+{
+    return res->received < KNEE_DELIVERED * res->offered ||
+           res->p99 > KNEE_P99_FACTOR * base_p99;
+}
+
+/*
+ * Steps up the rate from start until the knee is passed or max is reached
+ * and returns the highest rate found below the knee, 0 if already the start
+ * rate is above it
+ */
+static double sweep(double start, double max, FILE* file)
+{
+    struct step_result res;
+    double base_p99;
+    double good = 0;
+    double bad = 0;
+    double rate = start;
+
+    run_step(rate, &res);
+    print_step(file, &res);
+    base_p99 = res.p99;
+    if (res.received < KNEE_DELIVERED * res.offered) {
+        return 0;
+    }
+    good = rate;
+
+    while (rate < max) {
+        rate = fmin(rate * SWEEP_FACTOR, max);
+        run_step(rate, &res);
+        print_step(file, &res);
+        if (knee_passed(&res, base_p99)) {
+            bad = rate;
+            break;
+        }
+        good = rate;
+    }
+
+    if (bad == 0) {
+        return good;
+    }
+
+    for (int i = 0; i < SWEEP_BISECT; i++) {
+        rate = (good + bad) / 2;
+        run_step(rate, &res);
+        print_step(file, &res);
+        if (knee_passed(&res, base_p99)) {
+            bad = rate;
+        } else {
+            good = rate;
+        }
+    }
+    return good;
+}
+
+static void usage(const char* prog)
+{
+    fprintf(stderr, "usage: %s [-e] [-s <max rate>] <num clients> <interface> "
+                    "<port> <server IP> <mesure time (in seconds)> "
+                    "<rate (pkts/s)> <buffer size> [<output file name>]\n"
+                    "  -e  Poisson arrivals, constant gaps otherwise\n"
+                    "  -s  sweep the rate up to max rate and find the knee\n",
+                    prog);
+    exit(1);
 }
 
 int main(int argc, char **argv) 
 {
+    double rate;
+    double max_rate = 0;
+    char* out_file_name = NULL;
+    FILE* file = NULL;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "es:")) != -1) {
+        switch (opt) {
+        case 'e':
+            poisson = 1;
+            break;
+        case 's':
+            max_rate = atof(optarg);
+            break;
+        default:
+            usage(argv[0]);
+        }
+    }
+
     /* 
     * check command line arguments 
     */
-    if (argc < 8) {
-        fprintf(stderr, "usage: %s <num clients> <interface> <port> <server IP>" 
-                        "<mesure time (in seconds)> <max packets in flight>"
-                        "<buffer size> \n", argv[0]);
-        exit(1);
+    if (argc - optind < 7) {
+        usage(argv[0]);
     }
 
-    num_clients = atoi(argv[1]);
-    if_name = argv[2];
-    portno = atoi(argv[3]);
-    ip = argv[4];
-    bench_run_time = atof(argv[5]);
-    max_pkts_in_flight = atoi(argv[6]);
-    buf_size = atoi(argv[7]);
+    num_clients = atoi(argv[optind]);
+    if_name = argv[optind + 1];
+    portno = atoi(argv[optind + 2]);
+    ip = argv[optind + 3];
+    bench_run_time = atof(argv[optind + 4]);
+    rate = atof(argv[optind + 5]);
+    buf_size = atoi(argv[optind + 6]);
+    if (argc - optind > 7) {
+        out_file_name = argv[optind + 7];
+    }
 
     if ((num_clients >= 1) && (num_clients <= 100)) {
-        pkts_per_s = (double*) calloc(num_clients, sizeof(double));
-        pkts_send_per_s = (double*) calloc(num_clients, sizeof(double));
-        run_times = (double*) calloc(num_clients, sizeof(double));
         rcv_threads = (pthread_t*) calloc(num_clients, sizeof(pthread_t));
         snd_threads = (pthread_t*) calloc(num_clients, sizeof(pthread_t));
         sock_fds = (int*) calloc(num_clients, sizeof(int));
+        lat_stats = (struct lat_stats*) calloc(num_clients, sizeof(struct lat_stats));
     } else {
         fprintf(stderr, "Invalid client value. Should be 1 <= client value <= 100 \n");
         exit(1);
     }
 
 
-    if (bench_run_time < 0) {
-        fprintf(stderr, "Invalid run time. Should be > 0 \n");
+    if (bench_run_time <= 0 || rate <= 0) {
+        fprintf(stderr, "Invalid run time or rate. Should be > 0 \n");
         exit(1);
     }
 
-    gettimeofday(&st, NULL);
-    uint32_t num_cores = sysconf(_SC_NPROCESSORS_ONLN);
-    for (uint64_t i = 0; i < (uint32_t) num_clients; i++) { 
+    if (buf_size < (int) (2 * sizeof(uint64_t))) {
+        fprintf(stderr, "Invalid buffer size. Should be >= 16 \n");
+        exit(1);
+    }
 
-        sock_fds[i] = setup_socket(i);
-	    cpu_set_t cpuset;
-        CPU_ZERO(&cpuset);
-        CPU_SET(i % num_cores, &cpuset);
-        
-        pthread_attr_t attr;
-        pthread_attr_init(&attr);
-        pthread_attr_setaffinity_np(&attr, sizeof(cpu_set_t), &cpuset);
-	
-        int ret = pthread_create(&snd_threads[i], &attr, receiver_func, (void*) i);
-        assert(ret == 0);
+    if (out_file_name != NULL) {
+        file = fopen(out_file_name, "ab+");
+        if (file == NULL) {
+            fprintf(stderr, "Output file is invalid %s\n", out_file_name);
+            exit(1);
+        }
+        fprintf(file, "############################################################"
+                      "#################### \n");
+        fprintf(file, "#Config: num_clients %d, if_name %s, portno %d, ip %s, \n"
+                      "#        bench_run_time %.2f (s), rate %.0f, buf_size %d,\n"
+                      "#        poisson %d, max_rate %.0f \n",
+                num_clients, if_name, portno, ip, bench_run_time, rate,
+                buf_size, poisson, max_rate);
+        fprintf(file, "Offered \t| Sent \t| Received \t| p50 us \t| p99 us "
+                      "\t| p99.9 us \t| p99.99 us \t| lost \t| reordered\n");
+    }
 
-        ret = pthread_create(&rcv_threads[i], &attr, sender_func, (void*) i);
-        assert(ret == 0);
+    tsc_init();
+    for (uint64_t i = 0; i < (uint32_t) num_clients; i++) { 
+        setup_socket(i);
     }
-    
-    gettimeofday(&st, NULL);
 
-    for (int i = 0; i < num_clients; i++) {
-        pthread_join(rcv_threads[i], NULL);
+    if (max_rate > 0) {
+        double knee = sweep(rate, max_rate, file);
+        if (knee == 0) {
+            printf("Knee below the start rate \n");
+        } else {
+            printf("Knee at %.0f pkts/s \n", knee);
+        }
+        if (file != NULL) {
+            fprintf(file, "#Knee at %.0f pkts/s \n", knee);
+        }
+    } else {
+        struct step_result res;
+        run_step(rate, &res);
+        print_step(file, &res);
     }
 
-    for (int i = 0; i < num_clients; i++) {
-        pthread_join(snd_threads[i], NULL);
+    if (file != NULL) {
+        fprintf(file, "############################################################"
+                      "#################### \n");
+        fclose(file);
     }
 
-    double tot_pkts_per_s = 0;
     for (int i = 0; i < num_clients; i++) {
-        tot_pkts_per_s += pkts_per_s[i];
+        close(sock_fds[i]);
     }
-
-    printf("Mbit/s %f including header \n", ((tot_pkts_per_s)*(buf_size+42)*8)/(1000*1000));
-    printf("Mbit/s %f only payload \n", ((tot_pkts_per_s)*buf_size*8)/(1000*1000));
-    printf("Pkts/s %f \n", tot_pkts_per_s);
     return 0;
 }